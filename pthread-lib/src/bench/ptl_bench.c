@@ -0,0 +1,764 @@
+/*
+ * This file is part of the pthread-lib Library.
+ * Copyright (C) 2008-2009 Nick Powers.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Library General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor Boston, MA 02110-1301,  USA
+ */
+
+/**
+ * Benchmarks for the queue types and the thread manager, built as
+ * pthread_lib_bench. Each run prints one CSV line or JSON object, so results
+ * can be kept and compared across releases:
+ *
+ *   throughput: producers add, consumers get, for every queue type and
+ *               1..N producers by 1..N consumers (powers of two, then N)
+ *   pingpong:   round trip through two queues between two threads, as
+ *               latency percentiles
+ *   batch:      one producer and one consumer, single element calls
+ *               against ptl_q_add_batch / ptl_q_get_batch
+ *   executor:   tasks per second and submit to start latency of a manager
+ *               in each scheduling mode, for empty and small tasks
+ *
+ * Run with -h for the options. Latencies are in ns.
+ */
+
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <getopt.h>
+#include <assert.h>
+#include "../ptl_queue.h"
+#include "../ptl_linked_queue.h"
+#include "../ptl_array_queue.h"
+#include "../ptl_two_lock_queue.h"
+#include "../ptl_ring_queue.h"
+#include "../ptl_spsc_queue.h"
+#include "../ptl_priority_queue.h"
+#include "../ptl_thread_manager.h"
+#include "../ptl_stats.h"
+#include "../ptl_util.h"
+
+
+/* Constants */
+#define PTL_BENCH_MAX_THREADS 64
+#define PTL_BENCH_MAX_CPUS 1024
+#define PTL_BENCH_MAX_BATCH 1024
+
+#define PTL_BENCH_FORMAT_CSV  0
+#define PTL_BENCH_FORMAT_JSON 1
+
+#define PTL_BENCH_SUITE_THROUGHPUT 0x1
+#define PTL_BENCH_SUITE_PINGPONG   0x2
+#define PTL_BENCH_SUITE_BATCH      0x4
+#define PTL_BENCH_SUITE_EXECUTOR   0x8
+#define PTL_BENCH_SUITE_ALL        0xf
+
+#define PTL_BENCH_SMALL_TASK_LOOPS 1000	/* work done by a "small" task */
+
+
+/* Structures */
+
+/* a queue type under test */
+struct ptl_bench_queue {
+	const char *name;
+	ptl_q_funcs_t funcs;
+	int single_ended;			/* only one producer and one consumer allowed */
+};
+
+/* what to run, from the command line */
+struct ptl_bench_options {
+	int suites;					/* PTL_BENCH_SUITE_* */
+	const char *queue;			/* name of the only queue type to run, or NULL */
+	int max_producers;
+	int max_consumers;
+	long ops;					/* elements moved per throughput and batch run */
+	long rounds;				/* round trips per ping-pong run */
+	int batch;					/* elements per batch call */
+	int capacity;				/* given to ptl_q_create_queue */
+	int workers;				/* executor threads */
+	long tasks;					/* tasks per executor run */
+	int format;					/* PTL_BENCH_FORMAT_* */
+	struct ptl_tp_affinity affinity;	/* PTL_TP_PIN_* for every thread started */
+	int list[PTL_BENCH_MAX_CPUS];		/* cpus of a PTL_TP_PIN_LIST */
+};
+
+/* one line of output */
+struct ptl_bench_result {
+	const char *suite;
+	const char *subject;		/* queue type, or executor mode and task */
+	int producers;
+	int consumers;
+	int batch;
+	long ops;
+	double seconds;
+	const struct ptl_histogram *latency;	/* NULL when not measured */
+};
+
+/* state shared by the threads of one throughput or batch run */
+struct ptl_bench_run {
+	ptl_q_t q;
+	long per_producer;
+	long total;
+	long consumed;				/* atomic */
+	int batch;
+	pthread_barrier_t start;
+};
+
+/* state shared by the two threads of a ping-pong run */
+struct ptl_bench_pingpong {
+	ptl_q_t there;
+	ptl_q_t back;
+	long rounds;
+	struct ptl_histogram *latency;
+	pthread_barrier_t start;
+};
+
+/* one thread of a run */
+struct ptl_bench_thread {
+	pthread_t thread;
+	int cpu;					/* -1 not pinned */
+	void *run;
+};
+
+
+/* Private Functions */
+void _ptl_bench_usage(const char *name);
+int _ptl_bench_parse(int argc, char **argv, struct ptl_bench_options *options);
+int _ptl_bench_parse_suites(const char *list);
+int _ptl_bench_parse_pin(const char *pin, struct ptl_bench_options *options);
+int _ptl_bench_allowed_cpus(int *cpus, int max);
+int _ptl_bench_cpu_for(const struct ptl_bench_options *options, int index, int threads);
+void _ptl_bench_start(struct ptl_bench_thread *thread, void *(*body)(void *), void *run);
+void *_ptl_bench_producer(void *thread);
+void *_ptl_bench_consumer(void *thread);
+void *_ptl_bench_pinger(void *thread);
+void *_ptl_bench_ponger(void *thread);
+void *_ptl_bench_empty_task(void *arg);
+void *_ptl_bench_small_task(void *arg);
+void _ptl_bench_add(ptl_q_t q, void *value);
+void *_ptl_bench_get(ptl_q_t q);
+double _ptl_bench_move(const struct ptl_bench_options *options, const struct ptl_bench_queue *type,
+					   int producers, int consumers, int batch);
+void _ptl_bench_throughput(const struct ptl_bench_options *options, const struct ptl_bench_queue *type);
+void _ptl_bench_batch(const struct ptl_bench_options *options, const struct ptl_bench_queue *type);
+void _ptl_bench_pingpong(const struct ptl_bench_options *options, const struct ptl_bench_queue *type);
+void _ptl_bench_executor(const struct ptl_bench_options *options, int scheduling,
+						 void *(*task)(void *), const char *subject);
+void _ptl_bench_report(const struct ptl_bench_options *options, const struct ptl_bench_result *result);
+void _ptl_bench_finish(const struct ptl_bench_options *options);
+
+
+/* Global Variables */
+static struct ptl_bench_queue ptl_bench_queues[] = {
+	{ "linked",   &ptl_lq_funcs,   0 },
+	{ "array",    &ptl_aq_funcs,   0 },
+	{ "two_lock", &ptl_tlq_funcs,  0 },
+	{ "ring",     &ptl_rq_funcs,   0 },
+	{ "spsc",     &ptl_spsc_funcs, 1 },
+	{ "priority", &ptl_pq_funcs,   0 },
+	{ NULL, NULL, 0 }
+};
+static int ptl_bench_results = 0;		// lines printed, for the JSON separators
+static long ptl_bench_tasks_done = 0;	// executor tasks finished (atomic)
+static volatile unsigned long ptl_bench_sink = 0; // keeps small tasks from being optimized out
+
+
+
+int main(int argc, char **argv){
+	struct ptl_bench_options options;
+	
+	if(!_ptl_bench_parse(argc, argv, &options)){
+		_ptl_bench_usage(argv[0]);
+		return 1;
+	}
+	
+	struct ptl_bench_queue *type = NULL;
+	for(type = ptl_bench_queues; type->name != NULL; type++){
+		if(options.queue != NULL && strcmp(options.queue, type->name) != 0){
+			continue;
+		}
+		if(options.suites & PTL_BENCH_SUITE_THROUGHPUT){
+			_ptl_bench_throughput(&options, type);
+		}
+		if(options.suites & PTL_BENCH_SUITE_PINGPONG){
+			_ptl_bench_pingpong(&options, type);
+		}
+		if(options.suites & PTL_BENCH_SUITE_BATCH){
+			_ptl_bench_batch(&options, type);
+		}
+	}
+	
+	if(options.suites & PTL_BENCH_SUITE_EXECUTOR){
+		_ptl_bench_executor(&options, PTL_TM_SCHED_SHARED_QUEUE, _ptl_bench_empty_task, "shared/empty");
+		_ptl_bench_executor(&options, PTL_TM_SCHED_SHARED_QUEUE, _ptl_bench_small_task, "shared/small");
+		_ptl_bench_executor(&options, PTL_TM_SCHED_WORK_STEALING, _ptl_bench_empty_task, "stealing/empty");
+		_ptl_bench_executor(&options, PTL_TM_SCHED_WORK_STEALING, _ptl_bench_small_task, "stealing/small");
+	}
+	
+	_ptl_bench_finish(&options);
+	
+	return 0;
+}
+
+
+/* Private Functions */
+
+void _ptl_bench_usage(const char *name){
+	fprintf(stderr,
+		"usage: %s [options]\n"
+		"  -s, --suite LIST      throughput,pingpong,batch,executor (default all)\n"
+		"  -q, --queue NAME      linked, array, two_lock, ring, spsc or priority (default all)\n"
+		"  -p, --producers N     most producers in the throughput sweep (default 4)\n"
+		"  -c, --consumers N     most consumers in the throughput sweep (default 4)\n"
+		"  -n, --ops N           elements per throughput and batch run (default 1000000)\n"
+		"  -r, --rounds N        round trips per ping-pong run (default 100000)\n"
+		"  -b, --batch N         elements per batch call (default 32)\n"
+		"  -k, --capacity N      queue capacity (default 1024)\n"
+		"  -w, --workers N       executor threads (default 4)\n"
+		"  -t, --tasks N         tasks per executor run (default 200000)\n"
+		"  -P, --pin POLICY      none, compact, scatter or a cpu list like 0,2,4 (default none)\n"
+		"  -f, --format FORMAT   csv or json (default csv)\n", name);
+}
+
+
+/* fill in the defaults, then the command line. returns 0 on a bad option */
+int _ptl_bench_parse(int argc, char **argv, struct ptl_bench_options *options){
+	static struct option longs[] = {
+		{ "suite",     required_argument, NULL, 's' },
+		{ "queue",     required_argument, NULL, 'q' },
+		{ "producers", required_argument, NULL, 'p' },
+		{ "consumers", required_argument, NULL, 'c' },
+		{ "ops",       required_argument, NULL, 'n' },
+		{ "rounds",    required_argument, NULL, 'r' },
+		{ "batch",     required_argument, NULL, 'b' },
+		{ "capacity",  required_argument, NULL, 'k' },
+		{ "workers",   required_argument, NULL, 'w' },
+		{ "tasks",     required_argument, NULL, 't' },
+		{ "pin",       required_argument, NULL, 'P' },
+		{ "format",    required_argument, NULL, 'f' },
+		{ "help",      no_argument,       NULL, 'h' },
+		{ NULL, 0, NULL, 0 }
+	};
+	int opt = 0;
+	
+	memset(options, 0, sizeof(struct ptl_bench_options));
+	options->suites = PTL_BENCH_SUITE_ALL;
+	options->max_producers = 4;
+	options->max_consumers = 4;
+	options->ops = 1000000;
+	options->rounds = 100000;
+	options->batch = 32;
+	options->capacity = 1024;
+	options->workers = 4;
+	options->tasks = 200000;
+	options->format = PTL_BENCH_FORMAT_CSV;
+	options->affinity.policy = PTL_TP_PIN_NONE;
+	options->affinity.numa_node = PTL_TP_ANY_NODE;
+	
+	while((opt = getopt_long(argc, argv, "s:q:p:c:n:r:b:k:w:t:P:f:h", longs, NULL)) != -1){
+		switch(opt){
+		case 's': options->suites = _ptl_bench_parse_suites(optarg); break;
+		case 'q': options->queue = optarg; break;
+		case 'p': options->max_producers = atoi(optarg); break;
+		case 'c': options->max_consumers = atoi(optarg); break;
+		case 'n': options->ops = atol(optarg); break;
+		case 'r': options->rounds = atol(optarg); break;
+		case 'b': options->batch = atoi(optarg); break;
+		case 'k': options->capacity = atoi(optarg); break;
+		case 'w': options->workers = atoi(optarg); break;
+		case 't': options->tasks = atol(optarg); break;
+		case 'P': 
+			if(!_ptl_bench_parse_pin(optarg, options)){ return 0; }
+			break;
+		case 'f':
+			if(strcmp(optarg, "json") == 0){
+				options->format = PTL_BENCH_FORMAT_JSON;
+			} else if(strcmp(optarg, "csv") != 0){
+				return 0;
+			}
+			break;
+		default:
+			return 0;
+		}
+	}
+	
+	if(options->suites == 0 || options->ops <= 0 || options->rounds <= 0 || options->tasks <= 0 ||
+	   options->max_producers < 1 || options->max_producers > PTL_BENCH_MAX_THREADS ||
+	   options->max_consumers < 1 || options->max_consumers > PTL_BENCH_MAX_THREADS ||
+	   options->batch < 1 || options->batch > PTL_BENCH_MAX_BATCH ||
+	   options->capacity < 2 || options->workers < 1){
+		return 0;
+	}
+	
+	return 1;
+}
+
+
+/* comma separated suite names to PTL_BENCH_SUITE_* bits, 0 if one is unknown */
+int _ptl_bench_parse_suites(const char *list){
+	char copy[256];
+	char *save = NULL;
+	char *name = NULL;
+	int suites = 0;
+	
+	strncpy(copy, list, sizeof(copy) - 1);
+	copy[sizeof(copy) - 1] = '\0';
+	
+	for(name = strtok_r(copy, ",", &save); name != NULL; name = strtok_r(NULL, ",", &save)){
+		if(strcmp(name, "throughput") == 0){ suites |= PTL_BENCH_SUITE_THROUGHPUT; }
+		else if(strcmp(name, "pingpong") == 0){ suites |= PTL_BENCH_SUITE_PINGPONG; }
+		else if(strcmp(name, "batch") == 0){ suites |= PTL_BENCH_SUITE_BATCH; }
+		else if(strcmp(name, "executor") == 0){ suites |= PTL_BENCH_SUITE_EXECUTOR; }
+		else { return 0; }
+	}
+	
+	return suites;
+}
+
+
+/* a policy name, or a list of cpu ids */
+int _ptl_bench_parse_pin(const char *pin, struct ptl_bench_options *options){
+	if(strcmp(pin, "none") == 0){
+		options->affinity.policy = PTL_TP_PIN_NONE;
+	} else if(strcmp(pin, "compact") == 0){
+		options->affinity.policy = PTL_TP_PIN_COMPACT;
+	} else if(strcmp(pin, "scatter") == 0){
+		options->affinity.policy = PTL_TP_PIN_SCATTER;
+	} else {
+		const char *p = pin;
+		int n = 0;
+		
+		while(*p != '\0' && n < PTL_BENCH_MAX_CPUS){
+			char *end = NULL;
+			long cpu = strtol(p, &end, 10);
+			if(end == p || cpu < 0){ return 0; }
+			options->list[n++] = (int)cpu;
+			p = (*end == ',') ? end + 1 : end;
+			if(*end != ',' && *end != '\0'){ return 0; }
+		}
+		if(n == 0){ return 0; }
+		
+		options->affinity.policy = PTL_TP_PIN_LIST;
+		options->affinity.cpus = options->list;
+		options->affinity.num_cpus = n;
+	}
+	
+	return 1;
+}
+
+
+/* the cpus this process may run on, in order */
+int _ptl_bench_allowed_cpus(int *cpus, int max){
+	cpu_set_t set;
+	int n = 0;
+	int cpu = 0;
+	
+	CPU_ZERO(&set);
+	if(sched_getaffinity(0, sizeof(set), &set) != 0){
+		return 0;
+	}
+	
+	for(cpu = 0; cpu < CPU_SETSIZE && n < max; cpu++){
+		if(CPU_ISSET(cpu, &set)){
+			cpus[n++] = cpu;
+		}
+	}
+	
+	return n;
+}
+
+
+/**
+ * Cpu for thread 'index' of 'threads' in a run. COMPACT takes the allowed
+ * cpus in order, SCATTER spreads the threads evenly over them and LIST
+ * cycles through the given ones. NUMA nodes are left to the thread pool,
+ * these are the bench's own threads.
+ *
+ * @return cpu id, -1 not to pin
+ */
+int _ptl_bench_cpu_for(const struct ptl_bench_options *options, int index, int threads){
+	int cpus[PTL_BENCH_MAX_CPUS];
+	int n = 0;
+	
+	switch(options->affinity.policy){
+	case PTL_TP_PIN_LIST:
+		return options->list[index % options->affinity.num_cpus];
+	case PTL_TP_PIN_COMPACT:
+		n = _ptl_bench_allowed_cpus(cpus, PTL_BENCH_MAX_CPUS);
+		return (n > 0) ? cpus[index % n] : -1;
+	case PTL_TP_PIN_SCATTER:
+		n = _ptl_bench_allowed_cpus(cpus, PTL_BENCH_MAX_CPUS);
+		return (n > 0) ? cpus[((long)index * n / threads) % n] : -1;
+	default:
+		return -1;
+	}
+}
+
+
+/* start 'body' on 'thread', pinned to its cpu if it has one */
+void _ptl_bench_start(struct ptl_bench_thread *thread, void *(*body)(void *), void *run){
+	pthread_attr_t attr;
+	
+	thread->run = run;
+	pthread_attr_init(&attr);
+	
+	if(thread->cpu >= 0){
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		CPU_SET(thread->cpu, &set);
+		pthread_attr_setaffinity_np(&attr, sizeof(set), &set);
+	}
+	
+	int rc = pthread_create(&thread->thread, &attr, body, thread);
+	assert(rc == 0);
+	
+	pthread_attr_destroy(&attr);
+}
+
+
+/* add, retrying while a bounded queue is full */
+void _ptl_bench_add(ptl_q_t q, void *value){
+	while(!ptl_q_add(q, value)){
+		sched_yield();
+	}
+}
+
+
+/* get, retrying while the queue is empty */
+void *_ptl_bench_get(ptl_q_t q){
+	void *value = NULL;
+	
+	while((value = ptl_q_get(q)) == NULL){
+		sched_yield();
+	}
+	
+	return value;
+}
+
+
+/* adds 'per_producer' non-null values, 'batch' at a time */
+void *_ptl_bench_producer(void *thread){
+	struct ptl_bench_run *run = (struct ptl_bench_run *)((struct ptl_bench_thread *)thread)->run;
+	void *values[PTL_BENCH_MAX_BATCH];
+	long i = 0;
+	
+	pthread_barrier_wait(&run->start);
+	
+	while(i < run->per_producer){
+		if(run->batch <= 1){
+			_ptl_bench_add(run->q, (void *)(uintptr_t)(i + 1));
+			i++;
+			continue;
+		}
+		
+		int want = (run->per_producer - i < run->batch) ? (int)(run->per_producer - i) : run->batch;
+		int j = 0;
+		for(j = 0; j < want; j++){
+			values[j] = (void *)(uintptr_t)(i + j + 1);
+		}
+		
+		int added = ptl_q_add_batch(run->q, values, want);
+		if(added == 0){
+			sched_yield();
+		}
+		i += added;
+	}
+	
+	return NULL;
+}
+
+
+/* takes values until all producers' values are taken */
+void *_ptl_bench_consumer(void *thread){
+	struct ptl_bench_run *run = (struct ptl_bench_run *)((struct ptl_bench_thread *)thread)->run;
+	void *values[PTL_BENCH_MAX_BATCH];
+	
+	pthread_barrier_wait(&run->start);
+	
+	while(__atomic_load_n(&run->consumed, __ATOMIC_RELAXED) < run->total){
+		int taken = 0;
+		
+		if(run->batch <= 1){
+			taken = (ptl_q_get(run->q) != NULL) ? 1 : 0;
+		} else {
+			taken = ptl_q_get_batch(run->q, values, run->batch);
+		}
+		
+		if(taken > 0){
+			__atomic_add_fetch(&run->consumed, taken, __ATOMIC_RELAXED);
+		} else {
+			sched_yield();
+		}
+	}
+	
+	return NULL;
+}
+
+
+/* times each round trip */
+void *_ptl_bench_pinger(void *thread){
+	struct ptl_bench_pingpong *run = (struct ptl_bench_pingpong *)((struct ptl_bench_thread *)thread)->run;
+	long i = 0;
+	
+	pthread_barrier_wait(&run->start);
+	
+	for(i = 0; i < run->rounds; i++){
+		unsigned long long start = ptl_get_time_nsec();
+		_ptl_bench_add(run->there, (void *)(uintptr_t)(i + 1));
+		_ptl_bench_get(run->back);
+		ptl_hist_record(run->latency, ptl_get_time_nsec() - start);
+	}
+	
+	return NULL;
+}
+
+
+/* sends every value back */
+void *_ptl_bench_ponger(void *thread){
+	struct ptl_bench_pingpong *run = (struct ptl_bench_pingpong *)((struct ptl_bench_thread *)thread)->run;
+	long i = 0;
+	
+	pthread_barrier_wait(&run->start);
+	
+	for(i = 0; i < run->rounds; i++){
+		_ptl_bench_add(run->back, _ptl_bench_get(run->there));
+	}
+	
+	return NULL;
+}
+
+
+/* moves 'ops' values through a new queue, returning the seconds it took */
+double _ptl_bench_move(const struct ptl_bench_options *options, const struct ptl_bench_queue *type,
+					   int producers, int consumers, int batch){
+	struct ptl_bench_thread threads[2 * PTL_BENCH_MAX_THREADS];
+	struct ptl_bench_run run;
+	int n = producers + consumers;
+	int i = 0;
+	
+	memset(&run, 0, sizeof(run));
+	run.q = ptl_q_create_queue(type->funcs, options->capacity);
+	run.per_producer = options->ops / producers;
+	run.total = run.per_producer * producers;
+	run.batch = batch;
+	pthread_barrier_init(&run.start, NULL, n + 1);
+	
+	for(i = 0; i < n; i++){
+		threads[i].cpu = _ptl_bench_cpu_for(options, i, n);
+		_ptl_bench_start(&threads[i], (i < producers) ? _ptl_bench_producer : _ptl_bench_consumer, &run);
+	}
+	
+	pthread_barrier_wait(&run.start);
+	unsigned long long start = ptl_get_time_nsec();
+	
+	for(i = 0; i < n; i++){
+		pthread_join(threads[i].thread, NULL);
+	}
+	
+	unsigned long long end = ptl_get_time_nsec();
+	
+	pthread_barrier_destroy(&run.start);
+	ptl_q_destroy_queue(run.q);
+	
+	return (double)(end - start) / 1e9;
+}
+
+
+/* 1, 2, 4 ... up to the maximum, and the maximum itself */
+void _ptl_bench_throughput(const struct ptl_bench_options *options, const struct ptl_bench_queue *type){
+	int producers = 1;
+	int consumers = 1;
+	
+	for(producers = 1; producers <= options->max_producers; 
+		producers = (producers * 2 > options->max_producers && producers != options->max_producers) ?
+					options->max_producers : producers * 2){
+		for(consumers = 1; consumers <= options->max_consumers;
+			consumers = (consumers * 2 > options->max_consumers && consumers != options->max_consumers) ?
+						options->max_consumers : consumers * 2){
+			if(type->single_ended && (producers > 1 || consumers > 1)){
+				break;
+			}
+			
+			struct ptl_bench_result result = { "throughput", type->name, producers, consumers, 1, 
+											   (options->ops / producers) * producers, 0.0, NULL };
+			result.seconds = _ptl_bench_move(options, type, producers, consumers, 1);
+			_ptl_bench_report(options, &result);
+		}
+	}
+}
+
+
+/* the same single producer and consumer, with and without batch calls */
+void _ptl_bench_batch(const struct ptl_bench_options *options, const struct ptl_bench_queue *type){
+	int batches[2] = { 1, options->batch };
+	int i = 0;
+	
+	for(i = 0; i < 2; i++){
+		struct ptl_bench_result result = { "batch", type->name, 1, 1, batches[i], options->ops, 0.0, NULL };
+		result.seconds = _ptl_bench_move(options, type, 1, 1, batches[i]);
+		_ptl_bench_report(options, &result);
+	}
+}
+
+
+/* a value goes there and comes back, 'rounds' times */
+void _ptl_bench_pingpong(const struct ptl_bench_options *options, const struct ptl_bench_queue *type){
+	struct ptl_bench_thread threads[2];
+	struct ptl_bench_pingpong run;
+	int i = 0;
+	
+	run.there = ptl_q_create_queue(type->funcs, options->capacity);
+	run.back = ptl_q_create_queue(type->funcs, options->capacity);
+	run.rounds = options->rounds;
+	run.latency = (struct ptl_histogram *)ptl_stats_alloc(sizeof(struct ptl_histogram));
+	pthread_barrier_init(&run.start, NULL, 3);
+	
+	for(i = 0; i < 2; i++){
+		threads[i].cpu = _ptl_bench_cpu_for(options, i, 2);
+		_ptl_bench_start(&threads[i], (i == 0) ? _ptl_bench_pinger : _ptl_bench_ponger, &run);
+	}
+	
+	pthread_barrier_wait(&run.start);
+	unsigned long long start = ptl_get_time_nsec();
+	
+	for(i = 0; i < 2; i++){
+		pthread_join(threads[i].thread, NULL);
+	}
+	
+	struct ptl_bench_result result = { "pingpong", type->name, 1, 1, 1, options->rounds, 
+									   (double)(ptl_get_time_nsec() - start) / 1e9, run.latency };
+	_ptl_bench_report(options, &result);
+	
+	pthread_barrier_destroy(&run.start);
+	ptl_q_destroy_queue(run.there);
+	ptl_q_destroy_queue(run.back);
+	free(run.latency);
+}
+
+
+void *_ptl_bench_empty_task(void *arg){
+	__atomic_add_fetch(&ptl_bench_tasks_done, 1, __ATOMIC_RELEASE);
+	
+	return NULL;
+}
+
+
+/* a little arithmetic, about a microsecond */
+void *_ptl_bench_small_task(void *arg){
+	unsigned long x = (unsigned long)(uintptr_t)arg;
+	int i = 0;
+	
+	for(i = 0; i < PTL_BENCH_SMALL_TASK_LOOPS; i++){
+		x = x * 6364136223846793005UL + 1442695040888963407UL;
+	}
+	ptl_bench_sink = x;
+	
+	__atomic_add_fetch(&ptl_bench_tasks_done, 1, __ATOMIC_RELEASE);
+	
+	return NULL;
+}
+
+
+/**
+ * Submits 'tasks' tasks from this thread to a manager with 'workers'
+ * threads and waits until they all ran. The manager's own stats give the
+ * submit to start latency.
+ */
+void _ptl_bench_executor(const struct ptl_bench_options *options, int scheduling,
+						 void *(*task)(void *), const char *subject){
+	struct ptl_tm_options tm_options;
+	long i = 0;
+	
+	ptl_tm_options_init(&tm_options);
+	tm_options.scheduling = scheduling;
+	tm_options.affinity = options->affinity;
+	tm_options.collect_stats = 1;
+	
+	ptl_q_t q = ptl_q_create_queue(&ptl_lq_funcs, options->capacity);
+	ptl_thread_manager_t manager = create_thread_manager_with_options(options->workers, options->workers,
+																	  1000, q, NULL, NULL, NULL,
+																	  &tm_options);
+	assert(manager);
+	
+	__atomic_store_n(&ptl_bench_tasks_done, 0, __ATOMIC_RELAXED);
+	unsigned long long start = ptl_get_time_nsec();
+	
+	for(i = 0; i < options->tasks; i++){
+		submit(manager, task);
+	}
+	while(__atomic_load_n(&ptl_bench_tasks_done, __ATOMIC_ACQUIRE) < options->tasks){
+		sched_yield();
+	}
+	
+	double seconds = (double)(ptl_get_time_nsec() - start) / 1e9;
+	
+	struct ptl_tm_stats *stats = (struct ptl_tm_stats *)malloc(sizeof(struct ptl_tm_stats));
+	assert(stats);
+	ptl_tm_get_stats(manager, stats);
+	
+	struct ptl_bench_result result = { "executor", subject, 1, options->workers, 1, options->tasks,
+									   seconds, &stats->queue_wait };
+	_ptl_bench_report(options, &result);
+	
+	free(stats);
+	destroy_thread_manager(manager);
+	ptl_q_destroy_queue(q);
+}
+
+
+/* one CSV line, or one object of the JSON array */
+void _ptl_bench_report(const struct ptl_bench_options *options, const struct ptl_bench_result *result){
+	unsigned long long p50 = 0, p99 = 0, p999 = 0, max = 0;
+	double rate = (result->seconds > 0.0) ? result->ops / result->seconds : 0.0;
+	
+	if(result->latency != NULL){
+		p50 = ptl_hist_percentile(result->latency, 50.0);
+		p99 = ptl_hist_percentile(result->latency, 99.0);
+		p999 = ptl_hist_percentile(result->latency, 99.9);
+		max = result->latency->max;
+	}
+	
+	if(options->format == PTL_BENCH_FORMAT_JSON){
+		printf("%s\n  {\"suite\": \"%s\", \"subject\": \"%s\", \"producers\": %d, \"consumers\": %d, "
+			   "\"batch\": %d, \"ops\": %ld, \"seconds\": %.6f, \"ops_per_sec\": %.0f, "
+			   "\"p50_ns\": %llu, \"p99_ns\": %llu, \"p999_ns\": %llu, \"max_ns\": %llu}",
+			   (ptl_bench_results == 0) ? "[" : ",", result->suite, result->subject, 
+			   result->producers, result->consumers, result->batch, result->ops, result->seconds,
+			   rate, p50, p99, p999, max);
+	} else {
+		if(ptl_bench_results == 0){
+			printf("suite,subject,producers,consumers,batch,ops,seconds,ops_per_sec,"
+				   "p50_ns,p99_ns,p999_ns,max_ns\n");
+		}
+		printf("%s,%s,%d,%d,%d,%ld,%.6f,%.0f,%llu,%llu,%llu,%llu\n",
+			   result->suite, result->subject, result->producers, result->consumers, 
+			   result->batch, result->ops, result->seconds, rate, p50, p99, p999, max);
+	}
+	
+	ptl_bench_results++;
+	fflush(stdout);
+}
+
+
+/* close the JSON array */
+void _ptl_bench_finish(const struct ptl_bench_options *options){
+	if(options->format == PTL_BENCH_FORMAT_JSON){
+		printf("%s\n", (ptl_bench_results == 0) ? "[]" : "\n]");
+	}
+}
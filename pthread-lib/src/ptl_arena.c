@@ -0,0 +1,179 @@
+/*
+ * This file is part of the pthread-lib Library.
+ * Copyright (C) 2008-2009 Nick Powers.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Library General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor Boston, MA 02110-1301,  USA
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include "ptl_arena.h"
+#include "ptl_util.h"
+
+/* Private Functions */
+struct ptl_arena_chunk *_ptl_arena_new_chunk(size_t size);
+void *_ptl_arena_next_chunk(ptl_arena_t arena, size_t size);
+
+
+/* Public Functions */
+
+/* See header file for documentation */
+
+/* the arena and its first chunk */
+ptl_arena_t ptl_arena_create(size_t chunk_size){
+	if(chunk_size == 0){ chunk_size = PTL_ARENA_DEFAULT_CHUNK_SIZE; }
+	
+	ptl_arena_t arena = (ptl_arena_t)calloc(1, sizeof(struct ptl_arena));
+	assert(arena);
+	
+	arena->chunk_size = chunk_size;
+	arena->first = _ptl_arena_new_chunk(chunk_size);
+	arena->current = arena->first;
+	
+	return arena;
+}
+
+
+/* free every chunk */
+void ptl_arena_destroy(ptl_arena_t arena){
+	if(arena == NULL){ return; }
+	
+	while(arena->first != NULL){
+		struct ptl_arena_chunk *chunk = arena->first;
+		arena->first = chunk->next;
+		FREE(chunk);
+	}
+	
+	FREE(arena);
+}
+
+
+/* bump the pointer in the current chunk, or move on to the next one */
+void *ptl_arena_alloc(ptl_arena_t arena, size_t size){
+	size = (size + PTL_ARENA_ALIGN - 1) & ~((size_t)PTL_ARENA_ALIGN - 1);
+	
+	struct ptl_arena_chunk *chunk = arena->current;
+	if(size > chunk->size - chunk->used){
+		return _ptl_arena_next_chunk(arena, size);
+	}
+	
+	void *mem = chunk->data + chunk->used;
+	chunk->used += size;
+	arena->allocated += size;
+	arena->last = mem;
+	
+	return mem;
+}
+
+
+/* alloc, zeroed */
+void *ptl_arena_calloc(ptl_arena_t arena, size_t count, size_t size){
+	if(size != 0 && count > (size_t)-1 / size){ return NULL; }
+	
+	void *mem = ptl_arena_alloc(arena, count * size);
+	memset(mem, 0, count * size);
+	
+	return mem;
+}
+
+
+/* in place for the latest allocation, else copy when it grows */
+void *ptl_arena_realloc(ptl_arena_t arena, void *ptr, size_t old_size, size_t new_size){
+	if(ptr == NULL){ return ptl_arena_alloc(arena, new_size); }
+	
+	struct ptl_arena_chunk *chunk = arena->current;
+	if(ptr == arena->last){
+		size_t offset = (char *)ptr - chunk->data;
+		size_t old_end = chunk->used;
+		size_t new_end = offset + ((new_size + PTL_ARENA_ALIGN - 1) & ~((size_t)PTL_ARENA_ALIGN - 1));
+		if(new_end <= chunk->size){
+			chunk->used = new_end;
+			arena->allocated = arena->allocated - old_end + new_end;
+			return ptr;
+		}
+	}
+	
+	if(new_size <= old_size){ return ptr; }
+	
+	void *mem = ptl_arena_alloc(arena, new_size);
+	memcpy(mem, ptr, old_size);
+	
+	return mem;
+}
+
+
+/* rewind every chunk, keeping them up to PTL_ARENA_MAX_RETAINED bytes */
+void ptl_arena_reset(ptl_arena_t arena){
+	if(arena->allocated == 0){ return; } // nothing since the last one
+	
+	struct ptl_arena_chunk *chunk = arena->first;
+	size_t retained = chunk->size;
+	chunk->used = 0;
+	
+	while(chunk->next != NULL){
+		struct ptl_arena_chunk *next = chunk->next;
+		if(retained + next->size > PTL_ARENA_MAX_RETAINED){
+			chunk->next = next->next;
+			FREE(next);
+			continue;
+		}
+		
+		retained += next->size;
+		next->used = 0;
+		chunk = next;
+	}
+	
+	arena->current = arena->first;
+	arena->last = NULL;
+	arena->allocated = 0;
+}
+
+
+/* Private Functions */
+
+/* a chunk with 'size' bytes of data */
+struct ptl_arena_chunk *_ptl_arena_new_chunk(size_t size){
+	struct ptl_arena_chunk *chunk = NULL;
+	
+	int rc = posix_memalign((void **)&chunk, PTL_ARENA_ALIGN, sizeof(struct ptl_arena_chunk) + size);
+	assert(rc == 0 && chunk);
+	
+	chunk->next = NULL;
+	chunk->size = size;
+	chunk->used = 0;
+	
+	return chunk;
+}
+
+
+/* the current chunk is full: use the next kept chunk if 'size' fits in it,
+   else put a new one after the current one */
+void *_ptl_arena_next_chunk(ptl_arena_t arena, size_t size){
+	struct ptl_arena_chunk *chunk = arena->current->next;
+	
+	if(chunk == NULL || chunk->size < size){
+		chunk = _ptl_arena_new_chunk(size > arena->chunk_size ? size : arena->chunk_size);
+		chunk->next = arena->current->next;
+		arena->current->next = chunk;
+	}
+	
+	arena->current = chunk;
+	chunk->used = size;
+	arena->allocated += size;
+	arena->last = chunk->data;
+	
+	return chunk->data;
+}
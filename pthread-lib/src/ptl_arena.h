@@ -0,0 +1,129 @@
+/*
+ * This file is part of the pthread-lib Library.
+ * Copyright (C) 2008-2009 Nick Powers.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Library General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor Boston, MA 02110-1301,  USA
+ */
+
+/**
+ * This "class" is an arena: scratch memory handed out by bumping a pointer
+ * through large chunks, and given back all at once by a reset. Nothing is
+ * freed on its own. It is for the many short lived allocations of one piece
+ * of work, e.g. a task, which then cost an add each instead of a malloc and
+ * a free.
+ *
+ * Chunks are PTL_ARENA_DEFAULT_CHUNK_SIZE unless the arena is made with
+ * another size; a larger request gets a chunk of its own. A reset keeps up
+ * to PTL_ARENA_MAX_RETAINED bytes of chunks for the next round and frees the
+ * rest, so an arena that is reset often stops calling malloc at all.
+ *
+ * An arena is not thread safe, it belongs to one thread (or fiber) at a time.
+ * See ptl_worker_arena for the one each pool worker has.
+ */
+
+#ifndef __PTL_ARENA_H__
+#define __PTL_ARENA_H__
+
+#include <stddef.h>
+
+/* Constants */
+#define PTL_ARENA_DEFAULT_CHUNK_SIZE (64 * 1024)	/**< bytes per chunk */
+#define PTL_ARENA_MAX_RETAINED (1024 * 1024)		/**< bytes of chunks a reset keeps */
+#define PTL_ARENA_ALIGN 16							/**< every allocation is aligned to it */
+
+
+/* Structures */
+
+struct ptl_arena_chunk {
+	struct ptl_arena_chunk *next;
+	size_t size;					/**< bytes in 'data' */
+	size_t used;
+	char data[] __attribute__((aligned(PTL_ARENA_ALIGN)));
+};
+
+struct ptl_arena {
+	struct ptl_arena_chunk *first;
+	struct ptl_arena_chunk *current;	/**< allocations come from it, the chunks
+											 after it are empty */
+	size_t chunk_size;
+	void *last;						/**< latest allocation, realloc grows it in place */
+	size_t allocated;				/**< bytes handed out since the last reset */
+};
+
+
+/* Type Definitions */
+typedef struct ptl_arena *ptl_arena_t;
+
+
+/* Public Functions */
+
+/**
+ * Creates an arena with its first chunk.
+ * To finish using this data structure, be sure to call the 'destroy' function.
+ *
+ * @param chunk_size bytes per chunk, PTL_ARENA_DEFAULT_CHUNK_SIZE if 0
+ * @return an empty arena
+ */
+ptl_arena_t ptl_arena_create(size_t chunk_size);
+
+/**
+ * Frees the arena and every chunk, and so everything allocated from it.
+ *
+ * @param arena arena to free, may be NULL
+ */
+void ptl_arena_destroy(ptl_arena_t arena);
+
+/**
+ * Allocates 'size' bytes, aligned to PTL_ARENA_ALIGN. The memory is not
+ * zeroed and stays valid until the next reset.
+ *
+ * @param arena non-null arena
+ * @param size bytes wanted
+ * @return the memory, never NULL
+ */
+void *ptl_arena_alloc(ptl_arena_t arena, size_t size);
+
+/**
+ * Allocates zeroed memory for 'count' elements of 'size' bytes.
+ *
+ * @param arena non-null arena
+ * @param count number of elements
+ * @param size bytes per element
+ * @return the memory, or NULL if count * size overflows
+ */
+void *ptl_arena_calloc(ptl_arena_t arena, size_t count, size_t size);
+
+/**
+ * Resizes memory from this arena. The latest allocation grows or shrinks in
+ * place while its chunk has room; anything else that grows is copied to a
+ * new allocation and the old one is left unused until the reset.
+ *
+ * @param arena non-null arena
+ * @param ptr memory from 'arena', or NULL to allocate
+ * @param old_size bytes 'ptr' was allocated with
+ * @param new_size bytes wanted
+ * @return the resized memory, never NULL
+ */
+void *ptl_arena_realloc(ptl_arena_t arena, void *ptr, size_t old_size, size_t new_size);
+
+/**
+ * Gives back everything allocated from the arena at once. Chunks are kept
+ * up to PTL_ARENA_MAX_RETAINED bytes, the first one always.
+ *
+ * @param arena non-null arena
+ */
+void ptl_arena_reset(ptl_arena_t arena);
+
+#endif
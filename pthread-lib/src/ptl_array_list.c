@@ -36,6 +36,7 @@
 /* Private Functions */
 void _check_capacity(ptl_array_list_t array_list, int size);
 void _shift_elements(ptl_array_list_t array_list, int index, int num_places);
+void _set_capacity(ptl_array_list_t array_list, int capacity);
 
 /* creates the array list with an inital size of 10. */
 ptl_array_list_t ptl_al_create_array_list(){
@@ -64,6 +65,22 @@ ptl_array_list_t ptl_al_create_array_list_size(int size){
 }
 
 
+/* creates the array list, and later grows it, in 'arena'. */
+ptl_array_list_t ptl_al_create_array_list_arena(int size, ptl_arena_t arena){
+	if(size <= 0 || arena == NULL) { return 0; }
+	
+	ptl_array_list_t array_list = (ptl_array_list_t)ptl_arena_alloc(arena, sizeof(struct ptl_array_list));
+	
+	array_list->capacity = size;
+	array_list->size = 0;
+	array_list->array = (void **)ptl_arena_calloc(arena, size, sizeof(void *));
+	array_list->malloc_size = size * sizeof(void *);
+	array_list->arena = arena;
+	
+	return array_list;
+}
+
+
 /* frees all memory allocated in create functions. */
 int ptl_al_destroy_array_list(ptl_array_list_t array_list){
 	if(array_list == NULL) { return 0; }
@@ -71,9 +88,12 @@ int ptl_al_destroy_array_list(ptl_array_list_t array_list){
 	array_list->capacity = 0;
 	array_list->size = 0;
 	array_list->malloc_size = 0;
+	if(array_list->arena != NULL) { return 1; } // the arena's reset frees it
+	
 	// if any of the pointers in this array are pointing of any allocated 
 	// memory, then that pointer is lost...
 	FREE(array_list->array);
+	FREE(array_list);
 	
 	return 1;
 }
@@ -86,23 +106,19 @@ int ptl_al_destroy_array_list_freefunc(ptl_array_list_t array_list, void (*free_
 	void **ptr = array_list->array;
 	void **i_ptr = NULL;
 	
-	array_list->capacity = 0;
-	array_list->size = 0;
-	array_list->malloc_size = 0;
-
 	// free each element
 	int i = 0;
 	for(i=0; i<array_list->size; i++){
 		i_ptr = ptr + i; // get to element 'i'
 		
-		free_func(*i_ptr); // free it using passed-in function
+		if(*i_ptr != NULL){
+			free_func(*i_ptr); // free it using passed-in function
+		}
 	}
 	
 	
 	// free entire array
-	FREE(array_list->array);
-	
-	return 1;
+	return ptl_al_destroy_array_list(array_list);
 }
 
 /* if list if null or size is equal to zero. */
@@ -116,34 +132,10 @@ int ptl_al_add(ptl_array_list_t array_list, void *value){
 	if(array_list == NULL || value == NULL) { return 0; }
 	
 	// if we have room, then continue, otherwise this funciton will create room
-	_check_capacity(array_list, 0);
-	
-	// put the value in the list
-	void **ptr = array_list->array;
-	ptr += array_list->size; // move to our desired position (end of the list in this case)
-	
-	
-	int c_index = array_list->size - 1; // current index
-	// check if this space is occupied
-	if(*ptr != NULL) { // oops, something is here
-		
-		// go until we find an empty spot or until we reached the end
-		while(*ptr == NULL  &&  c_index < array_list->capacity){
-			c_index++;
-		}
-		
-		// check if we hit the end
-		if((c_index + 1) == array_list->capacity){
-			// we need to expand our list
-			_check_capacity (array_list, 1);
-		}
-	}
-	
-	// either we have room or we just made room, lets put or element in now
-	*((array_list->array) + c_index) = value; // we need to get to the ptr in the list, then assign our ptr there
-	
-	array_list->size++; // increase our size
+	_check_capacity(array_list, 1);
 	
+	// the first slot past 'size' is always free
+	array_list->array[array_list->size++] = value;
 	
 	return 1;
 }
@@ -151,25 +143,20 @@ int ptl_al_add(ptl_array_list_t array_list, void *value){
 
 /* adds, if an element is here, shifts all values to the right. */
 int ptl_al_add_index(ptl_array_list_t array_list, void *value, int index){
-	if(array_list == NULL || 
-	   index >= array_list->capacity || 
-	   index < 0){ 
-		   return 0; 
-	   }
-	
-	_check_capacity(array_list, index + 1);
-	
-	void **ptr = (array_list->array) + index;
+	if(array_list == NULL || index < 0){ 
+		return 0; 
+	}
 	
-	// check if this 'index' is occupied
-	if(*ptr != NULL){
-		// copy all elements to the right i.e. make some space (and we all rolled over...)
-		_shift_elements(array_list, index, 1);
+	// past the end, nothing to shift
+	if(index >= array_list->size){
+		return ptl_al_set(array_list, value, index);
 	}
 	
+	// make some space (and we all rolled over...)
+	_shift_elements(array_list, index, 1);
+	array_list->array[index] = value;
 	
-	// reuse existing function
-	return ptl_al_set(array_list, value, index);
+	return 1;
 }
 
 
@@ -192,14 +179,12 @@ int ptl_al_set(ptl_array_list_t array_list, void *value, int index){
 		   return 0; 
    }
 	
-	if(index >= array_list->capacity){
-		_check_capacity (array_list, index + 1);
+	if(index >= array_list->size){
+		_check_capacity(array_list, index + 1 - array_list->size);
+		array_list->size = index + 1; // the slots between stay NULL
 	}
 	
-	void **ptr = array_list->array;
-	ptr += index; // move to our desired position ('index' in this case)
-	*ptr = value; // we need to get to the ptr in the list, then assign our ptr there
-	
+	array_list->array[index] = value;
 	
 	return 1;
 }
@@ -209,14 +194,11 @@ int ptl_al_set(ptl_array_list_t array_list, void *value, int index){
 void *ptl_al_remove_index(ptl_array_list_t array_list, int index){
 	if(array_list == NULL || 
 	   index < 0 || 
-	   index >= array_list->capacity) {
+	   index >= array_list->size) {
 		   return NULL; 
    }
 	
-	void **ptr = ((array_list->array) + index); // ptr to ptr in array
-	void *element = *ptr; // ptr to element in array
-	
-	*ptr = NULL; // make ptr in array null
+	void *element = array_list->array[index]; // ptr to element in array
 	
 	// shift elements to the left by 1
 	_shift_elements(array_list, index, -1);
@@ -250,8 +232,9 @@ void *ptl_al_remove(ptl_array_list_t array_list, void* value){
 void ptl_al_clear(ptl_array_list_t array_list){
 	if(array_list == NULL) { return; }
 	
-	// set all ptrs to NULL
-	memset(array_list->array, 0, array_list->malloc_size);
+	// only slots below 'size' can be set
+	memset(array_list->array, 0, array_list->size * sizeof(void *));
+	array_list->size = 0;
 }
 
 
@@ -265,7 +248,7 @@ int ptl_al_contains(ptl_array_list_t array_list, void* value){
 /* go through array, return the index of the element if the element is in the array */
 int ptl_al_index_of(ptl_array_list_t array_list, void* value){
 	if(array_list == NULL || value == NULL) {
-		return 0; 
+		return -1; 
     }
 	
 	void **ptr = array_list->array;
@@ -288,69 +271,157 @@ int ptl_al_index_of(ptl_array_list_t array_list, void* value){
 }
 
 
-/* check if array needs to be expanded, if so, it expands it */
+/* make room for 'capacity' elements up front */
+int ptl_al_reserve(ptl_array_list_t array_list, int capacity){
+	if(array_list == NULL || capacity < 0) { return 0; }
+	
+	if(capacity > array_list->capacity){
+		_set_capacity(array_list, capacity);
+	}
+	
+	return 1;
+}
+
+
+/* give back the memory past 'size' */
+int ptl_al_shrink_to_fit(ptl_array_list_t array_list){
+	if(array_list == NULL) { return 0; }
+	
+	// keep at least one slot so the array is never a zero size allocation
+	int capacity = (array_list->size > 0) ? array_list->size : 1;
+	if(capacity < array_list->capacity){
+		_set_capacity(array_list, capacity);
+	}
+	
+	return 1;
+}
+
+
+/* appends every element of 'other' */
+int ptl_al_add_all(ptl_array_list_t array_list, ptl_array_list_t other){
+	if(array_list == NULL || other == NULL) { return 0; }
+	
+	return ptl_al_insert_range(array_list, array_list->size, other->array, other->size);
+}
+
+
+/* inserts 'count' values at 'index', shifting the rest right once */
+int ptl_al_insert_range(ptl_array_list_t array_list, int index, void **values, int count){
+	if(array_list == NULL || index < 0 || index > array_list->size ||
+	   count < 0 || (values == NULL && count > 0)) {
+		return 0;
+	}
+	if(count == 0) { return 1; }
+	
+	// 'values' may point into this list's own array, which is about to move
+	if(values >= array_list->array && values < array_list->array + array_list->size){
+		long offset = values - array_list->array;
+		
+		_shift_elements(array_list, index, count);
+		values = array_list->array + offset;
+		if(offset >= index){ // the source moved right with the shift
+			values += count;
+			memcpy(array_list->array + index, values, count * sizeof(void *));
+		} else if(offset + count <= index){
+			memcpy(array_list->array + index, values, count * sizeof(void *));
+		} else { // the source straddles 'index'
+			int before = index - offset;
+			memcpy(array_list->array + index, values, before * sizeof(void *));
+			memcpy(array_list->array + index + before, 
+				   array_list->array + index + count, (count - before) * sizeof(void *));
+		}
+	} else {
+		_shift_elements(array_list, index, count);
+		memcpy(array_list->array + index, values, count * sizeof(void *));
+	}
+	
+	return 1;
+}
+
+
+/* removes the elements in [from, to), shifting the rest left once */
+int ptl_al_remove_range(ptl_array_list_t array_list, int from, int to){
+	if(array_list == NULL || from < 0 || to > array_list->size || from > to) {
+		return 0;
+	}
+	
+	if(to > from){
+		_shift_elements(array_list, from, -(to - from));
+	}
+	
+	return 1;
+}
+
+
+/* check if array needs room for 'size' more elements, if so, it expands it */
 void _check_capacity(ptl_array_list_t array_list, int size){
 	assert(array_list);
 	assert(size >= 0);
 	
-	if( (array_list->size + size) >= array_list->capacity ){ // make the array list bigger
-		
-		// calculate new capacity
-		int new_capacity = ((array_list->capacity + size) * 3)/2 + 1;
-		
-		// allocate new memory
-		int malloc_size = new_capacity * (sizeof(void *)); 
-		void **new_array = (void *)calloc(new_capacity, sizeof(void*));
-		assert(new_array);
+	if( (array_list->size + size) > array_list->capacity ){ // make the array list bigger
 		
-		// copy elements to the new array using the 'real' size
-		memcpy(new_array, array_list->array, array_list->malloc_size);
-		void *old_array = array_list->array;
-		
-		// save new capcity and malloc size
-		array_list->capacity = new_capacity;
-		array_list->malloc_size = malloc_size;
-		array_list->array = new_array;
-		// size stays the same
+		// grow geometrically so n adds cost O(n) copies in total
+		int new_capacity = (array_list->capacity * 3)/2 + 1;
+		if(new_capacity < array_list->size + size){
+			new_capacity = array_list->size + size;
+		}
 		
-		// free old memory
-		FREE(old_array);
+		_set_capacity(array_list, new_capacity);
 	}
 }
 
 
-/* shifts the elements of the array left or right */
+/* reallocates the array to exactly 'capacity' slots, new slots are NULL */
+void _set_capacity(ptl_array_list_t array_list, int capacity){
+	assert(array_list);
+	assert(capacity > 0 && capacity >= array_list->size);
+	
+	void **new_array = NULL;
+	if(array_list->arena != NULL){
+		new_array = (void **)ptl_arena_realloc(array_list->arena, array_list->array,
+											   array_list->capacity * sizeof(void *),
+											   capacity * sizeof(void *));
+	} else {
+		new_array = (void **)realloc(array_list->array, capacity * sizeof(void *));
+	}
+	assert(new_array);
+	
+	if(capacity > array_list->capacity){
+		memset(new_array + array_list->capacity, 0, 
+			   (capacity - array_list->capacity) * sizeof(void *));
+	}
+	
+	// save new capcity and malloc size, size stays the same
+	array_list->array = new_array;
+	array_list->capacity = capacity;
+	array_list->malloc_size = capacity * sizeof(void *);
+}
+
+
+/* shifts the elements from 'index' to 'size' left or right in place,
+   and adjusts 'size' by 'num_places' */
 void _shift_elements(ptl_array_list_t array_list, int index, int num_places){
 	assert(array_list);
 	assert(index >= 0);
 	assert(num_places != 0);
 	
-	// use a temporary array to shift
-	void **temp_array = (void *)calloc(array_list->capacity, sizeof(void *));
-	assert(temp_array);
-	
-	int copy_size = 0;
-	void* start = 0;
-	
-	if(num_places > 0){ // shift right
-		// index ... size
-		copy_size = (sizeof(void *))*(index-(array_list->size)); 
-		start = (array_list->array)+index;
+	if(num_places > 0){ // shift right, opening [index, index + num_places)
+		_check_capacity(array_list, num_places);
 		
-	} else { // (num_places is negative) - shift left
+		memmove(array_list->array + index + num_places, array_list->array + index,
+				(array_list->size - index) * sizeof(void *));
+		memset(array_list->array + index, 0, num_places * sizeof(void *));
+		
+	} else { // (num_places is negative) - shift left over [index, index + pos_num_places)
 		int pos_num_places = num_places * -1;
-		// index+1 ... size elements
-		copy_size = (sizeof(void *)) * 
-				((index+pos_num_places)-(array_list->size)); 
+		assert(index + pos_num_places <= array_list->size);
 		
-		start = (array_list->array)+index+pos_num_places;
+		memmove(array_list->array + index, array_list->array + index + pos_num_places,
+				(array_list->size - index - pos_num_places) * sizeof(void *));
+		// the vacated tail must read as NULL again
+		memset(array_list->array + array_list->size - pos_num_places, 0, 
+			   pos_num_places * sizeof(void *));
 	}
-	// copy part to shift into temp array
-	memcpy(temp_array, start, copy_size);
-	
-	// copy from temp back to original array
-	memcpy((array_list->array)+index+num_places, temp_array, copy_size);
 	
-	// free temporary memory
-	FREE(temp_array);
+	array_list->size += num_places;
 }
@@ -22,18 +22,30 @@
  * This "class" is an implementation of an ArrayList (see Javadoc). It is an
  * array of pointers that can point to any memory. It starts with an inital
  * 'size' and grows (and may shrink) as more elements are put in the list.
+ *
+ * Growth is geometric (by half again) and done with realloc, and inserts and
+ * removes shift the tail in place, so n appends cost O(n) in total. The
+ * elements are the slots [0, size); every slot from 'size' to 'capacity' is
+ * NULL.
+ *
+ * A list made with ptl_al_create_array_list_arena lives in an arena, list
+ * and array both: it grows with ptl_arena_realloc and is freed by the
+ * arena's next reset, not by 'destroy'.
  */
 
 
 #ifndef __PTL_ARRAY_LIST_H__
 #define __PTL_ARRAY_LIST_H__
 
+#include "ptl_arena.h"
+
 /* Structures */
 struct ptl_array_list {
 	int capacity; 		/**< largest current size */
 	int size;	  		/**< current size */
 	int malloc_size; 	/**< size used in the malloc */
 	void **array;  		/**< array of pointers - elements in the array */
+	ptl_arena_t arena;	/**< where the list and 'array' live, NULL for malloc */
 };
 
 /* Type Definitions */
@@ -59,6 +71,17 @@ ptl_array_list_t ptl_al_create_array_list();
  */
 ptl_array_list_t ptl_al_create_array_list_size(int size);
 
+/**
+ * Creates an array list of 'size' length in 'arena', e.g. the one of the
+ * worker running a task (see ptl_worker_arena). It must not be used after
+ * the arena's next reset. Calling 'destroy' is optional, it frees nothing.
+ *
+ * @param size starting size of this array list
+ * @param arena arena to allocate the list from
+ * @return a fully initialized array list of 'size' length
+ */
+ptl_array_list_t ptl_al_create_array_list_arena(int size, ptl_arena_t arena);
+
 /**
  * Destroy an array list that was created using a 'create' function.
  *
@@ -87,12 +110,9 @@ int ptl_al_destroy_array_list_freefunc(ptl_array_list_t array_list, void (*free_
 int ptl_al_is_empty(ptl_array_list_t array_list);
 
 /**
- * Adds a 'value' to the list at the 'end' of the list. It inserts in the
- * (current size - 1) index. If current size is 4, then the element will 
- * be put in index 3 position. If it is found that the element at the end of
- * the list is occupied, then each position after that is tried until the end
- * of the list. If there is no room from 'size' to 'capacity', then the array
- * list is expanded and the element is put at previous capacity + 1.
+ * Adds a 'value' to the list at the 'end' of the list, index 'size'. If
+ * current size is 4, then the element will be put in index 4 position. If
+ * there is no room, then the array list is expanded first. Amortized O(1).
  *
  * @param array list to add a value
  * @param value to be added to the list
@@ -101,9 +121,9 @@ int ptl_al_is_empty(ptl_array_list_t array_list);
 int ptl_al_add(ptl_array_list_t array_list, void *value);
 
 /**
- * Add the element at 'index'. If the position 'index' is occupied, then
- * all elements past this 'index' are shifted to the right. If this position
- * is unoccupied, then the value is simply inserted.
+ * Add the element at 'index'. If 'index' is within the list, then all
+ * elements from this 'index' on are shifted to the right by one. If 'index'
+ * is past the end, then this acts as ptl_al_set.
  *
  * @param array list to add the value
  * @param value to be added to the list
@@ -124,8 +144,9 @@ void *ptl_al_get(ptl_array_list_t array_list, int index);
 
 /**
  * Sets the 'value' at index 'index. This value will be set at position 'index'
- * even if the element at 'index' is occupied. If 'index' is past 'capacity',
- * then the array list grows and the element is set at 'index'.
+ * even if the element at 'index' is occupied. If 'index' is past the end,
+ * then the array list grows, the size becomes 'index' + 1 and the slots
+ * between the old end and 'index' are NULL.
  *
  * @param array list to set an element
  * @param value to be set at 'index'
@@ -135,9 +156,9 @@ void *ptl_al_get(ptl_array_list_t array_list, int index);
 int ptl_al_set(ptl_array_list_t array_list, void *value, int index);
 
 /**
- * Removes the element at position 'index' and returns it. The pointer at
- * position 'index' then become null. If the removal of an index greater than
- * capacity is requested, then NULL is returned.
+ * Removes the element at position 'index' and returns it. The elements after
+ * 'index' are shifted to the left by one and the size drops by one. If the
+ * removal of an index past the end is requested, then NULL is returned.
  *
  * @param array list to remove an element
  * @param 'index' that an element will be removed
@@ -157,8 +178,8 @@ void *ptl_al_remove_index(ptl_array_list_t array_list, int index);
 void *ptl_al_remove(ptl_array_list_t array_list, void* value);
 
 /**
- * Clears the list of all element. Sets all pointers in the list to NULL.
- * Keep in mind, this does not free any memory. If an element in this list
+ * Clears the list of all element. Sets all pointers in the list to NULL and
+ * the size to 0, keeping the capacity. Keep in mind, this does not free any memory. If an element in this list
  * points to memory that is not referenced elsewhere, then this may cause
  * a memory leak.
  *
@@ -187,4 +208,59 @@ int ptl_al_contains(ptl_array_list_t array_list, void* value);
  */
 int ptl_al_index_of(ptl_array_list_t array_list, void* value);
 
+/**
+ * Makes sure the list can hold 'capacity' elements without growing again.
+ * Use it before adding a batch of known size.
+ *
+ * @param array list to grow
+ * @param number of elements to make room for
+ * @return 1 if successful, 0 otherwise
+ */
+int ptl_al_reserve(ptl_array_list_t array_list, int capacity);
+
+/**
+ * Shrinks the capacity down to the size (but at least 1), giving back the
+ * memory a large batch left behind.
+ *
+ * @param array list to shrink
+ * @return 1 if successful, 0 otherwise
+ */
+int ptl_al_shrink_to_fit(ptl_array_list_t array_list);
+
+/**
+ * Appends every element of 'other', in order, to the end of the list.
+ * 'other' is left as it is and may be the list itself. O(size of 'other').
+ *
+ * @param array list to add to
+ * @param array list whose elements are added
+ * @return 1 if successful, 0 otherwise
+ */
+int ptl_al_add_all(ptl_array_list_t array_list, ptl_array_list_t other);
+
+/**
+ * Inserts 'count' elements from 'values' at 'index'. The elements from
+ * 'index' on are shifted to the right by 'count' once, so this is O(size +
+ * count) and not 'count' single inserts. 'index' may be the size, which
+ * appends. 'values' may point into this list.
+ *
+ * @param array list to insert into
+ * @param 'index' of the first inserted element, 0 to size
+ * @param array of 'count' elements to insert
+ * @param number of elements to insert
+ * @return 1 if successful, 0 otherwise
+ */
+int ptl_al_insert_range(ptl_array_list_t array_list, int index, void **values, int count);
+
+/**
+ * Removes the elements from 'from' up to, but not including, 'to', and
+ * shifts the rest to the left once. This does not free any memory the
+ * elements point to.
+ *
+ * @param array list to remove from
+ * @param first index to remove
+ * @param index past the last one to remove, up to size
+ * @return 1 if successful, 0 otherwise
+ */
+int ptl_al_remove_range(ptl_array_list_t array_list, int from, int to);
+
 #endif
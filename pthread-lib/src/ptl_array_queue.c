@@ -27,39 +27,69 @@
 #include <malloc.h>
 #include <assert.h>
 #include <string.h>
+#include <errno.h>
 #include "ptl_queue.h"
 #include "ptl_util.h"
 #include "ptl_array_queue.h"
 
 
+/* Structures */
+
+/* Array state (kept in q->data). Slots hold bare 'value' pointers so runs
+   of them can be copied with memcpy */
+struct ptl_aq_state {
+	void **slots;	/**< the circular array, 'capacity' long */
+	long head;		/**< index of the first element */
+	long tail;		/**< index the next add writes */
+};
+
+
 /* Private Functions */
-int _ptl_aq_is_at_end(ptl_q_t q, ptl_q_element_t ptr);
+int _ptl_aq_put(ptl_q_t q, void *value);
+void* _ptl_aq_take(ptl_q_t q);
 
 
 /* Global Variables */
-pthread_mutex_t ptl_aq_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/* functions to use with ptl_q_create_queue() */
+struct ptl_q_funcs ptl_aq_funcs = {
+	ptl_aq_init_queue,
+	ptl_aq_destroy_queue,
+	ptl_aq_add,
+	ptl_aq_add_wait,
+	ptl_aq_clear,
+	ptl_aq_peek,
+	ptl_aq_get,
+	ptl_aq_get_wait,
+	NULL,			// 'size' is kept up to date
+	ptl_aq_add_batch,
+	ptl_aq_get_batch,
+	ptl_aq_add_evict
+};
 
 
 /* initalize the ptl_q structure for an array queue */
 void ptl_aq_init_queue (ptl_q_t q){
 	assert(q);
 	
-	pthread_mutex_lock(&ptl_aq_mutex); // lock
+	// each queue has its own lock, nothing else can see 'q' yet
+	pthread_mutex_init(&q->mutex, NULL);
+	ptl_cond_init(&q->not_empty); // signalled by add
+	ptl_cond_init(&q->not_full); // signalled by get
 	
-	strncpy(q->type, "array", PTL_Q_TYPE_LENGTH);
+	q->type = PTL_Q_TYPE_ARRAY;
 	// capacity is already set
 	q->size = 0;
-	q->head = NULL; // this will point to the beginning of the array
-	q->tail = NULL; // this will point to the end of the array
-	q->ptr = NULL; // this will point to the beginning of the array always
+	q->head = q->tail = q->ptr = NULL; // not used, see 'struct ptl_aq_state'
 	// functions is already set
 	
 	// create our finite array with a size of 'capacity'
-	ptl_q_element_t array = (ptl_q_element_t)calloc(q->capacity, sizeof(struct ptl_q_element));
-	assert(array);
-	q->head = q->tail = q->ptr = array;
-	
-	pthread_mutex_unlock(&ptl_aq_mutex); // unlock
+	struct ptl_aq_state *aq = (struct ptl_aq_state *)calloc(1, sizeof(struct ptl_aq_state));
+	assert(aq);
+	aq->slots = (void **)calloc(q->capacity, sizeof(void *));
+	assert(aq->slots);
+	aq->head = aq->tail = 0;
+	q->data = aq;
 	
 	return;
 }
@@ -69,15 +99,21 @@ void ptl_aq_init_queue (ptl_q_t q){
 void ptl_aq_destroy_queue(ptl_q_t q){
 	assert(q);
 	
-	pthread_mutex_lock(&ptl_aq_mutex); // lock
+	PTL_Q_LOCK(q, &q->mutex); // lock
+	
+	struct ptl_aq_state *aq = (struct ptl_aq_state *)q->data;
 	
-	strncpy(q->type, "\0", PTL_Q_TYPE_LENGTH);
+	q->type = PTL_Q_TYPE_NONE;
 	q->capacity = 0;
 	q->size = 0;
-	FREE(q->head); // free our dynamic array memory
-	q->tail = NULL;
+	FREE(aq->slots); // free our dynamic array memory
+	FREE(q->data);
 	
-	pthread_mutex_unlock(&ptl_aq_mutex); // unlock
+	pthread_mutex_unlock(&q->mutex); // unlock
+	
+	pthread_mutex_destroy(&q->mutex); // no one else may use 'q' now
+	pthread_cond_destroy(&q->not_empty);
+	pthread_cond_destroy(&q->not_full);
 	
 	return;
 }
@@ -88,68 +124,111 @@ int ptl_aq_add(ptl_q_t q, void *value){
 	if(q == NULL || value == NULL){ return 0;}
 	
 	// take from head, put at tail
-	pthread_mutex_lock(&ptl_aq_mutex); // lock
+	PTL_Q_LOCK(q, &q->mutex); // lock
 	
-	int at_capacity = q->size == q->capacity;
-	// since we take from the head, we should always be able to add at
-	// size, unless we are at capacity
+	int added = _ptl_aq_put(q, value);
 	
-	if(!at_capacity){ // also head should equal tail
-		q->tail->value = value; // assign the value
-		
-		// increment tail - ensure it goes to zero if at 'capacity'
-		if(_ptl_aq_is_at_end(q, q->tail)){
-			q->tail = q->ptr; // point to the "beginning" of the list
-		} else {
-			q->tail++; // point to next element
-		}
-		
-		q->size++; // increment our size
-	}
+	pthread_mutex_unlock(&q->mutex); // unlock
+	
+	return added;
+}
+
+
+/* add, taking the head first if the array is full */
+int ptl_aq_add_evict(ptl_q_t q, void *value, void **evicted){
+	if(q == NULL || value == NULL || evicted == NULL){ return 0; }
 	
-	pthread_mutex_unlock(&ptl_aq_mutex); // unlock
+	PTL_Q_LOCK(q, &q->mutex); // lock
 	
-	return at_capacity;
+	*evicted = (q->size >= q->capacity) ? _ptl_aq_take(q) : NULL;
+	int added = _ptl_aq_put(q, value);
+	
+	pthread_mutex_unlock(&q->mutex); // unlock
+	
+	return added;
 }
 
 
-/* try to add, if it fails, try again until timeout */
+/* try to add, if the queue is full wait on 'not_full' until 'timeout' */
 int ptl_aq_add_wait(ptl_q_t q, void *value, long timeout){
 	if(q == NULL || value == NULL || timeout < 0) { return 0; }
 	
-	time_t start_time;
-	time_t curr_time;
-	time(&start_time);
-	double time_diff;
+	struct timespec deadline;
+	ptl_get_future_time(&deadline, timeout * 1000); // ms to usec
 	int added_a_element = 0;
 	
-	// while our add fails...
-	while(!(added_a_element = ptl_aq_add(q, value))){
-		// check the time
-		time(&curr_time);
-		time_diff = difftime(curr_time, start_time);
-		
-		if(timeout >= ((long)time_diff)){
-			break; // I chose to use break to get out before the sleep
+	PTL_Q_LOCK(q, &q->mutex); // lock
+	
+	// the cond wait gives up the lock while we sleep
+	while(!(added_a_element = _ptl_aq_put(q, value))){
+		if(pthread_cond_timedwait(&q->not_full, &q->mutex, &deadline) == ETIMEDOUT){
+			added_a_element = _ptl_aq_put(q, value); // one last try
+			break;
 		}
-		
-		ptl_timed_wait(3); // wait 3 microseconds
-		// this wait time may be a bad idea...later rewrite to use conds
 	}
 	
+	pthread_mutex_unlock(&q->mutex); // unlock
+	
 	return added_a_element;
 }
 
 
+/* add as many 'values' as fit, copying them in at most two runs */
+int ptl_aq_add_batch(ptl_q_t q, void **values, int count){
+	if(q == NULL || values == NULL || count <= 0){ return 0; }
+	
+	struct ptl_aq_state *aq = (struct ptl_aq_state *)q->data;
+	
+	// a NULL can't be stored, the batch ends before it
+	int non_null = 0;
+	while(non_null < count && values[non_null] != NULL){
+		non_null++;
+	}
+	
+	PTL_Q_LOCK(q, &q->mutex); // lock
+	
+	long room = q->capacity - q->size;
+	int added = (non_null < room) ? non_null : (int)room;
+	
+	if(added > 0){
+		// from 'tail' to the end of the array, then wrap to the beginning
+		long first_run = q->capacity - aq->tail;
+		if(first_run > added){ first_run = added; }
+		
+		memcpy(aq->slots + aq->tail, values, first_run * sizeof(void *));
+		memcpy(aq->slots, values + first_run, (added - first_run) * sizeof(void *));
+		
+		aq->tail = (aq->tail + added) % q->capacity;
+		__atomic_add_fetch(&q->size, added, __ATOMIC_ACQ_REL);
+		
+		if(added == 1){
+			pthread_cond_signal(&q->not_empty);
+		} else {
+			pthread_cond_broadcast(&q->not_empty); // enough for several 'gets'
+		}
+	}
+	
+	pthread_mutex_unlock(&q->mutex); // unlock
+	
+	return added;
+}
+
+
 /* clear the elements from the list. The 'value' elements aren't freed */
 void ptl_aq_clear(ptl_q_t q){
 	if(q == NULL) { return; }
 	
-	pthread_mutex_lock(&ptl_aq_mutex); // lock
+	struct ptl_aq_state *aq = (struct ptl_aq_state *)q->data;
+	
+	PTL_Q_LOCK(q, &q->mutex); // lock
 
-	memset(q->ptr, 0, sizeof(struct ptl_q_element) * q->capacity);
+	memset(aq->slots, 0, sizeof(void *) * q->capacity);
+	aq->head = aq->tail = 0;
+	__atomic_store_n(&q->size, 0, __ATOMIC_RELEASE);
 	
-	pthread_mutex_unlock(&ptl_aq_mutex); // unlock
+	pthread_cond_broadcast(&q->not_full); // there is room for everyone
+	
+	pthread_mutex_unlock(&q->mutex); // unlock
 	
 	return;
 }
@@ -158,19 +237,19 @@ void ptl_aq_clear(ptl_q_t q){
 /* clear the elements from the list. Free the'value' elements using 
    the supplied function */
 void ptl_aq_clear_freefunc(ptl_q_t q, void (*free_func)(void *)){
+	if(q == NULL) { return; }
 	
-	pthread_mutex_lock(&ptl_aq_mutex); // lock
+	PTL_Q_LOCK(q, &q->mutex); // lock
 
-	// interate through and free all 'value' elements
-	ptl_q_element_t ptr = q->ptr;
-	int i = 0; 
-	for(i=0; i < q->capacity;i++){
-		ptr += i; // move to desired position
-		free_func(ptr->value); // call the free function for 'value'
-		ptr->value = NULL; //set it to null
+	// take and free all 'value' elements
+	void *value = NULL;
+	while((value = _ptl_aq_take(q)) != NULL){
+		free_func(value); // call the free function for 'value'
 	}
 	
-	pthread_mutex_unlock(&ptl_aq_mutex); // unlock
+	pthread_cond_broadcast(&q->not_full); // there is room for everyone
+	
+	pthread_mutex_unlock(&q->mutex); // unlock
 	
 	return;
 }
@@ -180,13 +259,15 @@ void ptl_aq_clear_freefunc(ptl_q_t q, void (*free_func)(void *)){
 void* ptl_aq_peek(ptl_q_t q){
 	if(q == NULL){ return NULL; }
 	
-	pthread_mutex_lock(&ptl_aq_mutex); // lock
+	struct ptl_aq_state *aq = (struct ptl_aq_state *)q->data;
 	
-	void* value = q->head->value;
+	PTL_Q_LOCK(q, &q->mutex); // lock
+	
+	void* value = aq->slots[aq->head]; // NULL if empty
 	// don't decrement size
 	// don't move 'head'
 	
-	pthread_mutex_unlock(&ptl_aq_mutex); // unlock
+	pthread_mutex_unlock(&q->mutex); // unlock
 	
 	return value;
 }
@@ -196,65 +277,119 @@ void* ptl_aq_peek(ptl_q_t q){
 void* ptl_aq_get(ptl_q_t q){
 	if(q == NULL){ return NULL; }
 	
-	pthread_mutex_lock(&ptl_aq_mutex); // lock
+	PTL_Q_LOCK(q, &q->mutex); // lock
 	
-	void* value = NULL;
+	void* value = _ptl_aq_take(q);
 	
-	// check if we have anything in the queue first
-	if(q->size > 0){
-		// take from head, put at tail
-		value = q->head->value;
-		q->head->value = NULL;
-		
-		// time to increment 'head'
-		if(_ptl_aq_is_at_end(q, q->head)){
-			q->head = q->ptr; // set to beginning of memory
-		} else {
-			q->head++; // just increment
-		}
-		
-		q->size++;
-		
-	}
-	
-	pthread_mutex_unlock(&ptl_aq_mutex); // unlock
+	pthread_mutex_unlock(&q->mutex); // unlock
 	
 	return value;
 }
 
 
-/* try to get an element, if no elements exist, then keep 
-   trying until 'timeout' */
+/* try to get an element, if no elements exist, then wait on 'not_empty'
+   until 'timeout' */
 void* ptl_aq_get_wait(ptl_q_t q, long timeout){
 	if(q == NULL || timeout < 0) { return NULL; }
 	
-	time_t start_time;
-	time_t curr_time;
-	time(&start_time);
-	double time_diff;
+	struct timespec deadline;
+	ptl_get_future_time(&deadline, timeout * 1000); // ms to usec
 	void* element = NULL;
 	
-	while((element = ptl_aq_get(q)) == NULL){
+	PTL_Q_LOCK(q, &q->mutex); // lock
+	
+	// the cond wait gives up the lock while we sleep
+	while((element = _ptl_aq_take(q)) == NULL){
+		if(pthread_cond_timedwait(&q->not_empty, &q->mutex, &deadline) == ETIMEDOUT){
+			element = _ptl_aq_take(q); // one last try
+			break;
+		}
+	}
+	
+	pthread_mutex_unlock(&q->mutex); // unlock
+	
+	return element;
+}
+
+
+/* take up to 'max' elements, copying them out in at most two runs */
+int ptl_aq_get_batch(ptl_q_t q, void **values, int max){
+	if(q == NULL || values == NULL || max <= 0){ return 0; }
+	
+	struct ptl_aq_state *aq = (struct ptl_aq_state *)q->data;
+	
+	PTL_Q_LOCK(q, &q->mutex); // lock
+	
+	int taken = (max < q->size) ? max : (int)q->size;
+	
+	if(taken > 0){
+		// from 'head' to the end of the array, then wrap to the beginning
+		long first_run = q->capacity - aq->head;
+		if(first_run > taken){ first_run = taken; }
 		
-		// check the time
-		time(&curr_time);
-		time_diff = difftime(curr_time, start_time);
+		memcpy(values, aq->slots + aq->head, first_run * sizeof(void *));
+		memcpy(values + first_run, aq->slots, (taken - first_run) * sizeof(void *));
+		memset(aq->slots + aq->head, 0, first_run * sizeof(void *));
+		memset(aq->slots, 0, (taken - first_run) * sizeof(void *));
 		
-		if(timeout >= ((long)time_diff)){
-			break; // I chose to use break to get out before the sleep
-		}
+		aq->head = (aq->head + taken) % q->capacity;
+		__atomic_sub_fetch(&q->size, taken, __ATOMIC_ACQ_REL);
 		
-		ptl_timed_wait(3); // wait 3 microseconds
-		// this wait time may be a bad idea...later rewrite to use conds
+		if(taken == 1){
+			pthread_cond_signal(&q->not_full);
+		} else {
+			pthread_cond_broadcast(&q->not_full); // room for several 'adds'
+		}
 	}
 	
-	return element;
+	pthread_mutex_unlock(&q->mutex); // unlock
+	
+	return taken;
 }
 
 
-/* checks of 'ptr' is pointing to the end of the list */
-int _ptl_aq_is_at_end(ptl_q_t q, ptl_q_element_t ptr){
-	ptl_q_element_t end_of_list = q->ptr + (q->capacity - 1);
+/* puts 'value' at the tail, the lock must be held. returns 0 if full */
+int _ptl_aq_put(ptl_q_t q, void *value){
+	// since we take from the head, we should always be able to add at
+	// size, unless we are at capacity
+	if(q->size >= q->capacity){ return 0; }
+	
+	struct ptl_aq_state *aq = (struct ptl_aq_state *)q->data;
+	
+	aq->slots[aq->tail] = value; // assign the value
 	
-	return ptr == end_of_list;
+	// increment tail - ensure it goes to zero if at 'capacity'
+	if(++aq->tail == q->capacity){
+		aq->tail = 0; // point to the "beginning" of the list
+	}
+	
+	PTL_ATOMIC_INC(q->size); // increment our size
+	
+	pthread_cond_signal(&q->not_empty); // wake up a waiting 'get'
+	
+	return 1;
+}
+
+
+/* takes the value at the head, the lock must be held. returns NULL if empty */
+void* _ptl_aq_take(ptl_q_t q){
+	// check if we have anything in the queue first
+	if(q->size <= 0){ return NULL; }
+	
+	struct ptl_aq_state *aq = (struct ptl_aq_state *)q->data;
+	
+	// take from head, put at tail
+	void* value = aq->slots[aq->head];
+	aq->slots[aq->head] = NULL;
+	
+	// time to increment 'head'
+	if(++aq->head == q->capacity){
+		aq->head = 0; // set to beginning of memory
+	}
+	
+	PTL_ATOMIC_DEC(q->size);
+	
+	pthread_cond_signal(&q->not_full); // wake up a waiting 'add'
+	
+	return value;
 }
@@ -22,13 +22,21 @@
  * This "class" is an array implemention of a queue. It can be used with the
  * ptl_queue "interface" to have a finite, bounded set of work that can be
  * executed using the thread pool. This queue uses simple locking/blocking
- * operations for all get and put operations.
+ * operations for all get and put operations. The waiting versions sleep on
+ * the queue's 'not_empty'/'not_full' conditions instead of polling. The
+ * array holds bare 'value' pointers, so the batch functions copy whole runs
+ * of them with memcpy under a single lock.
  */
 
 
 #ifndef __PTL_ARRAY_QUEUE_H__
 #define __PTL_ARRAY_QUEUE_H__
 
+/**
+ * Function table for this queue, e.g. ptl_q_create_queue(&ptl_aq_funcs, 64)
+ */
+extern struct ptl_q_funcs ptl_aq_funcs;
+
 /**
  * Destroys the queue and frees the memory. This should be used when the queue
  * is no longer going to be used.
@@ -58,17 +66,40 @@ int ptl_aq_add(ptl_q_t q, void *value);
 
 /**
  * Tries to insert the item into the array queue. If there is not room, it will
- * wait until there is room or until 'timeout' occurs.
+ * wait until there is room or until 'timeout' occurs. The thread sleeps on
+ * the 'not_full' condition, which every get signals.
  *
  * 
  * @param q non-null queue to add the value
  * @param value data that will be added to the queue
- * @param timeout this parameter is ignored
+ * @param timeout number of milliseconds to wait for room
  * @return 1 if successful, 0 otherwise
  * @see ptl_lq_add()
  **/
 int ptl_aq_add_wait(ptl_q_t q, void *value, long timeout);
 
+/**
+ * Inserts up to 'count' elements under one lock, copying them into the array
+ * with memcpy. Stops when the queue is full or at the first NULL.
+ *
+ * @param q non-null queue
+ * @param values elements to add, in order
+ * @param count number of elements in 'values'
+ * @return number of elements added, from the front of 'values'
+ */
+int ptl_aq_add_batch(ptl_q_t q, void **values, int count);
+
+/**
+ * Inserts 'value', removing the head first if the array is full, all under
+ * one lock. Used by ptl_q_discard_oldest_policy.
+ *
+ * @param q non-null queue
+ * @param value the value to be stored in the queue
+ * @param evicted set to the removed head, or NULL if there was room
+ * @return 1 if successful, 0 otherwise
+ */
+int ptl_aq_add_evict(ptl_q_t q, void *value, void **evicted);
+
 /**
  * Removes all of the elements from this queue freeing memory as it iterates
  * through. Please note, it does not free the 'values' put in the list using add.
@@ -109,17 +140,24 @@ void* ptl_aq_peek(ptl_q_t q);
  */
 void* ptl_aq_get(ptl_q_t q);
 
+/**
+ * Retrieves and removes up to 'max' elements under one lock, copying them out
+ * of the array with memcpy.
+ *
+ * @param q non-null queue to get elements from
+ * @param values where the elements are stored, in queue order
+ * @param max room in 'values'
+ * @return number of elements stored in 'values'
+ */
+int ptl_aq_get_batch(ptl_q_t q, void **values, int max);
+
 /**
  * Retrieves and removes the head of this queue, waiting up to the specified
  * wait time if necessary for an element to become available.
- * This function will block only when trying to get an element, meaning another
- * thread may beat 'this' thread to the next element.
- *
- * @note one may experience bad performance by continually checking if an element
- *       is available and blocking until we reach the timeout value.
+ * The thread sleeps on the 'not_empty' condition, which every add signals.
  *
  * @param q non-null queue to get an element from
- * @param timeout time in seconds
+ * @param timeout time in milliseconds
  * @return the head element or NULL if no element was found
  */
 void* ptl_aq_get_wait(ptl_q_t q, long timeout);
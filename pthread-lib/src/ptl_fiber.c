@@ -0,0 +1,399 @@
+/*
+ * This file is part of the pthread-lib Library.
+ * Copyright (C) 2008-2009 Nick Powers.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Library General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor Boston, MA 02110-1301,  USA
+ */
+
+/* See header file for documentation. */
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <sched.h>
+#include <unistd.h>
+#include <ucontext.h>
+#include <sys/mman.h>
+#include "ptl_fiber.h"
+#include "ptl_util.h"
+
+
+/* Structures */
+
+/* a fiber in ptl_fiber_cond_wait, on that fiber's stack */
+struct ptl_fiber_waiter {
+	ptl_fiber_t fiber;
+	struct ptl_fiber_waiter *next;
+	struct ptl_fiber_waiter *prev;
+	struct ptl_fiber_cond *cond;
+	pthread_mutex_t *mutex;			// the wait's, guards the fields below
+	struct ptl_timer timer;			// on the pool's wheel, for timed waits
+	int linked;						// still on 'cond'
+	int timed_out;
+	int timer_done;					// atomic, the timer callback won't touch it again
+};
+
+
+/* Private Functions */
+void _ptl_fiber_start();
+void _ptl_fiber_recycle(ptl_fiber_t fiber);
+void _ptl_fiber_unmap(ptl_fiber_t fiber);
+void _ptl_fiber_unlock(void *mutex);
+void _ptl_fiber_link(struct ptl_fiber_cond *cond, struct ptl_fiber_waiter *waiter);
+void _ptl_fiber_unlink(struct ptl_fiber_cond *cond, struct ptl_fiber_waiter *waiter);
+ptl_tw_t _ptl_fiber_timer_wheel(ptl_fiber_pool_t pool);
+void _ptl_fiber_timeouts(struct ptl_timer **timers, int count, void *pool);
+
+
+/* Global Variables */
+static __thread ptl_fiber_t ptl_fiber_self = NULL; // fiber this thread runs, if any
+int ptl_fiber_in_use = 0;
+
+
+/* Public Functions */
+
+/* an empty pool, stacks are mapped as fibers are made */
+ptl_fiber_pool_t ptl_fiber_pool_create(size_t stack_size,
+									   void (*resume)(ptl_fiber_t fiber, void *context),
+									   void *context){
+	if(resume == NULL){ return NULL; }
+	
+	ptl_fiber_pool_t pool = (ptl_fiber_pool_t)calloc(1, sizeof(struct ptl_fiber_pool));
+	assert(pool);
+	
+	pool->page_size = (size_t)sysconf(_SC_PAGESIZE);
+	if(stack_size == 0){
+		stack_size = PTL_FIBER_DEFAULT_STACK_SIZE;
+	}
+	pool->stack_size = (stack_size + pool->page_size - 1) & ~(pool->page_size - 1);
+	pool->resume = resume;
+	pool->context = context;
+	pthread_mutex_init(&pool->mutex, NULL);
+	
+	__atomic_store_n(&ptl_fiber_in_use, 1, __ATOMIC_SEQ_CST);
+	
+	return pool;
+}
+
+
+/* unmap the kept stacks */
+void ptl_fiber_pool_destroy(ptl_fiber_pool_t pool){
+	if(pool == NULL){ return; }
+	
+	if(pool->timer_wheel != NULL){
+		ptl_tw_destroy(pool->timer_wheel);
+	}
+	
+	while(pool->free != NULL){
+		ptl_fiber_t fiber = pool->free;
+		pool->free = fiber->next;
+		_ptl_fiber_unmap(fiber);
+	}
+	
+	pthread_mutex_destroy(&pool->mutex);
+	FREE(pool);
+}
+
+
+/* reuse a finished fiber's stack, or map a new one below a guard page */
+ptl_fiber_t ptl_fiber_create(ptl_fiber_pool_t pool, 
+							 void (*entry)(ptl_fiber_t fiber, void *arg), void *arg){
+	if(pool == NULL || entry == NULL){ return NULL; }
+	
+	pthread_mutex_lock(&pool->mutex);
+	ptl_fiber_t fiber = pool->free;
+	if(fiber != NULL){
+		pool->free = fiber->next;
+		pool->retained--;
+	}
+	pthread_mutex_unlock(&pool->mutex);
+	
+	if(fiber == NULL){
+		fiber = (ptl_fiber_t)calloc(1, sizeof(struct ptl_fiber));
+		assert(fiber);
+		
+		fiber->mapped = pool->stack_size + pool->page_size;
+		fiber->stack = mmap(NULL, fiber->mapped, PROT_READ | PROT_WRITE,
+							MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK, -1, 0);
+		if(fiber->stack == MAP_FAILED){
+			FREE(fiber);
+			return NULL;
+		}
+		mprotect(fiber->stack, pool->page_size, PROT_NONE); // stacks grow down into it
+		fiber->pool = pool;
+	}
+	
+	fiber->entry = entry;
+	fiber->arg = arg;
+	fiber->done = 0;
+	fiber->park = NULL;
+	fiber->next = NULL;
+	
+	getcontext(&fiber->context);
+	fiber->context.uc_stack.ss_sp = (char *)fiber->stack + pool->page_size;
+	fiber->context.uc_stack.ss_size = pool->stack_size;
+	fiber->context.uc_link = NULL; // _ptl_fiber_start switches back itself
+	makecontext(&fiber->context, _ptl_fiber_start, 0);
+	
+	return fiber;
+}
+
+
+/* switch to it; once it switches back, recycle it or run its 'park' */
+int ptl_fiber_run(ptl_fiber_t fiber){
+	if(fiber == NULL){ return 0; }
+	
+	ucontext_t caller;
+	ptl_fiber_t outer = ptl_fiber_self; // a fiber may run another
+	
+	fiber->caller = &caller;
+	ptl_fiber_self = fiber;
+	swapcontext(&caller, &fiber->context);
+	ptl_fiber_self = outer;
+	
+	if(fiber->done){
+		_ptl_fiber_recycle(fiber);
+		return 1;
+	}
+	
+	// off its stack now, whoever 'park' lets resume it may run it at once
+	void (*park)(void *) = fiber->park;
+	void *park_arg = fiber->park_arg;
+	fiber->park = NULL;
+	if(park != NULL){
+		park(park_arg);
+	}
+	
+	return 0;
+}
+
+
+/* the fiber this thread runs */
+ptl_fiber_t ptl_fiber_current(){
+	return ptl_fiber_self;
+}
+
+
+/* back to the ptl_fiber_run that runs us, 'park' runs there */
+void ptl_fiber_suspend(void (*park)(void *), void *arg){
+	ptl_fiber_t fiber = ptl_fiber_self;
+	if(fiber == NULL){ return; }
+	
+	fiber->park = park;
+	fiber->park_arg = arg;
+	swapcontext(&fiber->context, fiber->caller);
+}
+
+
+/* the pool decides where it runs */
+void ptl_fiber_resume(ptl_fiber_t fiber){
+	fiber->pool->resume(fiber, fiber->pool->context);
+}
+
+
+/* nobody waiting */
+void ptl_fiber_cond_init(struct ptl_fiber_cond *cond){
+	if(cond == NULL){ return; }
+	
+	cond->head = NULL;
+	cond->tail = NULL;
+}
+
+
+/* wait on 'cond' with the waiter on our own stack; 'mutex' is unlocked once
+   we're switched out, so a signal can't come before the fiber can be run */
+int ptl_fiber_cond_wait(struct ptl_fiber_cond *cond, pthread_mutex_t *mutex, long timeout){
+	ptl_fiber_t fiber = ptl_fiber_self;
+	if(fiber == NULL || timeout == 0){ return 0; }
+	
+	struct ptl_fiber_waiter waiter;
+	memset(&waiter, 0, sizeof(struct ptl_fiber_waiter));
+	waiter.fiber = fiber;
+	waiter.cond = cond;
+	waiter.mutex = mutex;
+	_ptl_fiber_link(cond, &waiter);
+	
+	ptl_tw_t wheel = NULL;
+	if(timeout > 0){
+		wheel = _ptl_fiber_timer_wheel(fiber->pool);
+		ptl_tw_init_timer(&waiter.timer, &waiter);
+		ptl_tw_add(wheel, &waiter.timer, timeout);
+	}
+	
+	ptl_fiber_suspend(_ptl_fiber_unlock, mutex);
+	
+	// a timer that is expiring can't be cancelled, wait until it's done with us
+	if(wheel != NULL && !ptl_tw_cancel(wheel, &waiter.timer)){
+		while(!__atomic_load_n(&waiter.timer_done, __ATOMIC_ACQUIRE)){
+			sched_yield();
+		}
+	}
+	
+	pthread_mutex_lock(mutex);
+	
+	return !waiter.timed_out;
+}
+
+
+/* the oldest waiter goes */
+int ptl_fiber_cond_signal(struct ptl_fiber_cond *cond){
+	struct ptl_fiber_waiter *waiter = cond->head;
+	if(waiter == NULL){ return 0; }
+	
+	_ptl_fiber_unlink(cond, waiter);
+	ptl_fiber_resume(waiter->fiber);
+	
+	return 1;
+}
+
+
+/* all of them go */
+void ptl_fiber_cond_broadcast(struct ptl_fiber_cond *cond){
+	while(ptl_fiber_cond_signal(cond)){
+		// resumed one
+	}
+}
+
+
+
+/* Private Functions */
+
+/* first thing a fiber runs: 'entry', then back to whoever runs it now */
+void _ptl_fiber_start(){
+	ptl_fiber_t fiber = ptl_fiber_self;
+	
+	fiber->entry(fiber, fiber->arg);
+	
+	fiber->done = 1;
+	setcontext(fiber->caller);
+}
+
+
+/* keep it for the next ptl_fiber_create, up to PTL_FIBER_MAX_RETAINED */
+void _ptl_fiber_recycle(ptl_fiber_t fiber){
+	ptl_fiber_pool_t pool = fiber->pool;
+	
+	if(fiber->arena != NULL){
+		ptl_arena_reset(fiber->arena);
+	}
+	
+	pthread_mutex_lock(&pool->mutex);
+	if(pool->retained < PTL_FIBER_MAX_RETAINED){
+		fiber->next = pool->free;
+		pool->free = fiber;
+		pool->retained++;
+		fiber = NULL;
+	}
+	pthread_mutex_unlock(&pool->mutex);
+	
+	if(fiber != NULL){
+		_ptl_fiber_unmap(fiber);
+	}
+}
+
+
+/* give its stack back and free it */
+void _ptl_fiber_unmap(ptl_fiber_t fiber){
+	munmap(fiber->stack, fiber->mapped);
+	ptl_arena_destroy(fiber->arena);
+	FREE(fiber);
+}
+
+
+/* ptl_fiber_cond_wait's 'park' */
+void _ptl_fiber_unlock(void *mutex){
+	pthread_mutex_unlock((pthread_mutex_t *)mutex);
+}
+
+
+/* to the tail of 'cond' */
+void _ptl_fiber_link(struct ptl_fiber_cond *cond, struct ptl_fiber_waiter *waiter){
+	waiter->next = NULL;
+	waiter->prev = cond->tail;
+	if(cond->tail != NULL){
+		cond->tail->next = waiter;
+	} else {
+		cond->head = waiter;
+	}
+	cond->tail = waiter;
+	waiter->linked = 1;
+}
+
+
+/* off 'cond', from anywhere in it */
+void _ptl_fiber_unlink(struct ptl_fiber_cond *cond, struct ptl_fiber_waiter *waiter){
+	if(waiter->prev != NULL){
+		waiter->prev->next = waiter->next;
+	} else {
+		cond->head = waiter->next;
+	}
+	if(waiter->next != NULL){
+		waiter->next->prev = waiter->prev;
+	} else {
+		cond->tail = waiter->prev;
+	}
+	waiter->linked = 0;
+}
+
+
+/* the pool's timer wheel, started by the first timed wait */
+ptl_tw_t _ptl_fiber_timer_wheel(ptl_fiber_pool_t pool){
+	ptl_tw_t wheel = __atomic_load_n(&pool->timer_wheel, __ATOMIC_ACQUIRE);
+	if(wheel != NULL){
+		return wheel;
+	}
+	
+	pthread_mutex_lock(&pool->mutex);
+	if((wheel = pool->timer_wheel) == NULL){
+		wheel = ptl_tw_create(PTL_TW_DEFAULT_TICK_MSEC, _ptl_fiber_timeouts, pool);
+		assert(wheel);
+		__atomic_store_n(&pool->timer_wheel, wheel, __ATOMIC_RELEASE);
+	}
+	pthread_mutex_unlock(&pool->mutex);
+	
+	return wheel;
+}
+
+
+/**
+ * The wheel's callback. Each timer belongs to a fiber in a timed wait; the
+ * waiters still on their condition are taken off and resumed as timed out.
+ * Once 'timer_done' is set the waiter may be gone, so it's the last thing
+ * touched.
+ */
+void _ptl_fiber_timeouts(struct ptl_timer **timers, int count, void *pool){
+	int i = 0;
+	
+	for(i = 0; i < count; i++){
+		struct ptl_fiber_waiter *waiter = (struct ptl_fiber_waiter *)timers[i]->data;
+		pthread_mutex_t *mutex = waiter->mutex;
+		ptl_fiber_t fiber = waiter->fiber;
+		int resume = 0;
+		
+		pthread_mutex_lock(mutex);
+		if(waiter->linked){
+			_ptl_fiber_unlink(waiter->cond, waiter);
+			waiter->timed_out = 1;
+			resume = 1;
+		}
+		__atomic_store_n(&waiter->timer_done, 1, __ATOMIC_RELEASE);
+		pthread_mutex_unlock(mutex);
+		
+		if(resume){
+			ptl_fiber_resume(fiber);
+		}
+	}
+}
@@ -0,0 +1,213 @@
+/*
+ * This file is part of the pthread-lib Library.
+ * Copyright (C) 2008-2009 Nick Powers.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Library General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor Boston, MA 02110-1301,  USA
+ */
+
+/**
+ * Stackful fibers: functions that run on a stack of their own and can be
+ * switched out part way through, so whatever waits inside them gives the
+ * thread back instead of blocking it. Fibers are switched with ucontext.
+ *
+ * A fiber runs until it returns or suspends; ptl_fiber_run returns either
+ * way. A suspended fiber is resumed through its pool's 'resume' function
+ * (a thread manager queues it for a worker), and may go on on another
+ * thread than it started on. Code in a fiber must therefore not keep
+ * pointers to thread locals across a wait.
+ *
+ * Stacks come from a pool and are mapped with a guard page below them, so
+ * running off the end faults instead of corrupting the next stack. Finished
+ * fibers keep their stack, and their arena reset, for the next one.
+ *
+ * struct ptl_fiber_cond is what waits are built on: the fiber version of a
+ * condition variable, used with the mutex of whatever it waits for.
+ * ptl_future_get and ptl_q_get_wait use it when called from a fiber.
+ */
+
+#ifndef __PTL_FIBER_H__
+#define __PTL_FIBER_H__
+
+#include <pthread.h>
+#include <ucontext.h>
+#include "ptl_timer_wheel.h"
+#include "ptl_arena.h"
+
+/* Constants */
+#define PTL_FIBER_DEFAULT_STACK_SIZE (64 * 1024)	/**< usable bytes, the guard page is extra */
+#define PTL_FIBER_MAX_RETAINED 1024					/**< finished fibers a pool keeps */
+
+
+/* Structures */
+
+struct ptl_fiber;
+struct ptl_fiber_waiter;
+
+struct ptl_fiber_pool {
+	pthread_mutex_t mutex;			/**< guards 'free', 'retained' and making 'timer_wheel' */
+	struct ptl_fiber *free;			/**< finished fibers, stacks still mapped */
+	int retained;
+	size_t stack_size;				/**< usable bytes per stack, page aligned */
+	size_t page_size;
+	void (*resume)(struct ptl_fiber *fiber, void *context);
+									/**< makes a woken fiber run again */
+	void *context;					/**< passed to 'resume' */
+	ptl_tw_t timer_wheel;			/**< ends timed waits, made by the first one */
+};
+
+struct ptl_fiber {
+	ucontext_t context;				/**< where it left off */
+	ucontext_t *caller;				/**< the ptl_fiber_run it switches back to */
+	void *stack;					/**< the mapping, guard page first */
+	size_t mapped;
+	void (*entry)(struct ptl_fiber *fiber, void *arg);
+	void *arg;
+	int done;						/**< 'entry' returned */
+	void (*park)(void *);			/**< run by ptl_fiber_run once the fiber is off
+										 its stack, see ptl_fiber_suspend */
+	void *park_arg;
+	struct ptl_fiber_pool *pool;
+	struct ptl_fiber *next;			/**< link in the pool's free list */
+	ptl_arena_t arena;				/**< scratch memory of what runs on it, see
+										 ptl_worker_arena; kept with the stack */
+};
+
+/* fibers waiting, oldest first. Guarded by the mutex the waits pass in */
+struct ptl_fiber_cond {
+	struct ptl_fiber_waiter *head;
+	struct ptl_fiber_waiter *tail;
+};
+
+
+/* Type Definitions */
+typedef struct ptl_fiber_pool *ptl_fiber_pool_t;
+typedef struct ptl_fiber *ptl_fiber_t;
+
+
+/**
+ * Set to 1 by the first ptl_fiber_pool_create, before any fiber can run, and
+ * never cleared. While it's 0 no fiber waits anywhere, so a queue add skips
+ * the fence that its fiber wakeup needs.
+ */
+extern int ptl_fiber_in_use;
+
+
+/* Public Functions */
+
+/**
+ * Creates a pool of fiber stacks.
+ *
+ * @param stack_size usable bytes per stack, PTL_FIBER_DEFAULT_STACK_SIZE if 0.
+ * 		  Rounded up to whole pages
+ * @param resume called with a fiber that was woken up, from the thread that
+ * 		  woke it. It must make some thread call ptl_fiber_run on it
+ * @param context passed to 'resume'
+ * @return a new pool, or NULL if 'resume' is NULL
+ */
+ptl_fiber_pool_t ptl_fiber_pool_create(size_t stack_size,
+									   void (*resume)(ptl_fiber_t fiber, void *context),
+									   void *context);
+
+/**
+ * Unmaps the stacks kept by the pool and frees it. Every fiber made from it
+ * must have finished.
+ *
+ * @param pool pool to destroy, may be NULL
+ */
+void ptl_fiber_pool_destroy(ptl_fiber_pool_t pool);
+
+/**
+ * Makes a fiber that calls 'entry(fiber, arg)' once it is run. It is
+ * recycled when 'entry' returns.
+ *
+ * @param pool non-null pool
+ * @param entry function to run on the fiber
+ * @param arg passed to 'entry'
+ * @return a fiber that hasn't started, or NULL if no stack could be mapped
+ */
+ptl_fiber_t ptl_fiber_create(ptl_fiber_pool_t pool, 
+							 void (*entry)(ptl_fiber_t fiber, void *arg), void *arg);
+
+/**
+ * Switches the calling thread to 'fiber' until it finishes or suspends.
+ * A fiber may run another fiber.
+ *
+ * @param fiber a fiber that hasn't started, or one that was resumed
+ * @return 1 if it finished (and is gone), 0 if it suspended
+ */
+int ptl_fiber_run(ptl_fiber_t fiber);
+
+/**
+ * The fiber the calling thread is running, if any.
+ *
+ * @return the current fiber, NULL outside of one
+ */
+ptl_fiber_t ptl_fiber_current();
+
+/**
+ * Switches the current fiber out. Once it is off its stack, the thread that
+ * ran it calls 'park(arg)' (e.g. to unlock what the fiber waits on); from
+ * then on anybody may ptl_fiber_resume it. Returns when it runs again.
+ * Only call it from a fiber.
+ *
+ * @param park called after the switch, may be NULL
+ * @param arg passed to 'park'
+ */
+void ptl_fiber_suspend(void (*park)(void *), void *arg);
+
+/**
+ * Hands a suspended fiber to its pool's 'resume' function.
+ *
+ * @param fiber non-null fiber that suspended
+ */
+void ptl_fiber_resume(ptl_fiber_t fiber);
+
+/**
+ * Sets up a condition nobody waits on.
+ *
+ * @param cond condition to initialize
+ */
+void ptl_fiber_cond_init(struct ptl_fiber_cond *cond);
+
+/**
+ * pthread_cond_timedwait for fibers: unlocks 'mutex', suspends the current
+ * fiber until it's signalled or 'timeout' runs out, and locks 'mutex'
+ * again. The thread goes on with other fibers meanwhile. Only call it from
+ * a fiber, with 'mutex' held.
+ *
+ * @param cond non-null condition
+ * @param mutex held by the caller, guards 'cond'
+ * @param timeout ms to wait at most, less than 0 for no limit
+ * @return 1 if signalled, 0 if it timed out
+ */
+int ptl_fiber_cond_wait(struct ptl_fiber_cond *cond, pthread_mutex_t *mutex, long timeout);
+
+/**
+ * Resumes the fiber that has waited longest, if any. Call it with the
+ * waits' mutex held.
+ *
+ * @param cond non-null condition
+ * @return 1 if a fiber was resumed, 0 if none was waiting
+ */
+int ptl_fiber_cond_signal(struct ptl_fiber_cond *cond);
+
+/**
+ * Resumes every waiting fiber. Call it with the waits' mutex held.
+ *
+ * @param cond non-null condition
+ */
+void ptl_fiber_cond_broadcast(struct ptl_fiber_cond *cond);
+
+#endif
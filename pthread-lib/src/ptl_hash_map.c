@@ -0,0 +1,398 @@
+/*
+ * This file is part of the pthread-lib Library.
+ * Copyright (C) 2008-2009 Nick Powers.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Library General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor Boston, MA 02110-1301,  USA
+ */
+
+
+/*
+ * For a "class" description, see the header file.
+ */
+
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include "ptl_hash_map.h"
+#include "ptl_util.h"
+
+/* Constants */
+#define _PTL_HM_EMPTY 0
+#define _PTL_HM_REMOVED 1
+#define _PTL_HM_SEGMENT_BITS 4			/* log2 of PTL_HM_SEGMENTS */
+#define _PTL_HM_MIN_TABLE 8
+
+/* Private Functions */
+unsigned long _ptl_hm_hash(ptl_hash_map_t map, const void *key);
+struct ptl_hm_segment *_ptl_hm_segment(ptl_hash_map_t map, unsigned long hash);
+struct ptl_hm_entry *_ptl_hm_find(ptl_hash_map_t map, struct ptl_hm_segment *segment, 
+								  const void *key, unsigned long hash);
+struct ptl_hm_entry *_ptl_hm_insert(ptl_hash_map_t map, struct ptl_hm_segment *segment, 
+									const void *key, unsigned long hash, void *value);
+void _ptl_hm_delete(struct ptl_hm_segment *segment, struct ptl_hm_entry *entry);
+void _ptl_hm_rehash(struct ptl_hm_segment *segment, unsigned long size);
+
+
+/* pointer keys, default size */
+ptl_hash_map_t ptl_hm_create_hash_map(){
+	return ptl_hm_create_hash_map_funcs(PTL_HM_DEFAULT_CAPACITY, NULL, NULL);
+}
+
+
+/* segments share the capacity, each table starting a power of two */
+ptl_hash_map_t ptl_hm_create_hash_map_funcs(long capacity, ptl_hm_hash_func hash_func, 
+											ptl_hm_equals_func equals_func){
+	ptl_hash_map_t map = (ptl_hash_map_t)calloc(1, sizeof(struct ptl_hash_map));
+	assert(map);
+	
+	map->hash_func = hash_func;
+	map->equals_func = equals_func;
+	map->segments = (struct ptl_hm_segment *)ptl_cache_aligned_alloc(
+						PTL_HM_SEGMENTS * sizeof(struct ptl_hm_segment));
+	
+	// room for the segment's share at under 3/4 full
+	unsigned long size = _PTL_HM_MIN_TABLE;
+	while(size * 3 / 4 < (unsigned long)(capacity / PTL_HM_SEGMENTS + 1)){
+		size <<= 1;
+	}
+	
+	int i = 0;
+	for(i = 0; i < PTL_HM_SEGMENTS; i++){
+		struct ptl_hm_segment *segment = &map->segments[i];
+		
+		pthread_mutex_init(&segment->mutex, NULL);
+		segment->table = (struct ptl_hm_entry *)calloc(size, sizeof(struct ptl_hm_entry));
+		assert(segment->table);
+		segment->mask = size - 1;
+	}
+	
+	return map;
+}
+
+
+/* the keys and values belong to the caller */
+int ptl_hm_destroy_hash_map(ptl_hash_map_t map){
+	if(map == NULL) { return 0; }
+	
+	int i = 0;
+	for(i = 0; i < PTL_HM_SEGMENTS; i++){
+		pthread_mutex_destroy(&map->segments[i].mutex);
+		FREE(map->segments[i].table);
+	}
+	FREE(map->segments);
+	FREE(map);
+	
+	return 1;
+}
+
+
+/* look the key up in its segment */
+void *ptl_hm_get(ptl_hash_map_t map, const void *key){
+	if(map == NULL) { return NULL; }
+	
+	unsigned long hash = _ptl_hm_hash(map, key);
+	struct ptl_hm_segment *segment = _ptl_hm_segment(map, hash);
+	void *value = NULL;
+	
+	pthread_mutex_lock(&segment->mutex);
+	struct ptl_hm_entry *entry = _ptl_hm_find(map, segment, key, hash);
+	if(entry != NULL){
+		value = entry->value;
+	}
+	pthread_mutex_unlock(&segment->mutex);
+	
+	return value;
+}
+
+
+/* values are never NULL, so a value means the key is there */
+int ptl_hm_contains(ptl_hash_map_t map, const void *key){
+	return (ptl_hm_get(map, key) != NULL);
+}
+
+
+/* insert or replace */
+void *ptl_hm_put(ptl_hash_map_t map, const void *key, void *value){
+	if(map == NULL || value == NULL) { return NULL; }
+	
+	unsigned long hash = _ptl_hm_hash(map, key);
+	struct ptl_hm_segment *segment = _ptl_hm_segment(map, hash);
+	void *previous = NULL;
+	
+	pthread_mutex_lock(&segment->mutex);
+	struct ptl_hm_entry *entry = _ptl_hm_find(map, segment, key, hash);
+	if(entry != NULL){
+		previous = entry->value;
+		entry->value = value;
+	} else {
+		_ptl_hm_insert(map, segment, key, hash, value);
+	}
+	pthread_mutex_unlock(&segment->mutex);
+	
+	return previous;
+}
+
+
+/* insert only, the check and the insert under one lock */
+void *ptl_hm_put_if_absent(ptl_hash_map_t map, const void *key, void *value){
+	if(map == NULL || value == NULL) { return NULL; }
+	
+	unsigned long hash = _ptl_hm_hash(map, key);
+	struct ptl_hm_segment *segment = _ptl_hm_segment(map, hash);
+	void *existing = NULL;
+	
+	pthread_mutex_lock(&segment->mutex);
+	struct ptl_hm_entry *entry = _ptl_hm_find(map, segment, key, hash);
+	if(entry != NULL){
+		existing = entry->value;
+	} else {
+		_ptl_hm_insert(map, segment, key, hash, value);
+	}
+	pthread_mutex_unlock(&segment->mutex);
+	
+	return existing;
+}
+
+
+/* leaves a tombstone so longer probe runs stay intact */
+void *ptl_hm_remove(ptl_hash_map_t map, const void *key){
+	if(map == NULL) { return NULL; }
+	
+	unsigned long hash = _ptl_hm_hash(map, key);
+	struct ptl_hm_segment *segment = _ptl_hm_segment(map, hash);
+	void *value = NULL;
+	
+	pthread_mutex_lock(&segment->mutex);
+	struct ptl_hm_entry *entry = _ptl_hm_find(map, segment, key, hash);
+	if(entry != NULL){
+		value = entry->value;
+		_ptl_hm_delete(segment, entry);
+	}
+	pthread_mutex_unlock(&segment->mutex);
+	
+	return value;
+}
+
+
+/* read, compute and write back under the segment lock */
+void *ptl_hm_compute(ptl_hash_map_t map, const void *key, ptl_hm_compute_func func, void *arg){
+	if(map == NULL || func == NULL) { return NULL; }
+	
+	unsigned long hash = _ptl_hm_hash(map, key);
+	struct ptl_hm_segment *segment = _ptl_hm_segment(map, hash);
+	
+	pthread_mutex_lock(&segment->mutex);
+	struct ptl_hm_entry *entry = _ptl_hm_find(map, segment, key, hash);
+	void *value = func(key, (entry != NULL) ? entry->value : NULL, arg);
+	
+	if(entry != NULL){
+		if(value != NULL){
+			entry->value = value;
+		} else {
+			_ptl_hm_delete(segment, entry);
+		}
+	} else if(value != NULL){
+		_ptl_hm_insert(map, segment, key, hash, value);
+	}
+	pthread_mutex_unlock(&segment->mutex);
+	
+	return value;
+}
+
+
+/* adds up the per segment counts without locking */
+long ptl_hm_size(ptl_hash_map_t map){
+	if(map == NULL) { return 0; }
+	
+	long size = 0;
+	int i = 0;
+	for(i = 0; i < PTL_HM_SEGMENTS; i++){
+		size += __atomic_load_n(&map->segments[i].count, __ATOMIC_RELAXED);
+	}
+	
+	return size;
+}
+
+
+/* empties each table, keeping its size */
+void ptl_hm_clear(ptl_hash_map_t map){
+	if(map == NULL) { return; }
+	
+	int i = 0;
+	for(i = 0; i < PTL_HM_SEGMENTS; i++){
+		struct ptl_hm_segment *segment = &map->segments[i];
+		
+		pthread_mutex_lock(&segment->mutex);
+		memset(segment->table, 0, (segment->mask + 1) * sizeof(struct ptl_hm_entry));
+		__atomic_store_n(&segment->count, 0, __ATOMIC_RELAXED);
+		segment->used = 0;
+		pthread_mutex_unlock(&segment->mutex);
+	}
+}
+
+
+/* one segment locked at a time */
+void ptl_hm_for_each(ptl_hash_map_t map, void (*func)(const void *key, void *value, void *arg), void *arg){
+	if(map == NULL || func == NULL) { return; }
+	
+	int i = 0;
+	for(i = 0; i < PTL_HM_SEGMENTS; i++){
+		struct ptl_hm_segment *segment = &map->segments[i];
+		unsigned long j = 0;
+		
+		pthread_mutex_lock(&segment->mutex);
+		for(j = 0; j <= segment->mask; j++){
+			if(segment->table[j].hash > _PTL_HM_REMOVED){
+				func(segment->table[j].key, segment->table[j].value, arg);
+			}
+		}
+		pthread_mutex_unlock(&segment->mutex);
+	}
+}
+
+
+/* FNV-1a */
+unsigned long ptl_hm_hash_string(const void *key){
+	const unsigned char *c = (const unsigned char *)key;
+	unsigned long hash = 14695981039346656037UL;
+	
+	while(c != NULL && *c != '\0'){
+		hash ^= *c++;
+		hash *= 1099511628211UL;
+	}
+	
+	return hash;
+}
+
+
+/* NULL only equals NULL */
+int ptl_hm_equals_string(const void *key1, const void *key2){
+	if(key1 == NULL || key2 == NULL) { return key1 == key2; }
+	
+	return (strcmp((const char *)key1, (const char *)key2) == 0);
+}
+
+
+/* the user's hash (or the pointer) mixed so every bit counts, then kept off
+   the two values that mark empty and removed slots */
+unsigned long _ptl_hm_hash(ptl_hash_map_t map, const void *key){
+	unsigned long hash = (map->hash_func != NULL) ? map->hash_func(key) : (unsigned long)key;
+	
+	// splitmix64 finalizer: pointers and small ids have few varying bits
+	hash ^= hash >> 30;
+	hash *= 0xbf58476d1ce4e5b9UL;
+	hash ^= hash >> 27;
+	hash *= 0x94d049bb133111ebUL;
+	hash ^= hash >> 31;
+	
+	return (hash > _PTL_HM_REMOVED) ? hash : hash + 2;
+}
+
+
+/* top bits pick the segment, the low bits are left for the slot */
+struct ptl_hm_segment *_ptl_hm_segment(ptl_hash_map_t map, unsigned long hash){
+	return &map->segments[hash >> (sizeof(unsigned long) * 8 - _PTL_HM_SEGMENT_BITS)];
+}
+
+
+/* linear probe from the hash's slot to the first empty one, the segment is locked */
+struct ptl_hm_entry *_ptl_hm_find(ptl_hash_map_t map, struct ptl_hm_segment *segment, 
+								  const void *key, unsigned long hash){
+	unsigned long i = hash & segment->mask;
+	
+	for(;;){
+		struct ptl_hm_entry *entry = &segment->table[i];
+		
+		if(entry->hash == _PTL_HM_EMPTY){
+			return NULL;
+		}
+		if(entry->hash == hash && 
+		   (entry->key == key || 
+			(map->equals_func != NULL && map->equals_func(entry->key, key)))){
+			return entry;
+		}
+		i = (i + 1) & segment->mask;
+	}
+}
+
+
+/* the key is known to be absent, the segment is locked */
+struct ptl_hm_entry *_ptl_hm_insert(ptl_hash_map_t map, struct ptl_hm_segment *segment, 
+									const void *key, unsigned long hash, void *value){
+	// leave a quarter of the table empty so probe runs stay short
+	if((unsigned long)(segment->used + 1) > (segment->mask + 1) * 3 / 4){
+		unsigned long size = segment->mask + 1;
+		
+		// mostly tombstones: rehash at the same size, otherwise double
+		if((unsigned long)(segment->count + 1) > size / 2){
+			size <<= 1;
+		}
+		_ptl_hm_rehash(segment, size);
+	}
+	
+	unsigned long i = hash & segment->mask;
+	while(segment->table[i].hash > _PTL_HM_REMOVED){
+		i = (i + 1) & segment->mask;
+	}
+	
+	struct ptl_hm_entry *entry = &segment->table[i];
+	if(entry->hash == _PTL_HM_EMPTY){
+		segment->used++;
+	}
+	entry->hash = hash;
+	entry->key = (void *)key;
+	entry->value = value;
+	__atomic_store_n(&segment->count, segment->count + 1, __ATOMIC_RELAXED);
+	
+	return entry;
+}
+
+
+/* turns the slot into a tombstone, the segment is locked */
+void _ptl_hm_delete(struct ptl_hm_segment *segment, struct ptl_hm_entry *entry){
+	entry->hash = _PTL_HM_REMOVED;
+	entry->key = NULL;
+	entry->value = NULL;
+	__atomic_store_n(&segment->count, segment->count - 1, __ATOMIC_RELAXED);
+}
+
+
+/* moves the keys into a new table of 'size' slots, dropping tombstones */
+void _ptl_hm_rehash(struct ptl_hm_segment *segment, unsigned long size){
+	struct ptl_hm_entry *old_table = segment->table;
+	unsigned long old_size = segment->mask + 1;
+	unsigned long i = 0;
+	
+	segment->table = (struct ptl_hm_entry *)calloc(size, sizeof(struct ptl_hm_entry));
+	assert(segment->table);
+	segment->mask = size - 1;
+	
+	for(i = 0; i < old_size; i++){
+		if(old_table[i].hash > _PTL_HM_REMOVED){
+			unsigned long j = old_table[i].hash & segment->mask;
+			
+			while(segment->table[j].hash != _PTL_HM_EMPTY){
+				j = (j + 1) & segment->mask;
+			}
+			segment->table[j] = old_table[i];
+		}
+	}
+	segment->used = segment->count;
+	
+	FREE(old_table);
+}
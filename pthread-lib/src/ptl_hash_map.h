@@ -0,0 +1,222 @@
+/*
+ * This file is part of the pthread-lib Library.
+ * Copyright (C) 2008-2009 Nick Powers.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Library General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor Boston, MA 02110-1301,  USA
+ */
+
+/**
+ * A hash map that threads can share, with void * keys and values. Lookups
+ * are O(1) where ptl_array_list would scan.
+ *
+ * The map is split into PTL_HM_SEGMENTS segments (lock striping). Each one
+ * has its own lock and its own open addressing table. A key's segment comes
+ * from the top bits of its hash, and its slot from the low bits. Threads
+ * working on keys in different segments never touch the same lock or the
+ * same cache lines.
+ *
+ * A table is a power of two in size. Every slot holds the key's hash next to
+ * the key and value, so linear probing reads along one run of memory and
+ * most mismatches are ruled out without calling 'equals'. When a segment
+ * passes 3/4 full, counting tombstones, only that segment is rehashed, under
+ * its own lock. Writers to the other segments keep going, and no
+ * operation ever waits on more than 1 / PTL_HM_SEGMENTS of the map.
+ *
+ * By default keys are compared as pointers, which also makes small integer
+ * ids work as keys: (void *)(uintptr_t)id. Pass ptl_hm_hash_string and
+ * ptl_hm_equals_string for C strings, or functions of your own. NULL is a
+ * valid key. Values may not be NULL, because NULL means "no value" in every
+ * return. The map never frees keys or values.
+ */
+
+#ifndef __PTL_HASH_MAP_H__
+#define __PTL_HASH_MAP_H__
+
+#include <pthread.h>
+#include "ptl_util.h"
+
+/* Constants */
+#define PTL_HM_SEGMENTS 16				/**< lock stripes, a power of two */
+#define PTL_HM_DEFAULT_CAPACITY 64		/**< default expected number of keys */
+
+
+/* Type Definitions */
+typedef unsigned long (*ptl_hm_hash_func)(const void *key);
+typedef int (*ptl_hm_equals_func)(const void *key1, const void *key2);
+
+/**
+ * Called by ptl_hm_compute with the segment locked.
+ *
+ * @param key being computed
+ * @param its current value, NULL if absent
+ * @param arg passed to ptl_hm_compute
+ * @return the new value, or NULL to remove the key
+ */
+typedef void *(*ptl_hm_compute_func)(const void *key, void *value, void *arg);
+
+
+/* Structures */
+
+struct ptl_hm_entry {
+	unsigned long hash;					/**< 0 empty, 1 removed, otherwise the key's hash */
+	void *key;
+	void *value;
+};
+
+struct ptl_hm_segment {
+	pthread_mutex_t mutex;
+	struct ptl_hm_entry *table;
+	unsigned long mask;					/**< table size - 1 */
+	long count;							/**< keys held */
+	long used;							/**< slots not empty, keys and tombstones */
+} __attribute__((aligned(PTL_CACHE_LINE_SIZE)));
+
+struct ptl_hash_map {
+	ptl_hm_hash_func hash_func;
+	ptl_hm_equals_func equals_func;		/**< NULL compares pointers */
+	struct ptl_hm_segment *segments;	/**< PTL_HM_SEGMENTS of them */
+};
+
+typedef struct ptl_hash_map *ptl_hash_map_t;
+
+
+/* Public Functions */
+
+/**
+ * Creates a map with pointer keys, sized for PTL_HM_DEFAULT_CAPACITY keys.
+ * To finish using this data structure, be sure to call the 'destroy' function.
+ *
+ * @return a fully initialized map
+ */
+ptl_hash_map_t ptl_hm_create_hash_map();
+
+/**
+ * Creates a map sized for about 'capacity' keys before any segment grows.
+ *
+ * @param expected number of keys, rounded up per segment to a power of two
+ * @param hash function for the keys, NULL hashes the pointer
+ * @param equals function for the keys, NULL compares pointers. Keys that
+ *        are equal must hash the same.
+ * @return a fully initialized map
+ */
+ptl_hash_map_t ptl_hm_create_hash_map_funcs(long capacity, ptl_hm_hash_func hash_func, 
+											ptl_hm_equals_func equals_func);
+
+/**
+ * Destroys a map, but not the keys and values it holds.
+ *
+ * @param map to be freed
+ * @return 1 if successful, 0 otherwise
+ */
+int ptl_hm_destroy_hash_map(ptl_hash_map_t map);
+
+/**
+ * Finds the value of 'key'.
+ *
+ * @param map to search
+ * @param key to look up
+ * @return the value, NULL if the key is absent
+ */
+void *ptl_hm_get(ptl_hash_map_t map, const void *key);
+
+/**
+ * Check if the map holds 'key'.
+ *
+ * @param map to search
+ * @param key to look for
+ * @return 1 if present, 0 otherwise
+ */
+int ptl_hm_contains(ptl_hash_map_t map, const void *key);
+
+/**
+ * Maps 'key' to 'value', replacing any value it had.
+ *
+ * @param map to add to
+ * @param key to add
+ * @param value, not NULL
+ * @return the previous value, NULL if there was none
+ */
+void *ptl_hm_put(ptl_hash_map_t map, const void *key, void *value);
+
+/**
+ * Maps 'key' to 'value' only if the key is absent, as one atomic step.
+ *
+ * @param map to add to
+ * @param key to add
+ * @param value, not NULL
+ * @return NULL if 'value' went in, otherwise the value already there
+ */
+void *ptl_hm_put_if_absent(ptl_hash_map_t map, const void *key, void *value);
+
+/**
+ * Removes 'key'.
+ *
+ * @param map to remove from
+ * @param key to remove
+ * @return the value it had, NULL if it was absent
+ */
+void *ptl_hm_remove(ptl_hash_map_t map, const void *key);
+
+/**
+ * Replaces the value of 'key' with 'func(key, current, arg)' as one atomic
+ * step: insert (current is NULL), update, or remove (func returns NULL).
+ * 'func' runs with the key's segment locked, so it must be short and must
+ * not use the map.
+ *
+ * @param map to update
+ * @param key to update
+ * @param function computing the new value
+ * @param arg passed to 'func'
+ * @return the new value, NULL if the key is now absent
+ */
+void *ptl_hm_compute(ptl_hash_map_t map, const void *key, ptl_hm_compute_func func, void *arg);
+
+/**
+ * Number of keys. Segments are counted one at a time, so under concurrent
+ * writes this is a close estimate.
+ *
+ * @param map to count
+ * @return the number of keys
+ */
+long ptl_hm_size(ptl_hash_map_t map);
+
+/**
+ * Removes every key. Doesn't free any keys or values.
+ *
+ * @param map to clear
+ */
+void ptl_hm_clear(ptl_hash_map_t map);
+
+/**
+ * Calls 'func' on every key and value, one segment at a time with that
+ * segment locked. 'func' must not use the map.
+ *
+ * @param map to walk
+ * @param function to call
+ * @param arg passed to 'func'
+ */
+void ptl_hm_for_each(ptl_hash_map_t map, void (*func)(const void *key, void *value, void *arg), void *arg);
+
+/**
+ * Hash of a NUL terminated string (FNV-1a), for ptl_hm_create_hash_map_funcs.
+ */
+unsigned long ptl_hm_hash_string(const void *key);
+
+/**
+ * strcmp() == 0 for NUL terminated strings, for ptl_hm_create_hash_map_funcs.
+ */
+int ptl_hm_equals_string(const void *key1, const void *key2);
+
+#endif
@@ -26,23 +26,47 @@
 #include <time.h>
 #include <sys/time.h>
 #include <string.h>
+#include <errno.h>
 #include "ptl_queue.h"
 #include "ptl_linked_queue.h"
 #include "ptl_util.h"
+#include "ptl_node_pool.h"
+
+/* Private Functions */
+void* _ptl_lq_take(ptl_q_t q, ptl_q_element_t *old_head);
 
 /* Global Variables */
 
-pthread_mutex_t ptl_lq_mutex = PTHREAD_MUTEX_INITIALIZER;
+/* functions to use with ptl_q_create_queue() */
+struct ptl_q_funcs ptl_lq_funcs = {
+	ptl_lq_init_queue,
+	ptl_lq_destroy_queue,
+	ptl_lq_add,
+	ptl_lq_add_wait,
+	ptl_lq_clear,
+	ptl_lq_peek,
+	ptl_lq_get,
+	ptl_lq_get_wait,
+	NULL,			// 'size' is kept up to date
+	ptl_lq_add_batch,
+	ptl_lq_get_batch
+};
 
 /* initialize memory needed for this type of queue. */
 void ptl_lq_init_queue (ptl_q_t q){
-	pthread_mutex_lock(&ptl_lq_mutex); // lock
+	// each queue has its own lock, nothing else can see 'q' yet
+	pthread_mutex_init(&q->mutex, NULL);
+	ptl_cond_init(&q->not_empty); // signalled by add
+	ptl_cond_init(&q->not_full); // never used, this queue is unbounded
 
-	strncpy(q->type, "linked", PTL_Q_TYPE_LENGTH);
-	q->tail = q->head = ptl_q_create_element(NULL);
+	q->type = PTL_Q_TYPE_LINKED;
+	q->size = 0;
 	q->ptr = NULL; // not used
 	
-	pthread_mutex_unlock(&ptl_lq_mutex); // unlock
+	// elements are recycled through a pool, 'capacity' nodes are allocated now
+	q->data = ptl_np_create_pool((q->capacity > 0) ? q->capacity : 0,
+								 PTL_NP_DEFAULT_MAX_RETAINED);
+	q->tail = q->head = ptl_np_get_element(q->data, NULL); // dummy node
 }
 
 
@@ -51,8 +75,13 @@ void ptl_lq_destroy_queue(ptl_q_t q){
 	ptl_lq_clear(q); // clears all
 
 	FREE(q->head); // remove final piece of memory in queue
+	q->tail = NULL;
+	ptl_np_destroy_pool(q->data);
+	q->data = NULL;
 	
-	pthread_mutex_destroy(&ptl_lq_mutex);
+	pthread_mutex_destroy(&q->mutex); // only this queue used it
+	pthread_cond_destroy(&q->not_empty);
+	pthread_cond_destroy(&q->not_full);
 	// leave destroying of ptl_q_t to the 'interface'
 }
 
@@ -64,18 +93,56 @@ int ptl_lq_add(ptl_q_t q, void *value){
 
 	// no capacity check as this list is unbounded
 
-	pthread_mutex_lock(&ptl_lq_mutex); // lock
-	// create the element/node
-	ptl_q_element_t element = ptl_q_create_element (value);
+	// get the element/node before taking the lock
+	ptl_q_element_t element = ptl_np_get_element(q->data, value);
+
+	PTL_Q_LOCK(q, &q->mutex); // lock
 	
 	q->tail = q->tail->next = element;
-	q->size++;
+	PTL_ATOMIC_INC(q->size);
 	
-	pthread_mutex_unlock(&ptl_lq_mutex); // unlock
+	pthread_cond_signal(&q->not_empty); // wake up a waiting 'get'
+	
+	pthread_mutex_unlock(&q->mutex); // unlock
 	
 	return 1;
 }
 
+/* link a chain of new elements onto the tail under one lock */
+int ptl_lq_add_batch(ptl_q_t q, void **values, int count){
+	if(q == NULL || values == NULL || count <= 0){ return 0; }
+	
+	// build the chain before taking the lock
+	ptl_q_element_t first = NULL;
+	ptl_q_element_t last = NULL;
+	int added = 0;
+	while(added < count && values[added] != NULL){
+		ptl_q_element_t element = ptl_np_get_element(q->data, values[added]);
+		if(last == NULL){
+			first = element;
+		} else {
+			last->next = element;
+		}
+		last = element;
+		added++;
+	}
+	
+	if(added == 0){ return 0; }
+	
+	PTL_Q_LOCK(q, &q->mutex); // lock
+	
+	q->tail->next = first;
+	q->tail = last;
+	__atomic_add_fetch(&q->size, added, __ATOMIC_ACQ_REL);
+	
+	pthread_cond_broadcast(&q->not_empty); // enough for several 'gets'
+	
+	pthread_mutex_unlock(&q->mutex); // unlock
+	
+	return added;
+}
+
+
 /* There is no waiting for this type of queue because it is unbounded. */
 int ptl_lq_add_wait(ptl_q_t q, void *value, long timeout){
 	 /* This is an unbounded queue, add will always
@@ -114,9 +181,9 @@ void ptl_lq_clear_freefunc(ptl_q_t q, void (*free_func)(void *)){
 /* Retrieves, but does not remove, the head of this queue. */
 void* ptl_lq_peek(ptl_q_t q){
 
-	if(q->size <= 0){ return NULL; } // need to lock (seperate lock?)
+	if(PTL_ATOMIC_LOAD(q->size) <= 0){ return NULL; } // nothing to take
 
-	pthread_mutex_lock(&ptl_lq_mutex); // lock
+	PTL_Q_LOCK(q, &q->mutex); // lock
 	
 	ptl_q_element_t first = q->head->next; // get first element
 	void *return_elem = NULL;
@@ -126,7 +193,7 @@ void* ptl_lq_peek(ptl_q_t q){
 		if (first != NULL) { return_elem = first->value; } // create copy pointer
 
 	}
-	pthread_mutex_unlock(&ptl_lq_mutex); // unlock
+	pthread_mutex_unlock(&q->mutex); // unlock
 
 	return return_elem;
 }
@@ -134,56 +201,95 @@ void* ptl_lq_peek(ptl_q_t q){
 
 /* Retrieves and removes the head of this queue. */
 void* ptl_lq_get(ptl_q_t q){
-	if(q->size <= 0){ return NULL; } // need to lock (seperate lock?)
+	if(PTL_ATOMIC_LOAD(q->size) <= 0){ return NULL; } // nothing to take
+
+	ptl_q_element_t old_head = NULL;
 
-	pthread_mutex_lock(&ptl_lq_mutex); // lock
+	PTL_Q_LOCK(q, &q->mutex); // lock
 	
-    ptl_q_element_t first = q->head->next;
+	void* value = _ptl_lq_take(q, &old_head);
 	
-	void* value = NULL;
-	if(first != NULL){ // check if we have no elements
-		FREE(q->head); // moving head ptr, free previous head
-		
-		q->head = first;
-		value = first->value;	
-		first->value = NULL;
+	pthread_mutex_unlock(&q->mutex); // unlock
+	
+	ptl_np_put_element(q->data, old_head); // recycle outside of the lock
+	
+    return value;
+}
 
-		q->size--;
+
+/* take up to 'max' elements under one lock */
+int ptl_lq_get_batch(ptl_q_t q, void **values, int max){
+	if(q == NULL || values == NULL || max <= 0){ return 0; }
+	if(PTL_ATOMIC_LOAD(q->size) <= 0){ return 0; } // nothing to take
+	
+	ptl_q_element_t old_heads = NULL; // recycled once we unlock
+	ptl_q_element_t old_head = NULL;
+	int taken = 0;
 	
+	PTL_Q_LOCK(q, &q->mutex); // lock
+	
+	while(taken < max && (values[taken] = _ptl_lq_take(q, &old_head)) != NULL){
+		old_head->next = old_heads;
+		old_heads = old_head;
+		taken++;
 	}
-	pthread_mutex_unlock(&ptl_lq_mutex); // unlock
 	
-    return value;
+	pthread_mutex_unlock(&q->mutex); // unlock
+	
+	while(old_heads != NULL){
+		old_head = old_heads;
+		old_heads = old_heads->next;
+		ptl_np_put_element(q->data, old_head);
+	}
+	
+	return taken;
 }
 
 
 /* Retrieves and removes the head of this queue, waiting up to the specified
    wait time if necessary for an element to become available. */
 void* ptl_lq_get_wait(ptl_q_t q, long timeout){
-	if(q == NULL || q->size <= 0){ return NULL; } // try to break out early if missing info
+	if(q == NULL || timeout < 0){ return NULL; } // try to break out early if missing info
 	
-    time_t start_time;
-	time_t curr_time;
-	time(&start_time);
-	double time_diff;
+	struct timespec deadline;
+	ptl_get_future_time(&deadline, timeout * 1000); // ms to usec
+	ptl_q_element_t old_head = NULL;
 	void *element = NULL;
 	
-	// keep trying until we reach the max allowed time
-	while((element = ptl_lq_get(q)) == NULL){
-		
-		// check the time
-		time(&curr_time);
-		time_diff = difftime(curr_time, start_time);
-		
-		if(timeout >= ((long)time_diff)){
-			break; // I chose to use break to get out before the sleep
+	PTL_Q_LOCK(q, &q->mutex); // lock
+	
+	// sleep on 'not_empty' (giving up the lock) until an add or the deadline
+	while((element = _ptl_lq_take(q, &old_head)) == NULL){
+		if(pthread_cond_timedwait(&q->not_empty, &q->mutex, &deadline) == ETIMEDOUT){
+			element = _ptl_lq_take(q, &old_head); // one last try
+			break;
 		}
-		
-		ptl_timed_wait(3); // wait 3 microseconds
-		// this wait time may be a bad idea...
 	}
 	
+	pthread_mutex_unlock(&q->mutex); // unlock
+	
+	ptl_np_put_element(q->data, old_head);
 	
 	// this may be NULL if nothing was retrieved
 	return element;
 }
+
+
+/* takes the first element, the lock must be held. returns NULL if empty.
+   The previous head is handed back in 'old_head' to be recycled. */
+void* _ptl_lq_take(ptl_q_t q, ptl_q_element_t *old_head){
+    ptl_q_element_t first = q->head->next;
+	
+	void* value = NULL;
+	if(first != NULL){ // check if we have no elements
+		*old_head = q->head; // moving head ptr, recycle previous head
+		
+		q->head = first;
+		value = first->value;	
+		first->value = NULL;
+
+		PTL_ATOMIC_DEC(q->size);
+	}
+	
+	return value;
+}
@@ -22,13 +22,19 @@
  * This linked queue implementation is a simple FIFO queue with locking/blocking
  * operations for all get and put operations. A single lock is used to control
  * both get and put. Like all linked list implementations, capacity is not a 
- * concern.
+ * concern. To keep producers and consumers from blocking each other, see
+ * ptl_two_lock_queue.h.
  */
 
 
 #ifndef __PTL_LINKED_QUEUE_H__
 #define __PTL_LINKED_QUEUE_H__
 
+/**
+ * Function table for this queue, e.g. ptl_q_create_queue(&ptl_lq_funcs, 0)
+ */
+extern struct ptl_q_funcs ptl_lq_funcs;
+
 /**
  * Destroys the queue and frees the memory. This should be used when the queue
  * is no longer going to be used.
@@ -39,7 +45,8 @@ void ptl_lq_destroy_queue(ptl_q_t q);
 
 /**
  * Initializes the queue, creating all memory needed to support this data
- * structure.
+ * structure. Nodes are recycled through a node pool (see ptl_node_pool.h),
+ * and 'capacity' nodes are preallocated.
  * 
  * @param q queue to be initized.
  */
@@ -57,6 +64,17 @@ void ptl_lq_init_queue (ptl_q_t q);
  */
 int ptl_lq_add(ptl_q_t q, void *value);
 
+/**
+ * Inserts up to 'count' elements. The nodes are chained together first and
+ * then linked on under one lock. Stops at the first NULL value.
+ *
+ * @param q non-null queue
+ * @param values elements to add, in order
+ * @param count number of elements in 'values'
+ * @return number of elements added
+ */
+int ptl_lq_add_batch(ptl_q_t q, void **values, int count);
+
 /**
  * This is a dummy function. There is no waiting for this type of queue
  * because it is unbounded. It simply cals ptl_lq_add().
@@ -108,17 +126,23 @@ void* ptl_lq_peek(ptl_q_t q);
  */
 void* ptl_lq_get(ptl_q_t q);
 
+/**
+ * Retrieves and removes up to 'max' elements under one lock.
+ *
+ * @param q non-null queue to get elements from
+ * @param values where the elements are stored, in queue order
+ * @param max room in 'values'
+ * @return number of elements stored in 'values'
+ */
+int ptl_lq_get_batch(ptl_q_t q, void **values, int max);
+
 /**
  * Retrieves and removes the head of this queue, waiting up to the specified
  * wait time if necessary for an element to become available.
- * This function will block only when trying to get an element, meaning another
- * thread may beat 'this' thread to the next element.
- *
- * @note one may experience bad performance by continually checking if an element
- *       is available and blocking until we reach the timeout value.
+ * The thread sleeps on the 'not_empty' condition, which every add signals.
  *
  * @param q non-null queue to get an element from
- * @param timeout time in seconds
+ * @param timeout time in milliseconds
  * @return the head element or NULL if no element was found
  */
 void* ptl_lq_get_wait(ptl_q_t q, long timeout);
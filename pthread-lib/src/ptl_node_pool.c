@@ -0,0 +1,239 @@
+/*
+ * This file is part of the pthread-lib Library.
+ * Copyright (C) 2008-2009 Nick Powers.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Library General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor Boston, MA 02110-1301,  USA
+ */
+
+ /*
+  * For a "class" description, see the header file. 
+  */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include "ptl_queue.h"
+#include "ptl_node_pool.h"
+#include "ptl_util.h"
+
+
+/* Structures */
+
+/* free elements owned by one thread */
+struct ptl_np_cache {
+	ptl_q_element_t head;
+	int count;
+	int registered; // exit handler installed for this thread
+};
+
+
+/* Private Functions */
+void _ptl_np_refill(ptl_node_pool_t pool, struct ptl_np_cache *cache);
+void _ptl_np_spill(ptl_node_pool_t pool, struct ptl_np_cache *cache);
+void _ptl_np_free_cache(void *cache);
+void _ptl_np_create_key();
+void _ptl_np_register_cache(struct ptl_np_cache *cache);
+
+
+/* Global Variables */
+static __thread struct ptl_np_cache ptl_np_cache;
+static pthread_key_t ptl_np_key;
+static pthread_once_t ptl_np_key_once = PTHREAD_ONCE_INIT;
+
+
+/* create the pool and fill it with 'preallocate' elements */
+ptl_node_pool_t ptl_np_create_pool(long preallocate, long max_retained){
+	ptl_node_pool_t pool = (ptl_node_pool_t)calloc(1, sizeof(struct ptl_node_pool));
+	assert(pool);
+	
+	pthread_mutex_init(&pool->mutex, NULL);
+	pool->shared = NULL;
+	pool->shared_count = 0;
+	pool->max_retained = (max_retained > preallocate) ? max_retained : preallocate;
+	
+	long i = 0;
+	for(i = 0; i < preallocate; i++){
+		ptl_q_element_t e = ptl_q_create_element(NULL);
+		assert(e);
+		e->next = pool->shared;
+		pool->shared = e;
+	}
+	pool->shared_count = preallocate;
+	
+	pthread_once(&ptl_np_key_once, _ptl_np_create_key);
+	
+	return pool;
+}
+
+
+/* free the shared list and the pool */
+void ptl_np_destroy_pool(ptl_node_pool_t pool){
+	if(pool == NULL){ return; }
+	
+	ptl_q_element_t e = pool->shared;
+	while(e != NULL){
+		ptl_q_element_t next = e->next;
+		FREE(e);
+		e = next;
+	}
+	
+	pthread_mutex_destroy(&pool->mutex);
+	FREE(pool);
+}
+
+
+/* pop from the thread cache, refilling from the pool if needed */
+ptl_q_element_t ptl_np_get_element(ptl_node_pool_t pool, void *value){
+	struct ptl_np_cache *cache = &ptl_np_cache;
+	
+	if(cache->head == NULL && pool != NULL){
+		_ptl_np_refill(pool, cache);
+	}
+	
+	ptl_q_element_t e = cache->head;
+	if(e == NULL){ // nothing to recycle
+		return ptl_q_create_element(value);
+	}
+	
+	cache->head = e->next;
+	cache->count--;
+	
+	e->value = value;
+	e->next = NULL;
+	e->prev = NULL;
+	
+	return e;
+}
+
+
+/* push onto the thread cache, spilling to the pool if it's full */
+void ptl_np_put_element(ptl_node_pool_t pool, ptl_q_element_t element){
+	if(element == NULL){ return; }
+	
+	struct ptl_np_cache *cache = &ptl_np_cache;
+	
+	_ptl_np_register_cache(cache);
+	
+	if(cache->count >= PTL_NP_CACHE_SIZE){
+		_ptl_np_spill(pool, cache);
+	}
+	
+	element->value = NULL;
+	element->next = cache->head;
+	cache->head = element;
+	cache->count++;
+}
+
+
+/* Private Functions */
+
+/* move up to a batch of elements from the pool into the cache */
+void _ptl_np_refill(ptl_node_pool_t pool, struct ptl_np_cache *cache){
+	if(__atomic_load_n(&pool->shared_count, __ATOMIC_RELAXED) <= 0){
+		return; // don't bother locking
+	}
+	
+	pthread_mutex_lock(&pool->mutex); // lock
+	
+	int moved = 0;
+	while(pool->shared != NULL && moved < PTL_NP_BATCH_SIZE){
+		ptl_q_element_t e = pool->shared;
+		pool->shared = e->next;
+		e->next = cache->head;
+		cache->head = e;
+		moved++;
+	}
+	// read without the lock in the check above
+	__atomic_store_n(&pool->shared_count, pool->shared_count - moved, __ATOMIC_RELAXED);
+	
+	pthread_mutex_unlock(&pool->mutex); // unlock
+	
+	cache->count += moved;
+	if(moved > 0){
+		_ptl_np_register_cache(cache); // a thread that only allocates keeps them too
+	}
+}
+
+
+/* free this thread's cache when it exits */
+void _ptl_np_register_cache(struct ptl_np_cache *cache){
+	if(!cache->registered){
+		pthread_once(&ptl_np_key_once, _ptl_np_create_key);
+		pthread_setspecific(ptl_np_key, cache);
+		cache->registered = 1;
+	}
+}
+
+
+/* move a batch of elements from the cache into the pool (or free them) */
+void _ptl_np_spill(ptl_node_pool_t pool, struct ptl_np_cache *cache){
+	// unlink the batch from the cache outside of the lock
+	ptl_q_element_t first = cache->head;
+	ptl_q_element_t last = first;
+	int moved = 1;
+	while(moved < PTL_NP_BATCH_SIZE && last->next != NULL){
+		last = last->next;
+		moved++;
+	}
+	cache->head = last->next;
+	cache->count -= moved;
+	last->next = NULL;
+	
+	int kept = 0;
+	if(pool != NULL){
+		pthread_mutex_lock(&pool->mutex); // lock
+		
+		if(pool->shared_count + moved <= pool->max_retained){
+			last->next = pool->shared;
+			pool->shared = first;
+			__atomic_store_n(&pool->shared_count, pool->shared_count + moved, __ATOMIC_RELAXED);
+			kept = 1;
+		}
+		
+		pthread_mutex_unlock(&pool->mutex); // unlock
+	}
+	
+	if(!kept){ // the pool already holds enough
+		while(first != NULL){
+			ptl_q_element_t next = first->next;
+			FREE(first);
+			first = next;
+		}
+	}
+}
+
+
+/* thread exit handler, frees what the thread had cached */
+void _ptl_np_free_cache(void *c){
+	struct ptl_np_cache *cache = (struct ptl_np_cache *)c;
+	
+	ptl_q_element_t e = cache->head;
+	while(e != NULL){
+		ptl_q_element_t next = e->next;
+		FREE(e);
+		e = next;
+	}
+	
+	cache->head = NULL;
+	cache->count = 0;
+	cache->registered = 0;
+}
+
+
+/* create the key whose destructor frees thread caches */
+void _ptl_np_create_key(){
+	pthread_key_create(&ptl_np_key, _ptl_np_free_cache);
+}
@@ -0,0 +1,99 @@
+/*
+ * This file is part of the pthread-lib Library.
+ * Copyright (C) 2008-2009 Nick Powers.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Library General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor Boston, MA 02110-1301,  USA
+ */
+
+
+/**
+ * This "class" recycles queue elements (ptl_q_element_t) so the linked queues
+ * don't call malloc/free for every add/get. Each thread keeps a small cache of
+ * free elements and only touches the shared pool list, under the pool's lock,
+ * to move a batch of PTL_NP_BATCH_SIZE elements in or out. A producer thread
+ * that only allocates and a consumer thread that only frees reach a steady
+ * state where elements circulate through the pool with no heap calls.
+ *
+ * All elements are the same size, so each thread has one cache that serves
+ * every pool. A thread's cache is freed when the thread exits.
+ */
+
+
+#ifndef __PTL_NODE_POOL_H__
+#define __PTL_NODE_POOL_H__
+
+#include <pthread.h>
+#include "ptl_queue.h"
+
+/* Constants */
+#define PTL_NP_CACHE_SIZE 64			/**< max elements cached per thread */
+#define PTL_NP_BATCH_SIZE 32			/**< elements moved per trip to the pool */
+#define PTL_NP_DEFAULT_MAX_RETAINED 1024 /**< default cap on the shared list */
+
+
+/* Structures */
+struct ptl_node_pool {
+	pthread_mutex_t mutex;		/**< guards 'shared' and 'shared_count' */
+	ptl_q_element_t shared;		/**< free elements, linked through 'next' */
+	long shared_count;			/**< number of elements in 'shared' */
+	long max_retained;			/**< extra elements are freed, not kept */
+};
+
+
+/* Type Definitions */
+typedef struct ptl_node_pool *ptl_node_pool_t;
+
+
+/* Public Functions */
+
+/**
+ * Creates a pool, allocating 'preallocate' elements up front.
+ *
+ * @param preallocate number of elements to put in the pool now
+ * @param max_retained most elements the shared list keeps, it is raised to
+ *                     'preallocate' if smaller
+ * @return a new pool
+ */
+ptl_node_pool_t ptl_np_create_pool(long preallocate, long max_retained);
+
+/**
+ * Frees the pool and the elements in its shared list. Elements sitting in
+ * thread caches are left there for other pools to use.
+ *
+ * @param pool the pool to destroy
+ */
+void ptl_np_destroy_pool(ptl_node_pool_t pool);
+
+/**
+ * Gets an element holding 'value' from this thread's cache, refilling the
+ * cache from 'pool' when it is empty. Falls back to malloc only when both
+ * are empty.
+ *
+ * @param pool pool to refill from, may be NULL
+ * @param value value to store in the element
+ * @return an element with 'next' and 'prev' set to NULL
+ */
+ptl_q_element_t ptl_np_get_element(ptl_node_pool_t pool, void *value);
+
+/**
+ * Returns an element to this thread's cache. When the cache is full, a batch
+ * is moved to 'pool', or freed if the pool already retains 'max_retained'.
+ *
+ * @param pool pool to spill into, may be NULL
+ * @param element element to recycle, may be NULL
+ */
+void ptl_np_put_element(ptl_node_pool_t pool, ptl_q_element_t element);
+
+#endif
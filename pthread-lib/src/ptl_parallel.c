@@ -0,0 +1,279 @@
+/*
+ * This file is part of the pthread-lib Library.
+ * Copyright (C) 2008-2009 Nick Powers.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Library General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor Boston, MA 02110-1301,  USA
+ */
+
+
+/*
+ * For a "class" description, see the header file.
+ */
+
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include "ptl_parallel.h"
+#include "ptl_task.h"
+#include "ptl_util.h"
+
+/* Structures */
+
+/* one loop, on the caller's stack: the helpers are gone before it returns */
+struct _ptl_par_job {
+	void (*fn)(long begin, long end, void *ctx);
+	void *ctx;
+	long end;
+	long grain;							/* chunk size, the smallest one if GUIDED */
+	int schedule;
+	int participants;					/* helpers + the caller */
+	long cursor __attribute__((aligned(PTL_CACHE_LINE_SIZE)));	/* next index not taken */
+	long remaining __attribute__((aligned(PTL_CACHE_LINE_SIZE)));	/* indices not done, the latch */
+	pthread_mutex_t mutex;
+	pthread_cond_t done;
+};
+
+/* what ptl_parallel_map and ptl_parallel_reduce pass as 'ctx' */
+struct _ptl_par_list {
+	void **array;
+	void *(*map_fn)(void *);
+	void *(*combine_fn)(void *, void *);
+	long grain;
+	void **partials;					/* reduce: one per chunk, in order */
+};
+
+/* Private Functions */
+int _ptl_par_run(ptl_thread_manager_t manager, long begin, long end, long grain, int schedule,
+				 void (*fn)(long begin, long end, void *ctx), void *ctx);
+int _ptl_par_claim(struct _ptl_par_job *job, long *begin, long *end);
+void *_ptl_par_work(void *job);
+long _ptl_par_grain(long length, long grain, int participants);
+void _ptl_par_map_chunk(long begin, long end, void *ctx);
+void _ptl_par_reduce_chunk(long begin, long end, void *ctx);
+
+
+/* dynamic chunks, the usual choice */
+int ptl_parallel_for(ptl_thread_manager_t manager, long begin, long end, long grain,
+					 void (*fn)(long begin, long end, void *ctx), void *ctx){
+	return ptl_parallel_for_schedule(manager, begin, end, grain, PTL_PAR_DYNAMIC, fn, ctx);
+}
+
+
+/* checks the arguments, the job does the rest */
+int ptl_parallel_for_schedule(ptl_thread_manager_t manager, long begin, long end, long grain,
+							  int schedule, void (*fn)(long begin, long end, void *ctx), void *ctx){
+	if(manager == NULL || fn == NULL || end < begin ||
+	   schedule < PTL_PAR_STATIC || schedule > PTL_PAR_GUIDED) {
+		return 0;
+	}
+	
+	return _ptl_par_run(manager, begin, end, grain, schedule, fn, ctx);
+}
+
+
+/* each chunk maps its own slots, so no two threads write the same one */
+int ptl_parallel_map(ptl_thread_manager_t manager, ptl_array_list_t list, void *(*fn)(void *)){
+	if(manager == NULL || list == NULL || fn == NULL) { return 0; }
+	
+	struct _ptl_par_list par_list = { list->array, fn, NULL, 0, NULL };
+	
+	return _ptl_par_run(manager, 0, list->size, 0, PTL_PAR_DYNAMIC, _ptl_par_map_chunk, &par_list);
+}
+
+
+/* fixed size chunks fold into their own slot, the caller folds the slots */
+void *ptl_parallel_reduce(ptl_thread_manager_t manager, ptl_array_list_t list,
+						  void *(*map_fn)(void *), void *(*combine_fn)(void *, void *)){
+	if(manager == NULL || list == NULL || combine_fn == NULL || list->size <= 0) {
+		return NULL;
+	}
+	
+	// the chunk index comes from the chunk's start, so the grain is fixed here
+	int participants = ptl_tm_get_pool_size(manager) + 1;
+	long grain = _ptl_par_grain(list->size, 0, participants);
+	long chunks = (list->size + grain - 1) / grain;
+	
+	struct _ptl_par_list par_list = { list->array, map_fn, combine_fn, grain, NULL };
+	par_list.partials = (void **)calloc(chunks, sizeof(void *));
+	assert(par_list.partials);
+	
+	void *result = NULL;
+	if(_ptl_par_run(manager, 0, list->size, grain, PTL_PAR_DYNAMIC, _ptl_par_reduce_chunk, &par_list)){
+		long i = 0;
+		result = par_list.partials[0];
+		for(i = 1; i < chunks; i++){
+			result = combine_fn(result, par_list.partials[i]);
+		}
+	}
+	FREE(par_list.partials);
+	
+	return result;
+}
+
+
+/**
+ * Submits the helpers, works alongside them, waits on the latch for the
+ * chunks still running elsewhere, then makes sure no helper can touch the
+ * job any more: the ones not started are cancelled, and the ones that did
+ * start are waited for, which is short since the cursor is spent.
+ */
+int _ptl_par_run(ptl_thread_manager_t manager, long begin, long end, long grain, int schedule,
+				 void (*fn)(long begin, long end, void *ctx), void *ctx){
+	if(end == begin) { return 1; }
+	
+	struct _ptl_par_job job;
+	ptl_future_t helpers[PTL_PAR_MAX_HELPERS];
+	int num_helpers = ptl_tm_get_pool_size(manager);
+	long length = end - begin;
+	
+	if(num_helpers > PTL_PAR_MAX_HELPERS) { num_helpers = PTL_PAR_MAX_HELPERS; }
+	
+	job.fn = fn;
+	job.ctx = ctx;
+	job.end = end;
+	job.schedule = schedule;
+	job.participants = num_helpers + 1;
+	job.grain = _ptl_par_grain(length, grain, job.participants);
+	if(schedule == PTL_PAR_STATIC){
+		long share = (length + job.participants - 1) / job.participants;
+		if(share > job.grain) { job.grain = share; }
+	}
+	job.cursor = begin;
+	job.remaining = length;
+	pthread_mutex_init(&job.mutex, NULL);
+	ptl_cond_init(&job.done);
+	
+	// no more helpers than there are chunks for them
+	long chunks = (length + job.grain - 1) / job.grain;
+	if(num_helpers > chunks - 1) { num_helpers = (int)(chunks - 1); }
+	
+	int i = 0;
+	for(i = 0; i < num_helpers; i++){
+		helpers[i] = submit_with_arg(manager, _ptl_par_work, &job);
+	}
+	
+	_ptl_par_work(&job);
+	
+	if(__atomic_load_n(&job.remaining, __ATOMIC_ACQUIRE) > 0){
+		pthread_mutex_lock(&job.mutex);
+		while(__atomic_load_n(&job.remaining, __ATOMIC_ACQUIRE) > 0){
+			pthread_cond_wait(&job.done, &job.mutex);
+		}
+		pthread_mutex_unlock(&job.mutex);
+	}
+	
+	for(i = 0; i < num_helpers; i++){
+		if(helpers[i] == NULL) { continue; }
+		
+		if(!ptl_future_cancel(helpers[i])){ // started, or rejected and never will
+			ptl_future_get(helpers[i], PTL_FUTURE_WAIT_FOREVER);
+		}
+		ptl_future_destroy(helpers[i]);
+	}
+	
+	pthread_mutex_destroy(&job.mutex);
+	pthread_cond_destroy(&job.done);
+	
+	return 1;
+}
+
+
+/* takes the next chunk off the cursor, 0 once the range is spent */
+int _ptl_par_claim(struct _ptl_par_job *job, long *begin, long *end){
+	long start = __atomic_load_n(&job->cursor, __ATOMIC_RELAXED);
+	long size = job->grain;
+	
+	if(job->schedule != PTL_PAR_GUIDED){
+		if(start >= job->end) { return 0; }
+		
+		start = __atomic_fetch_add(&job->cursor, size, __ATOMIC_RELAXED);
+	} else {
+		do {
+			if(start >= job->end) { return 0; }
+			
+			size = (job->end - start) / (2 * job->participants);
+			if(size < job->grain) { size = job->grain; }
+		} while(!__atomic_compare_exchange_n(&job->cursor, &start, start + size, 1,
+											 __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+	}
+	
+	if(start >= job->end) { return 0; }
+	
+	*begin = start;
+	*end = (job->end - start > size) ? start + size : job->end;
+	
+	return 1;
+}
+
+
+/* what the caller and every helper run: chunks until none are left */
+void *_ptl_par_work(void *arg){
+	struct _ptl_par_job *job = (struct _ptl_par_job *)arg;
+	long begin = 0;
+	long end = 0;
+	
+	while(_ptl_par_claim(job, &begin, &end)){
+		job->fn(begin, end, job->ctx);
+		
+		// the last chunk done opens the latch
+		if(__atomic_sub_fetch(&job->remaining, end - begin, __ATOMIC_ACQ_REL) == 0){
+			pthread_mutex_lock(&job->mutex);
+			pthread_cond_broadcast(&job->done);
+			pthread_mutex_unlock(&job->mutex);
+		}
+	}
+	
+	return NULL;
+}
+
+
+/* 'grain', or one giving PTL_PAR_CHUNKS_PER_THREAD chunks per participant */
+long _ptl_par_grain(long length, long grain, int participants){
+	if(grain > 0) { return grain; }
+	
+	grain = length / ((long)participants * PTL_PAR_CHUNKS_PER_THREAD);
+	
+	return (grain > 0) ? grain : 1;
+}
+
+
+/* ptl_parallel_map's chunk */
+void _ptl_par_map_chunk(long begin, long end, void *ctx){
+	struct _ptl_par_list *par_list = (struct _ptl_par_list *)ctx;
+	long i = 0;
+	
+	for(i = begin; i < end; i++){
+		par_list->array[i] = par_list->map_fn(par_list->array[i]);
+	}
+}
+
+
+/* ptl_parallel_reduce's chunk, folded left to right into its own slot */
+void _ptl_par_reduce_chunk(long begin, long end, void *ctx){
+	struct _ptl_par_list *par_list = (struct _ptl_par_list *)ctx;
+	void *value = NULL;
+	long i = 0;
+	
+	for(i = begin; i < end; i++){
+		void *mapped = (par_list->map_fn != NULL) ? 
+			par_list->map_fn(par_list->array[i]) : par_list->array[i];
+		
+		value = (i == begin) ? mapped : par_list->combine_fn(value, mapped);
+	}
+	
+	par_list->partials[begin / par_list->grain] = value;
+}
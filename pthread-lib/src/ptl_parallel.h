@@ -0,0 +1,113 @@
+/*
+ * This file is part of the pthread-lib Library.
+ * Copyright (C) 2008-2009 Nick Powers.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Library General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor Boston, MA 02110-1301,  USA
+ */
+
+/**
+ * Data parallel loops on a thread manager: split an index range, or the
+ * elements of a ptl_array_list, into chunks and run the chunks on the
+ * manager's workers.
+ *
+ * A loop is one shared job. It hands out chunks through an atomic cursor
+ * and counts the elements still to be done, which is the loop's only latch.
+ * Up to one helper task per worker is submitted, and the calling thread
+ * takes chunks too instead of blocking. So a loop always finishes, even
+ * when every worker is busy, or when it is started from inside a task. That
+ * includes workers busy running the very loop that submitted it. Helpers
+ * that never got to run are cancelled at the end.
+ *
+ * Chunking (the 'schedule' of ptl_parallel_for_schedule):
+ *   PTL_PAR_STATIC   one equal chunk per participant, the least overhead
+ *                    when every index costs the same
+ *   PTL_PAR_DYNAMIC  chunks of 'grain' indices taken in turn, balances
+ *                    uneven work
+ *   PTL_PAR_GUIDED   chunks start at 1 / (2 * participants) of what's left
+ *                    and shrink toward 'grain', fewer trips to the cursor
+ *                    than DYNAMIC with much the same balance
+ * 'grain' is the smallest chunk. 0 or less picks one giving about
+ * PTL_PAR_CHUNKS_PER_THREAD chunks per participant.
+ */
+
+#ifndef __PTL_PARALLEL_H__
+#define __PTL_PARALLEL_H__
+
+#include "ptl_thread_manager.h"
+#include "ptl_array_list.h"
+
+/* Constants */
+#define PTL_PAR_STATIC 0
+#define PTL_PAR_DYNAMIC 1
+#define PTL_PAR_GUIDED 2
+
+#define PTL_PAR_MAX_HELPERS 64			/**< helper tasks per loop at most */
+#define PTL_PAR_CHUNKS_PER_THREAD 8		/**< for the grain picked when it's 0 */
+
+
+/* Public Functions */
+
+/**
+ * Calls 'fn(chunk_begin, chunk_end, ctx)' over chunks that cover [begin,
+ * end) exactly once, with PTL_PAR_DYNAMIC chunks, and returns once all of
+ * them are done.
+ *
+ * @param manager whose workers help, the caller always takes part
+ * @param begin first index
+ * @param end index past the last one
+ * @param grain smallest chunk, 0 to pick one
+ * @param fn called on each chunk, from any thread
+ * @param ctx passed to 'fn'
+ * @return 1 if successful, 0 otherwise
+ */
+int ptl_parallel_for(ptl_thread_manager_t manager, long begin, long end, long grain,
+					 void (*fn)(long begin, long end, void *ctx), void *ctx);
+
+/**
+ * ptl_parallel_for with the chunking chosen by 'schedule'.
+ *
+ * @param schedule PTL_PAR_STATIC, PTL_PAR_DYNAMIC or PTL_PAR_GUIDED
+ * @return 1 if successful, 0 otherwise
+ */
+int ptl_parallel_for_schedule(ptl_thread_manager_t manager, long begin, long end, long grain,
+							  int schedule, void (*fn)(long begin, long end, void *ctx), void *ctx);
+
+/**
+ * Replaces every element of 'list' with 'fn(element)', in parallel. The
+ * list may not be changed by anyone else meanwhile.
+ *
+ * @param manager whose workers help
+ * @param list to map in place
+ * @param fn called once per element, from any thread
+ * @return 1 if successful, 0 otherwise
+ */
+int ptl_parallel_map(ptl_thread_manager_t manager, ptl_array_list_t list, void *(*fn)(void *));
+
+/**
+ * Maps every element of 'list' with 'map_fn' and folds the results with
+ * 'combine_fn'. Results are combined in list order, so 'combine_fn' must be
+ * associative but needn't be commutative. The first result in each chunk
+ * seeds that chunk's fold, so no identity value is needed.
+ *
+ * @param manager whose workers help
+ * @param list to reduce
+ * @param map_fn called once per element, NULL uses the elements as they are
+ * @param combine_fn folds two results into one, left before right
+ * @return the reduced value, NULL if the list is empty
+ */
+void *ptl_parallel_reduce(ptl_thread_manager_t manager, ptl_array_list_t list,
+						  void *(*map_fn)(void *), void *(*combine_fn)(void *, void *));
+
+#endif
@@ -0,0 +1,415 @@
+/*
+ * This file is part of the pthread-lib Library.
+ * Copyright (C) 2008-2009 Nick Powers.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Library General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor Boston, MA 02110-1301,  USA
+ */
+
+ /*
+  * For a "class" description, see the header file. 
+  */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <string.h>
+#include <errno.h>
+#include "ptl_queue.h"
+#include "ptl_util.h"
+#include "ptl_task.h"
+#include "ptl_priority_queue.h"
+
+
+/* Structures */
+
+/* one heap slot. 'seq' breaks ties so equal priorities stay FIFO */
+struct ptl_pq_entry {
+	long priority;
+	unsigned long seq;
+	void *value;
+};
+
+/* heap state (kept in q->data) */
+struct ptl_pq_state {
+	struct ptl_pq_entry *heap;		/**< the 4-ary heap, root at 0 */
+	long allocated;					/**< entries 'heap' has room for */
+	unsigned long next_seq;			/**< 'seq' of the next add */
+	long (*priority_func)(void *);	/**< NULL means priority 0 */
+};
+
+
+/* Private Functions */
+void _ptl_pq_init(ptl_q_t q, long (*priority_func)(void *));
+int _ptl_pq_put(ptl_q_t q, void *value);
+void* _ptl_pq_take(ptl_q_t q);
+long _ptl_pq_task_priority(void *task);
+
+
+/* Global Variables */
+
+/* functions to use with ptl_q_create_queue() */
+struct ptl_q_funcs ptl_pq_funcs = {
+	ptl_pq_init_queue,
+	ptl_pq_destroy_queue,
+	ptl_pq_add,
+	ptl_pq_add_wait,
+	ptl_pq_clear,
+	ptl_pq_peek,
+	ptl_pq_get,
+	ptl_pq_get_wait,
+	NULL,			// 'size' is kept up to date
+	ptl_pq_add_batch,
+	ptl_pq_get_batch,
+	ptl_pq_add_evict
+};
+
+/* same queue, ordered by ptl_task 'priority' */
+struct ptl_q_funcs ptl_pq_task_funcs = {
+	ptl_pq_init_task_queue,
+	ptl_pq_destroy_queue,
+	ptl_pq_add,
+	ptl_pq_add_wait,
+	ptl_pq_clear,
+	ptl_pq_peek,
+	ptl_pq_get,
+	ptl_pq_get_wait,
+	NULL,
+	ptl_pq_add_batch,
+	ptl_pq_get_batch,
+	ptl_pq_add_evict
+};
+
+
+/* initalize a priority queue where everything has priority 0 */
+void ptl_pq_init_queue(ptl_q_t q){
+	_ptl_pq_init(q, NULL);
+}
+
+
+/* initalize a priority queue of tasks */
+void ptl_pq_init_task_queue(ptl_q_t q){
+	_ptl_pq_init(q, _ptl_pq_task_priority);
+}
+
+
+/* free all the memory associated with a priority queue */
+void ptl_pq_destroy_queue(ptl_q_t q){
+	assert(q);
+	
+	PTL_Q_LOCK(q, &q->mutex); // lock
+	
+	struct ptl_pq_state *pq = (struct ptl_pq_state *)q->data;
+	
+	q->type = PTL_Q_TYPE_NONE;
+	q->capacity = 0;
+	q->size = 0;
+	FREE(pq->heap);
+	FREE(q->data);
+	
+	pthread_mutex_unlock(&q->mutex); // unlock
+	
+	pthread_mutex_destroy(&q->mutex); // no one else may use 'q' now
+	pthread_cond_destroy(&q->not_empty);
+	pthread_cond_destroy(&q->not_full);
+}
+
+
+/* swap in the priority function, under the lock */
+void ptl_pq_set_priority_func(ptl_q_t q, long (*priority_func)(void *)){
+	if(q == NULL){ return; }
+	
+	PTL_Q_LOCK(q, &q->mutex); // lock
+	((struct ptl_pq_state *)q->data)->priority_func = priority_func;
+	pthread_mutex_unlock(&q->mutex); // unlock
+}
+
+
+/* sift 'value' up from the bottom. returns 0 if bounded and full */
+int ptl_pq_add(ptl_q_t q, void *value){
+	if(q == NULL || value == NULL){ return 0; }
+	
+	PTL_Q_LOCK(q, &q->mutex); // lock
+	
+	int added = _ptl_pq_put(q, value);
+	
+	pthread_mutex_unlock(&q->mutex); // unlock
+	
+	return added;
+}
+
+
+/* add, taking the head first if a bounded heap is full */
+int ptl_pq_add_evict(ptl_q_t q, void *value, void **evicted){
+	if(q == NULL || value == NULL || evicted == NULL){ return 0; }
+	
+	PTL_Q_LOCK(q, &q->mutex); // lock
+	
+	*evicted = (q->capacity > 0 && q->size >= q->capacity) ? _ptl_pq_take(q) : NULL;
+	int added = _ptl_pq_put(q, value);
+	
+	pthread_mutex_unlock(&q->mutex); // unlock
+	
+	return added;
+}
+
+
+/* try to add, if the queue is full wait on 'not_full' until 'timeout' */
+int ptl_pq_add_wait(ptl_q_t q, void *value, long timeout){
+	if(q == NULL || value == NULL || timeout < 0){ return 0; }
+	
+	struct timespec deadline;
+	ptl_get_future_time(&deadline, timeout * 1000); // ms to usec
+	int added = 0;
+	
+	PTL_Q_LOCK(q, &q->mutex); // lock
+	
+	// the cond wait gives up the lock while we sleep
+	while(!(added = _ptl_pq_put(q, value))){
+		if(pthread_cond_timedwait(&q->not_full, &q->mutex, &deadline) == ETIMEDOUT){
+			added = _ptl_pq_put(q, value); // one last try
+			break;
+		}
+	}
+	
+	pthread_mutex_unlock(&q->mutex); // unlock
+	
+	return added;
+}
+
+
+/* add each value under one lock */
+int ptl_pq_add_batch(ptl_q_t q, void **values, int count){
+	if(q == NULL || values == NULL || count <= 0){ return 0; }
+	
+	PTL_Q_LOCK(q, &q->mutex); // lock
+	
+	int added = 0;
+	while(added < count && values[added] != NULL && _ptl_pq_put(q, values[added])){
+		added++;
+	}
+	
+	if(added > 1){
+		pthread_cond_broadcast(&q->not_empty); // enough for several 'gets'
+	}
+	
+	pthread_mutex_unlock(&q->mutex); // unlock
+	
+	return added;
+}
+
+
+/* forget every entry. The 'value' elements aren't freed */
+void ptl_pq_clear(ptl_q_t q){
+	if(q == NULL){ return; }
+	
+	PTL_Q_LOCK(q, &q->mutex); // lock
+	
+	__atomic_store_n(&q->size, 0, __ATOMIC_RELEASE);
+	
+	pthread_cond_broadcast(&q->not_full); // there is room for everyone
+	
+	pthread_mutex_unlock(&q->mutex); // unlock
+}
+
+
+/* the root is the highest priority */
+void* ptl_pq_peek(ptl_q_t q){
+	if(q == NULL){ return NULL; }
+	
+	struct ptl_pq_state *pq = (struct ptl_pq_state *)q->data;
+	
+	PTL_Q_LOCK(q, &q->mutex); // lock
+	
+	void *value = (q->size > 0) ? pq->heap[0].value : NULL;
+	
+	pthread_mutex_unlock(&q->mutex); // unlock
+	
+	return value;
+}
+
+
+/* take the root */
+void* ptl_pq_get(ptl_q_t q){
+	if(q == NULL){ return NULL; }
+	
+	PTL_Q_LOCK(q, &q->mutex); // lock
+	
+	void *value = _ptl_pq_take(q);
+	
+	pthread_mutex_unlock(&q->mutex); // unlock
+	
+	return value;
+}
+
+
+/* take up to 'max' roots under one lock */
+int ptl_pq_get_batch(ptl_q_t q, void **values, int max){
+	if(q == NULL || values == NULL || max <= 0){ return 0; }
+	
+	PTL_Q_LOCK(q, &q->mutex); // lock
+	
+	int taken = 0;
+	while(taken < max && (values[taken] = _ptl_pq_take(q)) != NULL){
+		taken++;
+	}
+	
+	if(taken > 1 && q->capacity > 0){
+		pthread_cond_broadcast(&q->not_full); // room for several 'adds'
+	}
+	
+	pthread_mutex_unlock(&q->mutex); // unlock
+	
+	return taken;
+}
+
+
+/* try to get an element, if none exist wait on 'not_empty' until 'timeout' */
+void* ptl_pq_get_wait(ptl_q_t q, long timeout){
+	if(q == NULL || timeout < 0){ return NULL; }
+	
+	struct timespec deadline;
+	ptl_get_future_time(&deadline, timeout * 1000); // ms to usec
+	void *element = NULL;
+	
+	PTL_Q_LOCK(q, &q->mutex); // lock
+	
+	// the cond wait gives up the lock while we sleep
+	while((element = _ptl_pq_take(q)) == NULL){
+		if(pthread_cond_timedwait(&q->not_empty, &q->mutex, &deadline) == ETIMEDOUT){
+			element = _ptl_pq_take(q); // one last try
+			break;
+		}
+	}
+	
+	pthread_mutex_unlock(&q->mutex); // unlock
+	
+	return element;
+}
+
+
+
+/* Private Functions */
+
+/* lock, conditions and an empty heap. nothing else can see 'q' yet */
+void _ptl_pq_init(ptl_q_t q, long (*priority_func)(void *)){
+	assert(q);
+	
+	pthread_mutex_init(&q->mutex, NULL);
+	ptl_cond_init(&q->not_empty); // signalled by add
+	ptl_cond_init(&q->not_full); // signalled by get, when bounded
+	
+	q->type = PTL_Q_TYPE_PRIORITY;
+	q->size = 0;
+	q->head = q->tail = q->ptr = NULL; // not used, see 'struct ptl_pq_state'
+	
+	struct ptl_pq_state *pq = (struct ptl_pq_state *)calloc(1, sizeof(struct ptl_pq_state));
+	assert(pq);
+	pq->allocated = (q->capacity > 0) ? q->capacity : PTL_PQ_INITIAL_CAPACITY;
+	pq->heap = (struct ptl_pq_entry *)malloc(pq->allocated * sizeof(struct ptl_pq_entry));
+	assert(pq->heap);
+	pq->next_seq = 0;
+	pq->priority_func = priority_func;
+	q->data = pq;
+}
+
+
+/* 'a' is taken before 'b' */
+#define PTL_PQ_BEFORE(a, b) ((a)->priority > (b)->priority || \
+							 ((a)->priority == (b)->priority && (a)->seq < (b)->seq))
+
+
+/* sift a new entry up from the end, the lock must be held. returns 0 if full */
+int _ptl_pq_put(ptl_q_t q, void *value){
+	struct ptl_pq_state *pq = (struct ptl_pq_state *)q->data;
+	long size = q->size;
+	
+	if(size >= pq->allocated){
+		if(q->capacity > 0){ return 0; } // bounded and full
+		
+		long allocated = pq->allocated * 2;
+		struct ptl_pq_entry *heap = (struct ptl_pq_entry *)realloc(pq->heap, 
+			allocated * sizeof(struct ptl_pq_entry));
+		assert(heap);
+		pq->heap = heap;
+		pq->allocated = allocated;
+	}
+	
+	struct ptl_pq_entry entry;
+	entry.priority = (pq->priority_func != NULL) ? pq->priority_func(value) : 0;
+	entry.seq = pq->next_seq++;
+	entry.value = value;
+	
+	// move parents down until 'entry' fits, then write it once
+	long i = size;
+	while(i > 0){
+		long parent = (i - 1) / PTL_PQ_ARITY;
+		if(!PTL_PQ_BEFORE(&entry, &pq->heap[parent])){ break; }
+		pq->heap[i] = pq->heap[parent];
+		i = parent;
+	}
+	pq->heap[i] = entry;
+	
+	PTL_ATOMIC_INC(q->size);
+	
+	pthread_cond_signal(&q->not_empty); // wake up a waiting 'get'
+	
+	return 1;
+}
+
+
+/* take the root and sift the last entry down, the lock must be held */
+void* _ptl_pq_take(ptl_q_t q){
+	if(q->size <= 0){ return NULL; }
+	
+	struct ptl_pq_state *pq = (struct ptl_pq_state *)q->data;
+	void *value = pq->heap[0].value;
+	long size = PTL_ATOMIC_DEC(q->size);
+	
+	if(size > 0){
+		struct ptl_pq_entry last = pq->heap[size];
+		
+		// move the best child up until 'last' fits, then write it once
+		long i = 0;
+		for(;;){
+			long first = i * PTL_PQ_ARITY + 1;
+			if(first >= size){ break; }
+			
+			long best = first;
+			long end = (first + PTL_PQ_ARITY < size) ? first + PTL_PQ_ARITY : size;
+			long c = 0;
+			for(c = first + 1; c < end; c++){
+				if(PTL_PQ_BEFORE(&pq->heap[c], &pq->heap[best])){ best = c; }
+			}
+			
+			if(!PTL_PQ_BEFORE(&pq->heap[best], &last)){ break; }
+			pq->heap[i] = pq->heap[best];
+			i = best;
+		}
+		pq->heap[i] = last;
+	}
+	
+	if(q->capacity > 0){
+		pthread_cond_signal(&q->not_full); // wake up a waiting 'add'
+	}
+	
+	return value;
+}
+
+
+/* priority of a ptl_task_t */
+long _ptl_pq_task_priority(void *task){
+	return ((ptl_task_t)task)->priority;
+}
@@ -0,0 +1,182 @@
+/*
+ * This file is part of the pthread-lib Library.
+ * Copyright (C) 2008-2009 Nick Powers.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Library General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor Boston, MA 02110-1301,  USA
+ */
+
+/**
+ * This "class" is a priority queue for the ptl_queue "interface". The
+ * element with the highest priority is taken first, elements with equal
+ * priorities are taken in the order they were added. It is a 4-ary heap in
+ * one contiguous array: a node's four children sit next to each other, so
+ * each level of a sift touches about one cache line and the tree is half
+ * as deep as a binary heap.
+ *
+ * A 'capacity' above 0 bounds the queue (add fails or waits when full), 0
+ * or less makes it unbounded, the array doubling as it fills. Like the
+ * array queue, all operations take the queue's lock and the waiting
+ * versions sleep on 'not_empty'/'not_full'.
+ *
+ * Use ptl_pq_task_funcs for a thread manager's 'work_q'; tasks are ordered
+ * by 'priority' in struct ptl_task (see submit_with_priority). With
+ * ptl_pq_funcs the priority of a value comes from ptl_pq_set_priority_func().
+ */
+
+
+#ifndef __PTL_PRIORITY_QUEUE_H__
+#define __PTL_PRIORITY_QUEUE_H__
+
+#include "ptl_queue.h"
+
+/* Constants */
+#define PTL_PQ_INITIAL_CAPACITY 64	/**< starting size of an unbounded queue */
+#define PTL_PQ_ARITY 4				/**< children per heap node */
+
+
+/**
+ * Function table for this queue, e.g. ptl_q_create_queue(&ptl_pq_funcs, 0).
+ * Every value has priority 0 until ptl_pq_set_priority_func() is called.
+ */
+extern struct ptl_q_funcs ptl_pq_funcs;
+
+/**
+ * Function table for a queue of ptl_task_t ordered by the task's 'priority'.
+ */
+extern struct ptl_q_funcs ptl_pq_task_funcs;
+
+/**
+ * Initializes the queue, creating all memory needed to support this data
+ * structure.
+ * 
+ * @param q queue to be initized.
+ */
+void ptl_pq_init_queue(ptl_q_t q);
+
+/**
+ * Initializes the queue to order ptl_task_t values by their 'priority'.
+ * 
+ * @param q queue to be initized.
+ */
+void ptl_pq_init_task_queue(ptl_q_t q);
+
+/**
+ * Destroys the queue and frees the memory. This should be used when the queue
+ * is no longer going to be used.
+ * 
+ * @param q the queue to destroy
+ */
+void ptl_pq_destroy_queue(ptl_q_t q);
+
+/**
+ * Sets how the priority of a value is found. Call it before adding.
+ *
+ * @param q non-null priority queue
+ * @param priority_func returns the priority of a value, higher is taken first.
+ *                      NULL gives every value priority 0
+ */
+void ptl_pq_set_priority_func(ptl_q_t q, long (*priority_func)(void *));
+
+/**
+ * Inserts the specified element into this queue. Returns true
+ * upon success and false if no space is currently available.
+ *
+ * @param q non-null queue
+ * @param value the value to be stored in the queue
+ * @return 1 if successful, 0 otherwise
+ */
+int ptl_pq_add(ptl_q_t q, void *value);
+
+/**
+ * Tries to insert the item. If the queue is bounded and full, it will
+ * wait until there is room or until 'timeout' occurs. The thread sleeps on
+ * the 'not_full' condition, which every get signals.
+ * 
+ * @param q non-null queue to add the value
+ * @param value data that will be added to the queue
+ * @param timeout number of milliseconds to wait for room
+ * @return 1 if successful, 0 otherwise
+ */
+int ptl_pq_add_wait(ptl_q_t q, void *value, long timeout);
+
+/**
+ * Inserts up to 'count' elements under one lock. Stops at the first NULL
+ * value or when the queue is full.
+ *
+ * @param q non-null queue
+ * @param values elements to add
+ * @param count number of elements in 'values'
+ * @return number of elements added, from the front of 'values'
+ */
+int ptl_pq_add_batch(ptl_q_t q, void **values, int count);
+
+/**
+ * Inserts 'value', removing the head (the highest priority element) first if
+ * a bounded queue is full, all under one lock.
+ *
+ * @param q non-null queue
+ * @param value the value to be stored in the queue
+ * @param evicted set to the removed head, or NULL if there was room
+ * @return 1 if successful, 0 otherwise
+ */
+int ptl_pq_add_evict(ptl_q_t q, void *value, void **evicted);
+
+/**
+ * Removes all of the elements from this queue. The 'values' are not freed.
+ *
+ * @param q non-null queue to be cleared
+ */
+void ptl_pq_clear(ptl_q_t q);
+
+/**
+ * Retrieves, but does not remove, the highest priority element.
+ *
+ * @param q non-null queue to peek on
+ * @return pointer to the head element or NULL if no element was found
+ */
+void* ptl_pq_peek(ptl_q_t q);
+
+/**
+ * Retrieves and removes the highest priority element. It will return NULL if
+ * the queue is empty.
+ *
+ * @param q non-null queue to get an element from
+ * @return the head element or NULL if no element was found
+ */
+void* ptl_pq_get(ptl_q_t q);
+
+/**
+ * Retrieves and removes up to 'max' elements under one lock, highest
+ * priority first.
+ *
+ * @param q non-null queue to get elements from
+ * @param values where the elements are stored, in priority order
+ * @param max room in 'values'
+ * @return number of elements stored in 'values'
+ */
+int ptl_pq_get_batch(ptl_q_t q, void **values, int max);
+
+/**
+ * Retrieves and removes the highest priority element, waiting up to the
+ * specified wait time if necessary for an element to become available.
+ * The thread sleeps on the 'not_empty' condition, which every add signals.
+ *
+ * @param q non-null queue to get an element from
+ * @param timeout time in milliseconds
+ * @return the head element or NULL if no element was found
+ */
+void* ptl_pq_get_wait(ptl_q_t q, long timeout);
+
+#endif
@@ -22,13 +22,52 @@
 #include <stdio.h>
 #include <assert.h>
 #include <malloc.h>
+#include <string.h>
 #include <assert.h>
 #include "ptl_queue.h"
+#include "ptl_array_list.h"
+#include "ptl_stats.h"
 #include "ptl_util.h"
 
+/* the counters, or NULL when they are off */
+#define _PTL_Q_STATS(q) ((struct ptl_q_stats_block *)__atomic_load_n(&(q)->stats, __ATOMIC_ACQUIRE))
+#define _PTL_Q_STAT_ADD(c, field, n) __atomic_add_fetch(&(c)->field, (n), __ATOMIC_RELAXED)
+
+
+/* Structures */
+
+/* what 'fiber_wait' points to */
+struct ptl_q_fiber_wait {
+	pthread_mutex_t mutex; // guards 'waiting'
+	struct ptl_fiber_cond waiting;
+};
+
+/* one stripe of counters, alone on its cache lines (see ptl_stats.h) */
+struct ptl_q_stats_stripe {
+	struct ptl_q_stats counts;
+} __attribute__((aligned(PTL_CACHE_LINE_SIZE)));
+
+/* what 'stats' points to */
+struct ptl_q_stats_block {
+	struct ptl_q_stats_stripe stripes[PTL_STATS_STRIPES];
+};
+
 
 /* Private Function Declarations */
 int _check_function_ptrs(ptl_q_funcs_t q_functions);
+int _ptl_q_has_elements(void *q);
+int _ptl_q_has_room(void *q);
+int _ptl_q_add_wait(ptl_q_t q, void *value, long timeout);
+void* _ptl_q_get_wait(ptl_q_t q, long timeout);
+struct ptl_q_stats *_ptl_q_my_stats(struct ptl_q_stats_block *block);
+void _ptl_q_count_add(ptl_q_t q, struct ptl_q_stats_block *block, int added, int refused);
+void* _ptl_q_fiber_get_wait(ptl_q_t q, long timeout);
+struct ptl_q_fiber_wait *_ptl_q_get_fiber_wait(ptl_q_t q);
+void _ptl_q_wake_fibers(ptl_q_t q, int added);
+
+
+/* Global Variables */
+static __thread struct ptl_spin_state ptl_q_spin_state; // this thread's recent waits
 
 
 
@@ -36,8 +75,7 @@ int _check_function_ptrs(ptl_q_funcs_t q_functions);
 ptl_q_t ptl_q_create_queue(ptl_q_funcs_t q_functions, int capacity){
 	_check_function_ptrs(q_functions);
 	
-	ptl_q_t q = (ptl_q_t)malloc(sizeof(struct ptl_q));
-	assert(q);
+	ptl_q_t q = (ptl_q_t)ptl_cache_aligned_alloc(sizeof(struct ptl_q));
 	
 	q->capacity = capacity;
 	q->functions = q_functions; // TODO is this right?
@@ -49,6 +87,23 @@ ptl_q_t ptl_q_create_queue(ptl_q_funcs_t q_functions, int capacity){
 }
 
 
+/* the tag as a string */
+const char *ptl_q_type_name(ptl_q_t q){
+	if(q == NULL) { return "none"; }
+	
+	switch(q->type){
+	case PTL_Q_TYPE_LINKED:   return "linked";
+	case PTL_Q_TYPE_ARRAY:    return "array";
+	case PTL_Q_TYPE_TWO_LOCK: return "two_lock";
+	case PTL_Q_TYPE_RING:     return "ring";
+	case PTL_Q_TYPE_SPSC:     return "spsc";
+	case PTL_Q_TYPE_PRIORITY: return "priority";
+	case PTL_Q_TYPE_NONE:     return "none";
+	default:                  return "user";
+	}
+}
+
+
 /* creates an element/node that houses the 'value' given to it  */
 ptl_q_element_t ptl_q_create_element(void *value){
 	ptl_q_element_t e = (ptl_q_element_t)malloc(sizeof(struct ptl_q_element));
@@ -71,6 +126,13 @@ void ptl_q_destroy_queue(ptl_q_t q){
 	
 	funcs->ptl_q_destroy_queue(q); // call the destroy function supplied
 	
+	FREE(q->stats);
+	
+	struct ptl_q_fiber_wait *wait = (struct ptl_q_fiber_wait *)q->fiber_wait;
+	if(wait != NULL){
+		pthread_mutex_destroy(&wait->mutex);
+		FREE(wait);
+	}
 	FREE(q); // free the entire q
 	
 	return;
@@ -82,19 +144,76 @@ int ptl_q_add(ptl_q_t q, void *value){
 	if(q == NULL) { return 0; }
 	
 	ptl_q_funcs_t funcs = (ptl_q_funcs_t)(q->functions);
+	struct ptl_q_stats_block *block = NULL;
+	
+	int added = funcs->ptl_q_add(q, value);
+	
+	_ptl_q_wake_fibers(q, added);
 	
-	return funcs->ptl_q_add(q, value);
+	if((block = _PTL_Q_STATS(q)) != NULL){
+		_ptl_q_count_add(q, block, added, !added);
+	}
+	
+	return added;
 }
 
 
-/* add an element to the queue (it may wait for it to have room)
-   (calls supplied function) */
+/* add an element to the queue (it may wait for it to have room) */
 int ptl_q_add_wait(ptl_q_t q, void *value, long timeout){
 	if(q == NULL) { return 0; }
 	
+	struct ptl_q_stats_block *block = NULL;
+	
+	int added = _ptl_q_add_wait(q, value, timeout);
+	
+	_ptl_q_wake_fibers(q, added);
+	
+	if((block = _PTL_Q_STATS(q)) != NULL){
+		_ptl_q_count_add(q, block, added, 0);
+		if(!added){
+			_PTL_Q_STAT_ADD(_ptl_q_my_stats(block), failed_adds, 1);
+		}
+	}
+	
+	return added;
+}
+
+
+/* ptl_q_add_wait without the counting (calls supplied function), 
+   spinning first if the queue is set to */
+int _ptl_q_add_wait(ptl_q_t q, void *value, long timeout){
 	ptl_q_funcs_t funcs = (ptl_q_funcs_t)(q->functions);
 	
-	return funcs->ptl_q_add_wait(q, value, timeout);
+	if(q->wait_strategy.spin_max <= 0 && q->wait_strategy.yields <= 0){
+		return funcs->ptl_q_add_wait(q, value, timeout);
+	}
+	
+	if(funcs->ptl_q_add(q, value)){
+		return 1;
+	}
+	
+	if(ptl_wait_spin(&q->wait_strategy, &ptl_q_spin_state, _ptl_q_has_room, q) &&
+	   funcs->ptl_q_add(q, value)){
+		return 1;
+	}
+	
+	unsigned long long start = ptl_get_time_nsec();
+	int added = funcs->ptl_q_add_wait(q, value, timeout);
+	ptl_wait_note_park(&q->wait_strategy, &ptl_q_spin_state, ptl_get_time_nsec() - start);
+	
+	return added;
+}
+
+
+/* copy the strategy in, NULL for none */
+void ptl_q_set_wait_strategy(ptl_q_t q, const struct ptl_wait_strategy *strategy){
+	if(q == NULL) { return; }
+	
+	if(strategy == NULL){
+		ptl_wait_strategy_init(&q->wait_strategy, PTL_WAIT_LOW_CPU);
+	} else {
+		q->wait_strategy = *strategy;
+	}
 }
 
 
@@ -113,17 +232,64 @@ void* ptl_q_get(ptl_q_t q){
 	if(q == NULL) { return NULL; }
 	
 	ptl_q_funcs_t funcs = (ptl_q_funcs_t)(q->functions);
+	struct ptl_q_stats_block *block = NULL;
+	
+	void *value = funcs->ptl_q_get(q);
+	
+	if(value != NULL && (block = _PTL_Q_STATS(q)) != NULL){
+		_PTL_Q_STAT_ADD(_ptl_q_my_stats(block), dequeued, 1);
+	}
 	
-	return funcs->ptl_q_get(q);
+	return value;
 }
 
 /* same as ptl_q_get, but it waits if an element is not in the queue */
 void* ptl_q_get_wait(ptl_q_t q, long timeout){
 	if(q == NULL) { return NULL; }
 	
+	struct ptl_q_stats_block *block = NULL;
+	
+	void *value = _ptl_q_get_wait(q, timeout);
+	
+	if((block = _PTL_Q_STATS(q)) != NULL){
+		if(value != NULL){
+			_PTL_Q_STAT_ADD(_ptl_q_my_stats(block), dequeued, 1);
+		} else {
+			_PTL_Q_STAT_ADD(_ptl_q_my_stats(block), timed_out_waits, 1);
+		}
+	}
+	
+	return value;
+}
+
+
+/* ptl_q_get_wait without the counting, spinning first if the queue is set to */
+void* _ptl_q_get_wait(ptl_q_t q, long timeout){
 	ptl_q_funcs_t funcs = (ptl_q_funcs_t)(q->functions);
 	
-	return funcs->ptl_q_get_wait(q, timeout);
+	if(timeout > 0 && ptl_fiber_current() != NULL){
+		return _ptl_q_fiber_get_wait(q, timeout);
+	}
+	
+	if(q->wait_strategy.spin_max <= 0 && q->wait_strategy.yields <= 0){
+		return funcs->ptl_q_get_wait(q, timeout);
+	}
+	
+	void *value = funcs->ptl_q_get(q);
+	if(value != NULL){
+		return value;
+	}
+	
+	if(ptl_wait_spin(&q->wait_strategy, &ptl_q_spin_state, _ptl_q_has_elements, q) &&
+	   (value = funcs->ptl_q_get(q)) != NULL){
+		return value;
+	}
+	
+	unsigned long long start = ptl_get_time_nsec();
+	value = funcs->ptl_q_get_wait(q, timeout);
+	ptl_wait_note_park(&q->wait_strategy, &ptl_q_spin_state, ptl_get_time_nsec() - start);
+	
+	return value;
 }
 
 
@@ -139,6 +305,173 @@ void ptl_q_clear(ptl_q_t q){
 }
 
 
+/* add several elements, one at a time if the queue has no batch function */
+int ptl_q_add_batch(ptl_q_t q, void **values, int count){
+	if(q == NULL || values == NULL || count <= 0) { return 0; }
+	
+	ptl_q_funcs_t funcs = (ptl_q_funcs_t)(q->functions);
+	struct ptl_q_stats_block *block = NULL;
+	int added = 0;
+	
+	if(funcs->ptl_q_add_batch != NULL){
+		added = funcs->ptl_q_add_batch(q, values, count);
+	} else {
+		while(added < count && funcs->ptl_q_add(q, values[added])){
+			added++;
+		}
+	}
+	
+	_ptl_q_wake_fibers(q, added);
+	
+	if((block = _PTL_Q_STATS(q)) != NULL){
+		_ptl_q_count_add(q, block, added, count - added);
+	}
+	
+	return added;
+}
+
+
+/* get several elements, one at a time if the queue has no batch function */
+int ptl_q_get_batch(ptl_q_t q, void **values, int max){
+	if(q == NULL || values == NULL || max <= 0) { return 0; }
+	
+	ptl_q_funcs_t funcs = (ptl_q_funcs_t)(q->functions);
+	struct ptl_q_stats_block *block = NULL;
+	int taken = 0;
+	
+	if(funcs->ptl_q_get_batch != NULL){
+		taken = funcs->ptl_q_get_batch(q, values, max);
+	} else {
+		while(taken < max && (values[taken] = funcs->ptl_q_get(q)) != NULL){
+			taken++;
+		}
+	}
+	
+	if(taken > 0 && (block = _PTL_Q_STATS(q)) != NULL){
+		_PTL_Q_STAT_ADD(_ptl_q_my_stats(block), dequeued, taken);
+	}
+	
+	return taken;
+}
+
+
+/* add, making room by taking the head if needed */
+int ptl_q_add_evict(ptl_q_t q, void *value, void **evicted){
+	if(evicted != NULL){ *evicted = NULL; }
+	if(q == NULL || value == NULL || evicted == NULL) { return 0; }
+	
+	ptl_q_funcs_t funcs = (ptl_q_funcs_t)(q->functions);
+	struct ptl_q_stats_block *block = NULL;
+	int added = 0;
+	
+	if(funcs->ptl_q_add_evict != NULL){
+		added = funcs->ptl_q_add_evict(q, value, evicted);
+	} else if(!(added = funcs->ptl_q_add(q, value))){
+		*evicted = funcs->ptl_q_get(q);
+		added = funcs->ptl_q_add(q, value);
+	}
+	
+	_ptl_q_wake_fibers(q, added);
+	
+	if((block = _PTL_Q_STATS(q)) != NULL){
+		_ptl_q_count_add(q, block, added, !added);
+		if(*evicted != NULL){
+			struct ptl_q_stats *counts = _ptl_q_my_stats(block);
+			_PTL_Q_STAT_ADD(counts, dequeued, 1);
+			_PTL_Q_STAT_ADD(counts, evicted, 1);
+		}
+	}
+	
+	return added;
+}
+
+
+/* move everything in the queue to the end of 'list' */
+int ptl_q_drain_to(ptl_q_t q, ptl_array_list_t list){
+	if(q == NULL || list == NULL) { return 0; }
+	
+	void *batch[PTL_Q_DRAIN_BATCH_SIZE];
+	int moved = 0;
+	int taken = 0;
+	
+	while((taken = ptl_q_get_batch(q, batch, PTL_Q_DRAIN_BATCH_SIZE)) > 0){
+		ptl_al_insert_range(list, list->size, batch, taken);
+		moved += taken;
+	}
+	
+	return moved;
+}
+
+
+/* number of elements, from the supplied function if there is one */
+long ptl_q_size(ptl_q_t q){
+	if(q == NULL) { return 0; }
+	
+	ptl_q_funcs_t funcs = (ptl_q_funcs_t)(q->functions);
+	
+	if(funcs->ptl_q_size != NULL){
+		return funcs->ptl_q_size(q);
+	}
+	
+	return __atomic_load_n(&q->size, __ATOMIC_ACQUIRE);
+}
+
+
+/* allocate the counters, once; a racing second call frees its own */
+void ptl_q_enable_stats(ptl_q_t q){
+	if(q == NULL || _PTL_Q_STATS(q) != NULL) { return; }
+	
+	void *block = ptl_stats_alloc(sizeof(struct ptl_q_stats_block));
+	void *none = NULL;
+	
+	if(!__atomic_compare_exchange_n(&q->stats, &none, block, 0, 
+									__ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)){
+		free(block);
+	}
+}
+
+
+/* add the stripes up */
+int ptl_q_get_stats(ptl_q_t q, struct ptl_q_stats *stats){
+	if(stats == NULL) { return 0; }
+	
+	memset(stats, 0, sizeof(struct ptl_q_stats));
+	
+	struct ptl_q_stats_block *block = (q == NULL) ? NULL : _PTL_Q_STATS(q);
+	if(block == NULL) { return 0; }
+	
+	int i = 0;
+	for(i = 0; i < PTL_STATS_STRIPES; i++){
+		struct ptl_q_stats *counts = &block->stripes[i].counts;
+		
+		stats->enqueued += __atomic_load_n(&counts->enqueued, __ATOMIC_RELAXED);
+		stats->dequeued += __atomic_load_n(&counts->dequeued, __ATOMIC_RELAXED);
+		stats->rejected += __atomic_load_n(&counts->rejected, __ATOMIC_RELAXED);
+		stats->failed_adds += __atomic_load_n(&counts->failed_adds, __ATOMIC_RELAXED);
+		stats->timed_out_waits += __atomic_load_n(&counts->timed_out_waits, __ATOMIC_RELAXED);
+		stats->evicted += __atomic_load_n(&counts->evicted, __ATOMIC_RELAXED);
+		stats->contended += __atomic_load_n(&counts->contended, __ATOMIC_RELAXED);
+		
+		long peak = __atomic_load_n(&counts->peak_size, __ATOMIC_RELAXED);
+		if(peak > stats->peak_size){
+			stats->peak_size = peak;
+		}
+	}
+	
+	return 1;
+}
+
+
+/* one more lock that was held by somebody else */
+void ptl_q_note_contention(ptl_q_t q){
+	struct ptl_q_stats_block *block = NULL;
+	
+	if(q != NULL && (block = _PTL_Q_STATS(q)) != NULL){
+		_PTL_Q_STAT_ADD(_ptl_q_my_stats(block), contended, 1);
+	}
+}
+
+
 /*
  * Checks to ensure all the function pointers are set.
  * Returns 1 if set, 0 otherwise.
@@ -152,3 +485,123 @@ int _check_function_ptrs(ptl_q_funcs_t q_functions) {
 	
 	return 1;
 }
+
+
+/* 'ready' check for spinning in ptl_q_get_wait */
+int _ptl_q_has_elements(void *q){
+	return ptl_q_size((ptl_q_t)q) > 0;
+}
+
+
+/* 'ready' check for spinning in ptl_q_add_wait */
+int _ptl_q_has_room(void *q){
+	ptl_q_t queue = (ptl_q_t)q;
+	
+	return queue->capacity <= 0 || ptl_q_size(queue) < queue->capacity;
+}
+
+
+/* the calling thread's stripe */
+struct ptl_q_stats *_ptl_q_my_stats(struct ptl_q_stats_block *block){
+	return &block->stripes[ptl_stats_stripe()].counts;
+}
+
+
+/* counts an add, and the size it left the queue at */
+void _ptl_q_count_add(ptl_q_t q, struct ptl_q_stats_block *block, int added, int refused){
+	struct ptl_q_stats *counts = _ptl_q_my_stats(block);
+	
+	if(refused > 0){
+		_PTL_Q_STAT_ADD(counts, rejected, refused);
+	}
+	if(added <= 0){ return; }
+	
+	_PTL_Q_STAT_ADD(counts, enqueued, added);
+	
+	long size = ptl_q_size(q);
+	long peak = __atomic_load_n(&counts->peak_size, __ATOMIC_RELAXED);
+	while(size > peak && 
+		  !__atomic_compare_exchange_n(&counts->peak_size, &peak, size, 1, 
+									   __ATOMIC_RELAXED, __ATOMIC_RELAXED)){
+		// 'peak' was reloaded
+	}
+}
+
+
+/* ptl_q_get_wait from a fiber: wait on 'fiber_wait' for an add to resume us */
+void* _ptl_q_fiber_get_wait(ptl_q_t q, long timeout){
+	ptl_q_funcs_t funcs = (ptl_q_funcs_t)(q->functions);
+	
+	void *value = funcs->ptl_q_get(q);
+	if(value != NULL){
+		return value;
+	}
+	
+	struct ptl_q_fiber_wait *wait = _ptl_q_get_fiber_wait(q);
+	unsigned long long end = ptl_get_time_nsec() + (unsigned long long)timeout * 1000000ULL;
+	
+	pthread_mutex_lock(&wait->mutex);
+	// pairs with the fence in _ptl_q_wake_fibers. Either the add sees us
+	// waiting, or the get below sees what it added
+	__atomic_add_fetch(&q->fiber_waiters, 1, __ATOMIC_SEQ_CST);
+	
+	while((value = funcs->ptl_q_get(q)) == NULL){
+		unsigned long long now = ptl_get_time_nsec();
+		long left = (now < end) ? (long)((end - now + 999999ULL) / 1000000ULL) : 0;
+		
+		if(!ptl_fiber_cond_wait(&wait->waiting, &wait->mutex, left)){
+			value = funcs->ptl_q_get(q); // one last try
+			break;
+		}
+	}
+	
+	__atomic_sub_fetch(&q->fiber_waiters, 1, __ATOMIC_RELEASE);
+	pthread_mutex_unlock(&wait->mutex);
+	
+	return value;
+}
+
+
+/* 'fiber_wait', made by whoever waits first */
+struct ptl_q_fiber_wait *_ptl_q_get_fiber_wait(ptl_q_t q){
+	struct ptl_q_fiber_wait *wait = __atomic_load_n((struct ptl_q_fiber_wait **)&q->fiber_wait, 
+													__ATOMIC_ACQUIRE);
+	if(wait != NULL){
+		return wait;
+	}
+	
+	struct ptl_q_fiber_wait *made = (struct ptl_q_fiber_wait *)calloc(1, sizeof(struct ptl_q_fiber_wait));
+	assert(made);
+	pthread_mutex_init(&made->mutex, NULL);
+	ptl_fiber_cond_init(&made->waiting);
+	
+	void *none = NULL;
+	if(!__atomic_compare_exchange_n(&q->fiber_wait, &none, made, 0,
+									__ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)){
+		pthread_mutex_destroy(&made->mutex);
+		FREE(made);
+		return (struct ptl_q_fiber_wait *)none;
+	}
+	
+	return made;
+}
+
+
+/* after 'added' elements went in; resume as many waiting fibers. Costs a
+   fence and a load while no fiber waits, and only a load until the process
+   makes its first fiber pool */
+void _ptl_q_wake_fibers(ptl_q_t q, int added){
+	if(added <= 0 || !__atomic_load_n(&ptl_fiber_in_use, __ATOMIC_ACQUIRE)){ return; }
+	
+	__atomic_thread_fence(__ATOMIC_SEQ_CST); // see _ptl_q_fiber_get_wait
+	
+	if(__atomic_load_n(&q->fiber_waiters, __ATOMIC_RELAXED) > 0){
+		struct ptl_q_fiber_wait *wait = _ptl_q_get_fiber_wait(q);
+		
+		pthread_mutex_lock(&wait->mutex);
+		while(added-- > 0 && ptl_fiber_cond_signal(&wait->waiting)){
+			// resumed one
+		}
+		pthread_mutex_unlock(&wait->mutex);
+	}
+}
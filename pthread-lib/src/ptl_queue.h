@@ -25,7 +25,27 @@
 #ifndef __PTL_QUEUE_H__
 #define __PTL_QUEUE_H__
 
-#define PTL_Q_TYPE_LENGTH 32
+#include <pthread.h>
+#include "ptl_wait.h"
+#include "ptl_fiber.h"
+#include "ptl_util.h"
+
+/* Queue types, the 'type' tag each init function sets */
+#define PTL_Q_TYPE_NONE     0
+#define PTL_Q_TYPE_LINKED   1
+#define PTL_Q_TYPE_ARRAY    2
+#define PTL_Q_TYPE_TWO_LOCK 3
+#define PTL_Q_TYPE_RING     4
+#define PTL_Q_TYPE_SPSC     5
+#define PTL_Q_TYPE_PRIORITY 6
+#define PTL_Q_TYPE_USER     64 // first tag for queue types outside this library
+
+#define PTL_Q_DRAIN_BATCH_SIZE 64 // elements taken per batch in ptl_q_drain_to
+
+/* lock a queue mutex, counting a contention event if another thread holds it */
+#define PTL_Q_LOCK(q, m) { if(pthread_mutex_trylock(m) != 0){ ptl_q_note_contention(q); pthread_mutex_lock(m); } }
+
+struct ptl_array_list;
 
 /* Structures */
 
@@ -36,17 +56,53 @@ struct ptl_q_element {
 	struct ptl_q_element *prev; // previous element in this list
 };
 	
-/* Essential Data Elements */
+/* 
+ * Essential Data Elements. Fields are grouped by who writes them, and each
+ * group starts on its own cache line, so producers updating the tail don't
+ * invalidate the line consumers read the head from. ptl_q_create_queue
+ * allocates it cache line aligned; don't put one on the stack or in another
+ * struct.
+ */
 struct ptl_q {
-	char type[PTL_Q_TYPE_LENGTH + 1]; // string description of this queue (array, linked, etc.)
-	long capacity; // total capacity (may be used to restrict size)
-	long size; // current size
-	struct ptl_q_element *head; // first element
-	struct ptl_q_element *tail; // last element
-	struct ptl_q_element *ptr; // misc ptr
+	/* read-mostly, set when the queue is made */
 	void *functions;
 	/*struct ptl_q_funcs *functions;*/ // functions used to operate on the queue
- };
+	int type; // PTL_Q_TYPE_* of this queue (array, linked, etc.)
+	long capacity; // total capacity (may be used to restrict size)
+	void *data; // private state for queue types that need more than head/tail
+	struct ptl_wait_strategy wait_strategy; // spinning before the *_wait calls sleep, none by default
+	void *stats; // striped counters, NULL until ptl_q_enable_stats
+	
+	/* producer side */
+	struct ptl_q_element *tail __attribute__((aligned(PTL_CACHE_LINE_SIZE))); // last element
+	pthread_mutex_t tail_mutex; // second lock for queues that lock each end
+	
+	/* consumer side, and the lock of queues with only one */
+	struct ptl_q_element *head __attribute__((aligned(PTL_CACHE_LINE_SIZE))); // first element
+	struct ptl_q_element *ptr; // misc ptr
+	pthread_mutex_t mutex; // lock owned by this queue (set up in init_queue)
+	
+	/* waiting, touched by both sides only when one may be asleep */
+	pthread_cond_t not_empty __attribute__((aligned(PTL_CACHE_LINE_SIZE))); // signalled when an element is added
+	pthread_cond_t not_full; // signalled when an element is removed
+	void *fiber_wait; // where fibers in ptl_q_get_wait wait, made by the first of them
+	int fiber_waiters; // fibers waiting in ptl_q_get_wait (atomic)
+	
+	/* both sides */
+	long size __attribute__((aligned(PTL_CACHE_LINE_SIZE))); // current size (updated atomically, see PTL_ATOMIC_*)
+ } __attribute__((aligned(PTL_CACHE_LINE_SIZE)));
+
+/* What a queue counted since ptl_q_enable_stats, see ptl_q_get_stats */
+struct ptl_q_stats {
+	unsigned long long enqueued; // elements added, by any add function
+	unsigned long long dequeued; // elements removed, evictions included
+	unsigned long long rejected; // elements a non-blocking add refused, the queue was full
+	unsigned long long failed_adds; // ptl_q_add_wait calls that timed out
+	unsigned long long timed_out_waits; // ptl_q_get_wait calls that timed out
+	unsigned long long evicted; // heads removed by ptl_q_add_evict
+	unsigned long long contended; // lock acquisitions that had to wait, none for lock-free types
+	long peak_size; // largest size seen after an add
+};
 
 /* Functions Pointers */
 struct ptl_q_funcs {
@@ -100,6 +156,33 @@ struct ptl_q_funcs {
 	 */
 	void *(*ptl_q_get_wait)(struct ptl_q*, long);
 
+	/**
+	 * Returns the number of elements in the queue. Optional, if NULL the
+	 * 'size' field is used. Queues that don't keep 'size' up to date
+	 * (see ptl_ring_queue.h) must supply it.
+	 */
+	long (*ptl_q_size)(struct ptl_q*);
+
+	/**
+	 * Inserts up to 'count' elements with one lock acquisition or CAS,
+	 * returning how many were added. Optional, if NULL ptl_q_add is
+	 * called for each element.
+	 */
+	int (*ptl_q_add_batch)(struct ptl_q*, void **, int);
+
+	/**
+	 * Retrieves and removes up to 'max' elements with one lock acquisition
+	 * or CAS, returning how many were stored. Optional, if NULL ptl_q_get
+	 * is called for each element.
+	 */
+	int (*ptl_q_get_batch)(struct ptl_q*, void **, int);
+
+	/**
+	 * Inserts an element, first removing the head if the queue is full, as
+	 * one operation. Optional, if NULL a get and then an add are used.
+	 */
+	int (*ptl_q_add_evict)(struct ptl_q*, void *, void **);
+
 };
 
 
@@ -118,12 +201,21 @@ typedef struct ptl_q_element* ptl_q_element_t;
  *
  * @param q_functions list of functions that will be used to implement the 
  *                    operations
- * @param capacity of this queue. If a linked queue, this is ignored. For an
- *		  array queue, then this is the max size
+ * @param capacity of this queue. For an array queue, then this is the max size.
+ *		  A linked queue is unbounded and preallocates this many nodes
+ *		  in its node pool instead (see ptl_node_pool.h)
  * @return new memory for this queue
  */
 ptl_q_t ptl_q_create_queue(ptl_q_funcs_t q_functions, int capacity);
 
+/**
+ * Name of the queue's type, for messages.
+ *
+ * @param queue to name
+ * @return "linked", "array", etc., "none" if 'q' is null or not set up
+ */
+const char *ptl_q_type_name(ptl_q_t q);
+
 /**
  * Creates an element/node that houses the 'value' given to it. This element
  * can be null to create a dummy node, however, logic may think it the end of 
@@ -164,6 +256,16 @@ int ptl_q_add(ptl_q_t q, void *value);
  */
 int ptl_q_add_wait(ptl_q_t q, void *value, long timeout);
 
+/**
+ * Sets how ptl_q_get_wait() and ptl_q_add_wait() wait. They spin and yield
+ * per 'strategy' first and only then sleep the way the queue type does.
+ * New queues don't spin. Not thread safe, set it before sharing the queue.
+ *
+ * @param queue to configure
+ * @param strategy copied into the queue, NULL to stop spinning
+ */
+void ptl_q_set_wait_strategy(ptl_q_t q, const struct ptl_wait_strategy *strategy);
+
 /**
  * Retrieves, but does not remove, the head of this queue.
  * This function is read-only and therefore does not block.
@@ -187,6 +289,8 @@ void* ptl_q_get(ptl_q_t q);
  * Retrieves and removes the head of this queue, waiting up to the specified
  * wait time if necessary for an element to become available.
  * This function will block once it enters the function mutex.
+ * Called from a fiber (see ptl_fiber.h) it suspends the fiber instead, the
+ * adds resume it.
  *
  * @param queue to get the first element
  * @param timeout number of milliseconds to wait for the get to be successful
@@ -202,6 +306,87 @@ void* ptl_q_get_wait(ptl_q_t q, long timeout);
  */
 void ptl_q_clear(ptl_q_t q);
 
+/**
+ * Inserts up to 'count' elements, in order, as one operation when the queue
+ * type supports it. A bounded queue stops adding when it is full.
+ *
+ * @param queue to add the elements
+ * @param values elements to add
+ * @param count number of elements in 'values'
+ * @return number of elements added, from the front of 'values'
+ */
+int ptl_q_add_batch(ptl_q_t q, void **values, int count);
+
+/**
+ * Retrieves and removes up to 'max' elements from the head of the queue as one
+ * operation when the queue type supports it. Does not wait.
+ *
+ * @param queue to get the elements from
+ * @param values where the elements are stored, in queue order
+ * @param max room in 'values'
+ * @return number of elements stored in 'values'
+ */
+int ptl_q_get_batch(ptl_q_t q, void **values, int max);
+
+/**
+ * Inserts 'value'. If the queue is full its head is removed to make room,
+ * under the same lock when the queue type supports it. Otherwise the head
+ * is taken and the add tried once more, so another thread may take the room
+ * first; the caller then disposes of 'evicted' and may try again.
+ *
+ * @param queue to add the element
+ * @param value to add to the queue
+ * @param evicted set to the element removed to make room, or NULL
+ * @return 1 if 'value' was added, 0 otherwise
+ */
+int ptl_q_add_evict(ptl_q_t q, void *value, void **evicted);
+
+/**
+ * Moves every element currently in the queue to the end of 'list', using
+ * ptl_q_get_batch() so the queue is locked once per batch, not per element.
+ *
+ * @param queue to drain
+ * @param list array list that receives the elements
+ * @return number of elements moved
+ */
+int ptl_q_drain_to(ptl_q_t q, struct ptl_array_list *list);
+
+/**
+ * Starts counting what happens to the queue (see struct ptl_q_stats). Until
+ * this is called the operations only pay for one NULL check. Counting can't
+ * be turned off again, ptl_q_destroy_queue frees the counters.
+ *
+ * @param queue to count
+ */
+void ptl_q_enable_stats(ptl_q_t q);
+
+/**
+ * Adds up the per-thread counters. Counts taken while other threads use
+ * the queue are each up to date, they may just not add up to each other.
+ *
+ * @param queue to read
+ * @param stats filled in, zeroed if counting isn't on
+ * @return 1 if counting is on, 0 otherwise
+ */
+int ptl_q_get_stats(ptl_q_t q, struct ptl_q_stats *stats);
+
+/**
+ * Counts one contention event, for queue types to call when they had to
+ * wait for a lock (see PTL_Q_LOCK). Does nothing unless counting is on.
+ *
+ * @param queue that was contended
+ */
+void ptl_q_note_contention(ptl_q_t q);
+
+/**
+ * Returns the number of elements currently in the queue. Other threads may
+ * change it at any time, so treat it as a hint.
+ *
+ * @param queue to get the size of
+ * @return number of elements in the queue, 0 if 'q' is null
+ */
+long ptl_q_size(ptl_q_t q);
+
 
  
 #endif
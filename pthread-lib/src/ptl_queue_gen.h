@@ -0,0 +1,443 @@
+/*
+ * This file is part of the pthread-lib Library.
+ * Copyright (C) 2008-2009 Nick Powers.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Library General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor Boston, MA 02110-1301,  USA
+ */
+
+/**
+ * Generators for queues specialized to one element type. Each macro expands
+ * to a struct and static inline functions, so there is no function table and
+ * no indirect call, and the compiler can inline the whole fast path.
+ * Elements are stored by value: a queue of ints or of small structs needs no
+ * malloc per element, let alone per message.
+ *
+ *   PTL_DEFINE_RING(name, elem_type, capacity_pow2)
+ *       a bounded lock-free ring any number of producers and consumers can
+ *       share, the same algorithm as ptl_ring_queue.h. The capacity is a
+ *       compile-time power of two and the slots live inside the struct.
+ *
+ *   PTL_DEFINE_LQ(name, elem_type)
+ *       an unbounded FIFO behind one lock, as ptl_linked_queue.h. Removed
+ *       nodes are kept on a free list of up to PTL_GEN_LQ_MAX_FREE, so a
+ *       queue in a steady state stops calling malloc.
+ *
+ * Both generate, for 'name':
+ *
+ *   struct name;
+ *   void name_init(struct name *q);
+ *   void name_destroy(struct name *q);
+ *   int  name_add(struct name *q, elem_type value);        1, or 0 if full
+ *   int  name_add_wait(struct name *q, elem_type value, long timeout);
+ *   int  name_get(struct name *q, elem_type *value);       1, or 0 if empty
+ *   int  name_get_wait(struct name *q, elem_type *value, long timeout);
+ *   long name_size(struct name *q);
+ *   void name_clear(struct name *q);
+ *
+ * plus name_peek(q, &value) for PTL_DEFINE_LQ. A ring can't copy a slot it
+ * doesn't own without the copy tearing, so it has no peek. Timeouts are in
+ * ms, as with ptl_q_add_wait. Every value is a valid element, 0 included,
+ * so get returns its result through a pointer.
+ *
+ * Use one in a single .c file, or in a header of your own:
+ *
+ *   PTL_DEFINE_RING(int_ring, int, 1024)
+ *
+ *   static struct int_ring ring;   (or ptl_cache_aligned_alloc'd)
+ *   int_ring_init(&ring);
+ *   int_ring_add(&ring, 42);
+ *   int v; if(int_ring_get(&ring, &v)) ...
+ *
+ * A ring holds its slots, so a big ring belongs in static or heap memory,
+ * cache line aligned, and not on a thread's stack.
+ */
+
+#ifndef __PTL_QUEUE_GEN_H__
+#define __PTL_QUEUE_GEN_H__
+
+#include <pthread.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <assert.h>
+#include "ptl_util.h"
+
+/* Constants */
+#define PTL_GEN_LQ_MAX_FREE 1024	/**< nodes a PTL_DEFINE_LQ queue keeps for reuse */
+
+
+/* Private Functions, shared by the generated queues */
+
+/* signal 'cond' only if someone is sleeping on it, see _ptl_rq_wake */
+static inline void _ptl_gen_wake(pthread_mutex_t *mutex, int *waiters, pthread_cond_t *cond){
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	
+	if(__atomic_load_n(waiters, __ATOMIC_RELAXED) > 0){
+		pthread_mutex_lock(mutex);
+		pthread_cond_signal(cond);
+		pthread_mutex_unlock(mutex);
+	}
+}
+
+
+/**
+ * Bounded lock-free MPMC ring of 'elem_type', 'capacity_pow2' slots.
+ */
+#define PTL_DEFINE_RING(name, elem_type, capacity_pow2) \
+\
+/* fails to compile unless the capacity is a power of two, 2 or more */ \
+typedef char name##_capacity_check[((capacity_pow2) >= 2 &&  \
+	(((capacity_pow2) & ((capacity_pow2) - 1)) == 0)) ? 1 : -1]; \
+\
+struct name##_slot { \
+	unsigned long seq; \
+	elem_type value; \
+}; \
+\
+struct name { \
+	unsigned long enqueue_pos __attribute__((aligned(PTL_CACHE_LINE_SIZE))); \
+	int add_waiters; \
+	unsigned long dequeue_pos __attribute__((aligned(PTL_CACHE_LINE_SIZE))); \
+	int get_waiters; \
+	pthread_mutex_t mutex __attribute__((aligned(PTL_CACHE_LINE_SIZE))); \
+	pthread_cond_t not_empty; \
+	pthread_cond_t not_full; \
+	struct name##_slot slots[capacity_pow2] __attribute__((aligned(PTL_CACHE_LINE_SIZE))); \
+}; \
+\
+static inline void name##_init(struct name *q){ \
+	unsigned long i = 0; \
+	 \
+	q->enqueue_pos = q->dequeue_pos = 0; \
+	q->add_waiters = q->get_waiters = 0; \
+	pthread_mutex_init(&q->mutex, NULL); \
+	ptl_cond_init(&q->not_empty); \
+	ptl_cond_init(&q->not_full); \
+	for(i = 0; i < (capacity_pow2); i++){ \
+		q->slots[i].seq = i; \
+	} \
+} \
+\
+static inline void name##_destroy(struct name *q){ \
+	pthread_mutex_destroy(&q->mutex); \
+	pthread_cond_destroy(&q->not_empty); \
+	pthread_cond_destroy(&q->not_full); \
+} \
+\
+static inline int name##_try_add(struct name *q, elem_type value){ \
+	unsigned long pos = __atomic_load_n(&q->enqueue_pos, __ATOMIC_RELAXED); \
+	struct name##_slot *slot = NULL; \
+	 \
+	for(;;){ \
+		slot = &q->slots[pos & ((capacity_pow2) - 1)]; \
+		long dif = (long)__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) - (long)pos; \
+		 \
+		if(dif == 0){ \
+			if(__atomic_compare_exchange_n(&q->enqueue_pos, &pos, pos + 1, 1, \
+										   __ATOMIC_RELAXED, __ATOMIC_RELAXED)){ \
+				break; \
+			} \
+		} else if(dif < 0){ \
+			return 0; \
+		} else { \
+			pos = __atomic_load_n(&q->enqueue_pos, __ATOMIC_RELAXED); \
+		} \
+	} \
+	 \
+	slot->value = value; \
+	__atomic_store_n(&slot->seq, pos + 1, __ATOMIC_RELEASE); \
+	 \
+	return 1; \
+} \
+\
+static inline int name##_try_get(struct name *q, elem_type *value){ \
+	unsigned long pos = __atomic_load_n(&q->dequeue_pos, __ATOMIC_RELAXED); \
+	struct name##_slot *slot = NULL; \
+	 \
+	for(;;){ \
+		slot = &q->slots[pos & ((capacity_pow2) - 1)]; \
+		long dif = (long)__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) - (long)(pos + 1); \
+		 \
+		if(dif == 0){ \
+			if(__atomic_compare_exchange_n(&q->dequeue_pos, &pos, pos + 1, 1, \
+										   __ATOMIC_RELAXED, __ATOMIC_RELAXED)){ \
+				break; \
+			} \
+		} else if(dif < 0){ \
+			return 0; \
+		} else { \
+			pos = __atomic_load_n(&q->dequeue_pos, __ATOMIC_RELAXED); \
+		} \
+	} \
+	 \
+	*value = slot->value; \
+	__atomic_store_n(&slot->seq, pos + (capacity_pow2), __ATOMIC_RELEASE); \
+	 \
+	return 1; \
+} \
+\
+static inline int name##_add(struct name *q, elem_type value){ \
+	if(!name##_try_add(q, value)){ return 0; } \
+	 \
+	_ptl_gen_wake(&q->mutex, &q->get_waiters, &q->not_empty); \
+	 \
+	return 1; \
+} \
+\
+static inline int name##_get(struct name *q, elem_type *value){ \
+	if(!name##_try_get(q, value)){ return 0; } \
+	 \
+	_ptl_gen_wake(&q->mutex, &q->add_waiters, &q->not_full); \
+	 \
+	return 1; \
+} \
+\
+static inline int name##_add_wait(struct name *q, elem_type value, long timeout){ \
+	if(timeout < 0){ return 0; } \
+	if(name##_add(q, value)){ return 1; } \
+	 \
+	struct timespec deadline; \
+	int added = 0; \
+	 \
+	ptl_get_future_time(&deadline, timeout * 1000); \
+	pthread_mutex_lock(&q->mutex); \
+	__atomic_add_fetch(&q->add_waiters, 1, __ATOMIC_SEQ_CST); \
+	while(!(added = name##_try_add(q, value))){ \
+		if(pthread_cond_timedwait(&q->not_full, &q->mutex, &deadline) == ETIMEDOUT){ \
+			added = name##_try_add(q, value); \
+			break; \
+		} \
+	} \
+	__atomic_sub_fetch(&q->add_waiters, 1, __ATOMIC_SEQ_CST); \
+	pthread_mutex_unlock(&q->mutex); \
+	 \
+	if(added){ \
+		_ptl_gen_wake(&q->mutex, &q->get_waiters, &q->not_empty); \
+	} \
+	 \
+	return added; \
+} \
+\
+static inline int name##_get_wait(struct name *q, elem_type *value, long timeout){ \
+	if(timeout < 0){ return 0; } \
+	if(name##_get(q, value)){ return 1; } \
+	 \
+	struct timespec deadline; \
+	int got = 0; \
+	 \
+	ptl_get_future_time(&deadline, timeout * 1000); \
+	pthread_mutex_lock(&q->mutex); \
+	__atomic_add_fetch(&q->get_waiters, 1, __ATOMIC_SEQ_CST); \
+	while(!(got = name##_try_get(q, value))){ \
+		if(pthread_cond_timedwait(&q->not_empty, &q->mutex, &deadline) == ETIMEDOUT){ \
+			got = name##_try_get(q, value); \
+			break; \
+		} \
+	} \
+	__atomic_sub_fetch(&q->get_waiters, 1, __ATOMIC_SEQ_CST); \
+	pthread_mutex_unlock(&q->mutex); \
+	 \
+	if(got){ \
+		_ptl_gen_wake(&q->mutex, &q->add_waiters, &q->not_full); \
+	} \
+	 \
+	return got; \
+} \
+\
+static inline long name##_size(struct name *q){ \
+	unsigned long dequeue_pos = __atomic_load_n(&q->dequeue_pos, __ATOMIC_ACQUIRE); \
+	unsigned long enqueue_pos = __atomic_load_n(&q->enqueue_pos, __ATOMIC_ACQUIRE); \
+	long size = (long)(enqueue_pos - dequeue_pos); \
+	 \
+	return (size > (long)(capacity_pow2)) ? (long)(capacity_pow2) : size; \
+} \
+\
+static inline void name##_clear(struct name *q){ \
+	elem_type value; \
+	 \
+	while(name##_get(q, &value)){ \
+		; \
+	} \
+}
+/* end PTL_DEFINE_RING */
+
+
+/**
+ * Unbounded FIFO of 'elem_type' behind one lock.
+ */
+#define PTL_DEFINE_LQ(name, elem_type) \
+\
+struct name##_node { \
+	struct name##_node *next; \
+	elem_type value; \
+}; \
+\
+struct name { \
+	pthread_mutex_t mutex; \
+	pthread_cond_t not_empty; \
+	struct name##_node *head; \
+	struct name##_node *tail; \
+	struct name##_node *free_nodes; \
+	long free_count; \
+	long size; \
+	int get_waiters; \
+}; \
+\
+static inline void name##_init(struct name *q){ \
+	pthread_mutex_init(&q->mutex, NULL); \
+	ptl_cond_init(&q->not_empty); \
+	q->head = q->tail = q->free_nodes = NULL; \
+	q->free_count = 0; \
+	q->size = 0; \
+	q->get_waiters = 0; \
+} \
+\
+static inline void name##_free_list(struct name##_node *node){ \
+	while(node != NULL){ \
+		struct name##_node *next = node->next; \
+		free(node); \
+		node = next; \
+	} \
+} \
+\
+static inline void name##_destroy(struct name *q){ \
+	name##_free_list(q->head); \
+	name##_free_list(q->free_nodes); \
+	q->head = q->tail = q->free_nodes = NULL; \
+	pthread_mutex_destroy(&q->mutex); \
+	pthread_cond_destroy(&q->not_empty); \
+} \
+\
+static inline int name##_add(struct name *q, elem_type value){ \
+	struct name##_node *node = NULL; \
+	 \
+	pthread_mutex_lock(&q->mutex); \
+	if((node = q->free_nodes) != NULL){ \
+		q->free_nodes = node->next; \
+		q->free_count--; \
+	} else { \
+		pthread_mutex_unlock(&q->mutex); \
+		node = (struct name##_node *)malloc(sizeof(struct name##_node)); \
+		assert(node); \
+		pthread_mutex_lock(&q->mutex); \
+	} \
+	node->value = value; \
+	node->next = NULL; \
+	if(q->tail == NULL){ \
+		q->head = node; \
+	} else { \
+		q->tail->next = node; \
+	} \
+	q->tail = node; \
+	q->size++; \
+	if(q->get_waiters > 0){ \
+		pthread_cond_signal(&q->not_empty); \
+	} \
+	pthread_mutex_unlock(&q->mutex); \
+	 \
+	return 1; \
+} \
+\
+static inline int name##_add_wait(struct name *q, elem_type value, long timeout){ \
+	return name##_add(q, value); \
+} \
+\
+/* the lock is held */ \
+static inline void name##_take(struct name *q, elem_type *value){ \
+	struct name##_node *node = q->head; \
+	 \
+	*value = node->value; \
+	if((q->head = node->next) == NULL){ \
+		q->tail = NULL; \
+	} \
+	q->size--; \
+	if(q->free_count < PTL_GEN_LQ_MAX_FREE){ \
+		node->next = q->free_nodes; \
+		q->free_nodes = node; \
+		q->free_count++; \
+	} else { \
+		free(node); \
+	} \
+} \
+\
+static inline int name##_get(struct name *q, elem_type *value){ \
+	int got = 0; \
+	 \
+	pthread_mutex_lock(&q->mutex); \
+	if(q->head != NULL){ \
+		name##_take(q, value); \
+		got = 1; \
+	} \
+	pthread_mutex_unlock(&q->mutex); \
+	 \
+	return got; \
+} \
+\
+static inline int name##_get_wait(struct name *q, elem_type *value, long timeout){ \
+	if(timeout < 0){ return 0; } \
+	 \
+	struct timespec deadline; \
+	int got = 0; \
+	 \
+	ptl_get_future_time(&deadline, timeout * 1000); \
+	pthread_mutex_lock(&q->mutex); \
+	q->get_waiters++; \
+	while(q->head == NULL){ \
+		if(pthread_cond_timedwait(&q->not_empty, &q->mutex, &deadline) == ETIMEDOUT){ \
+			break; \
+		} \
+	} \
+	q->get_waiters--; \
+	if(q->head != NULL){ \
+		name##_take(q, value); \
+		got = 1; \
+	} \
+	pthread_mutex_unlock(&q->mutex); \
+	 \
+	return got; \
+} \
+\
+static inline int name##_peek(struct name *q, elem_type *value){ \
+	int got = 0; \
+	 \
+	pthread_mutex_lock(&q->mutex); \
+	if(q->head != NULL){ \
+		*value = q->head->value; \
+		got = 1; \
+	} \
+	pthread_mutex_unlock(&q->mutex); \
+	 \
+	return got; \
+} \
+\
+static inline long name##_size(struct name *q){ \
+	long size = 0; \
+	 \
+	pthread_mutex_lock(&q->mutex); \
+	size = q->size; \
+	pthread_mutex_unlock(&q->mutex); \
+	 \
+	return size; \
+} \
+\
+static inline void name##_clear(struct name *q){ \
+	elem_type value; \
+	 \
+	while(name##_get(q, &value)){ \
+		; \
+	} \
+}
+/* end PTL_DEFINE_LQ */
+
+#endif
@@ -0,0 +1,499 @@
+/*
+ * This file is part of the pthread-lib Library.
+ * Copyright (C) 2008-2009 Nick Powers.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Library General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor Boston, MA 02110-1301,  USA
+ */
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <assert.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include "ptl_reactor.h"
+#include "ptl_util.h"
+
+#define PTL_REACTOR_BUSY 0x20000	/**< in 'state': a callback is queued or running */
+#define PTL_REACTOR_EVENT_MASK (EPOLLIN | EPOLLOUT | EPOLLPRI | EPOLLERR | EPOLLHUP | EPOLLRDHUP)
+
+/* Private Functions */
+int _ptl_reactor_start_loop(ptl_reactor_t reactor, struct ptl_reactor_loop *loop);
+void *_ptl_reactor_run(void *loop);
+int _ptl_reactor_ready(ptl_reactor_handle_t handle, int events);
+void *_ptl_reactor_dispatch(void *handle);
+ptl_task_t _ptl_reactor_task(ptl_reactor_handle_t handle, ptl_future_t *future);
+void _ptl_reactor_submit(ptl_reactor_t reactor, ptl_task_t *tasks, ptl_future_t *futures, int count);
+void _ptl_reactor_resume(ptl_reactor_handle_t handle);
+int _ptl_reactor_arm(ptl_reactor_handle_t handle, int op);
+void _ptl_reactor_timers_expired(struct ptl_timer **timers, int count, void *reactor);
+void _ptl_reactor_bury(ptl_reactor_handle_t handle);
+void _ptl_reactor_reap(struct ptl_reactor_loop *loop);
+void _ptl_reactor_link(ptl_reactor_handle_t *list, ptl_reactor_handle_t handle);
+void _ptl_reactor_unlink(ptl_reactor_handle_t *list, ptl_reactor_handle_t handle);
+void _ptl_reactor_free_list(ptl_reactor_handle_t list);
+
+
+/* Public Functions */
+
+/* the timer wheel, then one epoll thread per loop */
+ptl_reactor_t ptl_reactor_create(ptl_thread_manager_t manager, int threads){
+	if(manager == NULL){ return NULL; }
+	if(threads <= 0){ threads = 1; }
+	
+	// it would drop queued callbacks the reactor never hears of
+	if(__atomic_load_n(&manager->rejection_policy, __ATOMIC_ACQUIRE) == ptl_q_discard_oldest_policy){
+		return NULL;
+	}
+	
+	ptl_reactor_t reactor = (ptl_reactor_t)calloc(1, sizeof(struct ptl_reactor));
+	assert(reactor);
+	
+	reactor->manager = manager;
+	reactor->running = 1;
+	reactor->loops = (struct ptl_reactor_loop *)calloc(threads, sizeof(struct ptl_reactor_loop));
+	assert(reactor->loops);
+	
+	reactor->timer_wheel = ptl_tw_create(PTL_TW_DEFAULT_TICK_MSEC, _ptl_reactor_timers_expired,
+										 reactor);
+	if(reactor->timer_wheel == NULL){
+		FREE(reactor->loops);
+		FREE(reactor);
+		return NULL;
+	}
+	
+	int i = 0;
+	for(i = 0; i < threads; i++){
+		if(!_ptl_reactor_start_loop(reactor, &reactor->loops[i])){
+			ptl_reactor_destroy(reactor); // the loops started so far
+			return NULL;
+		}
+		reactor->num_loops++;
+	}
+	
+	return reactor;
+}
+
+
+/* wake and join the threads; after the wheel is gone nothing sees a handle */
+void ptl_reactor_destroy(ptl_reactor_t reactor){
+	if(reactor == NULL){ return; }
+	
+	__atomic_store_n(&reactor->running, 0, __ATOMIC_RELEASE);
+	
+	int i = 0;
+	for(i = 0; i < reactor->num_loops; i++){
+		uint64_t one = 1;
+		if(write(reactor->loops[i].wake_fd, &one, sizeof(one)) < 0){
+			// it still looks at 'running' every PTL_REACTOR_POLL_MSEC
+		}
+	}
+	for(i = 0; i < reactor->num_loops; i++){
+		pthread_join(reactor->loops[i].thread, NULL);
+	}
+	
+	ptl_tw_destroy(reactor->timer_wheel);
+	
+	for(i = 0; i < reactor->num_loops; i++){
+		struct ptl_reactor_loop *loop = &reactor->loops[i];
+		
+		close(loop->epoll_fd);
+		close(loop->wake_fd);
+		_ptl_reactor_free_list(loop->handles);
+		_ptl_reactor_free_list(loop->dead);
+		pthread_mutex_destroy(&loop->mutex);
+	}
+	
+	FREE(reactor->loops);
+	FREE(reactor);
+}
+
+
+/* pick a loop round robin, and register with its epoll */
+ptl_reactor_handle_t ptl_reactor_add(ptl_reactor_t reactor, int fd, int events, int mode,
+									 int (*callback)(ptl_reactor_handle_t, int, void *),
+									 void *arg){
+	if(reactor == NULL || fd < 0 || callback == NULL){ return NULL; }
+	
+	ptl_reactor_handle_t handle = 
+		(ptl_reactor_handle_t)calloc(1, sizeof(struct ptl_reactor_handle));
+	assert(handle);
+	
+	handle->fd = fd;
+	handle->events = events;
+	handle->mode = mode;
+	handle->callback = callback;
+	handle->arg = arg;
+	ptl_tw_init_timer(&handle->timer, handle);
+	ptl_tw_init_timer(&handle->reaper, handle);
+	
+	unsigned int next = (unsigned int)__atomic_fetch_add(&reactor->next_loop, 1, __ATOMIC_RELAXED);
+	struct ptl_reactor_loop *loop = &reactor->loops[next % (unsigned int)reactor->num_loops];
+	handle->loop = loop;
+	
+	pthread_mutex_lock(&loop->mutex);
+	_ptl_reactor_link(&loop->handles, handle);
+	if(!_ptl_reactor_arm(handle, EPOLL_CTL_ADD)){
+		_ptl_reactor_unlink(&loop->handles, handle);
+		pthread_mutex_unlock(&loop->mutex);
+		FREE(handle);
+		return NULL;
+	}
+	pthread_mutex_unlock(&loop->mutex);
+	
+	return handle;
+}
+
+
+/* new interest, armed again */
+int ptl_reactor_rearm(ptl_reactor_t reactor, ptl_reactor_handle_t handle, int events){
+	if(reactor == NULL || handle == NULL){ return 0; }
+	
+	int armed = 0;
+	
+	pthread_mutex_lock(&handle->loop->mutex);
+	if(!handle->removed){
+		handle->events = events;
+		armed = _ptl_reactor_arm(handle, EPOLL_CTL_MOD);
+	}
+	pthread_mutex_unlock(&handle->loop->mutex);
+	
+	return armed;
+}
+
+
+/* (re)start the idle timer, or stop it */
+int ptl_reactor_set_timeout(ptl_reactor_t reactor, ptl_reactor_handle_t handle,
+							long timeout_msec){
+	if(reactor == NULL || handle == NULL){ return 0; }
+	
+	pthread_mutex_lock(&handle->loop->mutex);
+	if(handle->removed){
+		pthread_mutex_unlock(&handle->loop->mutex);
+		return 0;
+	}
+	
+	__atomic_store_n(&handle->timeout_msec, (timeout_msec > 0) ? timeout_msec : 0, 
+					 __ATOMIC_RELAXED);
+	ptl_tw_cancel(reactor->timer_wheel, &handle->timer);
+	if(timeout_msec > 0){
+		ptl_tw_add(reactor->timer_wheel, &handle->timer, timeout_msec);
+	}
+	pthread_mutex_unlock(&handle->loop->mutex);
+	
+	return 1;
+}
+
+
+/**
+ * Once 'removed' is set under the loop's lock, nobody arms the descriptor
+ * or the timer again. The loop's thread may still hold the handle from an
+ * epoll_wait, and the timer thread may be handing out its timeout, so it
+ * isn't freed here: the reaper timer fires after the timer thread is done
+ * with it, the loop's thread frees it on the next round once no callback
+ * is queued or running.
+ */
+int ptl_reactor_remove(ptl_reactor_t reactor, ptl_reactor_handle_t handle){
+	if(reactor == NULL || handle == NULL){ return 0; }
+	
+	struct ptl_reactor_loop *loop = handle->loop;
+	
+	pthread_mutex_lock(&loop->mutex);
+	if(handle->removed){
+		pthread_mutex_unlock(&loop->mutex);
+		return 0;
+	}
+	
+	__atomic_store_n(&handle->removed, 1, __ATOMIC_RELEASE);
+	epoll_ctl(loop->epoll_fd, EPOLL_CTL_DEL, handle->fd, NULL);
+	ptl_tw_cancel(reactor->timer_wheel, &handle->timer);
+	ptl_tw_add(reactor->timer_wheel, &handle->reaper, 1);
+	pthread_mutex_unlock(&loop->mutex);
+	
+	return 1;
+}
+
+
+/* Private Functions */
+
+/* epoll instance, wake up eventfd and thread of one loop */
+int _ptl_reactor_start_loop(ptl_reactor_t reactor, struct ptl_reactor_loop *loop){
+	loop->reactor = reactor;
+	loop->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	loop->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	pthread_mutex_init(&loop->mutex, NULL);
+	
+	struct epoll_event event;
+	memset(&event, 0, sizeof(struct epoll_event));
+	event.events = EPOLLIN;
+	event.data.ptr = NULL; // tells the wake up fd from the handles
+	
+	if(loop->epoll_fd >= 0 && loop->wake_fd >= 0 &&
+	   epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, loop->wake_fd, &event) == 0 &&
+	   pthread_create(&loop->thread, NULL, _ptl_reactor_run, loop) == 0){
+		return 1;
+	}
+	
+	if(loop->epoll_fd >= 0){ close(loop->epoll_fd); }
+	if(loop->wake_fd >= 0){ close(loop->wake_fd); }
+	pthread_mutex_destroy(&loop->mutex);
+	
+	return 0;
+}
+
+
+/**
+ * Thread of one loop. Turns the events of each epoll_wait into one task per
+ * handle that wasn't busy yet, and submits them in one batch. Ends once the
+ * reactor is destroyed or the manager stops running.
+ */
+void *_ptl_reactor_run(void *arg){
+	struct ptl_reactor_loop *loop = (struct ptl_reactor_loop *)arg;
+	ptl_reactor_t reactor = loop->reactor;
+	struct epoll_event events[PTL_REACTOR_MAX_EVENTS];
+	ptl_task_t tasks[PTL_REACTOR_MAX_EVENTS];
+	ptl_future_t futures[PTL_REACTOR_MAX_EVENTS];
+	int i = 0;
+	
+	while(PTL_ATOMIC_LOAD(reactor->running) &&
+		  PTL_ATOMIC_LOAD(reactor->manager->run_state) == PTL_RUNNING){
+		_ptl_reactor_reap(loop); // nothing from the last epoll_wait is in use now
+		
+		int n = epoll_wait(loop->epoll_fd, events, PTL_REACTOR_MAX_EVENTS, PTL_REACTOR_POLL_MSEC);
+		int count = 0;
+		
+		for(i = 0; i < n; i++){
+			ptl_reactor_handle_t handle = (ptl_reactor_handle_t)events[i].data.ptr;
+			
+			if(handle == NULL){
+				uint64_t value = 0;
+				if(read(loop->wake_fd, &value, sizeof(value)) < 0){
+					// already read, it's non-blocking
+				}
+				continue;
+			}
+			if(_ptl_reactor_ready(handle, events[i].events & PTL_REACTOR_EVENT_MASK)){
+				tasks[count] = _ptl_reactor_task(handle, &futures[count]);
+				count++;
+			}
+		}
+		
+		if(count > 0){
+			_ptl_reactor_submit(reactor, tasks, futures, count);
+		}
+	}
+	
+	return NULL;
+}
+
+
+/* add 'events' to the handle; 1 if it wasn't busy, so a callback must be queued */
+int _ptl_reactor_ready(ptl_reactor_handle_t handle, int events){
+	int old = __atomic_fetch_or(&handle->state, events | PTL_REACTOR_BUSY, __ATOMIC_ACQ_REL);
+	
+	return !(old & PTL_REACTOR_BUSY);
+}
+
+
+/* worker; hand the events to the callback until no more came in meanwhile */
+void *_ptl_reactor_dispatch(void *arg){
+	ptl_reactor_handle_t handle = (ptl_reactor_handle_t)arg;
+	ptl_reactor_t reactor = handle->loop->reactor;
+	
+	for(;;){
+		int events = __atomic_fetch_and(&handle->state, PTL_REACTOR_BUSY, __ATOMIC_ACQ_REL) &
+			~PTL_REACTOR_BUSY;
+		
+		if(events != 0 && !PTL_ATOMIC_LOAD(handle->removed)){
+			if(PTL_ATOMIC_LOAD(handle->timeout_msec) > 0){
+				ptl_tw_cancel(reactor->timer_wheel, &handle->timer); // it's not idle
+			}
+			
+			if(handle->callback(handle, events, handle->arg) == PTL_REACTOR_KEEP){
+				_ptl_reactor_resume(handle);
+			} else {
+				ptl_reactor_remove(reactor, handle);
+			}
+		}
+		
+		// idle again, unless events came in; from here it may be reaped
+		int expected = PTL_REACTOR_BUSY;
+		if(__atomic_compare_exchange_n(&handle->state, &expected, 0, 0,
+									   __ATOMIC_RELEASE, __ATOMIC_RELAXED)){
+			return handle; // non-NULL, so _ptl_reactor_submit tells it from a rejection
+		}
+	}
+}
+
+
+/* a callback task for a handle that just went BUSY, with a hold on its
+   future so _ptl_reactor_submit can see if it was rejected */
+ptl_task_t _ptl_reactor_task(ptl_reactor_handle_t handle, ptl_future_t *future){
+	ptl_task_t task = create_task_with_arg(_ptl_reactor_dispatch, handle);
+	*future = ptl_task_get_future(task);
+	
+	return task;
+}
+
+
+/* hand the callbacks to the manager in one batch. A rejected one leaves its
+   handle BUSY and unarmed, so it runs here instead; once the manager stopped
+   the handle is only let go of, for ptl_reactor_remove to reap */
+void _ptl_reactor_submit(ptl_reactor_t reactor, ptl_task_t *tasks, ptl_future_t *futures, int count){
+	int i = 0;
+	
+	submit_batch(reactor->manager, tasks, count);
+	
+	for(i = 0; i < count; i++){
+		// finished without a result: rejected (nothing cancels these)
+		if(ptl_future_is_done(futures[i]) && ptl_future_get(futures[i], 0) == NULL){
+			ptl_reactor_handle_t handle = (ptl_reactor_handle_t)tasks[i]->arg;
+			
+			if(PTL_ATOMIC_LOAD(reactor->manager->run_state) == PTL_RUNNING){
+				_ptl_reactor_dispatch(handle);
+			} else {
+				__atomic_store_n(&handle->state, 0, __ATOMIC_RELEASE);
+			}
+		}
+		ptl_future_destroy(futures[i]);
+	}
+}
+
+
+/* after a callback kept the handle; arm the descriptor and the idle timer again */
+void _ptl_reactor_resume(ptl_reactor_handle_t handle){
+	ptl_reactor_t reactor = handle->loop->reactor;
+	long timeout_msec = PTL_ATOMIC_LOAD(handle->timeout_msec);
+	
+	if(handle->mode != PTL_REACTOR_LEVEL && timeout_msec == 0){
+		return; // nothing to arm, no lock
+	}
+	
+	pthread_mutex_lock(&handle->loop->mutex);
+	if(!handle->removed){
+		if(handle->mode == PTL_REACTOR_LEVEL){
+			_ptl_reactor_arm(handle, EPOLL_CTL_MOD);
+		}
+		if(handle->timeout_msec > 0){
+			ptl_tw_add(reactor->timer_wheel, &handle->timer, handle->timeout_msec);
+		}
+	}
+	pthread_mutex_unlock(&handle->loop->mutex);
+}
+
+
+/* epoll_ctl the handle in, one-shot unless edge-triggered. The loop's lock is held */
+int _ptl_reactor_arm(ptl_reactor_handle_t handle, int op){
+	struct epoll_event event;
+	memset(&event, 0, sizeof(struct epoll_event));
+	
+	event.events = (handle->events & (EPOLLIN | EPOLLOUT | EPOLLPRI)) | EPOLLRDHUP;
+	event.events |= (handle->mode == PTL_REACTOR_EDGE) ? EPOLLET : EPOLLONESHOT;
+	event.data.ptr = handle;
+	
+	return epoll_ctl(handle->loop->epoll_fd, op, handle->fd, &event) == 0;
+}
+
+
+/* timer thread; queue the timeouts in one batch, hand reaped handles to their loop */
+void _ptl_reactor_timers_expired(struct ptl_timer **timers, int count, void *context){
+	ptl_reactor_t reactor = (ptl_reactor_t)context;
+	ptl_task_t tasks[PTL_TW_BATCH_SIZE];
+	ptl_future_t futures[PTL_TW_BATCH_SIZE];
+	int n = 0;
+	int i = 0;
+	
+	for(i = 0; i < count; i++){
+		ptl_reactor_handle_t handle = (ptl_reactor_handle_t)timers[i]->data;
+		
+		if(timers[i] == &handle->reaper){
+			_ptl_reactor_bury(handle); // this thread won't touch it again
+		} else if(_ptl_reactor_ready(handle, PTL_REACTOR_TIMEOUT)){
+			tasks[n] = _ptl_reactor_task(handle, &futures[n]);
+			n++;
+		}
+	}
+	
+	if(n > 0){
+		_ptl_reactor_submit(reactor, tasks, futures, n);
+	}
+}
+
+
+/* move a removed handle to the loop's dead list */
+void _ptl_reactor_bury(ptl_reactor_handle_t handle){
+	struct ptl_reactor_loop *loop = handle->loop;
+	
+	pthread_mutex_lock(&loop->mutex);
+	_ptl_reactor_unlink(&loop->handles, handle);
+	_ptl_reactor_link(&loop->dead, handle);
+	pthread_mutex_unlock(&loop->mutex);
+}
+
+
+/* loop thread, between two epoll_waits; free the dead with no callback left */
+void _ptl_reactor_reap(struct ptl_reactor_loop *loop){
+	pthread_mutex_lock(&loop->mutex);
+	
+	ptl_reactor_handle_t handle = loop->dead;
+	while(handle != NULL){
+		ptl_reactor_handle_t next = handle->next;
+		
+		if(!(__atomic_load_n(&handle->state, __ATOMIC_ACQUIRE) & PTL_REACTOR_BUSY)){
+			_ptl_reactor_unlink(&loop->dead, handle);
+			FREE(handle);
+		}
+		handle = next;
+	}
+	
+	pthread_mutex_unlock(&loop->mutex);
+}
+
+
+/* push on the front of 'list' */
+void _ptl_reactor_link(ptl_reactor_handle_t *list, ptl_reactor_handle_t handle){
+	handle->prev = NULL;
+	handle->next = *list;
+	if(*list != NULL){
+		(*list)->prev = handle;
+	}
+	*list = handle;
+}
+
+
+/* take out of 'list' */
+void _ptl_reactor_unlink(ptl_reactor_handle_t *list, ptl_reactor_handle_t handle){
+	if(handle->prev != NULL){
+		handle->prev->next = handle->next;
+	} else {
+		*list = handle->next;
+	}
+	if(handle->next != NULL){
+		handle->next->prev = handle->prev;
+	}
+	handle->next = handle->prev = NULL;
+}
+
+
+/* free every handle of a list */
+void _ptl_reactor_free_list(ptl_reactor_handle_t list){
+	while(list != NULL){
+		ptl_reactor_handle_t next = list->next;
+		FREE(list);
+		list = next;
+	}
+}
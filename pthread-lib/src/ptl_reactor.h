@@ -0,0 +1,204 @@
+/*
+ * This file is part of the pthread-lib Library.
+ * Copyright (C) 2008-2009 Nick Powers.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Library General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor Boston, MA 02110-1301,  USA
+ */
+
+/**
+ * This "class" is an epoll reactor that feeds a thread manager. A few
+ * reactor threads, each with its own epoll instance, wait on the file
+ * descriptors registered with them. The events one epoll_wait returns are
+ * turned into tasks and handed to the manager with one submit_batch call,
+ * and a worker runs the descriptor's callback. A small pool can serve many
+ * connections this way, as no worker blocks waiting on a socket.
+ *
+ * A handle never has two callbacks running at once: events that come in
+ * while its callback is queued or running are merged and handed to it when
+ * it returns. To keep that cheap, descriptors are registered one-shot
+ * unless edge-triggered, and re-armed after their callback (see the modes).
+ *
+ * A callback the manager rejects (its queue is full) runs on the reactor
+ * thread instead, which holds off reading more events until the workers
+ * catch up. The manager mustn't use ptl_q_discard_oldest_policy, which drops
+ * callbacks that were already queued; ptl_reactor_create refuses it.
+ *
+ * Idle timeouts use a timer wheel (ptl_timer_wheel.h); a handle whose
+ * timeout passes without a callback is called with PTL_REACTOR_TIMEOUT.
+ *
+ * The reactor follows the manager's lifecycle: its threads stop once the
+ * manager leaves the RUNNING state. Destroy it after the manager has
+ * terminated (queued callbacks still refer to its handles), and before
+ * destroy_thread_manager frees the manager.
+ */
+
+#ifndef __PTL_REACTOR_H__
+#define __PTL_REACTOR_H__
+
+#include <pthread.h>
+#include <sys/epoll.h>
+#include "ptl_thread_manager.h"
+#include "ptl_timer_wheel.h"
+
+/* Constants */
+/* events, the epoll bits */
+#define PTL_REACTOR_READ    EPOLLIN
+#define PTL_REACTOR_WRITE   EPOLLOUT
+#define PTL_REACTOR_ERROR   EPOLLERR		/**< always reported, no need to ask */
+#define PTL_REACTOR_HANGUP  (EPOLLHUP | EPOLLRDHUP)
+#define PTL_REACTOR_TIMEOUT 0x10000			/**< the handle's timeout passed */
+
+/**
+ * Modes of a handle:
+ *
+ *   LEVEL:   re-armed after each callback that keeps the handle, so it's
+ *            called again while the descriptor stays ready (the default)
+ *   EDGE:    edge-triggered, never re-armed. The callback must read or write
+ *            until EAGAIN, or it won't hear about the data left over
+ *   ONESHOT: called once, then disarmed until ptl_reactor_rearm
+ */
+#define PTL_REACTOR_LEVEL   0
+#define PTL_REACTOR_EDGE    1
+#define PTL_REACTOR_ONESHOT 2
+
+/* what a callback returns */
+#define PTL_REACTOR_REMOVE 0				/**< remove the handle, see ptl_reactor_remove */
+#define PTL_REACTOR_KEEP   1
+
+#define PTL_REACTOR_MAX_EVENTS 64			/**< events per epoll_wait, submitted as a batch */
+#define PTL_REACTOR_POLL_MSEC 100			/**< longest a reactor thread waits before
+												 looking at the manager's run state */
+
+
+/* Structures */
+
+struct ptl_reactor;
+struct ptl_reactor_loop;
+
+/**
+ * One registered descriptor. Made by ptl_reactor_add, freed by the reactor
+ * some time after ptl_reactor_remove.
+ */
+struct ptl_reactor_handle {
+	int fd;
+	int events;							/**< PTL_REACTOR_READ and/or WRITE */
+	int mode;							/**< PTL_REACTOR_LEVEL, EDGE or ONESHOT */
+	int (*callback)(struct ptl_reactor_handle *handle, int events, void *arg);
+	void *arg;							/**< passed to 'callback' */
+	int state;							/**< events not handed to the callback yet, plus
+											 a busy bit while it's queued or running */
+	int removed;						/**< set once by ptl_reactor_remove */
+	long timeout_msec;					/**< idle timeout, 0 for none */
+	struct ptl_timer timer;				/**< the idle timeout */
+	struct ptl_timer reaper;			/**< fires once removed, when the timer thread
+											 is done with the handle */
+	struct ptl_reactor_loop *loop;		/**< reactor thread it's registered with */
+	struct ptl_reactor_handle *next;	/**< in the loop's lists */
+	struct ptl_reactor_handle *prev;
+};
+
+/* one reactor thread and its epoll instance */
+struct ptl_reactor_loop {
+	pthread_t thread;
+	int epoll_fd;
+	int wake_fd;						/**< eventfd that interrupts epoll_wait */
+	pthread_mutex_t mutex;				/**< guards the lists, and epoll_ctl on handles */
+	struct ptl_reactor_handle *handles;	/**< registered, or removed but not reaped */
+	struct ptl_reactor_handle *dead;	/**< removed, freed once no callback is left */
+	struct ptl_reactor *reactor;
+};
+
+struct ptl_reactor {
+	ptl_thread_manager_t manager;		/**< runs the callbacks */
+	struct ptl_reactor_loop *loops;
+	int num_loops;
+	int next_loop;						/**< handles go round robin over the loops */
+	int running;						/**< 0 once destroying */
+	ptl_tw_t timer_wheel;				/**< idle timeouts and reaping */
+};
+
+
+/* Type Definitions */
+typedef struct ptl_reactor *ptl_reactor_t;
+typedef struct ptl_reactor_handle *ptl_reactor_handle_t;
+
+
+/* Public Functions */
+
+/**
+ * Creates a reactor and starts its threads.
+ *
+ * @param manager runs the callbacks, must be running and not use
+ * 		  ptl_q_discard_oldest_policy (now or later)
+ * @param threads reactor threads, 1 if 0 or less
+ * @return a running reactor, or NULL if epoll or a thread can't be set up, or
+ * 		   the manager discards the oldest task
+ */
+ptl_reactor_t ptl_reactor_create(ptl_thread_manager_t manager, int threads);
+
+/**
+ * Stops the reactor's threads and frees it and its handles. The
+ * descriptors are not closed. Call it once the manager has terminated, see
+ * ptl_tm_shutdown, but hasn't been destroyed.
+ *
+ * @param reactor reactor to destroy
+ */
+void ptl_reactor_destroy(ptl_reactor_t reactor);
+
+/**
+ * Registers 'fd'. 'callback(handle, events, arg)' then runs on the manager's
+ * workers with the events that came in, and returns PTL_REACTOR_KEEP or
+ * PTL_REACTOR_REMOVE.
+ *
+ * @param fd descriptor to watch, best non-blocking
+ * @param events PTL_REACTOR_READ and/or PTL_REACTOR_WRITE
+ * @param mode PTL_REACTOR_LEVEL, EDGE or ONESHOT
+ * @return the handle, or NULL if epoll refused 'fd'
+ */
+ptl_reactor_handle_t ptl_reactor_add(ptl_reactor_t reactor, int fd, int events, int mode,
+									 int (*callback)(ptl_reactor_handle_t, int, void *),
+									 void *arg);
+
+/**
+ * Changes what the handle waits for and arms it again; what a ONESHOT
+ * handle calls to hear about the next event. May be called from the
+ * handle's callback.
+ *
+ * @param events PTL_REACTOR_READ and/or PTL_REACTOR_WRITE
+ * @return 1 if armed, 0 if the handle was removed or epoll refused
+ */
+int ptl_reactor_rearm(ptl_reactor_t reactor, ptl_reactor_handle_t handle, int events);
+
+/**
+ * Calls the handle with PTL_REACTOR_TIMEOUT once 'timeout_msec' pass
+ * without a callback. The clock restarts when each callback returns.
+ *
+ * @param timeout_msec ms, 0 to turn the timeout off
+ * @return 1 if set, 0 if the handle was removed
+ */
+int ptl_reactor_set_timeout(ptl_reactor_t reactor, ptl_reactor_handle_t handle,
+							long timeout_msec);
+
+/**
+ * Stops watching the handle's descriptor; its callback isn't called again
+ * (one already running finishes). The handle is freed later, once no
+ * thread can see it any more. The descriptor may be closed on return. May
+ * be called from the handle's callback.
+ *
+ * @return 1 if removed, 0 if it already was
+ */
+int ptl_reactor_remove(ptl_reactor_t reactor, ptl_reactor_handle_t handle);
+
+#endif
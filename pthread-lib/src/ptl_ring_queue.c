@@ -0,0 +1,455 @@
+/*
+ * This file is part of the pthread-lib Library.
+ * Copyright (C) 2008-2009 Nick Powers.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Library General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor Boston, MA 02110-1301,  USA
+ */
+
+ /*
+  * For a "class" description, see the header file. 
+  */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <string.h>
+#include <errno.h>
+#include "ptl_queue.h"
+#include "ptl_util.h"
+#include "ptl_ring_queue.h"
+
+
+/* Structures */
+
+/* A single slot: the value and the position it is valid for */
+struct ptl_rq_slot {
+	unsigned long seq; // pos (free for the producer at pos), pos + 1 (full)
+	void *value;
+};
+
+/* Ring state (kept in q->data). Each end is on its own cache line */
+struct ptl_rq_state {
+	struct ptl_rq_slot *slots;	/**< the ring */
+	unsigned long mask;			/**< capacity - 1 */
+	unsigned long enqueue_pos __attribute__((aligned(PTL_CACHE_LINE_SIZE)));
+	int add_waiters;			/**< producers sleeping on 'not_full' */
+	unsigned long dequeue_pos __attribute__((aligned(PTL_CACHE_LINE_SIZE)));
+	int get_waiters;			/**< consumers sleeping on 'not_empty' */
+} __attribute__((aligned(PTL_CACHE_LINE_SIZE)));
+
+
+/* Private Functions */
+int _ptl_rq_try_add(struct ptl_rq_state *rq, void *value);
+void* _ptl_rq_try_get(struct ptl_rq_state *rq);
+void _ptl_rq_wake(ptl_q_t q, int *waiters, pthread_cond_t *cond);
+
+
+/* Global Variables */
+
+/* functions to use with ptl_q_create_queue() */
+struct ptl_q_funcs ptl_rq_funcs = {
+	ptl_rq_init_queue,
+	ptl_rq_destroy_queue,
+	ptl_rq_add,
+	ptl_rq_add_wait,
+	ptl_rq_clear,
+	ptl_rq_peek,
+	ptl_rq_get,
+	ptl_rq_get_wait,
+	ptl_rq_size,
+	ptl_rq_add_batch,
+	ptl_rq_get_batch
+};
+
+
+/* initalize the ptl_q structure for a ring queue */
+void ptl_rq_init_queue(ptl_q_t q){
+	assert(q);
+	
+	pthread_mutex_init(&q->mutex, NULL); // only used by the waiting calls
+	ptl_cond_init(&q->not_empty);
+	ptl_cond_init(&q->not_full);
+	
+	q->type = PTL_Q_TYPE_RING;
+	q->size = 0; // not used, see ptl_rq_size()
+	q->head = q->tail = q->ptr = NULL; // not used
+	
+	// round capacity up to a power of two so a mask finds the slot
+	unsigned long capacity = 2;
+	while(capacity < (unsigned long)q->capacity){
+		capacity <<= 1;
+	}
+	q->capacity = capacity;
+	
+	struct ptl_rq_state *rq = NULL;
+	int rc = posix_memalign((void **)&rq, PTL_CACHE_LINE_SIZE, sizeof(struct ptl_rq_state));
+	assert(rc == 0);
+	memset(rq, 0, sizeof(struct ptl_rq_state));
+	
+	rq->mask = capacity - 1;
+	rq->slots = (struct ptl_rq_slot *)calloc(capacity, sizeof(struct ptl_rq_slot));
+	assert(rq->slots);
+	
+	// slot 'i' is free for the producer at position 'i'
+	unsigned long i = 0;
+	for(i = 0; i < capacity; i++){
+		rq->slots[i].seq = i;
+	}
+	
+	q->data = rq;
+}
+
+
+/* free all the memory associated with a ring queue */
+void ptl_rq_destroy_queue(ptl_q_t q){
+	assert(q);
+	
+	struct ptl_rq_state *rq = (struct ptl_rq_state *)q->data;
+	
+	FREE(rq->slots);
+	FREE(q->data);
+	q->capacity = 0;
+	
+	pthread_mutex_destroy(&q->mutex);
+	pthread_cond_destroy(&q->not_empty);
+	pthread_cond_destroy(&q->not_full);
+}
+
+
+/* lock-free add, returns 0 if the ring is full */
+int ptl_rq_add(ptl_q_t q, void *value){
+	if(q == NULL || value == NULL){ return 0; }
+	
+	struct ptl_rq_state *rq = (struct ptl_rq_state *)q->data;
+	
+	if(!_ptl_rq_try_add(rq, value)){ return 0; }
+	
+	_ptl_rq_wake(q, &rq->get_waiters, &q->not_empty);
+	
+	return 1;
+}
+
+
+/* try lock-free first, then sleep on 'not_full' until 'timeout' */
+int ptl_rq_add_wait(ptl_q_t q, void *value, long timeout){
+	if(q == NULL || value == NULL || timeout < 0){ return 0; }
+	
+	if(ptl_rq_add(q, value)){ return 1; } // fast path
+	
+	struct ptl_rq_state *rq = (struct ptl_rq_state *)q->data;
+	struct timespec deadline;
+	ptl_get_future_time(&deadline, timeout * 1000); // ms to usec
+	int added_a_element = 0;
+	
+	pthread_mutex_lock(&q->mutex); // lock
+	
+	// announce ourselves before trying again, a consumer that frees a slot
+	// after our last try will then see us and signal
+	__atomic_add_fetch(&rq->add_waiters, 1, __ATOMIC_SEQ_CST);
+	
+	while(!(added_a_element = _ptl_rq_try_add(rq, value))){
+		if(pthread_cond_timedwait(&q->not_full, &q->mutex, &deadline) == ETIMEDOUT){
+			added_a_element = _ptl_rq_try_add(rq, value); // one last try
+			break;
+		}
+	}
+	
+	__atomic_sub_fetch(&rq->add_waiters, 1, __ATOMIC_SEQ_CST);
+	
+	pthread_mutex_unlock(&q->mutex); // unlock
+	
+	if(added_a_element){
+		_ptl_rq_wake(q, &rq->get_waiters, &q->not_empty);
+	}
+	
+	return added_a_element;
+}
+
+
+/* claim a run of free slots with one CAS and fill them */
+int ptl_rq_add_batch(ptl_q_t q, void **values, int count){
+	if(q == NULL || values == NULL || count <= 0){ return 0; }
+	
+	struct ptl_rq_state *rq = (struct ptl_rq_state *)q->data;
+	unsigned long pos = __atomic_load_n(&rq->enqueue_pos, __ATOMIC_RELAXED);
+	int run = 0;
+	
+	for(;;){
+		// count the free slots from 'pos'. Only a producer that moves
+		// 'enqueue_pos' past them can take them, so if our CAS succeeds
+		// they are still free
+		run = 0;
+		while(run < count && values[run] != NULL){
+			struct ptl_rq_slot *slot = &rq->slots[(pos + run) & rq->mask];
+			if(__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) != pos + run){
+				break;
+			}
+			run++;
+		}
+		
+		if(run == 0){ 
+			// full, unless another producer moved 'enqueue_pos' meanwhile
+			unsigned long now = __atomic_load_n(&rq->enqueue_pos, __ATOMIC_RELAXED);
+			if(now == pos){ return 0; }
+			pos = now;
+			continue;
+		}
+		
+		if(__atomic_compare_exchange_n(&rq->enqueue_pos, &pos, pos + run, 1,
+									   __ATOMIC_RELAXED, __ATOMIC_RELAXED)){
+			break;
+		}
+		// 'pos' was reloaded by the failed compare
+	}
+	
+	int i = 0;
+	for(i = 0; i < run; i++){
+		struct ptl_rq_slot *slot = &rq->slots[(pos + i) & rq->mask];
+		slot->value = values[i];
+		__atomic_store_n(&slot->seq, pos + i + 1, __ATOMIC_RELEASE); // publish
+	}
+	
+	_ptl_rq_wake(q, &rq->get_waiters, &q->not_empty);
+	
+	return run;
+}
+
+
+/* take everything out, the 'value' elements aren't freed */
+void ptl_rq_clear(ptl_q_t q){
+	if(q == NULL){ return; }
+	
+	while(ptl_rq_get(q) != NULL){
+		; // drop it
+	}
+}
+
+
+/* take everything out, free each 'value' with 'free_func' */
+void ptl_rq_clear_freefunc(ptl_q_t q, void (*free_func)(void *)){
+	if(q == NULL){ return; }
+	
+	void *value = NULL;
+	while((value = ptl_rq_get(q)) != NULL){
+		free_func(value);
+	}
+}
+
+
+/* looks at and returns the first element, but does not remove */
+void* ptl_rq_peek(ptl_q_t q){
+	if(q == NULL){ return NULL; }
+	
+	struct ptl_rq_state *rq = (struct ptl_rq_state *)q->data;
+	unsigned long pos = __atomic_load_n(&rq->dequeue_pos, __ATOMIC_RELAXED);
+	struct ptl_rq_slot *slot = &rq->slots[pos & rq->mask];
+	
+	if(__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) != pos + 1){
+		return NULL; // empty
+	}
+	
+	return __atomic_load_n(&slot->value, __ATOMIC_RELAXED);
+}
+
+
+/* lock-free get, returns NULL if the ring is empty */
+void* ptl_rq_get(ptl_q_t q){
+	if(q == NULL){ return NULL; }
+	
+	struct ptl_rq_state *rq = (struct ptl_rq_state *)q->data;
+	
+	void *value = _ptl_rq_try_get(rq);
+	
+	if(value != NULL){
+		_ptl_rq_wake(q, &rq->add_waiters, &q->not_full);
+	}
+	
+	return value;
+}
+
+
+/* claim a run of full slots with one CAS and empty them */
+int ptl_rq_get_batch(ptl_q_t q, void **values, int max){
+	if(q == NULL || values == NULL || max <= 0){ return 0; }
+	
+	struct ptl_rq_state *rq = (struct ptl_rq_state *)q->data;
+	unsigned long pos = __atomic_load_n(&rq->dequeue_pos, __ATOMIC_RELAXED);
+	int run = 0;
+	
+	for(;;){
+		// count the full slots from 'pos', see ptl_rq_add_batch
+		run = 0;
+		while(run < max){
+			struct ptl_rq_slot *slot = &rq->slots[(pos + run) & rq->mask];
+			if(__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) != pos + run + 1){
+				break;
+			}
+			run++;
+		}
+		
+		if(run == 0){
+			unsigned long now = __atomic_load_n(&rq->dequeue_pos, __ATOMIC_RELAXED);
+			if(now == pos){ return 0; } // empty
+			pos = now;
+			continue;
+		}
+		
+		if(__atomic_compare_exchange_n(&rq->dequeue_pos, &pos, pos + run, 1,
+									   __ATOMIC_RELAXED, __ATOMIC_RELAXED)){
+			break;
+		}
+	}
+	
+	int i = 0;
+	for(i = 0; i < run; i++){
+		struct ptl_rq_slot *slot = &rq->slots[(pos + i) & rq->mask];
+		values[i] = slot->value;
+		slot->value = NULL;
+		// free for the producer one lap later
+		__atomic_store_n(&slot->seq, pos + i + rq->mask + 1, __ATOMIC_RELEASE);
+	}
+	
+	_ptl_rq_wake(q, &rq->add_waiters, &q->not_full);
+	
+	return run;
+}
+
+
+/* try lock-free first, then sleep on 'not_empty' until 'timeout' */
+void* ptl_rq_get_wait(ptl_q_t q, long timeout){
+	if(q == NULL || timeout < 0){ return NULL; }
+	
+	void *element = ptl_rq_get(q); // fast path
+	if(element != NULL){ return element; }
+	
+	struct ptl_rq_state *rq = (struct ptl_rq_state *)q->data;
+	struct timespec deadline;
+	ptl_get_future_time(&deadline, timeout * 1000); // ms to usec
+	
+	pthread_mutex_lock(&q->mutex); // lock
+	
+	// announce ourselves before trying again (see ptl_rq_add_wait)
+	__atomic_add_fetch(&rq->get_waiters, 1, __ATOMIC_SEQ_CST);
+	
+	while((element = _ptl_rq_try_get(rq)) == NULL){
+		if(pthread_cond_timedwait(&q->not_empty, &q->mutex, &deadline) == ETIMEDOUT){
+			element = _ptl_rq_try_get(rq); // one last try
+			break;
+		}
+	}
+	
+	__atomic_sub_fetch(&rq->get_waiters, 1, __ATOMIC_SEQ_CST);
+	
+	pthread_mutex_unlock(&q->mutex); // unlock
+	
+	if(element != NULL){
+		_ptl_rq_wake(q, &rq->add_waiters, &q->not_full);
+	}
+	
+	return element;
+}
+
+
+/* number of elements between the two ends */
+long ptl_rq_size(ptl_q_t q){
+	if(q == NULL){ return 0; }
+	
+	struct ptl_rq_state *rq = (struct ptl_rq_state *)q->data;
+	
+	// read the consumer end first so the difference can't be negative
+	unsigned long dequeue_pos = __atomic_load_n(&rq->dequeue_pos, __ATOMIC_ACQUIRE);
+	unsigned long enqueue_pos = __atomic_load_n(&rq->enqueue_pos, __ATOMIC_ACQUIRE);
+	long size = (long)(enqueue_pos - dequeue_pos);
+	
+	return (size > q->capacity) ? q->capacity : size;
+}
+
+
+/* Private Functions */
+
+/* claim the slot at 'enqueue_pos' and fill it. returns 0 if full */
+int _ptl_rq_try_add(struct ptl_rq_state *rq, void *value){
+	struct ptl_rq_slot *slot = NULL;
+	unsigned long pos = __atomic_load_n(&rq->enqueue_pos, __ATOMIC_RELAXED);
+	
+	for(;;){
+		slot = &rq->slots[pos & rq->mask];
+		unsigned long seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+		long dif = (long)seq - (long)pos;
+		
+		if(dif == 0){ // free for us, try to claim it
+			if(__atomic_compare_exchange_n(&rq->enqueue_pos, &pos, pos + 1, 1,
+										   __ATOMIC_RELAXED, __ATOMIC_RELAXED)){
+				break;
+			}
+			// 'pos' was reloaded by the failed compare
+		} else if(dif < 0){ // still full from the last lap
+			return 0;
+		} else { // another producer got here first
+			pos = __atomic_load_n(&rq->enqueue_pos, __ATOMIC_RELAXED);
+		}
+	}
+	
+	slot->value = value;
+	__atomic_store_n(&slot->seq, pos + 1, __ATOMIC_RELEASE); // publish
+	
+	return 1;
+}
+
+
+/* claim the slot at 'dequeue_pos' and empty it. returns NULL if empty */
+void* _ptl_rq_try_get(struct ptl_rq_state *rq){
+	struct ptl_rq_slot *slot = NULL;
+	unsigned long pos = __atomic_load_n(&rq->dequeue_pos, __ATOMIC_RELAXED);
+	
+	for(;;){
+		slot = &rq->slots[pos & rq->mask];
+		unsigned long seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+		long dif = (long)seq - (long)(pos + 1);
+		
+		if(dif == 0){ // full, try to claim it
+			if(__atomic_compare_exchange_n(&rq->dequeue_pos, &pos, pos + 1, 1,
+										   __ATOMIC_RELAXED, __ATOMIC_RELAXED)){
+				break;
+			}
+		} else if(dif < 0){ // nothing written here yet
+			return NULL;
+		} else { // another consumer got here first
+			pos = __atomic_load_n(&rq->dequeue_pos, __ATOMIC_RELAXED);
+		}
+	}
+	
+	void *value = slot->value;
+	slot->value = NULL;
+	// free for the producer one lap later
+	__atomic_store_n(&slot->seq, pos + rq->mask + 1, __ATOMIC_RELEASE);
+	
+	return value;
+}
+
+
+/* signal 'cond' only if someone is sleeping on it */
+void _ptl_rq_wake(ptl_q_t q, int *waiters, pthread_cond_t *cond){
+	// order our slot update before reading the waiter count. A waiter
+	// increments the count before its last try, so one of us sees the other
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	
+	if(__atomic_load_n(waiters, __ATOMIC_RELAXED) > 0){
+		pthread_mutex_lock(&q->mutex);
+		pthread_cond_signal(cond);
+		pthread_mutex_unlock(&q->mutex);
+	}
+}
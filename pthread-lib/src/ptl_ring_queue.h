@@ -0,0 +1,158 @@
+/*
+ * This file is part of the pthread-lib Library.
+ * Copyright (C) 2008-2009 Nick Powers.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Library General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor Boston, MA 02110-1301,  USA
+ */
+
+
+/**
+ * This "class" is a lock-free, bounded ring buffer queue that any number of
+ * producers and consumers can share (D. Vyukov's bounded MPMC queue). Each
+ * slot holds the value and a sequence number. The sequence number tells a
+ * producer the slot is free and a consumer the slot is full, so add and get
+ * only need one compare-and-swap on their own end of the ring. The capacity
+ * is rounded up to a power of two.
+ *
+ * The waiting versions of add/get only take the queue's lock after the
+ * lock-free attempt fails. Producers and consumers then signal the other side
+ * only if a thread is actually waiting.
+ *
+ * This queue does not keep the 'size' field up to date. Use ptl_q_size().
+ */
+
+
+#ifndef __PTL_RING_QUEUE_H__
+#define __PTL_RING_QUEUE_H__
+
+/**
+ * Function table for this queue, e.g. ptl_q_create_queue(&ptl_rq_funcs, 1024)
+ */
+extern struct ptl_q_funcs ptl_rq_funcs;
+
+/**
+ * Initializes the queue, creating the ring of 'capacity' slots. 'capacity' is
+ * rounded up to the next power of two and stored back in the queue.
+ * 
+ * @param q queue to be initized.
+ */
+void ptl_rq_init_queue(ptl_q_t q);
+
+/**
+ * Destroys the queue and frees the memory. This should be used when the queue
+ * is no longer going to be used. The 'values' are not freed.
+ * 
+ * @param q the queue to destroy
+ */
+void ptl_rq_destroy_queue(ptl_q_t q);
+
+/**
+ * Inserts the specified element into this queue without waiting.
+ *
+ * @param q non-null queue
+ * @param value the value to be stored in the queue
+ * @return 1 if successful, 0 if the queue is full
+ */
+int ptl_rq_add(ptl_q_t q, void *value);
+
+/**
+ * Tries to insert the item into the ring. If there is not room, it will
+ * wait on the 'not_full' condition until there is room or until 'timeout'
+ * occurs.
+ * 
+ * @param q non-null queue to add the value
+ * @param value data that will be added to the queue
+ * @param timeout number of milliseconds to wait for room
+ * @return 1 if successful, 0 otherwise
+ **/
+int ptl_rq_add_wait(ptl_q_t q, void *value, long timeout);
+
+/**
+ * Inserts up to 'count' elements, claiming a run of free slots with a single
+ * compare-and-swap. Stops at the first NULL value or when the ring is full.
+ *
+ * @param q non-null queue
+ * @param values elements to add, in order
+ * @param count number of elements in 'values'
+ * @return number of elements added
+ */
+int ptl_rq_add_batch(ptl_q_t q, void **values, int count);
+
+/**
+ * Removes all of the elements from this queue. The 'values' are not freed.
+ *
+ * @param q non-null queue to be cleared
+ * @see ptl_rq_clear_freefunc()
+ */
+void ptl_rq_clear(ptl_q_t q);
+
+/**
+ * Removes all of the elements from this queue. It frees the 'values' using
+ * the function provided in the free_func parameter.
+ *
+ * @param q non-null queue to be cleared
+ * @param free_func function that will be used to free the 'value' elements
+ * @see ptl_rq_clear()
+ */
+void ptl_rq_clear_freefunc(ptl_q_t q, void (*free_func)(void *)); 
+
+/**
+ * Retrieves, but does not remove, the head of this queue. A consumer may
+ * take the element at any time after it is returned.
+ *
+ * @param q non-null queue to peek on
+ * @return pointer to the head element or NULL if no element was found
+ */
+void* ptl_rq_peek(ptl_q_t q);
+
+/**
+ * Retrieves and removes the head of this queue without waiting.
+ *
+ * @param q non-null queue to get an element from
+ * @return the head element or NULL if the queue is empty
+ */
+void* ptl_rq_get(ptl_q_t q);
+
+/**
+ * Retrieves and removes up to 'max' elements, claiming a run of full slots
+ * with a single compare-and-swap.
+ *
+ * @param q non-null queue to get elements from
+ * @param values where the elements are stored, in queue order
+ * @param max room in 'values'
+ * @return number of elements stored in 'values'
+ */
+int ptl_rq_get_batch(ptl_q_t q, void **values, int max);
+
+/**
+ * Retrieves and removes the head of this queue, waiting on the 'not_empty'
+ * condition up to 'timeout' if necessary for an element to become available.
+ *
+ * @param q non-null queue to get an element from
+ * @param timeout time in milliseconds
+ * @return the head element or NULL if no element was found
+ */
+void* ptl_rq_get_wait(ptl_q_t q, long timeout);
+
+/**
+ * Returns the number of elements in the ring, computed from the two ends.
+ *
+ * @param q non-null queue
+ * @return number of elements in the ring
+ */
+long ptl_rq_size(ptl_q_t q);
+
+
+#endif
@@ -21,18 +21,40 @@
 
 #include <pthread.h>
 #include <stdlib.h>
-#include <stdio.h>
+#include <stdint.h>
 #include <string.h>
 #include <errno.h>
 #include <assert.h>
 #include <signal.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/signalfd.h>
+#include <sys/eventfd.h>
 #include "ptl_signal_manager.h"
 #include "ptl_util.h"
 
 
+/* Constants */
+#define PTL_SMGR_QUEUED 1		/**< in a slot's 'state': its task is queued or running */
+#define PTL_SMGR_PENDING 2		/**< the signal came in since the function last started */
+
+
+/* Structures */
+
+/* one signal of the signalfd mode */
+struct ptl_smgr_slot {
+	int state;						// PTL_SMGR_* bits, atomic
+	void *(*func_ptr)();
+	ptl_signal_manager_t sig_mgr;
+};
+
 
 /* Private Functions */
 void *_ptl_signal_handler_function(void *functions);
+void *(*_ptl_smgr_func(ptl_smgr_funcs_t func_ptrs, int sig))();
+void *_ptl_smgr_signalfd_function(void *sig_mgr);
+void _ptl_smgr_raise(ptl_signal_manager_t sig_mgr, int sig);
+void *_ptl_smgr_run(void *slot);
 
 
 /* Creates a single thread to handle all interrupt signals */
@@ -44,13 +66,61 @@ ptl_signal_manager_t ptl_signal_handler_create(ptl_smgr_funcs_t func_ptrs){
 	
 	signal_manager->func_ptrs = func_ptrs;
 	signal_manager->running = 1;
+	signal_manager->signal_fd = -1;
+	signal_manager->wake_fd = -1;
 	
 	// _signal_handler_function is a private function declared below
-	int rc = pthread_create(&(signal_manager->smgr_thread), NULL, _ptl_signal_handler_function, (void *)signal_manager);
-	assert(rc);
+	if(pthread_create(&(signal_manager->smgr_thread), NULL, _ptl_signal_handler_function, 
+					  (void *)signal_manager) != 0){
+		FREE(signal_manager);
+		return NULL;
+	}
 	
-	//signal_manager->smgr_thread = smgr_thread;
+	return signal_manager;
+}
 
+
+/* Reads the signals with handlers from a signalfd, runs handlers on 'manager' */
+ptl_signal_manager_t ptl_signal_handler_create_signalfd(ptl_smgr_funcs_t func_ptrs,
+														ptl_thread_manager_t manager){
+	if(func_ptrs == NULL || manager == NULL){ return NULL; }
+	
+	ptl_signal_manager_t signal_manager = (ptl_signal_manager_t)calloc(1, sizeof(struct ptl_signal_manager));
+	assert(signal_manager);
+	
+	struct ptl_smgr_slot *slots = (struct ptl_smgr_slot *)calloc(NSIG, sizeof(struct ptl_smgr_slot));
+	assert(slots);
+	
+	signal_manager->func_ptrs = func_ptrs;
+	signal_manager->running = 1;
+	signal_manager->manager = manager;
+	signal_manager->slots = slots;
+	
+	// only the signals somebody handles, the rest keep their default action
+	sigset_t signals;
+	sigemptyset(&signals);
+	int sig = 0;
+	for(sig = 1; sig < NSIG; sig++){
+		slots[sig].func_ptr = _ptl_smgr_func(func_ptrs, sig);
+		slots[sig].sig_mgr = signal_manager;
+		if(slots[sig].func_ptr != NULL){
+			sigaddset(&signals, sig);
+		}
+	}
+	pthread_sigmask(SIG_BLOCK, &signals, NULL);
+	
+	signal_manager->signal_fd = signalfd(-1, &signals, SFD_NONBLOCK | SFD_CLOEXEC);
+	signal_manager->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	
+	if(signal_manager->signal_fd < 0 || signal_manager->wake_fd < 0 ||
+	   pthread_create(&(signal_manager->smgr_thread), NULL, _ptl_smgr_signalfd_function, 
+					  (void *)signal_manager) != 0){
+		if(signal_manager->signal_fd >= 0){ close(signal_manager->signal_fd); }
+		if(signal_manager->wake_fd >= 0){ close(signal_manager->wake_fd); }
+		FREE(slots);
+		FREE(signal_manager);
+		return NULL;
+	}
 	
 	return signal_manager;
 }
@@ -60,10 +130,18 @@ ptl_signal_manager_t ptl_signal_handler_create(ptl_smgr_funcs_t func_ptrs){
 void stop_signal_manager(ptl_signal_manager_t sig_mgr){
 
 	/* set flag to stop */
-	sig_mgr->running = 0;
+	__atomic_store_n(&sig_mgr->running, 0, __ATOMIC_RELEASE);
 
-	/* send signal to thread to break it out of wait */
-	pthread_kill(sig_mgr->smgr_thread, PTL_SIGNAL_HANDLER_DESTROY_SIGNAL);
+	if(sig_mgr->signal_fd >= 0){
+		/* wake the signalfd thread out of poll */
+		uint64_t one = 1;
+		if(write(sig_mgr->wake_fd, &one, sizeof(one)) < 0){
+			// only fails when the counter is full, it's awake then
+		}
+	} else {
+		/* send signal to thread to break it out of wait */
+		pthread_kill(sig_mgr->smgr_thread, PTL_SIGNAL_HANDLER_DESTROY_SIGNAL);
+	}
 	
 	destroy_signal_manager(sig_mgr);
 }
@@ -76,7 +154,18 @@ int destroy_signal_manager(ptl_signal_manager_t sig_mgr){
 	/* wait for the thread to stop */
 	int status = pthread_join(sig_mgr->smgr_thread, &ret_value);
 	
+	/* the functions still queued refer to the slots */
+	while(PTL_ATOMIC_LOAD(sig_mgr->in_flight) > 0){
+		ptl_timed_wait(1000);
+	}
+	
+	if(sig_mgr->signal_fd >= 0){
+		close(sig_mgr->signal_fd);
+		close(sig_mgr->wake_fd);
+	}
+	
 	// free memory
+	FREE(sig_mgr->slots);
 	FREE(sig_mgr);
 	
 	return (status == 0);
@@ -108,76 +197,28 @@ void *_ptl_signal_handler_function(void *sig_mgr){
 	assert(sig_mgr);
 	
 	sigset_t signals;
-	int rc = 0;
 	int sig_caught;
 
 	ptl_signal_manager_t signal_manager = (ptl_signal_manager_t)sig_mgr;
 	ptl_smgr_funcs_t func_ptrs = signal_manager->func_ptrs;
 
 	sigfillset(&signals);
-	while(signal_manager->running){ 
-
-		rc = sigwait(&signals, &sig_caught);
+	pthread_sigmask(SIG_BLOCK, &signals, NULL); // sigwait needs them blocked
+	while(PTL_ATOMIC_LOAD(signal_manager->running)){ 
 
-		printf("Caught signal [%d]...\n", sig_caught);
+		if(sigwait(&signals, &sig_caught) != 0){
+			continue;
+		}
 	 
-		switch(sig_caught){
-		case SIGTERM:
-			signal_manager->running = 0; // stop the signal manager
-				
-			if(func_ptrs->term_func_ptr != NULL){
-				func_ptrs->term_func_ptr();
-			}
-		break;
-		case SIGHUP:
-			if(func_ptrs->hup_func_ptr != NULL){
-				func_ptrs->hup_func_ptr();
-			}
-		break;
-		case SIGINT:
-			if(func_ptrs->int_func_ptr != NULL){
-				func_ptrs->int_func_ptr();
-			}
-		break;
-		case SIGQUIT:
-			if(func_ptrs->term_func_ptr != NULL){
-				func_ptrs->term_func_ptr();
-			}
-		break;
-		case SIGABRT:
-			if(func_ptrs->abort_func_ptr != NULL){
-				func_ptrs->abort_func_ptr();
-			}	
-		break;
-		case SIGUSR1:
-			if(func_ptrs->user1_func_ptr != NULL){
-				func_ptrs->user1_func_ptr();
-			}
-		break;
-		case SIGUSR2:
-			if(func_ptrs->user2_func_ptr != NULL){
-				func_ptrs->user2_func_ptr();
-			}
-		break;
-		case SIGALRM:
-			if(func_ptrs->alarm_func_ptr != NULL){
-				func_ptrs->alarm_func_ptr();
-			}
-		break;
-		case SIGCHLD:
-			if(func_ptrs->child_func_ptr != NULL){
-				func_ptrs->child_func_ptr();
-			}
-		break;
-		case SIGCONT:
-			if(func_ptrs->cont_func_ptr != NULL){
-				func_ptrs->cont_func_ptr();
-			}
-		break;
-		default:
-			printf("Caught Unsupported Signal [%d], Igoring.\n", sig_caught);
-		break;
-		} /* end switch */
+		if(sig_caught == SIGTERM){
+			__atomic_store_n(&signal_manager->running, 0, __ATOMIC_RELEASE); // stop the signal manager
+		}
+		
+		// unsupported signals have no function and are ignored
+		void *(*func_ptr)() = _ptl_smgr_func(func_ptrs, sig_caught);
+		if(func_ptr != NULL){
+			func_ptr();
+		}
 	} /* end while(still_running) */
 
 	
@@ -186,3 +227,96 @@ void *_ptl_signal_handler_function(void *sig_mgr){
 	
 	return NULL;
 }
+
+
+/* the function for 'sig', NULL if none is set or the signal isn't supported */
+void *(*_ptl_smgr_func(ptl_smgr_funcs_t func_ptrs, int sig))(){
+	switch(sig){
+	case SIGHUP:  return func_ptrs->hup_func_ptr;
+	case SIGINT:  return func_ptrs->int_func_ptr;
+	case SIGQUIT: return func_ptrs->quit_func_ptr;
+	case SIGABRT: return func_ptrs->abort_func_ptr;
+	case SIGUSR1: return func_ptrs->user1_func_ptr;
+	case SIGUSR2: return func_ptrs->user2_func_ptr;
+	case SIGALRM: return func_ptrs->alarm_func_ptr;
+	case SIGTERM: return func_ptrs->term_func_ptr;
+	case SIGCHLD: return func_ptrs->child_func_ptr;
+	case SIGCONT: return func_ptrs->cont_func_ptr;
+	default:      return NULL;
+	}
+}
+
+
+/**
+ * Thread of the signalfd mode. Sleeps in poll on the signalfd and the wake
+ * up eventfd, reads up to PTL_SMGR_READ_BATCH signals at a time and raises
+ * each. Nothing here blocks on anything but poll.
+ */
+void *_ptl_smgr_signalfd_function(void *sig_mgr){
+	ptl_signal_manager_t signal_manager = (ptl_signal_manager_t)sig_mgr;
+	struct signalfd_siginfo infos[PTL_SMGR_READ_BATCH];
+	struct pollfd fds[2];
+	
+	fds[0].fd = signal_manager->signal_fd;
+	fds[0].events = POLLIN;
+	fds[1].fd = signal_manager->wake_fd;
+	fds[1].events = POLLIN;
+	
+	while(PTL_ATOMIC_LOAD(signal_manager->running)){
+		if(poll(fds, 2, -1) <= 0 || !(fds[0].revents & POLLIN)){
+			continue; // interrupted, or woken to stop
+		}
+		
+		ssize_t size = read(signal_manager->signal_fd, infos, sizeof(infos));
+		int count = (size > 0) ? (int)(size / sizeof(struct signalfd_siginfo)) : 0;
+		int i = 0;
+		for(i = 0; i < count; i++){
+			_ptl_smgr_raise(signal_manager, (int)infos[i].ssi_signo);
+		}
+	}
+	
+	return NULL;
+}
+
+
+/* mark 'sig' pending; queue its function unless it's queued already */
+void _ptl_smgr_raise(ptl_signal_manager_t sig_mgr, int sig){
+	if(sig <= 0 || sig >= NSIG){ return; }
+	
+	struct ptl_smgr_slot *slot = &((struct ptl_smgr_slot *)sig_mgr->slots)[sig];
+	if(slot->func_ptr == NULL){ return; }
+	
+	int old = __atomic_fetch_or(&slot->state, PTL_SMGR_QUEUED | PTL_SMGR_PENDING, __ATOMIC_ACQ_REL);
+	if(old & PTL_SMGR_QUEUED){
+		return; // folded into the run that's queued
+	}
+	
+	PTL_ATOMIC_INC(sig_mgr->in_flight);
+	if(!submit_task(sig_mgr->manager, create_task_with_arg(_ptl_smgr_run, slot))){
+		// rejected, it never runs
+		__atomic_store_n(&slot->state, 0, __ATOMIC_RELEASE);
+		PTL_ATOMIC_DEC(sig_mgr->in_flight);
+	}
+}
+
+
+/* worker; run the function again for as long as the signal came in meanwhile */
+void *_ptl_smgr_run(void *arg){
+	struct ptl_smgr_slot *slot = (struct ptl_smgr_slot *)arg;
+	ptl_signal_manager_t sig_mgr = slot->sig_mgr;
+	
+	for(;;){
+		__atomic_fetch_and(&slot->state, PTL_SMGR_QUEUED, __ATOMIC_ACQ_REL);
+		slot->func_ptr();
+		
+		int expected = PTL_SMGR_QUEUED;
+		if(__atomic_compare_exchange_n(&slot->state, &expected, 0, 0,
+									   __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)){
+			break;
+		}
+	}
+	
+	PTL_ATOMIC_DEC(sig_mgr->in_flight); // the last use of 'sig_mgr'
+	
+	return NULL;
+}
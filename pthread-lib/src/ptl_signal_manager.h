@@ -24,13 +24,23 @@
  * quaterback)and handle all the signals sent to the running process. 
  * It is made flexible by allowing one to execute user-defined functions for 
  * a wide array of signals.
+ *
+ * In signalfd mode (ptl_signal_handler_create_signalfd) the thread only reads
+ * the signals from a signalfd and hands the functions to a thread manager as
+ * tasks, so a slow function doesn't hold up the next signal. Signals that
+ * come in while the function for that signal is still queued or running are
+ * folded into one more run after it.
  */
 
 #ifndef __PTL_SIGNAL_MANAGER_H__
 #define __PTL_SIGNAL_MANAGER_H__
 
+#include <pthread.h>
+#include "ptl_thread_manager.h"
+
 /* Defines */
 #define PTL_SIGNAL_HANDLER_DESTROY_SIGNAL SIGTERM
+#define PTL_SMGR_READ_BATCH 16		/**< signals read from the signalfd at once */
 
 /* Structures */
 struct ptl_smgr_funcs {
@@ -50,6 +60,12 @@ struct ptl_signal_manager {
 	struct ptl_smgr_funcs* func_ptrs;
 	pthread_t smgr_thread;
 	int running;
+	ptl_thread_manager_t manager;	/**< runs the functions in signalfd mode, 
+										 NULL in sigwait mode */
+	int signal_fd;					/**< signalfd mode only, -1 otherwise */
+	int wake_fd;					/**< eventfd that stops the signalfd thread */
+	void *slots;					/**< per signal: queued / pending again */
+	int in_flight;					/**< functions queued or running (atomic) */
 };
 
 /* Type Definitions */
@@ -70,6 +86,23 @@ typedef struct ptl_signal_manager* ptl_signal_manager_t;
  */
 ptl_signal_manager_t ptl_signal_handler_create(ptl_smgr_funcs_t func_ptrs);
 
+/**
+ * Same as ptl_signal_handler_create, but the signals that have a function
+ * are read from a signalfd, and each function runs as a task on 'manager'.
+ * A signal repeated before its function got to run is only run once more,
+ * so a burst of SIGUSR1 costs one or two runs. SIGTERM is a plain signal
+ * here, stop_signal_manager doesn't use it.
+ * The signals are blocked in the calling thread. Create it before starting
+ * other threads so they inherit the mask, or block them there (see
+ * block_all_signals), otherwise another thread may take the signal.
+ *
+ * @param func_ptrs set of functions to be executed for various signals
+ * @param manager runs the functions
+ * @return a new signal manager, or NULL if the signalfd can't be made
+ */
+ptl_signal_manager_t ptl_signal_handler_create_signalfd(ptl_smgr_funcs_t func_ptrs,
+														ptl_thread_manager_t manager);
+
 /**
  * Stops the thread manager by setting a flag and sending a signal.
  * This function must send a signal to the manager to break it out of
@@ -85,6 +118,9 @@ void stop_signal_manager(ptl_signal_manager_t sig_mgr);
 /**
  * Synchronizes the signal handler and frees the memory.
  * Do not use this function after calling stop_signal_handler.
+ * In signalfd mode it also waits for the functions still queued or running;
+ * ones the manager rejected are dropped. Stop it before shutting the manager
+ * down, or tasks handed back by shutdown_now would be waited for.
  *
  * @param sig_mgr the created signal manager
  */
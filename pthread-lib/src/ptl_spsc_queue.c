@@ -0,0 +1,380 @@
+/*
+ * This file is part of the pthread-lib Library.
+ * Copyright (C) 2008-2009 Nick Powers.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Library General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor Boston, MA 02110-1301,  USA
+ */
+
+ /*
+  * For a "class" description, see the header file. 
+  */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <string.h>
+#include <errno.h>
+#include "ptl_queue.h"
+#include "ptl_util.h"
+#include "ptl_spsc_queue.h"
+
+
+/* Structures */
+
+/* Ring state (kept in q->data). Each side writes only its own cache line */
+struct ptl_spsc_state {
+	void **slots;				/**< the ring */
+	unsigned long mask;			/**< capacity - 1 */
+	/* consumer side */
+	unsigned long head __attribute__((aligned(PTL_CACHE_LINE_SIZE)));
+	unsigned long cached_tail;	/**< last 'tail' the consumer read */
+	int consumer_waiting;		/**< consumer is asleep on 'not_empty' */
+	/* producer side */
+	unsigned long tail __attribute__((aligned(PTL_CACHE_LINE_SIZE)));
+	unsigned long cached_head;	/**< last 'head' the producer read */
+	int producer_waiting;		/**< producer is asleep on 'not_full' */
+} __attribute__((aligned(PTL_CACHE_LINE_SIZE)));
+
+
+/* Private Functions */
+int _ptl_spsc_try_add(struct ptl_spsc_state *sq, void *value);
+void* _ptl_spsc_try_get(struct ptl_spsc_state *sq);
+void _ptl_spsc_wake(ptl_q_t q, int *waiting, pthread_cond_t *cond);
+int _ptl_spsc_sleep(ptl_q_t q, pthread_cond_t *cond, struct timespec *deadline);
+
+
+/* Global Variables */
+
+/* functions to use with ptl_q_create_queue() */
+struct ptl_q_funcs ptl_spsc_funcs = {
+	ptl_spsc_init_queue,
+	ptl_spsc_destroy_queue,
+	ptl_spsc_add,
+	ptl_spsc_add_wait,
+	ptl_spsc_clear,
+	ptl_spsc_peek,
+	ptl_spsc_get,
+	ptl_spsc_get_wait,
+	ptl_spsc_size,
+	ptl_spsc_add_batch,
+	ptl_spsc_get_batch
+};
+
+
+/* initalize the ptl_q structure for a spsc queue */
+void ptl_spsc_init_queue(ptl_q_t q){
+	assert(q);
+	
+	pthread_mutex_init(&q->mutex, NULL); // only used to sleep
+	ptl_cond_init(&q->not_empty);
+	ptl_cond_init(&q->not_full);
+	
+	q->type = PTL_Q_TYPE_SPSC;
+	q->size = 0; // not used, see ptl_spsc_size()
+	q->head = q->tail = q->ptr = NULL; // not used
+	
+	// round capacity up to a power of two so a mask finds the slot
+	unsigned long capacity = 2;
+	while(capacity < (unsigned long)q->capacity){
+		capacity <<= 1;
+	}
+	q->capacity = capacity;
+	
+	struct ptl_spsc_state *sq = NULL;
+	int rc = posix_memalign((void **)&sq, PTL_CACHE_LINE_SIZE, sizeof(struct ptl_spsc_state));
+	assert(rc == 0);
+	memset(sq, 0, sizeof(struct ptl_spsc_state));
+	
+	sq->mask = capacity - 1;
+	sq->slots = (void **)calloc(capacity, sizeof(void *));
+	assert(sq->slots);
+	
+	q->data = sq;
+}
+
+
+/* free all the memory associated with a spsc queue */
+void ptl_spsc_destroy_queue(ptl_q_t q){
+	assert(q);
+	
+	struct ptl_spsc_state *sq = (struct ptl_spsc_state *)q->data;
+	
+	FREE(sq->slots);
+	FREE(q->data);
+	q->capacity = 0;
+	
+	pthread_mutex_destroy(&q->mutex);
+	pthread_cond_destroy(&q->not_empty);
+	pthread_cond_destroy(&q->not_full);
+}
+
+
+/* add without waiting, returns 0 if the ring is full */
+int ptl_spsc_add(ptl_q_t q, void *value){
+	if(q == NULL || value == NULL){ return 0; }
+	
+	struct ptl_spsc_state *sq = (struct ptl_spsc_state *)q->data;
+	
+	if(!_ptl_spsc_try_add(sq, value)){ return 0; }
+	
+	_ptl_spsc_wake(q, &sq->consumer_waiting, &q->not_empty);
+	
+	return 1;
+}
+
+
+/* add, sleeping on 'not_full' until 'timeout' when the ring is full */
+int ptl_spsc_add_wait(ptl_q_t q, void *value, long timeout){
+	if(q == NULL || value == NULL || timeout < 0){ return 0; }
+	
+	if(ptl_spsc_add(q, value)){ return 1; } // fast path
+	
+	struct ptl_spsc_state *sq = (struct ptl_spsc_state *)q->data;
+	struct timespec deadline;
+	ptl_get_future_time(&deadline, timeout * 1000); // ms to usec
+	int added_a_element = 0;
+	
+	__atomic_store_n(&sq->producer_waiting, 1, __ATOMIC_SEQ_CST);
+	
+	// retry and sleep under the lock, so a consumer's signal can't fall between
+	pthread_mutex_lock(&q->mutex); // lock
+	
+	while(!(added_a_element = _ptl_spsc_try_add(sq, value))){
+		if(!_ptl_spsc_sleep(q, &q->not_full, &deadline)){
+			added_a_element = _ptl_spsc_try_add(sq, value); // one last try
+			break;
+		}
+	}
+	
+	pthread_mutex_unlock(&q->mutex); // unlock
+	
+	__atomic_store_n(&sq->producer_waiting, 0, __ATOMIC_RELAXED);
+	
+	if(added_a_element){
+		_ptl_spsc_wake(q, &sq->consumer_waiting, &q->not_empty);
+	}
+	
+	return added_a_element;
+}
+
+
+/* copy as many 'values' as fit and publish them with one store */
+int ptl_spsc_add_batch(ptl_q_t q, void **values, int count){
+	if(q == NULL || values == NULL || count <= 0){ return 0; }
+	
+	struct ptl_spsc_state *sq = (struct ptl_spsc_state *)q->data;
+	unsigned long tail = sq->tail;
+	unsigned long capacity = sq->mask + 1;
+	
+	if(tail - sq->cached_head + count > capacity){ // may not fit, look again
+		sq->cached_head = __atomic_load_n(&sq->head, __ATOMIC_ACQUIRE);
+	}
+	
+	unsigned long room = capacity - (tail - sq->cached_head);
+	int added = 0;
+	while(added < count && (unsigned long)added < room && values[added] != NULL){
+		sq->slots[(tail + added) & sq->mask] = values[added];
+		added++;
+	}
+	
+	if(added == 0){ return 0; }
+	
+	__atomic_store_n(&sq->tail, tail + added, __ATOMIC_RELEASE); // publish
+	
+	_ptl_spsc_wake(q, &sq->consumer_waiting, &q->not_empty);
+	
+	return added;
+}
+
+
+/* take everything out, the 'value' elements aren't freed */
+void ptl_spsc_clear(ptl_q_t q){
+	if(q == NULL){ return; }
+	
+	while(ptl_spsc_get(q) != NULL){
+		; // drop it
+	}
+}
+
+
+/* looks at and returns the first element, but does not remove */
+void* ptl_spsc_peek(ptl_q_t q){
+	if(q == NULL){ return NULL; }
+	
+	struct ptl_spsc_state *sq = (struct ptl_spsc_state *)q->data;
+	unsigned long head = sq->head;
+	
+	if(head == sq->cached_tail){
+		sq->cached_tail = __atomic_load_n(&sq->tail, __ATOMIC_ACQUIRE);
+		if(head == sq->cached_tail){ return NULL; }
+	}
+	
+	return sq->slots[head & sq->mask];
+}
+
+
+/* get without waiting, returns NULL if the ring is empty */
+void* ptl_spsc_get(ptl_q_t q){
+	if(q == NULL){ return NULL; }
+	
+	struct ptl_spsc_state *sq = (struct ptl_spsc_state *)q->data;
+	
+	void *value = _ptl_spsc_try_get(sq);
+	
+	if(value != NULL){
+		_ptl_spsc_wake(q, &sq->producer_waiting, &q->not_full);
+	}
+	
+	return value;
+}
+
+
+/* copy out up to 'max' elements and hand the slots back with one store */
+int ptl_spsc_get_batch(ptl_q_t q, void **values, int max){
+	if(q == NULL || values == NULL || max <= 0){ return 0; }
+	
+	struct ptl_spsc_state *sq = (struct ptl_spsc_state *)q->data;
+	unsigned long head = sq->head;
+	
+	if(sq->cached_tail - head < (unsigned long)max){ // may have more, look again
+		sq->cached_tail = __atomic_load_n(&sq->tail, __ATOMIC_ACQUIRE);
+	}
+	
+	unsigned long available = sq->cached_tail - head;
+	int taken = (available < (unsigned long)max) ? (int)available : max;
+	
+	if(taken == 0){ return 0; }
+	
+	int i = 0;
+	for(i = 0; i < taken; i++){
+		values[i] = sq->slots[(head + i) & sq->mask];
+	}
+	
+	__atomic_store_n(&sq->head, head + taken, __ATOMIC_RELEASE); // hand back
+	
+	_ptl_spsc_wake(q, &sq->producer_waiting, &q->not_full);
+	
+	return taken;
+}
+
+
+/* get, sleeping on 'not_empty' until 'timeout' when the ring is empty */
+void* ptl_spsc_get_wait(ptl_q_t q, long timeout){
+	if(q == NULL || timeout < 0){ return NULL; }
+	
+	void *element = ptl_spsc_get(q); // fast path
+	if(element != NULL){ return element; }
+	
+	struct ptl_spsc_state *sq = (struct ptl_spsc_state *)q->data;
+	struct timespec deadline;
+	ptl_get_future_time(&deadline, timeout * 1000); // ms to usec
+	
+	__atomic_store_n(&sq->consumer_waiting, 1, __ATOMIC_SEQ_CST);
+	
+	// retry and sleep under the lock, so a producer's signal can't fall between
+	pthread_mutex_lock(&q->mutex); // lock
+	
+	while((element = _ptl_spsc_try_get(sq)) == NULL){
+		if(!_ptl_spsc_sleep(q, &q->not_empty, &deadline)){
+			element = _ptl_spsc_try_get(sq); // one last try
+			break;
+		}
+	}
+	
+	pthread_mutex_unlock(&q->mutex); // unlock
+	
+	__atomic_store_n(&sq->consumer_waiting, 0, __ATOMIC_RELAXED);
+	
+	if(element != NULL){
+		_ptl_spsc_wake(q, &sq->producer_waiting, &q->not_full);
+	}
+	
+	return element;
+}
+
+
+/* number of elements between the two ends */
+long ptl_spsc_size(ptl_q_t q){
+	if(q == NULL){ return 0; }
+	
+	struct ptl_spsc_state *sq = (struct ptl_spsc_state *)q->data;
+	
+	unsigned long head = __atomic_load_n(&sq->head, __ATOMIC_ACQUIRE);
+	unsigned long tail = __atomic_load_n(&sq->tail, __ATOMIC_ACQUIRE);
+	
+	return (long)(tail - head);
+}
+
+
+/* Private Functions */
+
+/* producer side: write the slot at 'tail'. returns 0 if full */
+int _ptl_spsc_try_add(struct ptl_spsc_state *sq, void *value){
+	unsigned long tail = sq->tail; // only we write it
+	
+	// only look at the consumer's line when our copy says full
+	if(tail - sq->cached_head > sq->mask){
+		sq->cached_head = __atomic_load_n(&sq->head, __ATOMIC_ACQUIRE);
+		if(tail - sq->cached_head > sq->mask){ return 0; }
+	}
+	
+	sq->slots[tail & sq->mask] = value;
+	__atomic_store_n(&sq->tail, tail + 1, __ATOMIC_RELEASE); // publish
+	
+	return 1;
+}
+
+
+/* consumer side: read the slot at 'head'. returns NULL if empty */
+void* _ptl_spsc_try_get(struct ptl_spsc_state *sq){
+	unsigned long head = sq->head; // only we write it
+	
+	// only look at the producer's line when our copy says empty
+	if(head == sq->cached_tail){
+		sq->cached_tail = __atomic_load_n(&sq->tail, __ATOMIC_ACQUIRE);
+		if(head == sq->cached_tail){ return NULL; }
+	}
+	
+	void *value = sq->slots[head & sq->mask];
+	__atomic_store_n(&sq->head, head + 1, __ATOMIC_RELEASE); // hand the slot back
+	
+	return value;
+}
+
+
+/* signal 'cond' if the other side said it is asleep (plain load, no fence) */
+void _ptl_spsc_wake(ptl_q_t q, int *waiting, pthread_cond_t *cond){
+	if(__atomic_load_n(waiting, __ATOMIC_RELAXED)){
+		pthread_mutex_lock(&q->mutex);
+		pthread_cond_signal(cond);
+		pthread_mutex_unlock(&q->mutex);
+	}
+}
+
+
+/* sleep on 'cond' until signalled, the deadline, or the next re-check.
+   'q->mutex' is held, the wait keeps it. returns 0 once 'deadline' has passed */
+int _ptl_spsc_sleep(ptl_q_t q, pthread_cond_t *cond, struct timespec *deadline){
+	struct timespec recheck;
+	ptl_get_future_time(&recheck, PTL_SPSC_RECHECK_USEC);
+	
+	int last = (recheck.tv_sec > deadline->tv_sec) ||
+		(recheck.tv_sec == deadline->tv_sec && recheck.tv_nsec >= deadline->tv_nsec);
+	
+	int rc = pthread_cond_timedwait(cond, &q->mutex, last ? deadline : &recheck);
+	
+	return !(last && rc == ETIMEDOUT);
+}
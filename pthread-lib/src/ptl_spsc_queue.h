@@ -0,0 +1,157 @@
+/*
+ * This file is part of the pthread-lib Library.
+ * Copyright (C) 2008-2009 Nick Powers.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Library General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor Boston, MA 02110-1301,  USA
+ */
+
+
+/**
+ * This "class" is a bounded ring buffer queue for exactly one producer thread
+ * and one consumer thread, e.g. two stages of a pipeline. Each side owns one
+ * index and keeps a cached copy of the other side's index, so it only reads
+ * the other side's cache line when the cached copy says the ring is full or
+ * empty. The fast path uses only acquire loads and release stores, with no
+ * locked instructions. The capacity is rounded up to a power of two.
+ *
+ * Only one thread may call add/add_wait and only one thread may call
+ * get/get_wait/peek/clear. Use ptl_rq_funcs when there are more threads.
+ *
+ * A waiting consumer (or producer) sets a flag, then retries and sleeps on
+ * the queue's condition under the queue's lock, so a signal can't slip in
+ * between its last try and its sleep. The other side checks the flag with a
+ * plain load, so the fast path stays fence-free. When that load misses a
+ * flag that was just set, the wakeup is not lost, but it may be noticed up
+ * to PTL_SPSC_RECHECK_USEC late.
+ *
+ * This queue does not keep the 'size' field up to date. Use ptl_q_size().
+ */
+
+
+#ifndef __PTL_SPSC_QUEUE_H__
+#define __PTL_SPSC_QUEUE_H__
+
+/* longest a waiting thread sleeps before it checks the ring again */
+#define PTL_SPSC_RECHECK_USEC 1000
+
+/**
+ * Function table for this queue, e.g. ptl_q_create_queue(&ptl_spsc_funcs, 1024)
+ */
+extern struct ptl_q_funcs ptl_spsc_funcs;
+
+/**
+ * Initializes the queue, creating the ring of 'capacity' slots. 'capacity' is
+ * rounded up to the next power of two and stored back in the queue.
+ * 
+ * @param q queue to be initized.
+ */
+void ptl_spsc_init_queue(ptl_q_t q);
+
+/**
+ * Destroys the queue and frees the memory. The 'values' are not freed.
+ * 
+ * @param q the queue to destroy
+ */
+void ptl_spsc_destroy_queue(ptl_q_t q);
+
+/**
+ * Inserts the specified element into this queue without waiting.
+ * Producer thread only.
+ *
+ * @param q non-null queue
+ * @param value the value to be stored in the queue
+ * @return 1 if successful, 0 if the queue is full
+ */
+int ptl_spsc_add(ptl_q_t q, void *value);
+
+/**
+ * Inserts the element, waiting up to 'timeout' for room if the queue is full.
+ * Producer thread only.
+ * 
+ * @param q non-null queue to add the value
+ * @param value data that will be added to the queue
+ * @param timeout number of milliseconds to wait for room
+ * @return 1 if successful, 0 otherwise
+ **/
+int ptl_spsc_add_wait(ptl_q_t q, void *value, long timeout);
+
+/**
+ * Inserts up to 'count' elements and publishes them with one release store.
+ * Stops at the first NULL value or when the ring is full. Producer thread only.
+ *
+ * @param q non-null queue
+ * @param values elements to add, in order
+ * @param count number of elements in 'values'
+ * @return number of elements added
+ */
+int ptl_spsc_add_batch(ptl_q_t q, void **values, int count);
+
+/**
+ * Removes all of the elements from this queue. The 'values' are not freed.
+ * Consumer thread only.
+ *
+ * @param q non-null queue to be cleared
+ */
+void ptl_spsc_clear(ptl_q_t q);
+
+/**
+ * Retrieves, but does not remove, the head of this queue.
+ * Consumer thread only.
+ *
+ * @param q non-null queue to peek on
+ * @return pointer to the head element or NULL if the queue is empty
+ */
+void* ptl_spsc_peek(ptl_q_t q);
+
+/**
+ * Retrieves and removes the head of this queue without waiting.
+ * Consumer thread only.
+ *
+ * @param q non-null queue to get an element from
+ * @return the head element or NULL if the queue is empty
+ */
+void* ptl_spsc_get(ptl_q_t q);
+
+/**
+ * Retrieves and removes up to 'max' elements and hands their slots back with
+ * one release store. Consumer thread only.
+ *
+ * @param q non-null queue to get elements from
+ * @param values where the elements are stored, in queue order
+ * @param max room in 'values'
+ * @return number of elements stored in 'values'
+ */
+int ptl_spsc_get_batch(ptl_q_t q, void **values, int max);
+
+/**
+ * Retrieves and removes the head of this queue, waiting up to 'timeout' for
+ * an element to become available. Consumer thread only.
+ *
+ * @param q non-null queue to get an element from
+ * @param timeout time in milliseconds
+ * @return the head element or NULL if no element was found
+ */
+void* ptl_spsc_get_wait(ptl_q_t q, long timeout);
+
+/**
+ * Returns the number of elements in the ring. Any thread may call this.
+ *
+ * @param q non-null queue
+ * @return number of elements in the ring
+ */
+long ptl_spsc_size(ptl_q_t q);
+
+
+#endif
@@ -0,0 +1,153 @@
+/*
+ * This file is part of the pthread-lib Library.
+ * Copyright (C) 2008-2009 Nick Powers.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Library General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor Boston, MA 02110-1301,  USA
+ */
+
+/* See header file for documentation. */
+
+#include <stdlib.h>
+#include "ptl_stats.h"
+#include "ptl_util.h"
+
+
+/* Global Variables */
+static int ptl_stats_next_stripe = 0;			// handed out round robin
+static __thread int ptl_stats_my_stripe = -1;	// this thread's, -1 until it asks
+
+
+/* Public Functions */
+
+/* pick a stripe the first time, then keep it */
+int ptl_stats_stripe(void){
+	if(ptl_stats_my_stripe < 0){
+		ptl_stats_my_stripe = __atomic_fetch_add(&ptl_stats_next_stripe, 1, __ATOMIC_RELAXED) 
+							  % PTL_STATS_STRIPES;
+	}
+	
+	return ptl_stats_my_stripe;
+}
+
+
+/* cache line aligned calloc */
+void *ptl_stats_alloc(size_t size){
+	return ptl_cache_aligned_alloc(size);
+}
+
+
+/* count it in its bucket, and in the totals */
+void ptl_hist_record(struct ptl_histogram *h, unsigned long long value){
+	__atomic_add_fetch(&h->counts[ptl_hist_bucket(value)], 1, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&h->total, 1, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&h->sum, value, __ATOMIC_RELAXED);
+	
+	unsigned long long max = __atomic_load_n(&h->max, __ATOMIC_RELAXED);
+	while(value > max && 
+		  !__atomic_compare_exchange_n(&h->max, &max, value, 1, 
+									   __ATOMIC_RELAXED, __ATOMIC_RELAXED)){
+		// 'max' was reloaded, try again while ours is still bigger
+	}
+}
+
+
+/* add the buckets of one to the other */
+void ptl_hist_merge(struct ptl_histogram *into, const struct ptl_histogram *from){
+	int i = 0;
+	
+	for(i = 0; i < PTL_HIST_BUCKETS; i++){
+		into->counts[i] += __atomic_load_n(&from->counts[i], __ATOMIC_RELAXED);
+	}
+	
+	into->total += __atomic_load_n(&from->total, __ATOMIC_RELAXED);
+	into->sum += __atomic_load_n(&from->sum, __ATOMIC_RELAXED);
+	
+	unsigned long long max = __atomic_load_n(&from->max, __ATOMIC_RELAXED);
+	if(max > into->max){
+		into->max = max;
+	}
+}
+
+
+/* walk the buckets until 'percentile' of the values are behind us */
+unsigned long long ptl_hist_percentile(const struct ptl_histogram *h, double percentile){
+	unsigned long long total = 0;
+	int i = 0;
+	
+	// add the buckets up rather than trusting 'total', they may disagree
+	// while the histogram is being merged
+	for(i = 0; i < PTL_HIST_BUCKETS; i++){
+		total += h->counts[i];
+	}
+	if(total == 0){ return 0; }
+	
+	if(percentile < 0.0){ percentile = 0.0; }
+	if(percentile > 100.0){ percentile = 100.0; }
+	
+	unsigned long long wanted = (unsigned long long)(percentile / 100.0 * total + 0.5);
+	unsigned long long seen = 0;
+	
+	if(wanted == 0){ wanted = 1; }
+	
+	for(i = 0; i < PTL_HIST_BUCKETS; i++){
+		seen += h->counts[i];
+		if(seen >= wanted){
+			unsigned long long value = ptl_hist_bucket_value(i);
+			// the top bucket covers up to the largest value seen
+			return (h->max != 0 && value > h->max) ? h->max : value;
+		}
+	}
+	
+	return h->max;
+}
+
+
+/* sum / total */
+unsigned long long ptl_hist_mean(const struct ptl_histogram *h){
+	if(h->total == 0){ return 0; }
+	
+	return h->sum / h->total;
+}
+
+
+/* exact below PTL_HIST_SUB_COUNT, then PTL_HIST_SUB_COUNT buckets per power of two */
+int ptl_hist_bucket(unsigned long long value){
+	if(value < PTL_HIST_SUB_COUNT){
+		return (int)value;
+	}
+	
+	int exp = 63 - __builtin_clzll(value); // PTL_HIST_SUB_BITS or more
+	if(exp > PTL_HIST_MAX_EXP){
+		return PTL_HIST_BUCKETS - 1;
+	}
+	
+	int shift = exp - PTL_HIST_SUB_BITS;
+	int sub = (int)(value >> shift) - PTL_HIST_SUB_COUNT; // the bits after the top one
+	
+	return (shift + 1) * PTL_HIST_SUB_COUNT + sub;
+}
+
+
+/* the inverse of ptl_hist_bucket, rounded up */
+unsigned long long ptl_hist_bucket_value(int bucket){
+	if(bucket < PTL_HIST_SUB_COUNT){
+		return (unsigned long long)bucket;
+	}
+	
+	int shift = bucket / PTL_HIST_SUB_COUNT - 1;
+	unsigned long long sub = (unsigned long long)(bucket % PTL_HIST_SUB_COUNT);
+	
+	return ((PTL_HIST_SUB_COUNT + sub + 1) << shift) - 1;
+}
@@ -0,0 +1,131 @@
+/*
+ * This file is part of the pthread-lib Library.
+ * Copyright (C) 2008-2009 Nick Powers.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Library General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor Boston, MA 02110-1301,  USA
+ */
+
+/**
+ * Building blocks for the opt-in statistics of queues and thread managers
+ * (see ptl_q_enable_stats and ptl_tm_options.collect_stats).
+ *
+ * Counters are striped: each thread writes the stripe picked by
+ * ptl_stats_stripe(), and every stripe sits in its own cache lines, so
+ * threads updating counters don't share a line. Readers add the stripes
+ * up. Two threads only share a stripe when there are more threads than
+ * PTL_STATS_STRIPES. Updates are relaxed atomic adds, so a shared stripe
+ * still counts right.
+ *
+ * Latencies go into log-linear histograms, the HdrHistogram layout. Values
+ * below PTL_HIST_SUB_COUNT get a bucket each. Above that, every power of two
+ * is split into PTL_HIST_SUB_COUNT equal buckets, so a recorded value is
+ * accurate to about 1 / PTL_HIST_SUB_COUNT of itself (6% with 16).
+ */
+
+#ifndef __PTL_STATS_H__
+#define __PTL_STATS_H__
+
+#include <stddef.h>
+
+/* Constants */
+#define PTL_STATS_STRIPES 16			/**< counter stripes, threads map onto them */
+
+#define PTL_HIST_SUB_BITS 4				/**< log2 of the buckets per power of two */
+#define PTL_HIST_SUB_COUNT (1 << PTL_HIST_SUB_BITS)
+#define PTL_HIST_MAX_EXP 36				/**< values of 2^(MAX_EXP + 1) and up (about two
+										 minutes in ns) go in the last bucket */
+#define PTL_HIST_BUCKETS ((PTL_HIST_MAX_EXP - PTL_HIST_SUB_BITS + 2) * PTL_HIST_SUB_COUNT)
+
+
+/* Structures */
+
+struct ptl_histogram {
+	unsigned long long counts[PTL_HIST_BUCKETS];
+	unsigned long long total;			/**< values recorded */
+	unsigned long long sum;				/**< of the values, for the mean */
+	unsigned long long max;				/**< largest value, exact */
+};
+
+
+/* Public Functions */
+
+/**
+ * Stripe of the calling thread, picked round robin the first time it asks.
+ *
+ * @return index below PTL_STATS_STRIPES
+ */
+int ptl_stats_stripe(void);
+
+/**
+ * Zeroed memory starting on a cache line boundary, free() releases it.
+ *
+ * @param size bytes wanted, rounded up to whole cache lines
+ * @return the memory
+ */
+void *ptl_stats_alloc(size_t size);
+
+/**
+ * Records one value. Safe to call from several threads on the same
+ * histogram.
+ *
+ * @param h histogram to add to
+ * @param value to record, in whatever unit the histogram uses
+ */
+void ptl_hist_record(struct ptl_histogram *h, unsigned long long value);
+
+/**
+ * Adds every count in 'from' to 'into'. 'from' may be updated meanwhile; the
+ * result then holds some of the new values, not a torn one.
+ *
+ * @param into histogram that receives the counts, not shared
+ * @param from histogram to add
+ */
+void ptl_hist_merge(struct ptl_histogram *into, const struct ptl_histogram *from);
+
+/**
+ * Value at or below which 'percentile' percent of the recorded values lie,
+ * give or take the bucket width.
+ *
+ * @param h histogram to read, not being updated
+ * @param percentile between 0 and 100
+ * @return the value, 0 if nothing was recorded
+ */
+unsigned long long ptl_hist_percentile(const struct ptl_histogram *h, double percentile);
+
+/**
+ * Mean of the recorded values.
+ *
+ * @param h histogram to read
+ * @return the mean, 0 if nothing was recorded
+ */
+unsigned long long ptl_hist_mean(const struct ptl_histogram *h);
+
+/**
+ * Bucket a value is counted in.
+ *
+ * @param value a recorded value
+ * @return index below PTL_HIST_BUCKETS
+ */
+int ptl_hist_bucket(unsigned long long value);
+
+/**
+ * Largest value counted in a bucket, what ptl_hist_percentile reports.
+ *
+ * @param bucket index below PTL_HIST_BUCKETS
+ * @return the value
+ */
+unsigned long long ptl_hist_bucket_value(int bucket);
+
+#endif
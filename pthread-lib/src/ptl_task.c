@@ -20,29 +20,538 @@
 
 #include <pthread.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
 #include <assert.h>
-#include <malloc.h>
-#include <assert.h>
-#include <string.h>
+#include <errno.h>
 #include "ptl_task.h"
+#include "ptl_trace.h"
 #include "ptl_util.h"
 
-/* create a task in dynamic memory */
-ptl_task_t create_task(void (*function_to_execute)(void*)){
+
+/* Constants */
+#define _PTL_TASK_SEALED ((struct ptl_task_link *)1)	/* 'successors' of a finished task */
+
+
+/* Structures */
+
+/* free tasks owned by one thread */
+struct ptl_task_cache {
+	ptl_task_t head;
+	int count;
+	int registered; // exit handler installed for this thread
+};
+
+
+/* Private Functions */
+ptl_task_t _ptl_task_alloc();
+void _ptl_task_recycle(ptl_task_t task);
+void _ptl_task_free(ptl_task_t task);
+void _ptl_task_refill(struct ptl_task_cache *cache);
+void _ptl_task_spill(struct ptl_task_cache *cache, int count);
+void _ptl_task_release_cache(void *cache);
+void _ptl_task_register_cache(struct ptl_task_cache *cache);
+void _ptl_task_create_key();
+struct ptl_future_sync *_ptl_future_get_sync(ptl_future_t future);
+long _ptl_future_msec_left(unsigned long long end_nsec);
+ptl_task_t _ptl_task_finish(ptl_task_t task, void *result, int state, int keep_one);
+ptl_task_t _ptl_task_release_successors(ptl_task_t task, int keep_one);
+
+
+/* Global Variables */
+static __thread struct ptl_task_cache ptl_task_cache;
+static pthread_key_t ptl_task_key;
+static pthread_once_t ptl_task_key_once = PTHREAD_ONCE_INIT;
+static pthread_mutex_t ptl_task_mutex = PTHREAD_MUTEX_INITIALIZER; // guards the shared list
+static ptl_task_t ptl_task_shared = NULL;
+static long ptl_task_shared_count = 0;
+
+
+/* Public Functions */
+
+/* create a task without an argument */
+ptl_task_t create_task(void *(*function_to_execute)(void*)){
+	return create_task_with_arg(function_to_execute, NULL);
+}
+
+
+/* take a task from the thread cache and fill it in */
+ptl_task_t create_task_with_arg(void *(*function_to_execute)(void*), void *arg){
 	if(function_to_execute == NULL) { return NULL; }
 	
-	ptl_task_t task = (ptl_task_t)calloc(1, sizeof(struct ptl_task));
-	assert(task);
+	ptl_task_t task = _ptl_task_alloc();
 	
 	task->function_to_execute = function_to_execute;
+	task->arg = arg;
+	task->priority = 0;
+	task->period = 0;
+	task->submit_nsec = 0;
 	task->state = PTL_TASK_STATE_CREATED;
+	task->refs = 1;
+	task->future.result = NULL;
+	task->future.waiters = 0;
+	task->pending = 1; // the submit
+	task->successors = NULL;
+	task->submit_func = NULL;
+	task->manager = NULL;
+	task->next = NULL;
+	task->trace_id = PTL_TRACE_NEW_ID();
 	
 	return task;
 }
 
-/* destroy memory for a task. Does not destroy any memory it's pointing to */
+
+/* drop the manager's (or creator's) hold. Does not destroy any memory it's pointing to */
 void destroy_task(ptl_task_t task){
 	if(task == NULL) { return; }
-	   
+	
+	if(PTL_ATOMIC_DEC(task->refs) == 0){
+		_ptl_task_recycle(task);
+	}
+}
+
+
+/* a second owner, released by ptl_future_destroy */
+ptl_future_t ptl_task_get_future(ptl_task_t task){
+	if(task == NULL){ return NULL; }
+	
+	PTL_ATOMIC_INC(task->refs);
+	
+	return &task->future;
+}
+
+
+/* count 'next' as waiting, then link it, unless 'task' is sealed already */
+int ptl_task_then(ptl_task_t task, ptl_task_t next){
+	if(task == NULL || next == NULL || task == next) { return 0; }
+	
+	// a submitted task is recycled once it has run, unless its future is held
+	assert(__atomic_load_n(&task->refs, __ATOMIC_ACQUIRE) > 0);
+	
+	struct ptl_task_link *link = (struct ptl_task_link *)malloc(sizeof(struct ptl_task_link));
+	assert(link);
+	link->task = next;
+	
+	PTL_ATOMIC_INC(next->pending);
+	
+	struct ptl_task_link *head = __atomic_load_n(&task->successors, __ATOMIC_ACQUIRE);
+	do {
+		if(head == _PTL_TASK_SEALED){ // finished, nothing to wait for
+			PTL_ATOMIC_DEC(next->pending);
+			FREE(link);
+			return 1;
+		}
+		link->next = head;
+	} while(!__atomic_compare_exchange_n(&task->successors, &head, link, 1,
+										 __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE));
+	
+	return 1;
+}
+
+
+/* one link per predecessor, once all of them are known to be valid; a link
+   made before a bad entry would release 'next' the caller was told failed */
+int ptl_task_when_all(ptl_task_t *tasks, int n, ptl_task_t next){
+	if(tasks == NULL || n < 0 || next == NULL) { return 0; }
+	
+	int i = 0;
+	for(i = 0; i < n; i++){
+		if(tasks[i] == NULL || tasks[i] == next){
+			return 0;
+		}
+	}
+	
+	for(i = 0; i < n; i++){
+		ptl_task_then(tasks[i], next);
+	}
+	
+	return 1;
+}
+
+
+/* a task without predecessors costs one load here */
+int ptl_task_hold(ptl_task_t task, int (*submit_func)(void *, ptl_task_t), void *manager){
+	if(__atomic_load_n(&task->pending, __ATOMIC_ACQUIRE) <= 1){
+		// only the submit is left (or it was released), it goes now
+		__atomic_store_n(&task->pending, 0, __ATOMIC_RELAXED);
+		return 0;
+	}
+	
+	// read by the predecessor that brings 'pending' to 0
+	task->submit_func = submit_func;
+	task->manager = manager;
+	
+	return (PTL_ATOMIC_DEC(task->pending) > 0);
+}
+
+
+/* CREATED -> RUNNING, fails once cancelled */
+int ptl_task_start(ptl_task_t task){
+	int expected = PTL_TASK_STATE_CREATED;
+	
+	return __atomic_compare_exchange_n(&task->state, &expected, PTL_TASK_STATE_RUNNING, 0,
+									   __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+}
+
+
+/* RUNNING -> CREATED, fails once cancelled (STOPPING) */
+int ptl_task_rearm(ptl_task_t task){
+	int expected = PTL_TASK_STATE_RUNNING;
+	
+	return __atomic_compare_exchange_n(&task->state, &expected, PTL_TASK_STATE_CREATED, 0,
+									   __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+}
+
+
+/* finish, and submit every successor that was only waiting on this one */
+void ptl_task_finish(ptl_task_t task, void *result, int state){
+	_ptl_task_finish(task, result, state, 0);
+}
+
+
+/* finish, keeping one ready successor for the caller to run */
+ptl_task_t ptl_task_finish_continue(ptl_task_t task, void *result, int state){
+	return _ptl_task_finish(task, result, state, 1);
+}
+
+
+/* look at the state, and only sleep on the (lazily made) condition if needed */
+void *ptl_future_get(ptl_future_t future, long timeout){
+	if(future == NULL){ return NULL; }
+	
+	ptl_task_t task = (ptl_task_t)((char *)future - offsetof(struct ptl_task, future));
+	
+	int state = __atomic_load_n(&task->state, __ATOMIC_ACQUIRE);
+	if(state == PTL_TASK_STATE_DONE){
+		return future->result;
+	}
+	if(state > PTL_TASK_STATE_DONE || timeout == 0){ // cancelled, rejected, or not waiting
+		return NULL;
+	}
+	
+	struct ptl_future_sync *sync = _ptl_future_get_sync(future);
+	struct timespec deadline;
+	unsigned long long end_nsec = 0;
+	int in_fiber = (ptl_fiber_current() != NULL);
+	if(timeout > 0){
+		ptl_get_future_time(&deadline, timeout * 1000); // ms to usec
+		end_nsec = ptl_get_time_nsec() + (unsigned long long)timeout * 1000000ULL;
+	}
+	
+	pthread_mutex_lock(&sync->mutex);
+	PTL_ATOMIC_INC(future->waiters);
+	__atomic_thread_fence(__ATOMIC_SEQ_CST); // see ptl_task_finish
+	
+	while((state = __atomic_load_n(&task->state, __ATOMIC_ACQUIRE)) < PTL_TASK_STATE_DONE){
+		if(in_fiber){
+			// the worker runs other fibers meanwhile
+			if(!ptl_fiber_cond_wait(&sync->fibers, &sync->mutex, _ptl_future_msec_left(end_nsec))){
+				state = __atomic_load_n(&task->state, __ATOMIC_ACQUIRE); // one last look
+				break;
+			}
+		} else if(timeout < 0){
+			pthread_cond_wait(&sync->done, &sync->mutex);
+		} else if(pthread_cond_timedwait(&sync->done, &sync->mutex, &deadline) == ETIMEDOUT){
+			state = __atomic_load_n(&task->state, __ATOMIC_ACQUIRE); // one last look
+			break;
+		}
+	}
+	
+	PTL_ATOMIC_DEC(future->waiters);
+	pthread_mutex_unlock(&sync->mutex);
+	
+	return (state == PTL_TASK_STATE_DONE) ? future->result : NULL;
+}
+
+
+/* DONE, CANCELLED and REJECTED are all final */
+int ptl_future_is_done(ptl_future_t future){
+	if(future == NULL){ return 0; }
+	
+	ptl_task_t task = (ptl_task_t)((char *)future - offsetof(struct ptl_task, future));
+	
+	return __atomic_load_n(&task->state, __ATOMIC_ACQUIRE) >= PTL_TASK_STATE_DONE;
+}
+
+
+/* CREATED -> CANCELLED, the worker that dequeues it skips it. A running
+   periodic task goes to STOPPING, its worker won't rearm it */
+int ptl_future_cancel(ptl_future_t future){
+	if(future == NULL){ return 0; }
+	
+	ptl_task_t task = (ptl_task_t)((char *)future - offsetof(struct ptl_task, future));
+	
+	for(;;){
+		int expected = PTL_TASK_STATE_CREATED;
+		
+		if(__atomic_compare_exchange_n(&task->state, &expected, PTL_TASK_STATE_RUNNING, 0,
+									   __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)){
+			// it's ours now, finish it so waiters wake up
+			ptl_task_finish(task, NULL, PTL_TASK_STATE_CANCELLED);
+			return 1;
+		}
+		
+		if(expected != PTL_TASK_STATE_RUNNING || task->period == 0){
+			return 0; // started or finished
+		}
+		
+		if(__atomic_compare_exchange_n(&task->state, &expected, PTL_TASK_STATE_STOPPING, 0,
+									   __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)){
+			return 1;
+		}
+		// rearmed in between, try again
+	}
+}
+
+
+/* drop the caller's hold */
+void ptl_future_destroy(ptl_future_t future){
+	if(future == NULL){ return; }
+	
+	destroy_task((ptl_task_t)((char *)future - offsetof(struct ptl_task, future)));
+}
+
+
+
+/* Private Functions */
+
+/* pop from the thread cache, refilling from the shared list if needed */
+ptl_task_t _ptl_task_alloc(){
+	struct ptl_task_cache *cache = &ptl_task_cache;
+	
+	if(cache->head == NULL){
+		_ptl_task_refill(cache);
+	}
+	
+	ptl_task_t task = cache->head;
+	if(task == NULL){ // nothing to recycle
+		task = (ptl_task_t)calloc(1, sizeof(struct ptl_task));
+		assert(task);
+		return task;
+	}
+	
+	cache->head = task->next;
+	cache->count--;
+	
+	return task; // 'future.sync' is kept from its last use
+}
+
+
+/* push onto the thread cache, spilling to the shared list if it's full */
+void _ptl_task_recycle(ptl_task_t task){
+	struct ptl_task_cache *cache = &ptl_task_cache;
+	
+	_ptl_task_register_cache(cache);
+	
+	if(cache->count >= PTL_TASK_CACHE_SIZE){
+		_ptl_task_spill(cache, PTL_TASK_BATCH_SIZE);
+	}
+	
+	task->function_to_execute = NULL;
+	task->arg = NULL;
+	task->next = cache->head;
+	cache->head = task;
+	cache->count++;
+}
+
+
+/* free the task and its future's lock, if it ever got one */
+void _ptl_task_free(ptl_task_t task){
+	if(task->future.sync != NULL){
+		pthread_mutex_destroy(&task->future.sync->mutex);
+		pthread_cond_destroy(&task->future.sync->done);
+		FREE(task->future.sync);
+	}
+	
 	FREE(task);
 }
+
+
+/* move up to a batch of tasks from the shared list into the cache */
+void _ptl_task_refill(struct ptl_task_cache *cache){
+	if(__atomic_load_n(&ptl_task_shared_count, __ATOMIC_RELAXED) <= 0){
+		return; // don't bother locking
+	}
+	
+	pthread_mutex_lock(&ptl_task_mutex); // lock
+	
+	int moved = 0;
+	while(ptl_task_shared != NULL && moved < PTL_TASK_BATCH_SIZE){
+		ptl_task_t task = ptl_task_shared;
+		ptl_task_shared = task->next;
+		task->next = cache->head;
+		cache->head = task;
+		moved++;
+	}
+	// read without the lock in the check above
+	__atomic_store_n(&ptl_task_shared_count, ptl_task_shared_count - moved, __ATOMIC_RELAXED);
+	
+	pthread_mutex_unlock(&ptl_task_mutex); // unlock
+	
+	cache->count += moved;
+	if(moved > 0){
+		_ptl_task_register_cache(cache); // a thread that only allocates keeps them too
+	}
+}
+
+
+/* hand this thread's cache back when it exits */
+void _ptl_task_register_cache(struct ptl_task_cache *cache){
+	if(!cache->registered){
+		pthread_once(&ptl_task_key_once, _ptl_task_create_key);
+		pthread_setspecific(ptl_task_key, cache);
+		cache->registered = 1;
+	}
+}
+
+
+/* move up to 'count' tasks from the cache to the shared list (or free them) */
+void _ptl_task_spill(struct ptl_task_cache *cache, int count){
+	if(cache->head == NULL){ return; }
+	
+	// unlink the batch from the cache outside of the lock
+	ptl_task_t first = cache->head;
+	ptl_task_t last = first;
+	int moved = 1;
+	while(moved < count && last->next != NULL){
+		last = last->next;
+		moved++;
+	}
+	cache->head = last->next;
+	cache->count -= moved;
+	last->next = NULL;
+	
+	int kept = 0;
+	pthread_mutex_lock(&ptl_task_mutex); // lock
+	
+	if(ptl_task_shared_count + moved <= PTL_TASK_MAX_RETAINED){
+		last->next = ptl_task_shared;
+		ptl_task_shared = first;
+		__atomic_store_n(&ptl_task_shared_count, ptl_task_shared_count + moved, __ATOMIC_RELAXED);
+		kept = 1;
+	}
+	
+	pthread_mutex_unlock(&ptl_task_mutex); // unlock
+	
+	if(!kept){ // the shared list already holds enough
+		while(first != NULL){
+			ptl_task_t next = first->next;
+			_ptl_task_free(first);
+			first = next;
+		}
+	}
+}
+
+
+/* thread exit handler, other threads can still use what it had cached */
+void _ptl_task_release_cache(void *c){
+	struct ptl_task_cache *cache = (struct ptl_task_cache *)c;
+	
+	while(cache->head != NULL){
+		_ptl_task_spill(cache, PTL_TASK_CACHE_SIZE);
+	}
+	
+	cache->count = 0;
+	cache->registered = 0;
+}
+
+
+/* create the key whose destructor hands thread caches back */
+void _ptl_task_create_key(){
+	pthread_key_create(&ptl_task_key, _ptl_task_release_cache);
+}
+
+
+/* publish the result with the state, wake waiters if there are any, then
+   release the successors */
+ptl_task_t _ptl_task_finish(ptl_task_t task, void *result, int state, int keep_one){
+	// DONE is traced by the worker, as the end of the run
+	if(state == PTL_TASK_STATE_CANCELLED){
+		PTL_TRACE_TASK(PTL_TRACE_CANCEL, task);
+	} else if(state == PTL_TASK_STATE_REJECTED){
+		PTL_TRACE_TASK(PTL_TRACE_REJECT, task);
+	}
+	
+	task->future.result = result;
+	__atomic_store_n(&task->state, state, __ATOMIC_RELEASE);
+	
+	// pairs with the fence in ptl_future_get. Either the waiter sees the
+	// final state, or this sees the waiter
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	
+	if(__atomic_load_n(&task->future.waiters, __ATOMIC_RELAXED) > 0){
+		struct ptl_future_sync *sync = __atomic_load_n(&task->future.sync, __ATOMIC_ACQUIRE);
+		pthread_mutex_lock(&sync->mutex);
+		pthread_cond_broadcast(&sync->done);
+		ptl_fiber_cond_broadcast(&sync->fibers);
+		pthread_mutex_unlock(&sync->mutex);
+	}
+	
+	return _ptl_task_release_successors(task, keep_one);
+}
+
+
+/**
+ * Seals the successor list so no more links go on it, and counts this task
+ * off each successor. Those that reach 0 are submitted to the manager they
+ * were held for. With 'keep_one', the first of them is returned instead.
+ */
+ptl_task_t _ptl_task_release_successors(ptl_task_t task, int keep_one){
+	struct ptl_task_link *link = __atomic_exchange_n(&task->successors, _PTL_TASK_SEALED,
+													  __ATOMIC_ACQ_REL);
+	ptl_task_t kept = NULL;
+	
+	while(link != NULL && link != _PTL_TASK_SEALED){
+		struct ptl_task_link *next_link = link->next;
+		ptl_task_t next = link->task;
+		
+		if(PTL_ATOMIC_DEC(next->pending) == 0){
+			if(keep_one && kept == NULL){
+				kept = next;
+			} else {
+				next->submit_func(next->manager, next);
+			}
+		}
+		
+		FREE(link);
+		link = next_link;
+	}
+	
+	return kept;
+}
+
+
+/* the future's lock and condition, made by whoever waits first */
+struct ptl_future_sync *_ptl_future_get_sync(ptl_future_t future){
+	struct ptl_future_sync *sync = __atomic_load_n(&future->sync, __ATOMIC_ACQUIRE);
+	if(sync != NULL){
+		return sync;
+	}
+	
+	struct ptl_future_sync *made = (struct ptl_future_sync *)calloc(1, sizeof(struct ptl_future_sync));
+	assert(made);
+	pthread_mutex_init(&made->mutex, NULL);
+	ptl_cond_init(&made->done);
+	ptl_fiber_cond_init(&made->fibers);
+	
+	if(!__atomic_compare_exchange_n(&future->sync, &sync, made, 0,
+									__ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)){
+		// another waiter got there first, 'sync' now holds theirs
+		pthread_mutex_destroy(&made->mutex);
+		pthread_cond_destroy(&made->done);
+		FREE(made);
+		return sync;
+	}
+	
+	return made;
+}
+
+
+/* ms until 'end_nsec' for a fiber wait, -1 without a deadline (0) */
+long _ptl_future_msec_left(unsigned long long end_nsec){
+	if(end_nsec == 0){ return -1; }
+	
+	unsigned long long now = ptl_get_time_nsec();
+	
+	return (now < end_nsec) ? (long)((end_nsec - now + 999999ULL) / 1000000ULL) : 0;
+}
@@ -20,37 +20,231 @@
 #ifndef __PTL_TASK_H__
 #define __PTL_TASK_H__
 
+#include <pthread.h>
+#include "ptl_timer_wheel.h"
+#include "ptl_fiber.h"
+
 
 #define PTL_TASK_STATE_CREATED 0
 #define PTL_TASK_STATE_RUNNING 1
 #define PTL_TASK_STATE_DONE 2
 #define PTL_TASK_STATE_CANCELLED 3
 #define PTL_TASK_STATE_REJECTED 4
+/* a periodic task cancelled while running, it ends after this run */
+#define PTL_TASK_STATE_STOPPING -1
+
+/* ptl_future_get() timeout that never expires */
+#define PTL_FUTURE_WAIT_FOREVER -1
+
+/* Constants */
+#define PTL_TASK_CACHE_SIZE 64			/**< max tasks cached per thread */
+#define PTL_TASK_BATCH_SIZE 32			/**< tasks moved per trip to the shared list */
+#define PTL_TASK_MAX_RETAINED 4096		/**< cap on the shared list of free tasks */
+
+
+/* Structures */
 
+struct ptl_task;
+
+/* one edge of a task graph, see ptl_task_then */
+struct ptl_task_link {
+	struct ptl_task *task;				/**< the successor */
+	struct ptl_task_link *next;
+};
+
+/* lock and condition for threads waiting on a future, made by the first one */
+struct ptl_future_sync {
+	pthread_mutex_t mutex;
+	pthread_cond_t done;
+	struct ptl_fiber_cond fibers;	/**< the waiters that are fibers */
+};
+
+/**
+ * The caller's half of a task. Completing it is one release store of the
+ * task's state; the lock and condition only exist once somebody waits.
+ */
+struct ptl_future {
+	void *result;					/**< what the function returned */
+	int waiters;					/**< threads in ptl_future_get (atomic) */
+	struct ptl_future_sync *sync;	/**< NULL until the first wait, then kept */
+};
 
 struct ptl_task {
-	int state;
+	int state;							/**< PTL_TASK_STATE_*, changed atomically */
 	void* (*function_to_execute)(void*); 
+	void *arg;							/**< passed to 'function_to_execute' */
+	int priority;						/**< higher runs first in a priority 'work_q' */
+	int refs;							/**< the manager's, and the future's if handed out */
+	struct ptl_future future;
+	struct ptl_timer timer;				/**< used while it waits to be scheduled */
+	long period;						/**< ms between runs: > 0 fixed rate, < 0 fixed
+											 delay, 0 runs once */
+	unsigned long long next_run_nsec;	/**< when a fixed rate run is due (monotonic) */
+	unsigned long long submit_nsec;		/**< when it was submitted or fell due, set
+											 while the manager collects stats */
+	int pending;						/**< its submit plus unfinished predecessors,
+											 it's queued once this drops to 0 */
+	struct ptl_task_link *successors;	/**< tasks waiting on this one, a stack pushed
+											 atomically, sealed when it finishes */
+	int (*submit_func)(void *, struct ptl_task *);	/**< hands it to 'manager' once
+														 its predecessors are done */
+	void *manager;						/**< set by a submit that had to wait */
+	struct ptl_task *next;				/**< link in the free lists */
+	unsigned long trace_id;				/**< names it in ptl_trace records, 0 when
+											 not compiled with PTL_TRACE */
 };
 
 
 typedef struct ptl_task *ptl_task_t;
+typedef struct ptl_future *ptl_future_t;
 
 /* Public Functions */
 
 /**
  * Create a task that contains a state.
+ * Tasks are recycled through a per-thread cache, so this rarely allocates.
  *
  * @param function that will be executed when this task is consumed
  * @return a non-null 'task'
  */
-ptl_task_t create_task(void (*function_to_execute)(void*));
+ptl_task_t create_task(void *(*function_to_execute)(void*));
+
+/**
+ * Create a task that calls 'function_to_execute' with 'arg'.
+ *
+ * @param function_to_execute function that will be executed when this task is consumed
+ * @param arg argument passed to the function, may be NULL
+ * @return a non-null 'task', or NULL if the function is NULL
+ */
+ptl_task_t create_task_with_arg(void *(*function_to_execute)(void*), void *arg);
 
 /**
  * Destroy a 'task'. This does not free any memory this 'task' may be pointing
  * to. It only frees the memory create during the 'create' function.
+ * If the task's future was handed out, the task is kept until
+ * ptl_future_destroy() is called as well.
  *
  * @param task task to be destroyed
  */
 void destroy_task(ptl_task_t task);
+
+/**
+ * Gets the future of 'task' and counts it as a second owner. The task is
+ * recycled only after both destroy_task() and ptl_future_destroy().
+ *
+ * @param task non-null task that hasn't been submitted yet
+ * @return the task's future
+ */
+ptl_future_t ptl_task_get_future(ptl_task_t task);
+
+/**
+ * Makes 'next' wait for 'task': once 'task' finishes (done, cancelled or
+ * rejected), 'next' may run. Call it before 'next' is submitted. Submitting
+ * 'next' then only queues it once every task it waits on has finished, and
+ * the last of them to finish submits it, so no thread blocks on the
+ * predecessors. A worker that finishes a task runs one of the successors
+ * it made ready itself, with no trip through the queue.
+ * If 'task' has already finished, this does nothing.
+ * Successors only follow ptl_task_finish, so this doesn't apply to a task
+ * that is scheduled with a delay.
+ * Once submitted, 'task' belongs to the manager, which recycles it as soon
+ * as it has run. So link it before submitting it, or hold its future
+ * (ptl_task_get_future) across the call; otherwise the link may land on a
+ * recycled task and 'next' never runs.
+ *
+ * @param task the predecessor, not submitted yet, or with its future held
+ * @param next the successor, not submitted yet
+ * @return 1 if successful, 0 otherwise
+ */
+int ptl_task_then(ptl_task_t task, ptl_task_t next);
+
+/**
+ * ptl_task_then for each of the 'n' 'tasks': 'next' waits for all of them.
+ * Every entry is checked before any is linked, so on failure 'next' waits
+ * on none of them.
+ *
+ * @param tasks the predecessors, each as ptl_task_then requires
+ * @param n how many there are
+ * @param next the successor, not submitted yet
+ * @return 1 if successful, 0 if a predecessor is NULL or 'next' itself
+ */
+int ptl_task_when_all(ptl_task_t *tasks, int n, ptl_task_t next);
+
+/**
+ * Called by a submit. If the task still waits on predecessors, it's held,
+ * and 'submit_func(manager, task)' is called by the last predecessor to
+ * finish.
+ *
+ * @return 1 if held, 0 if it can be queued now
+ */
+int ptl_task_hold(ptl_task_t task, int (*submit_func)(void *, ptl_task_t), void *manager);
+
+/**
+ * Moves a task from CREATED to RUNNING. Called by the worker about to run it.
+ *
+ * @return 1 if the task should run, 0 if it was cancelled first
+ */
+int ptl_task_start(ptl_task_t task);
+
+/**
+ * Moves a periodic task from RUNNING back to CREATED so it can run again.
+ * Called by the worker once a run is over.
+ *
+ * @return 1 if it can be scheduled again, 0 if it was cancelled while running
+ */
+int ptl_task_rearm(ptl_task_t task);
+
+/**
+ * Stores 'result', moves the task to 'state' (DONE, CANCELLED or REJECTED)
+ * and wakes anyone waiting on its future.
+ *
+ * @param task non-null task
+ * @param result what the function returned
+ * @param state final state of the task
+ */
+void ptl_task_finish(ptl_task_t task, void *result, int state);
+
+/**
+ * ptl_task_finish, except that one successor this made ready is returned
+ * instead of submitted, for the worker to run straight away.
+ *
+ * @return a successor the caller now owns as if it dequeued it, or NULL
+ */
+ptl_task_t ptl_task_finish_continue(ptl_task_t task, void *result, int state);
+
+/**
+ * Waits up to 'timeout' milliseconds for the task to finish.
+ * Called from a fiber (see ptl_fiber.h) it suspends the fiber instead of
+ * blocking the thread.
+ *
+ * @param future non-null future
+ * @param timeout ms to wait, 0 to only look, PTL_FUTURE_WAIT_FOREVER to wait
+ * @return what the function returned, NULL if it timed out or never ran
+ */
+void *ptl_future_get(ptl_future_t future, long timeout);
+
+/**
+ * Returns 1 if the task is done, cancelled or rejected.
+ *
+ * @return 1 if finished, 0 otherwise
+ */
+int ptl_future_is_done(ptl_future_t future);
+
+/**
+ * Cancels the task if it hasn't started. A worker that takes it from the
+ * queue later skips it. A periodic task that is running finishes the run,
+ * but is not scheduled again.
+ *
+ * @return 1 if cancelled, 0 if it already started (and runs once) or finished
+ */
+int ptl_future_cancel(ptl_future_t future);
+
+/**
+ * Releases the caller's hold on the future. The future may not be used
+ * afterwards.
+ *
+ * @param future future to release, may be NULL
+ */
+void ptl_future_destroy(ptl_future_t future);
+
 #endif
@@ -23,19 +23,110 @@
 #include <malloc.h>
 #include <assert.h>
 #include <string.h>
+#include <errno.h>
 #include "ptl_thread_manager.h"
+#include "ptl_linked_queue.h"
+#include "ptl_array_list.h"
+#include "ptl_trace.h"
 #include "ptl_util.h"
 
 
+/* Structures */
+
+/* one stripe of the manager's counters, alone on its cache lines (see ptl_stats.h) */
+struct ptl_tm_stats_stripe {
+	unsigned long long submitted;
+	unsigned long long completed;
+	unsigned long long rejected;
+	struct ptl_histogram queue_wait;
+	struct ptl_histogram run_time;
+} __attribute__((aligned(PTL_CACHE_LINE_SIZE)));
+
+/* the sizing controller's timer, and the totals of the last sample to take the
+   next one's differences from */
+struct ptl_tm_sizing_state {
+	struct ptl_timer timer;				// on the manager's timer wheel
+	int target;							// threads to keep, 0 until the first answer
+	unsigned long long last_nsec;		// when the last sample was taken
+	struct ptl_tm_stats now;			// totals read for this sample
+	struct ptl_histogram last_wait;		// histograms at the last sample
+	struct ptl_histogram last_run;
+	struct ptl_histogram window;		// this sample's waits, counts only
+};
+
+
 /* Private Functions */
 void _reject_handler(ptl_task_t task, void (*rejected_handler) (void *));
-void add_thread();
-void ensure_queued_task_handled();
+int _ptl_tm_reject(ptl_thread_manager_t manager, ptl_task_t task);
+int _ptl_tm_submit(ptl_thread_manager_t manager, ptl_task_t task, long timeout);
+void _ptl_tm_task_queued(ptl_thread_manager_t manager);
+void *_ptl_tm_worker(void *worker);
+int _ptl_tm_start_worker(ptl_thread_manager_t manager, ptl_task_t first_task, int limit);
+int _ptl_tm_release_worker(ptl_thread_manager_t manager, struct ptl_worker *worker, int retiring);
+void _ptl_tm_prestart_core_threads(ptl_thread_manager_t manager);
+ptl_thread_manager_t _ptl_tm_create_manager(ptl_thread_pool_t thread_pool,
+											ptl_q_t work_q,
+											void (*rejected_handler)(void *),
+											void (*before_execute)(void *),
+											void (*after_execute)(void *),
+											const struct ptl_tm_options *options);
+int _ptl_tm_has_work(ptl_thread_manager_t manager);
+void _ptl_tm_signal_work(ptl_thread_manager_t manager);
+int _ptl_tm_queue_ready(void *manager);
+int _ptl_tm_ws_ready(void *manager);
+int _ptl_tm_idle_wait(ptl_thread_manager_t manager, struct ptl_worker *worker,
+					  long timeout, int (*ready)(void *));
+long _ptl_tm_idle_remaining(unsigned long long *idle_since, long timeout);
+ptl_task_t _ptl_tm_steal(ptl_thread_manager_t manager, struct ptl_worker *worker);
+ptl_task_t _ptl_tm_get_next_task_ws(ptl_thread_manager_t manager, struct ptl_worker *worker);
+int add_thread(ptl_thread_manager_t manager, ptl_task_t first_task);
+int add_if_under_max_pool_size(ptl_thread_manager_t manager, ptl_task_t first_task);
+void ensure_queued_task_handled(ptl_thread_manager_t manager);
+ptl_tw_t _ptl_tm_get_timer_wheel(ptl_thread_manager_t manager);
+int _ptl_tm_schedule_task(ptl_thread_manager_t manager, ptl_task_t task, long delay_ms);
+ptl_future_t _ptl_tm_schedule_periodic(ptl_thread_manager_t manager,
+									   void *(*function_to_execute)(void *), void *arg,
+									   long initial_delay, long period);
+int _ptl_tm_reschedule(ptl_thread_manager_t manager, ptl_task_t task);
+void _ptl_tm_timers_expired(struct ptl_timer **timers, int count, void *manager);
+int _ptl_tm_queue_batch(ptl_thread_manager_t manager, ptl_task_t *tasks, int count);
 void reject();
-void run_task(void* task);
-void get_next_task();
-void interrupt_idle_threads();
-void drain_queue();
+ptl_task_t run_task(ptl_thread_manager_t manager, struct ptl_worker *worker, ptl_task_t task);
+int _ptl_tm_submit_released(void *manager, ptl_task_t task);
+ptl_task_t _ptl_tm_continue(ptl_thread_manager_t manager, ptl_task_t next);
+void _ptl_tm_run_done(ptl_thread_manager_t manager, struct ptl_worker *worker,
+					  ptl_task_t task, void *result);
+void _ptl_tm_count_submit(ptl_thread_manager_t manager, ptl_task_t task);
+void _ptl_tm_count_run(ptl_thread_manager_t manager, ptl_task_t task, unsigned long long start);
+ptl_task_t get_next_task(ptl_thread_manager_t manager, struct ptl_worker *worker);
+void interrupt_idle_threads(ptl_thread_manager_t manager);
+ptl_q_t drain_queue(ptl_thread_manager_t manager);
+void _ptl_tm_advance_run_state(ptl_thread_manager_t manager, int state);
+int _ptl_tm_try_terminate(ptl_thread_manager_t manager);
+int _ptl_tm_try_terminate_locked(ptl_thread_manager_t manager);
+void _ptl_tm_cancel_scheduled(ptl_thread_manager_t manager);
+int _ptl_tm_drop_cancelled(void **tasks, int count);
+int _ptl_tm_timer_tasks(ptl_thread_manager_t manager, ptl_timer_t *timers, int count, 
+						void **tasks);
+int _ptl_tm_keep_size(ptl_thread_manager_t manager);
+int _ptl_tm_above_max(ptl_thread_pool_t pool);
+void _ptl_tm_sizing_start(ptl_thread_manager_t manager);
+void _ptl_tm_sizing_sample(ptl_thread_manager_t manager);
+void _ptl_tm_run_fiber(ptl_thread_manager_t manager, ptl_task_t task);
+void _ptl_tm_fiber_main(ptl_fiber_t fiber, void *task);
+void _ptl_tm_run_tasks(ptl_thread_manager_t manager, ptl_task_t task);
+void *_ptl_tm_fiber_resume_task(void *fiber);
+void _ptl_tm_fiber_wake(ptl_fiber_t fiber, void *manager);
+int _ptl_tm_fibers_live(ptl_thread_manager_t manager);
+int _ptl_tm_fibers_ready(ptl_thread_manager_t manager, int tasks);
+struct ptl_worker *_ptl_tm_self() __attribute__((noinline));
+ptl_arena_t *_ptl_tm_arena_slot();
+void _ptl_tm_reset_arena();
+void _ptl_tm_count_completed(struct ptl_worker *worker);
+
+
+/* Global Variables */
+static __thread struct ptl_worker *ptl_tm_current_worker = NULL; // slot of this thread, if a worker
 
 
 /* Public Functions */
@@ -48,33 +139,68 @@ ptl_thread_manager_t create_thread_manager_with_functions(int core_pool_size,
 						   void (*rejected_handler)(void *),
 						   void (*before_execute)(void *),
 						   void (*after_execute)(void *)){
-					
- ptl_thread_manager_t manager = (ptl_thread_manager_t)calloc(1, sizeof(struct ptl_thread_manager));
-	assert(manager);
 	
-	/* create the thread pool */
+	/* see create_thread_manager_with_options for details */
+	return create_thread_manager_with_options(core_pool_size, 
+											  max_pool_size, 
+											  keep_alive_time, 
+											  work_q, 
+											  rejected_handler, 
+											  before_execute,
+											  after_execute,
+											  NULL);
+}
+
+
+/* create a manager with before and after execute functions and 'options' */
+ptl_thread_manager_t create_thread_manager_with_options(int core_pool_size, 
+						   int max_pool_size, 
+						   long keep_alive_time,
+						   ptl_q_t work_q,
+						   void (*rejected_handler)(void *),
+						   void (*before_execute)(void *),
+						   void (*after_execute)(void *),
+						   const struct ptl_tm_options *options){
+	if(work_q == NULL){ return NULL; }
+	
+	/* create the thread pool, with room to raise max later if asked for */
+	int slot_count = max_pool_size;
+	if(options != NULL && options->max_pool_limit > slot_count){
+		slot_count = options->max_pool_limit;
+	}
 	ptl_thread_pool_t thread_pool = 
-		ptl_create_thread_pool(core_pool_size, max_pool_size, keep_alive_time);
-							   
-							   
-	/* initilize the manager struct */
-	manager->work_q = work_q;
-	manager->thread_pool = thread_pool;
-	manager->run_state = PTL_RUNNING;
-	manager->num_completed_tasks = 0;
-	/* functions */
-	manager->rejected_handler = rejected_handler;
-	manager->before_execute = before_execute;
-	manager->after_execute = after_execute;
+		ptl_create_thread_pool_with_slots(core_pool_size, max_pool_size, keep_alive_time,
+										  slot_count, (options != NULL) ? &options->affinity : NULL);
+	if(thread_pool == NULL){ return NULL; }
 	
-	/* create mutexes and conditions */
-	pthread_mutex_t main_mutex = PTHREAD_MUTEX_INITIALIZER;
-  	pthread_cond_t  termination_mutex = PTHREAD_COND_INITIALIZER;
-							   
-	manager->main_mutex = main_mutex;
-	manager->termination_mutex = termination_mutex;
-							   
-	return manager;						   
+	ptl_thread_manager_t manager = _ptl_tm_create_manager(thread_pool, work_q, rejected_handler,
+														  before_execute, after_execute, options);
+	manager->owns_thread_pool = 1;
+	
+	return manager;
+}
+
+
+/* the defaults: one shared queue */
+void ptl_tm_options_init(struct ptl_tm_options *options){
+	if(options == NULL){ return; }
+	
+	memset(options, 0, sizeof(struct ptl_tm_options));
+	options->scheduling = PTL_TM_SCHED_SHARED_QUEUE;
+	options->rejection_policy = ptl_abort_policy;
+	ptl_wait_strategy_init(&options->wait_strategy, PTL_WAIT_BALANCED);
+	options->collect_stats = 0;
+	options->deque_capacity = PTL_WSD_DEFAULT_CAPACITY;
+	options->affinity.policy = PTL_TP_PIN_NONE;
+	options->affinity.numa_node = PTL_TP_ANY_NODE;
+	options->sizing.controller = NULL;
+	options->sizing.period_msec = PTL_TM_SIZING_PERIOD_MSEC;
+	options->sizing.grow_wait = PTL_TM_SIZING_GROW_WAIT_NSEC;
+	options->sizing.grow_samples = PTL_TM_SIZING_GROW_SAMPLES;
+	options->sizing.shrink_samples = PTL_TM_SIZING_SHRINK_SAMPLES;
+	options->max_pool_limit = 0;
+	options->fibers = 0;
+	options->fiber_stack_size = PTL_FIBER_DEFAULT_STACK_SIZE;
 }
 
 
@@ -101,33 +227,15 @@ ptl_thread_manager_t
 	create_thread_manager_with_pool(ptl_thread_pool_t thread_pool,
 						   			ptl_q_t work_q,
 						   			void (*rejected_handler) (void *)){
-				
-	ptl_thread_manager_t manager = (ptl_thread_manager_t)calloc(1, sizeof(struct ptl_thread_manager));
-	assert(manager);
-							   					   
-	/* initilize the manager struct */
-	manager->work_q = work_q;
-	manager->thread_pool = thread_pool;
-	manager->run_state = PTL_RUNNING;
-	manager->num_completed_tasks = 0;
-	/* functions */
-	manager->rejected_handler = rejected_handler;
-	manager->before_execute = NULL;
-	manager->after_execute = NULL;
+	if(thread_pool == NULL || work_q == NULL){ return NULL; }
 	
-	/* create mutexes and conditions */
-	pthread_mutex_t main_mutex = PTHREAD_MUTEX_INITIALIZER;
-  	pthread_cond_t  termination_mutex = PTHREAD_COND_INITIALIZER;
-							   
-	manager->main_mutex = main_mutex;
-	manager->termination_mutex = termination_mutex;
-										   
-	return manager;									   
+	return _ptl_tm_create_manager(thread_pool, work_q, rejected_handler,
+								  NULL, NULL, NULL);
 }
 
 
 /* put on work_q. If not able to, then call rejected handler with function */
-int submit(ptl_thread_manager_t manager, void (*function_to_execute)(void *)){
+int submit(ptl_thread_manager_t manager, void *(*function_to_execute)(void *)){
 	if(manager == NULL || function_to_execute == NULL){
 		return 0;
 	}
@@ -139,59 +247,549 @@ int submit(ptl_thread_manager_t manager, void (*function_to_execute)(void *)){
 }
 
 
-/* put on work_q. If not able to, then call rejected handler with function */
+/* submit a task for 'function_to_execute(arg)' and keep its future */
+ptl_future_t submit_with_arg(ptl_thread_manager_t manager, 
+							 void *(*function_to_execute)(void *), void *arg){
+	if(manager == NULL || function_to_execute == NULL){
+		return NULL;
+	}
+	
+	ptl_task_t task = create_task_with_arg(function_to_execute, arg);
+	ptl_future_t future = ptl_task_get_future(task); // before a worker can see it
+	
+	submit_task(manager, task); // if rejected, the future is already finished
+	
+	return future;
+}
+
+
+/* submit_with_arg, ordered by 'priority' in a priority work queue */
+ptl_future_t submit_with_priority(ptl_thread_manager_t manager, 
+								  void *(*function_to_execute)(void *), void *arg,
+								  int priority){
+	if(manager == NULL || function_to_execute == NULL){
+		return NULL;
+	}
+	
+	ptl_task_t task = create_task_with_arg(function_to_execute, arg);
+	task->priority = priority;
+	ptl_future_t future = ptl_task_get_future(task);
+	
+	submit_task(manager, task);
+	
+	return future;
+}
+
+
+/* hand to a new core thread, else put on work_q, else grow up to max. 
+   If none of that works, then the rejection policy gets the task */
 int submit_task(ptl_thread_manager_t manager, ptl_task_t task){
 	if(manager == NULL || task == NULL){
 		return 0;
 	}
 	
-	// put it in the work queue
-	int successful = ptl_q_add(manager->work_q, task);
+	return _ptl_tm_submit(manager, task, 0);
+}
+
+
+/* submit_task, waiting up to 'timeout' for room before rejecting */
+int submit_task_wait(ptl_thread_manager_t manager, ptl_task_t task, long timeout){
+	if(manager == NULL || task == NULL){
+		return 0;
+	}
+	
+	return _ptl_tm_submit(manager, task, timeout);
+}
+
+
+/* one trip to work_q per chunk, held tasks are left out of it */
+int submit_batch(ptl_thread_manager_t manager, ptl_task_t *tasks, int count){
+	if(manager == NULL || tasks == NULL){ return 0; }
+	
+	ptl_task_t chunk[PTL_Q_DRAIN_BATCH_SIZE];
+	int accepted = 0;
+	int i = 0;
+	
+	while(i < count){
+		int n = 0;
+		for(; i < count && n < PTL_Q_DRAIN_BATCH_SIZE; i++){
+			if(ptl_task_hold(tasks[i], _ptl_tm_submit_released, manager)){
+				accepted++; // its last predecessor submits it
+			} else {
+				chunk[n++] = tasks[i];
+			}
+		}
+		accepted += _ptl_tm_queue_batch(manager, chunk, n);
+	}
+	
+	return accepted;
+}
+
+
+/* submit now, or park it in the timer wheel until it's due */
+int schedule(ptl_thread_manager_t manager, ptl_task_t task, long delay_ms){
+	if(manager == NULL || task == NULL){
+		return 0;
+	}
+	
+	if(delay_ms <= 0){
+		return submit_task(manager, task);
+	}
+	
+	return _ptl_tm_schedule_task(manager, task, delay_ms);
+}
+
+
+/* runs due every 'period' ms from the first */
+ptl_future_t schedule_at_fixed_rate(ptl_thread_manager_t manager,
+									void *(*function_to_execute)(void *), void *arg,
+									long initial_delay, long period){
+	if(manager == NULL || function_to_execute == NULL || period <= 0){
+		return NULL;
+	}
 	
-	// if not successful, then call the rejected handler
-	if(!successful){
-		_reject_handler(task, manager->rejected_handler);
+	return _ptl_tm_schedule_periodic(manager, function_to_execute, arg, initial_delay, period);
+}
+
+
+/* runs 'delay' ms apart, a negative period marks fixed delay */
+ptl_future_t schedule_with_fixed_delay(ptl_thread_manager_t manager,
+									   void *(*function_to_execute)(void *), void *arg,
+									   long initial_delay, long delay){
+	if(manager == NULL || function_to_execute == NULL || delay <= 0){
+		return NULL;
 	}
 	
-	return successful;
+	return _ptl_tm_schedule_periodic(manager, function_to_execute, arg, initial_delay, -delay);
 }
 
-void shutdown(ptl_thread_manager_t manager){
-	return; //TODO: implement
+
+/* no new tasks, the queued ones still run. Waits for the workers to end,
+   unless called from one of them */
+void ptl_tm_shutdown(ptl_thread_manager_t manager){
+	if(manager == NULL){ return; }
+	
+	_ptl_tm_advance_run_state(manager, PTL_SHUTDOWN);
+	_ptl_tm_cancel_scheduled(manager);
+	interrupt_idle_threads(manager);
+	
+	if(!_ptl_tm_try_terminate(manager)){
+		ensure_queued_task_handled(manager); // queued tasks may have nobody to run them
+	}
+	
+	struct ptl_worker *self = ptl_tm_current_worker;
+	if(self == NULL || self->manager != manager){
+		ptl_tm_await_termination(manager, PTL_FUTURE_WAIT_FOREVER);
+	}
 }
 
+
+/* stop, and hand back everything that hasn't started */
 ptl_q_t shutdown_now(ptl_thread_manager_t manager){
-	return NULL; //TODO: implement
+	if(manager == NULL){ return NULL; }
+	
+	_ptl_tm_advance_run_state(manager, PTL_STOP);
+	_ptl_tm_cancel_scheduled(manager);
+	interrupt_idle_threads(manager);
+	
+	ptl_q_t drained = drain_queue(manager);
+	_ptl_tm_try_terminate(manager);
+	
+	return drained;
+}
+
+
+/* sleeps on 'termination_mutex', signalled by the last worker to end */
+int ptl_tm_await_termination(ptl_thread_manager_t manager, long timeout){
+	if(manager == NULL){ return 0; }
+	
+	struct timespec deadline;
+	if(timeout > 0){
+		ptl_get_future_time(&deadline, timeout * 1000); // ms to usec
+	}
+	
+	pthread_mutex_lock(&manager->main_mutex);
+	while(manager->run_state != PTL_TERMINATED && timeout != 0){
+		if(timeout < 0){
+			pthread_cond_wait(&manager->termination_mutex, &manager->main_mutex);
+		} else if(pthread_cond_timedwait(&manager->termination_mutex, &manager->main_mutex, 
+										 &deadline) == ETIMEDOUT){
+			break;
+		}
+	}
+	int terminated = (manager->run_state == PTL_TERMINATED);
+	pthread_mutex_unlock(&manager->main_mutex);
+	
+	return terminated;
+}
+
+
+/* shut down, then free what the manager made. 'work_q' is the caller's */
+int destroy_thread_manager(ptl_thread_manager_t manager){
+	if(manager == NULL){ return 0; }
+	
+	struct ptl_worker *self = ptl_tm_current_worker;
+	if(self != NULL && self->manager == manager){
+		return 0; // it would wait for itself
+	}
+	
+	ptl_tm_shutdown(manager);
+	
+	// no more timers fire, then reject whatever got queued after the workers left
+	ptl_tw_destroy(manager->timer_wheel);
+	manager->timer_wheel = NULL;
+	
+	ptl_q_t left = drain_queue(manager);
+	ptl_task_t task = NULL;
+	while((task = (ptl_task_t)ptl_q_get(left)) != NULL){
+		_reject_handler(task, NULL);
+	}
+	ptl_q_destroy_queue(left);
+	
+	if(manager->owns_thread_pool){
+		ptl_destroy_thread_pool(manager->thread_pool);
+	}
+	
+	// the workers only left once every fiber was done
+	ptl_q_destroy_queue(manager->fiber_q);
+	ptl_fiber_pool_destroy(manager->fiber_pool);
+	
+	pthread_mutex_destroy(&manager->main_mutex);
+	pthread_cond_destroy(&manager->termination_mutex);
+	FREE(manager->stats);
+	FREE(manager->sizing_state);
+	FREE(manager);
+	
+	return 1;
 }
 
+
 int is_terminated(ptl_thread_manager_t manager){
-	return manager->run_state == PTL_TERMINATED;
+	return PTL_ATOMIC_LOAD(manager->run_state) == PTL_TERMINATED;
 }
 
 int is_terminating(ptl_thread_manager_t manager){
-	return manager->run_state == PTL_SHUTDOWN || manager->run_state == PTL_STOP;
+	int state = PTL_ATOMIC_LOAD(manager->run_state);
+	
+	return state == PTL_SHUTDOWN || state == PTL_STOP;
+}
+
+
+/**
+ * Cancelling only flips the task's state, and the worker that dequeues it
+ * later drops it. This gets rid of the cancelled tasks still taking room in
+ * 'work_q' in one pass: the queue is drained in batches, the cancelled
+ * tasks are destroyed, and the rest go back in batches, in the order they
+ * were in. The worker deques are left alone, only their owners pop them.
+ */
+long purge_cancelled(ptl_thread_manager_t manager){
+	if(manager == NULL || ptl_q_size(manager->work_q) == 0){ return 0; }
+	
+	ptl_array_list_t list = ptl_al_create_array_list_size(PTL_Q_DRAIN_BATCH_SIZE);
+	ptl_q_drain_to(manager->work_q, list);
+	
+	int kept = _ptl_tm_drop_cancelled(list->array, list->size);
+	long purged = list->size - kept;
+	
+	int added = 0;
+	while(added < kept){
+		int n = ptl_q_add_batch(manager->work_q, list->array + added, kept - added);
+		if(n <= 0){ break; } // submitters filled it meanwhile
+		
+		added += n;
+		_ptl_tm_task_queued(manager);
+	}
+	
+	// those that no longer fit were accepted once, the policy decides
+	for(; added < kept; added++){
+		_ptl_tm_reject(manager, (ptl_task_t)list->array[added]);
+	}
+	
+	ptl_al_destroy_array_list(list);
+	
+	return purged;
+}
+
+
+/* the arena of this worker or fiber, made on first use */
+ptl_arena_t ptl_worker_arena(){
+	ptl_arena_t *slot = _ptl_tm_arena_slot();
+	if(slot == NULL){ return NULL; }
+	
+	if(*slot == NULL){
+		*slot = ptl_arena_create(0);
+	}
+	
+	return *slot;
+}
+
+
+/* threads currently in the pool */
+int ptl_tm_get_pool_size(ptl_thread_manager_t manager){
+	if(manager == NULL){ return 0; }
+	
+	return PTL_ATOMIC_LOAD(manager->thread_pool->current_pool_size);
+}
+
+
+/* retired threads were folded into the pool, add the ones still running */
+long ptl_tm_get_completed_task_count(ptl_thread_manager_t manager){
+	if(manager == NULL){ return 0; }
+	
+	ptl_thread_pool_t pool = manager->thread_pool;
+	
+	pthread_mutex_lock(&manager->main_mutex);
+	long completed = pool->completed_tasks;
+	int i = 0;
+	for(i = 0; i < pool->slot_count; i++){
+		if(pool->workers[i].alive){
+			completed += __atomic_load_n(&pool->workers[i].completed_tasks, __ATOMIC_RELAXED);
+		}
+	}
+	pthread_mutex_unlock(&manager->main_mutex);
+	
+	return completed;
+}
+
+/* a higher core starts its threads now, a lower one lets the rest time out */
+int ptl_tm_set_core_pool_size(ptl_thread_manager_t manager, int core_pool_size){
+	if(manager == NULL){ return 0; }
+	
+	ptl_thread_pool_t pool = manager->thread_pool;
+	
+	pthread_mutex_lock(&manager->main_mutex);
+	if(core_pool_size < 0 || core_pool_size > pool->max_pool_size){
+		pthread_mutex_unlock(&manager->main_mutex);
+		return 0;
+	}
+	int raised = (core_pool_size > pool->core_pool_size);
+	__atomic_store_n(&pool->core_pool_size, core_pool_size, __ATOMIC_RELEASE);
+	pthread_mutex_unlock(&manager->main_mutex);
+	
+	if(!raised){
+		interrupt_idle_threads(manager); // idle core threads start their keep alive
+	} else if(PTL_ATOMIC_LOAD(manager->run_state) == PTL_RUNNING){
+		_ptl_tm_prestart_core_threads(manager);
+	}
+	
+	return 1;
+}
+
+
+/* within the slots; threads above a lower max end when they look for work */
+int ptl_tm_set_max_pool_size(ptl_thread_manager_t manager, int max_pool_size){
+	if(manager == NULL){ return 0; }
+	
+	ptl_thread_pool_t pool = manager->thread_pool;
+	
+	pthread_mutex_lock(&manager->main_mutex);
+	if(max_pool_size <= 0 || max_pool_size < pool->core_pool_size ||
+	   max_pool_size > pool->slot_count){
+		pthread_mutex_unlock(&manager->main_mutex);
+		return 0;
+	}
+	int lowered = (max_pool_size < pool->max_pool_size);
+	__atomic_store_n(&pool->max_pool_size, max_pool_size, __ATOMIC_RELEASE);
+	pthread_mutex_unlock(&manager->main_mutex);
+	
+	if(lowered){
+		interrupt_idle_threads(manager);
+	}
+	
+	return 1;
+}
+
+
+/* core, or what the controller keeps above it */
+int ptl_tm_get_target_pool_size(ptl_thread_manager_t manager){
+	if(manager == NULL){ return 0; }
+	
+	return _ptl_tm_keep_size(manager);
+}
+
+
+/* swap in 'policy', or the default */
+void ptl_tm_set_rejection_policy(ptl_thread_manager_t manager,
+								 int (*policy)(ptl_thread_manager_t, ptl_task_t)){
+	if(manager == NULL){ return; }
+	
+	if(policy == NULL){
+		policy = ptl_abort_policy;
+	}
+	
+	__atomic_store_n(&manager->rejection_policy, policy, __ATOMIC_RELEASE);
+}
+
+
+/* each counter is read on its own, the copy isn't one snapshot */
+void ptl_tm_get_rejection_counts(ptl_thread_manager_t manager,
+								 struct ptl_tm_rejection_counts *counts){
+	if(manager == NULL || counts == NULL){ return; }
+	
+	counts->rejected = PTL_ATOMIC_LOAD(manager->rejections.rejected);
+	counts->caller_ran = PTL_ATOMIC_LOAD(manager->rejections.caller_ran);
+	counts->discarded = PTL_ATOMIC_LOAD(manager->rejections.discarded);
+	counts->discarded_oldest = PTL_ATOMIC_LOAD(manager->rejections.discarded_oldest);
+	counts->blocked = PTL_ATOMIC_LOAD(manager->rejections.blocked);
+	counts->timed_out = PTL_ATOMIC_LOAD(manager->rejections.timed_out);
 }
 
-void purge_cancelled(ptl_thread_manager_t manager){
-	return; //TODO: Implement
+
+/* add the stripes up, then the queue's own */
+int ptl_tm_get_stats(ptl_thread_manager_t manager, struct ptl_tm_stats *stats){
+	if(stats == NULL){ return 0; }
+	
+	memset(stats, 0, sizeof(struct ptl_tm_stats));
+	
+	if(manager == NULL || manager->stats == NULL){ return 0; }
+	
+	struct ptl_tm_stats_stripe *stripes = (struct ptl_tm_stats_stripe *)manager->stats;
+	int i = 0;
+	
+	for(i = 0; i < PTL_STATS_STRIPES; i++){
+		stats->submitted += __atomic_load_n(&stripes[i].submitted, __ATOMIC_RELAXED);
+		stats->completed += __atomic_load_n(&stripes[i].completed, __ATOMIC_RELAXED);
+		stats->rejected += __atomic_load_n(&stripes[i].rejected, __ATOMIC_RELAXED);
+		ptl_hist_merge(&stats->queue_wait, &stripes[i].queue_wait);
+		ptl_hist_merge(&stats->run_time, &stripes[i].run_time);
+	}
+	
+	ptl_q_get_stats(manager->work_q, &stats->queue);
+	
+	return 1;
 }
 
-void *ptl_abort_policy(){
-	return NULL; //TODO: Implement
+
+/* finish it as rejected and tell the 'rejected_handler' */
+int ptl_abort_policy(ptl_thread_manager_t manager, ptl_task_t task){
+	PTL_ATOMIC_INC(manager->rejections.rejected);
+	
+	_reject_handler(task, manager->rejected_handler);
+	
+	return 0;
+}
+
+
+/* run it here, which keeps this thread from submitting more meanwhile */
+int ptl_q_caller_runs_policy(ptl_thread_manager_t manager, ptl_task_t task){
+	if(PTL_ATOMIC_LOAD(manager->run_state) != PTL_RUNNING){
+		return ptl_q_discard_policy(manager, task);
+	}
+	
+	PTL_ATOMIC_INC(manager->rejections.caller_ran);
+	
+	if(!ptl_task_start(task)){ // cancelled
+		destroy_task(task);
+		return 1;
+	}
+	PTL_TRACE_TASK(PTL_TRACE_START, task);
+	
+	unsigned long long start = (manager->stats != NULL) ? ptl_get_time_nsec() : 0;
+	
+	void *result = task->function_to_execute(task->arg);
+	PTL_TRACE_TASK(PTL_TRACE_END, task);
+	
+	if(start != 0){
+		_ptl_tm_count_run(manager, task, start);
+	}
+	
+	if(task->period != 0){
+		if(_ptl_tm_reschedule(manager, task)){
+			return 1;
+		}
+		ptl_task_finish(task, result, PTL_TASK_STATE_CANCELLED);
+	} else {
+		ptl_task_finish(task, result, PTL_TASK_STATE_DONE);
+	}
+	
+	destroy_task(task);
+	
+	return 1;
 }
 
-void *ptl_q_caller_runs_policy(){
-	return NULL; //TODO: Implement
+
+/* drop it without telling anyone */
+int ptl_q_discard_policy(ptl_thread_manager_t manager, ptl_task_t task){
+	PTL_ATOMIC_INC(manager->rejections.discarded);
+	
+	_reject_handler(task, NULL);
+	
+	return 0;
 }
 
 
-void *ptl_q_discard_policy(){
-	return NULL; //TODO: Implement
+/* drop the head of 'work_q' to make room, until the task fits */
+int ptl_q_discard_oldest_policy(ptl_thread_manager_t manager, ptl_task_t task){
+	for(;;){
+		if(PTL_ATOMIC_LOAD(manager->run_state) != PTL_RUNNING){
+			return ptl_q_discard_policy(manager, task);
+		}
+		
+		void *evicted = NULL;
+		int added = ptl_q_add_evict(manager->work_q, task, &evicted);
+		
+		if(evicted != NULL){
+			PTL_ATOMIC_INC(manager->rejections.discarded_oldest);
+			_reject_handler((ptl_task_t)evicted, NULL);
+		}
+		
+		if(added){
+			_ptl_tm_task_queued(manager);
+			return 1;
+		}
+		
+		if(evicted == NULL){
+			return ptl_q_discard_policy(manager, task); // full, yet nothing to take
+		}
+	}
 }
 
+ 
+
+/* Sizing Controllers */
 
-void *ptl_q_discard_oldest_policy(){
-	return NULL; //TODO: Implement
+/* grow on a streak of samples behind, shrink on a streak of idle ones */
+int ptl_tm_queue_sizing(struct ptl_tm_sizing *sizing, const struct ptl_tm_sizing_sample *sample){
+	unsigned long long grow_wait = (sizing->grow_wait > 0) ? 
+		sizing->grow_wait : PTL_TM_SIZING_GROW_WAIT_NSEC;
+	int grow_samples = (sizing->grow_samples > 0) ? 
+		sizing->grow_samples : PTL_TM_SIZING_GROW_SAMPLES;
+	int shrink_samples = (sizing->shrink_samples > 0) ? 
+		sizing->shrink_samples : PTL_TM_SIZING_SHRINK_SAMPLES;
+	int target = sample->target_pool_size;
+	
+	int behind = sample->queue_depth > 0 && sample->idle_threads == 0 &&
+		(sample->mean_wait > grow_wait || sample->arrival_rate > sample->completion_rate);
+	int idle = sample->queue_depth == 0 && sample->idle_threads > 0;
+	
+	if(behind){
+		sizing->streak = (sizing->streak > 0) ? sizing->streak + 1 : 1;
+	} else if(idle){
+		sizing->streak = (sizing->streak < 0) ? sizing->streak - 1 : -1;
+	} else {
+		sizing->streak = 0;
+	}
+	
+	if(sizing->streak >= grow_samples){
+		// from what runs now, which may be above the target already
+		int busy = (sample->pool_size > target) ? sample->pool_size : target;
+		// Little's law: threads busy = arrivals per second * seconds per task
+		int needed = (int)(sample->arrival_rate * (double)sample->mean_run / 1e9 + 0.999);
+		int most = (busy > 0) ? busy * 2 : 1;
+		
+		target = (needed > busy) ? needed : busy + 1;
+		if(target > most){ target = most; }
+		sizing->streak = 0;
+	} else if(-sizing->streak >= shrink_samples){
+		int drop = sample->idle_threads / 2;
+		if(drop < 1){ drop = 1; }
+		
+		if(target > sample->pool_size){ target = sample->pool_size; }
+		target -= drop;
+		sizing->streak = 0;
+	}
+	
+	return target; // the manager clamps it to core and max
 }
 
  
@@ -199,27 +797,1221 @@ void *ptl_q_discard_oldest_policy(){
 /* Private Functions */
 
 
-//TODO: use this as a rejected function wrapper
+/* finish the task as rejected, unless it was cancelled, and let it go */
 void _reject_handler(ptl_task_t task, void (*rejected_handler) (void *)){
-	task->state = PTL_TASK_STATE_REJECTED;
+	if(ptl_task_start(task)){
+		ptl_task_finish(task, NULL, PTL_TASK_STATE_REJECTED);
+	}
 	
-	rejected_handler(task->function_to_execute);
+	if(rejected_handler != NULL){
+		rejected_handler(task);
+	}
 	
 	destroy_task(task);
 }
 
-/* add a thread to the currnent thread pool */
-void add_thread(){return;}
-void add_if_under_max_pool_size(){
-	return;
-}
+
+/* give the task to the current rejection policy */
+int _ptl_tm_reject(ptl_thread_manager_t manager, ptl_task_t task){
+	int (*policy)(ptl_thread_manager_t, ptl_task_t) = 
+		__atomic_load_n(&manager->rejection_policy, __ATOMIC_ACQUIRE);
 	
-void ensure_queued_task_handled(){return;}
-void reject(){return;}
-void run_task(void* task){return;}
-void get_next_task(){return;}
-void interrupt_idle_threads(){return;}
-void drain_queue(){return;}
+	if(manager->stats != NULL){
+		struct ptl_tm_stats_stripe *stripes = (struct ptl_tm_stats_stripe *)manager->stats;
+		__atomic_add_fetch(&stripes[ptl_stats_stripe()].rejected, 1, __ATOMIC_RELAXED);
+	}
+	
+	return policy(manager, task);
+}
 
- 
- 
+
+/**
+ * Hands the task to a new core thread, else puts it on 'work_q', else grows
+ * the pool up to max. If 'timeout' isn't 0 it then waits that long for room
+ * in 'work_q'. If none of that works, the rejection policy gets the task.
+ *
+ * @param timeout ms to wait for room, 0 not to wait
+ * @return 1 if the task was taken, otherwise what the policy returned
+ */
+int _ptl_tm_submit(ptl_thread_manager_t manager, ptl_task_t task, long timeout){
+	// waiting on predecessors, the last of them submits it (see ptl_task_then)
+	if(ptl_task_hold(task, _ptl_tm_submit_released, manager)){
+		return 1;
+	}
+	
+	PTL_TRACE_TASK(PTL_TRACE_SUBMIT, task);
+	if(manager->stats != NULL){
+		_ptl_tm_count_submit(manager, task);
+	}
+	
+	if(PTL_ATOMIC_LOAD(manager->run_state) != PTL_RUNNING){
+		return _ptl_tm_reject(manager, task);
+	}
+	
+	// a task from one of our own workers stays on that worker's deque
+	struct ptl_worker *self = ptl_tm_current_worker;
+	if(manager->scheduling == PTL_TM_SCHED_WORK_STEALING &&
+	   self != NULL && self->manager == manager){
+		ptl_wsd_push((ptl_wsd_t)self->deque, task);
+		_ptl_tm_signal_work(manager);
+		return 1;
+	}
+	
+	// below core, a new thread runs it straight away
+	if(add_thread(manager, task)){
+		return 1;
+	}
+	
+	// put it in the work queue
+	if(ptl_q_add(manager->work_q, task)){
+		_ptl_tm_task_queued(manager);
+		return 1;
+	}
+	
+	// the queue is full, a thread above core may still take it
+	if(add_if_under_max_pool_size(manager, task)){
+		return 1;
+	}
+	
+	// push back on the caller until the workers make room
+	if(timeout > 0){
+		PTL_ATOMIC_INC(manager->rejections.blocked);
+		if(ptl_q_add_wait(manager->work_q, task, timeout)){
+			_ptl_tm_task_queued(manager);
+			return 1;
+		}
+		PTL_ATOMIC_INC(manager->rejections.timed_out);
+	}
+	
+	return _ptl_tm_reject(manager, task);
+}
+
+
+/* after a task went into 'work_q'; make sure a worker will see it */
+void _ptl_tm_task_queued(ptl_thread_manager_t manager){
+	_ptl_tm_signal_work(manager);
+	ensure_queued_task_handled(manager);
+}
+
+/**
+ * Thread body of every worker. Runs the task it was started with, then takes
+ * tasks from the queue until get_next_task() lets it go. By then its slot is
+ * already released, so 'worker' must not be used after the loop.
+ *
+ * @param worker slot this thread runs in
+ */
+void *_ptl_tm_worker(void *worker){
+	struct ptl_worker *self = (struct ptl_worker *)worker;
+	ptl_thread_manager_t manager = (ptl_thread_manager_t)self->manager;
+	ptl_task_t task = (ptl_task_t)self->first_task;
+	self->first_task = NULL;
+	ptl_tm_current_worker = self;
+	PTL_TRACE_SET_WORKER(self->index);
+	
+	// made here, not by the creator, so its pages are local to this (maybe
+	// pinned) thread. Later threads in the slot reuse it
+	if(manager->scheduling == PTL_TM_SCHED_WORK_STEALING && self->deque == NULL){
+		__atomic_store_n(&self->deque, ptl_wsd_create(manager->deque_capacity), __ATOMIC_RELEASE);
+	}
+	
+	while(task != NULL || (task = get_next_task(manager, self)) != NULL){
+		if(manager->fiber_pool != NULL){
+			_ptl_tm_run_fiber(manager, task); // and the successors it makes ready
+			task = NULL;
+		} else {
+			task = run_task(manager, self, task); // a successor it made ready, or NULL
+		}
+	}
+	
+	ptl_tm_current_worker = NULL;
+	PTL_TRACE_SET_WORKER(PTL_TRACE_NO_WORKER);
+	
+	return NULL;
+}
+
+
+/* start a detached thread running 'first_task' if fewer than 'limit' exist */
+int _ptl_tm_start_worker(ptl_thread_manager_t manager, ptl_task_t first_task, int limit){
+	ptl_thread_pool_t pool = manager->thread_pool;
+	int started = 0;
+	
+	pthread_mutex_lock(&manager->main_mutex);
+	
+	// once shutdown, only threads for tasks already queued are started
+	int state = manager->run_state;
+	if(state >= PTL_STOP || (state != PTL_RUNNING && first_task != NULL) ||
+	   pool->current_pool_size >= limit){
+		pthread_mutex_unlock(&manager->main_mutex);
+		return 0;
+	}
+	
+	struct ptl_worker *worker = ptl_tp_free_worker(pool);
+	if(worker != NULL){
+		worker->alive = 1;
+		worker->completed_tasks = 0;
+		worker->first_task = first_task;
+		worker->manager = manager;
+		
+		pthread_attr_t attr;
+		pthread_attr_init(&attr);
+		pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED); // nobody joins
+		ptl_tp_set_worker_affinity(pool, worker, &attr); // starts on its cpu
+		
+		if(pthread_create(&worker->thread, &attr, _ptl_tm_worker, worker) == 0){
+			__atomic_store_n(&pool->current_pool_size, pool->current_pool_size + 1, __ATOMIC_RELEASE);
+			if(pool->current_pool_size > pool->largest_pool_size){
+				pool->largest_pool_size = pool->current_pool_size;
+			}
+			started = 1;
+		} else {
+			worker->alive = 0;
+			worker->first_task = NULL;
+		}
+		
+		pthread_attr_destroy(&attr);
+	}
+	
+	pthread_mutex_unlock(&manager->main_mutex);
+	
+	return started;
+}
+
+
+/**
+ * Gives the slot of 'worker' back and folds its counters into the pool.
+ * A 'retiring' (idle, above core) worker is only let go if the pool stays
+ * at core (or the sizing target) and isn't left empty with tasks queued.
+ *
+ * @return 1 if the worker was released and its thread must end, 0 otherwise
+ */
+int _ptl_tm_release_worker(ptl_thread_manager_t manager, struct ptl_worker *worker, int retiring){
+	ptl_thread_pool_t pool = manager->thread_pool;
+	
+	pthread_mutex_lock(&manager->main_mutex);
+	
+	int size = pool->current_pool_size;
+	if(retiring && (size <= _ptl_tm_keep_size(manager) ||
+					(size == 1 && (ptl_q_size(manager->work_q) > 0 || 
+								   _ptl_tm_fibers_live(manager))))){
+		pthread_mutex_unlock(&manager->main_mutex);
+		return 0;
+	}
+	
+	pool->completed_tasks += worker->completed_tasks;
+	manager->num_completed_tasks += worker->completed_tasks;
+	worker->completed_tasks = 0;
+	worker->alive = 0;
+	
+	__atomic_store_n(&pool->current_pool_size, size - 1, __ATOMIC_RELEASE);
+	if(size - 1 == 0){
+		_ptl_tm_try_terminate_locked(manager);
+	}
+	
+	pthread_mutex_unlock(&manager->main_mutex);
+	
+	return 1;
+}
+
+
+/* set up a manager around 'thread_pool' and start its core threads */
+ptl_thread_manager_t _ptl_tm_create_manager(ptl_thread_pool_t thread_pool,
+											ptl_q_t work_q,
+											void (*rejected_handler)(void *),
+											void (*before_execute)(void *),
+											void (*after_execute)(void *),
+											const struct ptl_tm_options *options){
+	struct ptl_tm_options defaults;
+	if(options == NULL){
+		ptl_tm_options_init(&defaults);
+		options = &defaults;
+	}
+	
+	ptl_thread_manager_t manager = (ptl_thread_manager_t)calloc(1, sizeof(struct ptl_thread_manager));
+	assert(manager);
+							   
+	/* initilize the manager struct */
+	manager->work_q = work_q;
+	manager->thread_pool = thread_pool;
+	manager->run_state = PTL_RUNNING;
+	manager->num_completed_tasks = 0;
+	manager->scheduling = options->scheduling;
+	/* functions */
+	manager->rejected_handler = rejected_handler;
+	manager->rejection_policy = (options->rejection_policy != NULL) ? 
+		options->rejection_policy : ptl_abort_policy;
+	manager->before_execute = before_execute;
+	manager->after_execute = after_execute;
+	
+	/* create mutexes and conditions */
+	pthread_mutex_init(&manager->main_mutex, NULL);
+	ptl_cond_init(&manager->termination_mutex); // for timed waits in ptl_tm_await_termination
+	manager->wait_strategy = options->wait_strategy;
+	ptl_ec_init(&manager->work_event);
+	
+	if(options->collect_stats || options->sizing.controller != NULL){
+		manager->stats = ptl_stats_alloc(PTL_STATS_STRIPES * sizeof(struct ptl_tm_stats_stripe));
+		ptl_q_enable_stats(work_q);
+	}
+	
+	/* each slot's deque is made by its first thread, see _ptl_tm_worker */
+	manager->deque_capacity = (options->deque_capacity > 0) ? 
+		options->deque_capacity : PTL_WSD_DEFAULT_CAPACITY;
+	
+	if(options->fibers){
+		manager->fiber_pool = ptl_fiber_pool_create(options->fiber_stack_size, 
+													_ptl_tm_fiber_wake, manager);
+		manager->fiber_q = ptl_q_create_queue(&ptl_lq_funcs, 0); // unbounded, never refuses
+	}
+	
+	// before any worker, they read the target
+	manager->sizing = options->sizing;
+	if(manager->sizing.controller != NULL){
+		_ptl_tm_sizing_start(manager);
+	}
+	
+	_ptl_tm_prestart_core_threads(manager);
+	
+	return manager;
+}
+
+
+/* the core threads wait on the queue from the start */
+void _ptl_tm_prestart_core_threads(ptl_thread_manager_t manager){
+	while(add_thread(manager, NULL));
+}
+
+
+/* add a thread to the currnent thread pool, while it's under core */
+int add_thread(ptl_thread_manager_t manager, ptl_task_t first_task){
+	ptl_thread_pool_t pool = manager->thread_pool;
+	
+	int core_pool_size = PTL_ATOMIC_LOAD(pool->core_pool_size);
+	if(PTL_ATOMIC_LOAD(pool->current_pool_size) >= core_pool_size){ 
+		return 0; // common case, no lock
+	}
+	
+	return _ptl_tm_start_worker(manager, first_task, core_pool_size);
+}
+
+
+/* add a thread above core, up to max */
+int add_if_under_max_pool_size(ptl_thread_manager_t manager, ptl_task_t first_task){
+	ptl_thread_pool_t pool = manager->thread_pool;
+	
+	int max_pool_size = PTL_ATOMIC_LOAD(pool->max_pool_size);
+	if(PTL_ATOMIC_LOAD(pool->current_pool_size) >= max_pool_size){
+		return 0;
+	}
+	
+	return _ptl_tm_start_worker(manager, first_task, max_pool_size);
+}
+
+
+/* after a task is queued; grow if it's more than the idle threads can take,
+   up to max, or with a sizing controller up to its target */
+void ensure_queued_task_handled(ptl_thread_manager_t manager){
+	ptl_thread_pool_t pool = manager->thread_pool;
+	
+	// pairs with the fence in get_next_task. Either that worker sees the
+	// task in the queue and stays, or this sees it is no longer idle
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	
+	int current_pool_size = PTL_ATOMIC_LOAD(pool->current_pool_size);
+	if(ptl_q_size(manager->work_q) <= PTL_ATOMIC_LOAD(pool->idle_threads) &&
+	   current_pool_size > 0){
+		return;
+	}
+	
+	if(manager->sizing.controller == NULL || current_pool_size == 0){
+		add_if_under_max_pool_size(manager, NULL);
+	} else {
+		// core, or the target when higher; the controller grows it past that
+		_ptl_tm_start_worker(manager, NULL, _ptl_tm_keep_size(manager));
+	}
+}
+
+
+void reject(){return;}
+
+
+/* the timer wheel, started on first use */
+ptl_tw_t _ptl_tm_get_timer_wheel(ptl_thread_manager_t manager){
+	ptl_tw_t wheel = __atomic_load_n(&manager->timer_wheel, __ATOMIC_ACQUIRE);
+	
+	if(wheel == NULL){
+		pthread_mutex_lock(&manager->main_mutex);
+		wheel = manager->timer_wheel;
+		if(wheel == NULL){
+			wheel = ptl_tw_create(PTL_TW_DEFAULT_TICK_MSEC, _ptl_tm_timers_expired, manager);
+			__atomic_store_n(&manager->timer_wheel, wheel, __ATOMIC_RELEASE);
+		}
+		pthread_mutex_unlock(&manager->main_mutex);
+	}
+	
+	return wheel;
+}
+
+
+/* park 'task' in the timer wheel, rejecting it if the manager isn't running */
+int _ptl_tm_schedule_task(ptl_thread_manager_t manager, ptl_task_t task, long delay_ms){
+	ptl_tw_t wheel = NULL;
+	int added = 0;
+	
+	if(PTL_ATOMIC_LOAD(manager->run_state) == PTL_RUNNING){
+		wheel = _ptl_tm_get_timer_wheel(manager);
+	}
+	
+	if(wheel != NULL){
+		ptl_tw_init_timer(&task->timer, task);
+		
+		// under the lock the run state moves with, so a shutdown's drain sees it
+		pthread_mutex_lock(&manager->main_mutex);
+		if(manager->run_state == PTL_RUNNING){
+			ptl_tw_add(wheel, &task->timer, delay_ms);
+			added = 1;
+		}
+		pthread_mutex_unlock(&manager->main_mutex);
+	}
+	
+	if(!added){
+		return _ptl_tm_reject(manager, task);
+	}
+	
+	return 1;
+}
+
+
+/* make the repeating task and schedule its first run */
+ptl_future_t _ptl_tm_schedule_periodic(ptl_thread_manager_t manager,
+									   void *(*function_to_execute)(void *), void *arg,
+									   long initial_delay, long period){
+	if(initial_delay < 0){
+		initial_delay = 0;
+	}
+	
+	ptl_task_t task = create_task_with_arg(function_to_execute, arg);
+	task->period = period;
+	task->next_run_nsec = ptl_get_time_nsec() + (unsigned long long)initial_delay * 1000000ULL;
+	ptl_future_t future = ptl_task_get_future(task);
+	
+	_ptl_tm_schedule_task(manager, task, initial_delay); // if rejected, the future is finished
+	
+	return future;
+}
+
+
+/* after a run of a periodic task; put it back in the wheel for the next */
+int _ptl_tm_reschedule(ptl_thread_manager_t manager, ptl_task_t task){
+	long delay_ms = -task->period;
+	int added = 0;
+	
+	if(PTL_ATOMIC_LOAD(manager->run_state) != PTL_RUNNING){
+		return 0;
+	}
+	
+	if(task->period > 0){ // fixed rate, due 'period' after the last was due
+		unsigned long long now = ptl_get_time_nsec();
+		task->next_run_nsec += (unsigned long long)task->period * 1000000ULL;
+		delay_ms = (task->next_run_nsec > now) ? 
+			(long)((task->next_run_nsec - now + 999999ULL) / 1000000ULL) : 0;
+	}
+	
+	// checked again under the lock the run state moves with: a shutdown that
+	// got in since has drained the wheel already and would never see it
+	pthread_mutex_lock(&manager->main_mutex);
+	if(manager->run_state == PTL_RUNNING && ptl_task_rearm(task)){
+		// once CREATED it may be cancelled, a worker then skips it when it's due
+		ptl_tw_add(manager->timer_wheel, &task->timer, delay_ms);
+		added = 1;
+	}
+	pthread_mutex_unlock(&manager->main_mutex);
+	
+	return added; // 0 if stopped, or cancelled while it ran
+}
+
+
+/* timer thread; queue the tasks that are due in one go, submit the rest one by one */
+void _ptl_tm_timers_expired(struct ptl_timer **timers, int count, void *context){
+	ptl_thread_manager_t manager = (ptl_thread_manager_t)context;
+	ptl_task_t tasks[PTL_TW_BATCH_SIZE];
+	
+	int timer_count = count;
+	count = _ptl_tm_timer_tasks(manager, timers, count, (void **)tasks);
+	if(count < timer_count){ // the other timer is the sizing controller's
+		_ptl_tm_sizing_sample(manager);
+	}
+	
+	_ptl_tm_queue_batch(manager, tasks, count);
+}
+
+
+/* queue the tasks in one go, submit the ones that don't fit one by one */
+int _ptl_tm_queue_batch(ptl_thread_manager_t manager, ptl_task_t *tasks, int count){
+	int accepted = 0;
+	int added = 0;
+	int i = 0;
+	
+	for(i = 0; i < count; i++){
+		PTL_TRACE_TASK(PTL_TRACE_SUBMIT, tasks[i]); // again by submit_task if left over
+		if(manager->stats != NULL){
+			tasks[i]->submit_nsec = ptl_get_time_nsec(); // before a worker can see it
+		}
+	}
+	
+	if(PTL_ATOMIC_LOAD(manager->run_state) == PTL_RUNNING){
+		added = ptl_q_add_batch(manager->work_q, (void **)tasks, count);
+	}
+	
+	if(added > 0){
+		if(manager->stats != NULL){
+			// the ones left over are counted by submit_task
+			struct ptl_tm_stats_stripe *stripes = (struct ptl_tm_stats_stripe *)manager->stats;
+			__atomic_add_fetch(&stripes[ptl_stats_stripe()].submitted, added, __ATOMIC_RELAXED);
+		}
+		for(i = 0; i < added; i++){
+			_ptl_tm_signal_work(manager); // only costs a syscall while workers are parked
+		}
+		ensure_queued_task_handled(manager);
+	}
+	
+	// the queue is full (or stopped); grow, or reject them
+	for(i = added; i < count; i++){
+		accepted += submit_task(manager, tasks[i]);
+	}
+	
+	return added + accepted;
+}
+
+
+/* a held task whose last predecessor just finished */
+int _ptl_tm_submit_released(void *manager, ptl_task_t task){
+	return _ptl_tm_submit((ptl_thread_manager_t)manager, task, 0);
+}
+
+
+/**
+ * before_execute, the task, after_execute. The worker owns the task now.
+ *
+ * @return a successor the task made ready, for this worker to run next
+ */
+ptl_task_t run_task(ptl_thread_manager_t manager, struct ptl_worker *worker, ptl_task_t task){
+	if(!ptl_task_start(task)){ // cancelled while it was queued
+		destroy_task(task);
+		return NULL;
+	}
+	PTL_TRACE_TASK(PTL_TRACE_START, task);
+	
+	unsigned long long start = (manager->stats != NULL) ? ptl_get_time_nsec() : 0;
+	
+	if(manager->before_execute != NULL){
+		manager->before_execute(task);
+	}
+	
+	void *result = task->function_to_execute(task->arg);
+	PTL_TRACE_TASK(PTL_TRACE_END, task);
+	
+	if(start != 0){
+		_ptl_tm_count_run(manager, task, start);
+	}
+	
+	if(task->period != 0){
+		_ptl_tm_run_done(manager, worker, task, result);
+		return NULL;
+	}
+	
+	// wakes the future and releases the successors
+	ptl_task_t next = ptl_task_finish_continue(task, result, PTL_TASK_STATE_DONE);
+	
+	if(manager->after_execute != NULL){
+		manager->after_execute(task);
+	}
+	_ptl_tm_reset_arena();
+	
+	_ptl_tm_count_completed(worker);
+	
+	destroy_task(task);
+	
+	return _ptl_tm_continue(manager, next);
+}
+
+
+/* run 'next' on this worker, skipping the queue, if it was held for this
+   manager and the manager still runs tasks. Otherwise submit it */
+ptl_task_t _ptl_tm_continue(ptl_thread_manager_t manager, ptl_task_t next){
+	if(next == NULL){ return NULL; }
+	
+	if(next->manager != manager || PTL_ATOMIC_LOAD(manager->run_state) != PTL_RUNNING){
+		next->submit_func(next->manager, next);
+		return NULL;
+	}
+	
+	PTL_TRACE_TASK(PTL_TRACE_SUBMIT, next);
+	if(manager->stats != NULL){
+		_ptl_tm_count_submit(manager, next);
+	}
+	
+	return next;
+}
+
+
+/* end of one run of a periodic task. Once rearmed another worker may own
+   it, so everything that uses it here comes first */
+void _ptl_tm_run_done(ptl_thread_manager_t manager, struct ptl_worker *worker,
+					  ptl_task_t task, void *result){
+	if(manager->after_execute != NULL){
+		manager->after_execute(task);
+	}
+	_ptl_tm_reset_arena();
+	
+	_ptl_tm_count_completed(worker);
+	
+	if(!_ptl_tm_reschedule(manager, task)){
+		// a series only ends by being stopped
+		ptl_task_finish(task, result, PTL_TASK_STATE_CANCELLED);
+		destroy_task(task);
+	}
+}
+
+
+/* one more task in; it starts waiting now */
+void _ptl_tm_count_submit(ptl_thread_manager_t manager, ptl_task_t task){
+	struct ptl_tm_stats_stripe *stripes = (struct ptl_tm_stats_stripe *)manager->stats;
+	
+	task->submit_nsec = ptl_get_time_nsec();
+	__atomic_add_fetch(&stripes[ptl_stats_stripe()].submitted, 1, __ATOMIC_RELAXED);
+}
+
+
+/* a run that began at 'start' just returned; time its wait and the run */
+void _ptl_tm_count_run(ptl_thread_manager_t manager, ptl_task_t task, unsigned long long start){
+	struct ptl_tm_stats_stripe *stripe = 
+		&((struct ptl_tm_stats_stripe *)manager->stats)[ptl_stats_stripe()];
+	unsigned long long end = ptl_get_time_nsec();
+	
+	// 0 if it never went through a counted submit
+	if(task->submit_nsec != 0 && start >= task->submit_nsec){
+		ptl_hist_record(&stripe->queue_wait, start - task->submit_nsec);
+	}
+	ptl_hist_record(&stripe->run_time, end - start);
+	__atomic_add_fetch(&stripe->completed, 1, __ATOMIC_RELAXED);
+}
+
+
+/**
+ * Next task from the queue for 'worker'. An idle worker spins, then parks
+ * on 'work_event' (see _ptl_tm_idle_wait). Threads above core wait up to
+ * 'keep_alive_time' and then retire; core threads wait in slices of
+ * PTL_TM_IDLE_RECHECK_MSEC so they notice the run state changing.
+ *
+ * @return the next task, or NULL once the worker has been released
+ */
+ptl_task_t get_next_task(ptl_thread_manager_t manager, struct ptl_worker *worker){
+	if(manager->scheduling == PTL_TM_SCHED_WORK_STEALING){
+		return _ptl_tm_get_next_task_ws(manager, worker);
+	}
+	
+	ptl_thread_pool_t pool = manager->thread_pool;
+	ptl_task_t task = NULL;
+	unsigned long long idle_since = 0;
+	
+	for(;;){
+		// suspended fibers are tasks in progress, they keep the workers
+		int state = PTL_ATOMIC_LOAD(manager->run_state);
+		if(!_ptl_tm_fibers_live(manager) && 
+		   (state >= PTL_STOP || (state == PTL_SHUTDOWN && ptl_q_size(manager->work_q) == 0))){
+			_ptl_tm_release_worker(manager, worker, 0);
+			return NULL;
+		}
+		
+		// max was lowered, this one goes
+		if(_ptl_tm_above_max(pool) && _ptl_tm_release_worker(manager, worker, 1)){
+			return NULL;
+		}
+		
+		// a woken fiber goes before new tasks
+		if(manager->fiber_q != NULL && (task = (ptl_task_t)ptl_q_get(manager->fiber_q)) != NULL){
+			return task;
+		}
+		if(state < PTL_STOP && (task = (ptl_task_t)ptl_q_get(manager->work_q)) != NULL){
+			PTL_TRACE_TASK(PTL_TRACE_DEQUEUE, task);
+			return task;
+		}
+		
+		int above_core = PTL_ATOMIC_LOAD(pool->current_pool_size) > _ptl_tm_keep_size(manager);
+		long timeout = above_core ? pool->keep_alive_time : PTL_TM_IDLE_RECHECK_MSEC;
+		long remaining = _ptl_tm_idle_remaining(&idle_since, timeout);
+		
+		if(remaining > 0 && _ptl_tm_idle_wait(manager, worker, remaining, _ptl_tm_queue_ready)){
+			continue; // there may be a task, or the state changed
+		}
+		
+		__atomic_thread_fence(__ATOMIC_SEQ_CST); // see ensure_queued_task_handled
+		
+		if(above_core && _ptl_tm_release_worker(manager, worker, 1)){
+			return NULL;
+		}
+		idle_since = 0; // a core thread starts another slice
+	}
+}
+
+
+/**
+ * Waits for work as the manager's wait strategy says: spin and yield while
+ * 'ready' is false, then park on 'work_event' for up to 'timeout' ms. The
+ * worker counts as idle all along, so submitters don't start threads for a
+ * task it's about to take.
+ *
+ * @param ready non-zero when there may be work for this worker
+ * @return 1 if there may be work, 0 if it timed out
+ */
+int _ptl_tm_idle_wait(ptl_thread_manager_t manager, struct ptl_worker *worker,
+					  long timeout, int (*ready)(void *)){
+	ptl_thread_pool_t pool = manager->thread_pool;
+	int woken = 1;
+	
+	PTL_ATOMIC_INC(pool->idle_threads);
+	
+	if(!ptl_wait_spin(&manager->wait_strategy, &worker->spin, ready, manager)){
+		// look once more after registering; a notify from here on wakes us
+		unsigned int key = ptl_ec_prepare(&manager->work_event);
+		
+		if(ready(manager)){
+			ptl_ec_cancel(&manager->work_event);
+		} else {
+			unsigned long long start = ptl_get_time_nsec();
+			PTL_TRACE_WORKER(PTL_TRACE_PARK);
+			woken = ptl_ec_wait(&manager->work_event, key, timeout);
+			PTL_TRACE_WORKER(PTL_TRACE_UNPARK);
+			ptl_wait_note_park(&manager->wait_strategy, &worker->spin, 
+							   ptl_get_time_nsec() - start);
+		}
+	}
+	
+	PTL_ATOMIC_DEC(pool->idle_threads);
+	
+	return woken;
+}
+
+
+/* ms left of 'timeout' since the worker went idle, starting the clock if needed */
+long _ptl_tm_idle_remaining(unsigned long long *idle_since, long timeout){
+	unsigned long long now = ptl_get_time_nsec();
+	
+	if(*idle_since == 0){
+		*idle_since = now;
+	}
+	
+	long elapsed = (long)((now - *idle_since) / 1000000ULL);
+	
+	return (elapsed < timeout) ? timeout - elapsed : 0;
+}
+
+
+/* 'ready' for the shared queue mode; a task, or a state change to look at */
+int _ptl_tm_queue_ready(void *manager){
+	ptl_thread_manager_t m = (ptl_thread_manager_t)manager;
+	
+	if(_ptl_tm_fibers_live(m)){
+		return _ptl_tm_fibers_ready(m, ptl_q_size(m->work_q) > 0);
+	}
+	
+	return ptl_q_size(m->work_q) > 0 || PTL_ATOMIC_LOAD(m->run_state) != PTL_RUNNING;
+}
+
+
+/* 'ready' for work-stealing mode */
+int _ptl_tm_ws_ready(void *manager){
+	ptl_thread_manager_t m = (ptl_thread_manager_t)manager;
+	
+	if(_ptl_tm_fibers_live(m)){
+		return _ptl_tm_fibers_ready(m, _ptl_tm_has_work(m));
+	}
+	
+	return _ptl_tm_has_work(m) || PTL_ATOMIC_LOAD(m->run_state) != PTL_RUNNING;
+}
+
+
+/* anything queued on 'work_q' or on any worker's deque */
+int _ptl_tm_has_work(ptl_thread_manager_t manager){
+	if(ptl_q_size(manager->work_q) > 0){
+		return 1;
+	}
+	
+	ptl_thread_pool_t pool = manager->thread_pool;
+	int i = 0;
+	for(i = 0; i < pool->slot_count; i++){
+		ptl_wsd_t deque = __atomic_load_n((ptl_wsd_t *)&pool->workers[i].deque, __ATOMIC_ACQUIRE);
+		if(deque != NULL && ptl_wsd_size(deque) > 0){
+			return 1;
+		}
+	}
+	
+	return 0;
+}
+
+
+/* after a push or queue add; wake one parked worker, if any is parked */
+void _ptl_tm_signal_work(ptl_thread_manager_t manager){
+	ptl_ec_notify_one(&manager->work_event);
+}
+
+
+/* try every other worker's deque once, starting at a random one */
+ptl_task_t _ptl_tm_steal(ptl_thread_manager_t manager, struct ptl_worker *worker){
+	static __thread unsigned int seed = 0;
+	if(seed == 0){
+		seed = (unsigned int)worker->index * 2654435761u + 1;
+	}
+	
+	// xorshift, good enough to spread thieves over victims
+	seed ^= seed << 13;
+	seed ^= seed >> 17;
+	seed ^= seed << 5;
+	
+	ptl_thread_pool_t pool = manager->thread_pool;
+	int n = pool->slot_count;
+	int start = (int)(seed % (unsigned int)n);
+	int i = 0;
+	for(i = 0; i < n; i++){
+		struct ptl_worker *victim = &pool->workers[(start + i) % n];
+		ptl_wsd_t deque = __atomic_load_n((ptl_wsd_t *)&victim->deque, __ATOMIC_ACQUIRE);
+		if(victim == worker || deque == NULL){ continue; } // never had a thread
+		
+		ptl_task_t task = (ptl_task_t)ptl_wsd_steal(deque);
+		if(task != NULL){
+			return task;
+		}
+	}
+	
+	return NULL;
+}
+
+
+/**
+ * get_next_task() for work-stealing mode. Looks at the worker's own deque
+ * (newest first), then 'work_q', then the other deques (oldest first). When
+ * all are empty it waits the same way and with the same timeouts as the
+ * shared queue mode.
+ *
+ * @return the next task, or NULL once the worker has been released
+ */
+ptl_task_t _ptl_tm_get_next_task_ws(ptl_thread_manager_t manager, struct ptl_worker *worker){
+	ptl_thread_pool_t pool = manager->thread_pool;
+	ptl_wsd_t own = (ptl_wsd_t)worker->deque;
+	ptl_task_t task = NULL;
+	unsigned long long idle_since = 0;
+	
+	for(;;){
+		// max was lowered; go once the own deque is empty, its tasks could
+		// still be stolen but would wait longer
+		if(_ptl_tm_above_max(pool) && ptl_wsd_size(own) == 0 &&
+		   _ptl_tm_release_worker(manager, worker, 1)){
+			return NULL;
+		}
+		
+		int state = PTL_ATOMIC_LOAD(manager->run_state);
+		if(manager->fiber_q != NULL && (task = (ptl_task_t)ptl_q_get(manager->fiber_q)) != NULL){
+			return task; // a woken fiber goes before new tasks
+		}
+		if(state < PTL_STOP &&
+		   ((task = (ptl_task_t)ptl_wsd_pop(own)) != NULL ||
+			(task = (ptl_task_t)ptl_q_get(manager->work_q)) != NULL ||
+			(task = _ptl_tm_steal(manager, worker)) != NULL)){
+			PTL_TRACE_TASK(PTL_TRACE_DEQUEUE, task);
+			return task;
+		}
+		
+		if(!_ptl_tm_fibers_live(manager) &&
+		   (state >= PTL_STOP || (state == PTL_SHUTDOWN && !_ptl_tm_has_work(manager)))){
+			_ptl_tm_release_worker(manager, worker, 0);
+			return NULL;
+		}
+		
+		int above_core = PTL_ATOMIC_LOAD(pool->current_pool_size) > _ptl_tm_keep_size(manager);
+		long timeout = above_core ? pool->keep_alive_time : PTL_TM_IDLE_RECHECK_MSEC;
+		long remaining = _ptl_tm_idle_remaining(&idle_since, timeout);
+		
+		if(remaining > 0 && _ptl_tm_idle_wait(manager, worker, remaining, _ptl_tm_ws_ready)){
+			continue;
+		}
+		
+		if(above_core && !_ptl_tm_has_work(manager) &&
+		   _ptl_tm_release_worker(manager, worker, 1)){
+			return NULL;
+		}
+		idle_since = 0;
+	}
+}
+
+
+/* wake every parked worker so it looks at the run state */
+void interrupt_idle_threads(ptl_thread_manager_t manager){
+	ptl_ec_notify_all(&manager->work_event);
+}
+
+
+/**
+ * Moves every task that hasn't started out of 'work_q' and the worker
+ * deques, in batches, into a new linked queue. Cancelled tasks are destroyed
+ * on the way. The timer wheel is left to _ptl_tm_cancel_scheduled.
+ *
+ * @return the queue of tasks, the caller owns them and the queue
+ */
+ptl_q_t drain_queue(ptl_thread_manager_t manager){
+	ptl_q_t drained = ptl_q_create_queue(&ptl_lq_funcs, 0);
+	void *batch[PTL_Q_DRAIN_BATCH_SIZE];
+	int taken = 0;
+	int i = 0;
+	
+	while((taken = ptl_q_get_batch(manager->work_q, batch, PTL_Q_DRAIN_BATCH_SIZE)) > 0){
+		ptl_q_add_batch(drained, batch, _ptl_tm_drop_cancelled(batch, taken));
+	}
+	
+	ptl_thread_pool_t pool = manager->thread_pool;
+	for(i = 0; i < pool->slot_count; i++){
+		ptl_wsd_t deque = __atomic_load_n((ptl_wsd_t *)&pool->workers[i].deque, __ATOMIC_ACQUIRE);
+		if(deque == NULL){ continue; }
+		
+		// a worker may still pop its own, stealing is safe alongside
+		do {
+			taken = 0;
+			while(taken < PTL_Q_DRAIN_BATCH_SIZE && (batch[taken] = ptl_wsd_steal(deque)) != NULL){
+				taken++;
+			}
+			ptl_q_add_batch(drained, batch, _ptl_tm_drop_cancelled(batch, taken));
+		} while(taken == PTL_Q_DRAIN_BATCH_SIZE);
+	}
+	
+	return drained;
+}
+
+
+/* the run state only moves forward, see the constants */
+void _ptl_tm_advance_run_state(ptl_thread_manager_t manager, int state){
+	pthread_mutex_lock(&manager->main_mutex);
+	if(manager->run_state < state){
+		__atomic_store_n(&manager->run_state, state, __ATOMIC_RELEASE);
+	}
+	pthread_mutex_unlock(&manager->main_mutex);
+}
+
+
+/* TERMINATED once stopping (or shut down with nothing left) and no thread remains */
+int _ptl_tm_try_terminate(ptl_thread_manager_t manager){
+	pthread_mutex_lock(&manager->main_mutex);
+	int terminated = _ptl_tm_try_terminate_locked(manager);
+	pthread_mutex_unlock(&manager->main_mutex);
+	
+	return terminated;
+}
+
+
+/* _ptl_tm_try_terminate with 'main_mutex' held */
+int _ptl_tm_try_terminate_locked(ptl_thread_manager_t manager){
+	int state = manager->run_state;
+	
+	if(state == PTL_TERMINATED){
+		return 1;
+	}
+	if(state == PTL_RUNNING || manager->thread_pool->current_pool_size > 0 ||
+	   (state == PTL_SHUTDOWN && _ptl_tm_has_work(manager))){
+		return 0;
+	}
+	
+	__atomic_store_n(&manager->run_state, PTL_TERMINATED, __ATOMIC_RELEASE);
+	pthread_cond_broadcast(&manager->termination_mutex);
+	
+	return 1;
+}
+
+
+/* finish everything waiting in the timer wheel as cancelled */
+void _ptl_tm_cancel_scheduled(ptl_thread_manager_t manager){
+	ptl_tw_t wheel = __atomic_load_n(&manager->timer_wheel, __ATOMIC_ACQUIRE);
+	ptl_timer_t timers[PTL_TW_BATCH_SIZE];
+	void *tasks[PTL_TW_BATCH_SIZE];
+	int taken = 0;
+	int i = 0;
+	
+	while(wheel != NULL && (taken = ptl_tw_drain(wheel, timers, PTL_TW_BATCH_SIZE)) > 0){
+		taken = _ptl_tm_timer_tasks(manager, timers, taken, tasks);
+		for(i = 0; i < taken; i++){
+			ptl_task_t task = (ptl_task_t)tasks[i];
+			
+			if(ptl_task_start(task)){
+				ptl_task_finish(task, NULL, PTL_TASK_STATE_CANCELLED);
+			}
+			destroy_task(task);
+		}
+	}
+}
+
+
+/* destroys the cancelled tasks among 'tasks' and packs the rest to the front
+   in order; returns how many are left */
+int _ptl_tm_drop_cancelled(void **tasks, int count){
+	int kept = 0;
+	int i = 0;
+	
+	for(i = 0; i < count; i++){
+		ptl_task_t task = (ptl_task_t)tasks[i];
+		
+		if(__atomic_load_n(&task->state, __ATOMIC_ACQUIRE) != PTL_TASK_STATE_CREATED){
+			destroy_task(task); // the tombstone of a cancelled task
+		} else {
+			tasks[kept++] = task;
+		}
+	}
+	
+	return kept;
+}
+
+/* the tasks of 'timers', leaving out the sizing controller's own timer;
+   returns how many */
+int _ptl_tm_timer_tasks(ptl_thread_manager_t manager, ptl_timer_t *timers, int count, 
+						void **tasks){
+	struct ptl_tm_sizing_state *state = (struct ptl_tm_sizing_state *)manager->sizing_state;
+	int n = 0;
+	int i = 0;
+	
+	for(i = 0; i < count; i++){
+		if(state != NULL && timers[i] == &state->timer){
+			continue;
+		}
+		tasks[n++] = timers[i]->data;
+	}
+	
+	return n;
+}
+
+
+/* threads kept when idle: core, or the sizing target when higher, never above max */
+int _ptl_tm_keep_size(ptl_thread_manager_t manager){
+	ptl_thread_pool_t pool = manager->thread_pool;
+	struct ptl_tm_sizing_state *state = (struct ptl_tm_sizing_state *)manager->sizing_state;
+	int keep = PTL_ATOMIC_LOAD(pool->core_pool_size);
+	
+	if(state != NULL){
+		int target = PTL_ATOMIC_LOAD(state->target);
+		if(target > keep){ keep = target; }
+	}
+	
+	int max_pool_size = PTL_ATOMIC_LOAD(pool->max_pool_size);
+	
+	return (keep < max_pool_size) ? keep : max_pool_size;
+}
+
+
+/* more threads than a lowered max allows */
+int _ptl_tm_above_max(ptl_thread_pool_t pool){
+	return PTL_ATOMIC_LOAD(pool->current_pool_size) > PTL_ATOMIC_LOAD(pool->max_pool_size);
+}
+
+
+/* set up the controller's state and put its timer on the wheel */
+void _ptl_tm_sizing_start(ptl_thread_manager_t manager){
+	if(manager->sizing.period_msec <= 0){
+		manager->sizing.period_msec = PTL_TM_SIZING_PERIOD_MSEC;
+	}
+	
+	struct ptl_tm_sizing_state *state = 
+		(struct ptl_tm_sizing_state *)calloc(1, sizeof(struct ptl_tm_sizing_state));
+	assert(state);
+	
+	state->last_nsec = ptl_get_time_nsec();
+	ptl_tw_init_timer(&state->timer, manager);
+	manager->sizing_state = state;
+	
+	ptl_tw_t wheel = _ptl_tm_get_timer_wheel(manager);
+	if(wheel != NULL){
+		ptl_tw_add(wheel, &state->timer, manager->sizing.period_msec);
+	}
+}
+
+
+/**
+ * Timer thread, every 'period_msec'. Takes the sample from the stats and
+ * the pool, asks the controller for a target and clamps it. The pool grows
+ * to the target here; it shrinks as threads above the target go idle and
+ * retire. Once the manager stops running the timer isn't added again.
+ */
+void _ptl_tm_sizing_sample(ptl_thread_manager_t manager){
+	struct ptl_tm_sizing_state *state = (struct ptl_tm_sizing_state *)manager->sizing_state;
+	ptl_thread_pool_t pool = manager->thread_pool;
+	struct ptl_tm_sizing_sample sample;
+	int i = 0;
+	
+	if(PTL_ATOMIC_LOAD(manager->run_state) != PTL_RUNNING){
+		return;
+	}
+	
+	unsigned long long now = ptl_get_time_nsec();
+	unsigned long long last_submitted = state->now.submitted;
+	unsigned long long last_completed = state->now.completed;
+	ptl_tm_get_stats(manager, &state->now);
+	
+	memset(&sample, 0, sizeof(struct ptl_tm_sizing_sample));
+	sample.period_msec = (long)((now - state->last_nsec) / 1000000ULL);
+	sample.queue_depth = ptl_q_size(manager->work_q);
+	sample.pool_size = PTL_ATOMIC_LOAD(pool->current_pool_size);
+	sample.idle_threads = PTL_ATOMIC_LOAD(pool->idle_threads);
+	sample.core_pool_size = PTL_ATOMIC_LOAD(pool->core_pool_size);
+	sample.max_pool_size = PTL_ATOMIC_LOAD(pool->max_pool_size);
+	sample.target_pool_size = _ptl_tm_keep_size(manager);
+	
+	double seconds = (double)(now - state->last_nsec) / 1e9;
+	if(seconds > 0){
+		sample.arrival_rate = (double)(state->now.submitted - last_submitted) / seconds;
+		sample.completion_rate = (double)(state->now.completed - last_completed) / seconds;
+	}
+	
+	// totals only grow, so what changed since the last sample is this period's
+	struct ptl_histogram *wait = &state->now.queue_wait;
+	struct ptl_histogram *run = &state->now.run_time;
+	unsigned long long waited = wait->total - state->last_wait.total;
+	unsigned long long ran = run->total - state->last_run.total;
+	
+	if(waited > 0){
+		sample.mean_wait = (wait->sum - state->last_wait.sum) / waited;
+		for(i = 0; i < PTL_HIST_BUCKETS; i++){
+			state->window.counts[i] = wait->counts[i] - state->last_wait.counts[i];
+		}
+		sample.p99_wait = ptl_hist_percentile(&state->window, 99.0);
+	}
+	if(ran > 0){
+		sample.mean_run = (run->sum - state->last_run.sum) / ran;
+	}
+	
+	state->last_wait = *wait;
+	state->last_run = *run;
+	state->last_nsec = now;
+	
+	int target = manager->sizing.controller(&manager->sizing, &sample);
+	if(target > sample.max_pool_size){ target = sample.max_pool_size; }
+	if(target < sample.core_pool_size){ target = sample.core_pool_size; }
+	__atomic_store_n(&state->target, target, __ATOMIC_RELEASE);
+	
+	while(PTL_ATOMIC_LOAD(pool->current_pool_size) < target &&
+		  _ptl_tm_start_worker(manager, NULL, target));
+	
+	ptl_tw_add(manager->timer_wheel, &state->timer, manager->sizing.period_msec);
+}
+
+
+/**
+ * The worker's side of fiber mode: a task gets a fiber of its own to run on,
+ * a woken fiber (queued on 'fiber_q' as a _ptl_tm_fiber_resume_task) goes
+ * on where it left off. Returns once the fiber finishes or waits.
+ */
+void _ptl_tm_run_fiber(ptl_thread_manager_t manager, ptl_task_t task){
+	if(task->function_to_execute == _ptl_tm_fiber_resume_task){
+		ptl_fiber_t fiber = (ptl_fiber_t)task->arg;
+		destroy_task(task);
+		ptl_fiber_run(fiber);
+		return;
+	}
+	
+	PTL_ATOMIC_INC(manager->fibers_live);
+	
+	ptl_fiber_t fiber = ptl_fiber_create(manager->fiber_pool, _ptl_tm_fiber_main, task);
+	if(fiber == NULL){
+		_ptl_tm_run_tasks(manager, task); // no stack to be had, it blocks the worker
+		return;
+	}
+	
+	ptl_fiber_run(fiber);
+}
+
+
+/* a fiber's entry, its pool belongs to the manager */
+void _ptl_tm_fiber_main(ptl_fiber_t fiber, void *task){
+	_ptl_tm_run_tasks((ptl_thread_manager_t)fiber->pool->context, (ptl_task_t)task);
+}
+
+
+/* run 'task' and the successors it makes ready, then count the fiber off.
+   The worker isn't passed on: the fiber may end on another one */
+void _ptl_tm_run_tasks(ptl_thread_manager_t manager, ptl_task_t task){
+	while(task != NULL){
+		task = run_task(manager, NULL, task);
+	}
+	
+	if(PTL_ATOMIC_DEC(manager->fibers_live) == 0 && 
+	   PTL_ATOMIC_LOAD(manager->run_state) != PTL_RUNNING){
+		interrupt_idle_threads(manager); // they stayed for the fibers
+	}
+}
+
+
+/* the task 'fiber_q' holds for a woken fiber. Running it anywhere resumes it */
+void *_ptl_tm_fiber_resume_task(void *fiber){
+	ptl_fiber_run((ptl_fiber_t)fiber);
+	
+	return NULL;
+}
+
+
+/* the pool's 'resume': queue the fiber for a worker, whatever the run state */
+void _ptl_tm_fiber_wake(ptl_fiber_t fiber, void *manager){
+	ptl_thread_manager_t m = (ptl_thread_manager_t)manager;
+	
+	ptl_q_add(m->fiber_q, create_task_with_arg(_ptl_tm_fiber_resume_task, fiber));
+	_ptl_tm_signal_work(m);
+}
+
+
+/* fibers started and not finished, which keep the workers */
+int _ptl_tm_fibers_live(ptl_thread_manager_t manager){
+	return manager->fiber_pool != NULL && PTL_ATOMIC_LOAD(manager->fibers_live) > 0;
+}
+
+
+/* 'ready' while fibers are live: a woken fiber, 'tasks' it may still take,
+   or the last fiber finished */
+int _ptl_tm_fibers_ready(ptl_thread_manager_t manager, int tasks){
+	return ptl_q_size(manager->fiber_q) > 0 || 
+		(tasks && PTL_ATOMIC_LOAD(manager->run_state) < PTL_STOP) ||
+		!_ptl_tm_fibers_live(manager);
+}
+
+
+/* this thread's worker slot, read afresh each call; a fiber's thread changes
+   across a wait, so the address mustn't be kept */
+struct ptl_worker *_ptl_tm_self(){
+	return ptl_tm_current_worker;
+}
+
+
+/* where the arena of whatever runs on this thread is kept: the fiber's, or
+   the worker slot's. NULL outside of the workers */
+ptl_arena_t *_ptl_tm_arena_slot(){
+	ptl_fiber_t fiber = ptl_fiber_current();
+	if(fiber != NULL){
+		return &fiber->arena;
+	}
+	
+	struct ptl_worker *self = _ptl_tm_self();
+	
+	return (self != NULL) ? (ptl_arena_t *)&self->arena : NULL;
+}
+
+
+/* end of a task: give back what it took from its arena */
+void _ptl_tm_reset_arena(){
+	ptl_arena_t *slot = _ptl_tm_arena_slot();
+	
+	if(slot != NULL && *slot != NULL){
+		ptl_arena_reset(*slot);
+	}
+}
+
+
+/* one more run for 'worker', or if NULL for the worker running this thread */
+void _ptl_tm_count_completed(struct ptl_worker *worker){
+	if(worker == NULL && (worker = _ptl_tm_self()) == NULL){
+		return; // a fiber resumed outside of the workers
+	}
+	
+	// only this thread writes it, readers fold it in under 'main_mutex'
+	__atomic_store_n(&worker->completed_tasks, worker->completed_tasks + 1, __ATOMIC_RELAXED);
+}
@@ -23,6 +23,10 @@
 #include "ptl_queue.h"
 #include "ptl_thread_pool.h"
 #include "ptl_task.h"
+#include "ptl_ws_deque.h"
+#include "ptl_timer_wheel.h"
+#include "ptl_wait.h"
+#include "ptl_stats.h"
 
 /* Constants */
 /**
@@ -39,7 +43,7 @@
  * time, but need not hit each state. The transitions are:
  *
  * RUNNING -> SHUTDOWN
- *    On invocation of shutdown(), perhaps implicitly in finalize()
+ *    On invocation of ptl_tm_shutdown(), perhaps implicitly in finalize()
  * (RUNNING or SHUTDOWN) -> STOP
  *    On invocation of shutdownNow()
  * SHUTDOWN -> TERMINATED
@@ -52,21 +56,164 @@
 #define PTL_STOP       2
 #define PTL_TERMINATED 3
 
+/* ms a core thread waits on an empty queue before checking the run state again */
+#define PTL_TM_IDLE_RECHECK_MSEC 1000
+
+/**
+ * Scheduling modes, see struct ptl_tm_options:
+ *
+ *   SHARED_QUEUE:  every worker takes tasks from 'work_q'
+ *   WORK_STEALING: each worker also owns a deque. Tasks submitted by a
+ *                  worker go on its own deque (LIFO), idle workers steal
+ *                  from the others (FIFO). Other threads still submit to
+ *                  'work_q', which is used as the injection queue.
+ */
+#define PTL_TM_SCHED_SHARED_QUEUE  0
+#define PTL_TM_SCHED_WORK_STEALING 1
+
+/* defaults of struct ptl_tm_sizing */
+#define PTL_TM_SIZING_PERIOD_MSEC 100			/**< between two samples */
+#define PTL_TM_SIZING_GROW_WAIT_NSEC 1000000ULL	/**< mean queue wait that counts as behind */
+#define PTL_TM_SIZING_GROW_SAMPLES 2			/**< samples behind in a row before growing */
+#define PTL_TM_SIZING_SHRINK_SAMPLES 50			/**< samples idle in a row before shrinking */
+
 
 /* Structures */
 
+struct ptl_thread_manager;
+
+/**
+ * What the sizing controller is shown once per period, see struct
+ * ptl_tm_sizing. Rates and times cover the period since the previous sample;
+ * times are in ns and only count tasks that started (or ended) in it.
+ */
+struct ptl_tm_sizing_sample {
+	long period_msec;				/**< since the previous sample */
+	long queue_depth;				/**< tasks waiting in 'work_q' */
+	int pool_size;					/**< live threads */
+	int idle_threads;				/**< of those, waiting for work */
+	int core_pool_size;
+	int max_pool_size;
+	int target_pool_size;			/**< what the controller answered last time */
+	double arrival_rate;			/**< tasks submitted per second */
+	double completion_rate;			/**< runs completed per second */
+	unsigned long long mean_wait;	/**< from submit to start */
+	unsigned long long p99_wait;
+	unsigned long long mean_run;	/**< spent in 'function_to_execute' */
+};
+
+/**
+ * Moves the pool between core and max as the load changes. Every
+ * 'period_msec' the manager's timer thread takes a sample and asks
+ * 'controller' how many threads to keep. The answer, clamped to
+ * [core_pool_size, max_pool_size], is the target: threads are started up to
+ * it, and idle threads only retire (after 'keep_alive_time') while the pool
+ * is above it. Submitting starts threads up to the target, not past it,
+ * when the queue holds more than the idle threads can take; only a full
+ * queue, or an empty pool, starts threads above it.
+ */
+struct ptl_tm_sizing {
+	int (*controller)(struct ptl_tm_sizing *sizing, const struct ptl_tm_sizing_sample *sample);
+											/**< returns the threads to keep, NULL for
+												 no controller (the default) */
+	long period_msec;						/**< ms between samples */
+	void *context;							/**< the controller's */
+	unsigned long long grow_wait;			/**< ptl_tm_queue_sizing: mean wait (ns)
+												 that counts as falling behind */
+	int grow_samples;						/**< ptl_tm_queue_sizing: samples behind in a
+												 row before it grows */
+	int shrink_samples;						/**< ptl_tm_queue_sizing: samples with idle
+												 threads in a row before it shrinks */
+	int streak;								/**< ptl_tm_queue_sizing's own: samples
+												 behind (> 0) or idle (< 0) in a row */
+};
+
+/**
+ * Choices made when the manager is created. Start from ptl_tm_options_init()
+ * so new fields get their defaults.
+ */
+struct ptl_tm_options {
+	int scheduling;					/**< PTL_TM_SCHED_*, SHARED_QUEUE by default */
+	long deque_capacity;			/**< starting size of each worker's deque */
+	struct ptl_tp_affinity affinity;/**< where workers run, not pinned by default */
+	int (*rejection_policy)(struct ptl_thread_manager *, struct ptl_task *);
+									/**< handles tasks nobody can take, 
+										 ptl_abort_policy by default */
+	struct ptl_wait_strategy wait_strategy;	/**< how idle workers wait, 
+												 PTL_WAIT_BALANCED by default */
+	int collect_stats;				/**< 1 to count and time tasks, see 
+										 ptl_tm_get_stats. 0 by default */
+	struct ptl_tm_sizing sizing;	/**< sizing controller, none by default. One
+										 turns 'collect_stats' on, it reads them */
+	int max_pool_limit;				/**< slots to make room for, so max_pool_size
+										 can be raised up to it later. 
+										 max_pool_size by default */
+	int fibers;						/**< 1 to run each task on a fiber, so a task
+										 waiting in ptl_future_get or ptl_q_get_wait
+										 lets its worker run others. 0 by default */
+	size_t fiber_stack_size;		/**< bytes per fiber stack,
+										 PTL_FIBER_DEFAULT_STACK_SIZE by default */
+};
+
+/**
+ * What a manager counted since it was created with 'collect_stats', see
+ * ptl_tm_get_stats. Times are in ns; a periodic task counts once per run.
+ */
+struct ptl_tm_stats {
+	unsigned long long submitted;		/**< tasks handed in, or due from the timer wheel */
+	unsigned long long completed;		/**< runs finished by a worker or the caller */
+	unsigned long long rejected;		/**< tasks handed to the rejection policy */
+	struct ptl_q_stats queue;			/**< those of 'work_q' */
+	struct ptl_histogram queue_wait;	/**< from submit (or due time) to start */
+	struct ptl_histogram run_time;		/**< spent in 'function_to_execute' */
+};
+
+/**
+ * Outcomes counted by the rejection policies and submit_task_wait, see
+ * ptl_tm_get_rejection_counts.
+ */
+struct ptl_tm_rejection_counts {
+	long rejected;					/**< finished as rejected by ptl_abort_policy */
+	long caller_ran;				/**< run by the submitting thread */
+	long discarded;					/**< dropped by ptl_q_discard_policy */
+	long discarded_oldest;			/**< queued tasks dropped to make room */
+	long blocked;					/**< submit_task_wait calls that had to wait */
+	long timed_out;					/**< of those, the ones still not queued at the deadline */
+};
+
 struct ptl_thread_manager {
 	ptl_q_t work_q;						/**< queue/list that is being used */
-	void (*rejected_handler)(void *);	/**< rejected handler function */
+	void (*rejected_handler)(void *);	/**< called by ptl_abort_policy with each task
+											 it rejects, before the task is destroyed */
 	int run_state;						/**< current running state of this manager */
 	pthread_mutex_t main_mutex; 		/**< Lock held on updates to pool_size, 
 	 							     		 core_pool_size,max_pool_size, run_state, 
 	 								 		 and workers set. */
-	int num_completed_tasks;			/**< number of completed tasks. */
+	long num_completed_tasks;			/**< tasks completed by threads that retired,
+											 see ptl_tm_get_completed_task_count */
 	pthread_cond_t termination_mutex;	/**< wait condition to support termination */
 	ptl_thread_pool_t thread_pool;
 	void (*before_execute)(void *);	  	/**< executes before function pointer */
 	void (*after_execute)(void *);	  	/**< executes after function pointer */
+	int scheduling;						/**< PTL_TM_SCHED_* */
+	struct ptl_wait_strategy wait_strategy;	/**< spinning before an idle worker parks */
+	struct ptl_eventcount work_event;	/**< idle workers park on it, tasks notify it */
+	long deque_capacity;				/**< starting size of the worker deques */
+	ptl_tw_t timer_wheel;				/**< holds scheduled tasks, made by the first
+											 schedule call */
+	int (*rejection_policy)(struct ptl_thread_manager *, struct ptl_task *);
+	struct ptl_tm_rejection_counts rejections;	/**< updated atomically */
+	void *stats;						/**< PTL_STATS_STRIPES stripes of counters, 
+											 NULL unless 'collect_stats' */
+	int owns_thread_pool;				/**< made by a create function, so it goes
+											 with destroy_thread_manager */
+	struct ptl_tm_sizing sizing;		/**< the controller and its settings */
+	void *sizing_state;					/**< the last sample and the target, NULL
+											 without a controller */
+	ptl_fiber_pool_t fiber_pool;		/**< stacks of the tasks' fibers, NULL
+											 without 'fibers' */
+	ptl_q_t fiber_q;					/**< fibers that were woken up, as tasks */
+	int fibers_live;					/**< started and not finished (atomic) */
 };
 
 
@@ -85,7 +232,12 @@ typedef struct ptl_thread_manager *ptl_thread_manager_t;
  * After this function is executed, the manager is ready to accept tasks.
  * The before and after functions are execute...before and after the 
  * task is executed.
+ * 'core_pool_size' threads are started now. When 'work_q' holds more tasks
+ * than there are idle threads, or is full, more are started up to
+ * 'max_pool_size'. A thread above core that is idle for 'keep_alive_time'
+ * milliseconds retires.
  * 
+ * @return a running manager, or NULL if the sizes or 'work_q' are invalid
  */
 ptl_thread_manager_t create_thread_manager_with_functions(int core_pool_size, 
 						   int max_pool_size, 
@@ -94,6 +246,34 @@ ptl_thread_manager_t create_thread_manager_with_functions(int core_pool_size,
 						   void (*rejected_handler)(void *),
 						   void (*before_execute)(void *),
 						   void (*after_execute)(void *));
+/**
+ * Same as create_thread_manager_with_functions, with the scheduling mode and
+ * other choices taken from 'options'.
+ * With 'fibers', a task that waits on a future or a queue is suspended and
+ * its worker goes on with the next task; once woken, it is run ahead of new
+ * tasks. The workers stay until every fiber has finished, even after
+ * shutdown_now. Waits on anything else (locks, sleeps, submit_task_wait)
+ * still block the worker.
+ *
+ * @param options NULL for the defaults, see ptl_tm_options_init
+ * @return a running manager, or NULL if the sizes or 'work_q' are invalid
+ */
+ptl_thread_manager_t create_thread_manager_with_options(int core_pool_size, 
+						   int max_pool_size, 
+						   long keep_alive_time,
+						   ptl_q_t work_q,
+						   void (*rejected_handler)(void *),
+						   void (*before_execute)(void *),
+						   void (*after_execute)(void *),
+						   const struct ptl_tm_options *options);
+
+/**
+ * Sets every option to its default.
+ *
+ * @param options options to fill in
+ */
+void ptl_tm_options_init(struct ptl_tm_options *options);
+
 /**
  * Create and initilize the thread pool manager.
  * This will create the pool of threads and put it in the RUNNING state.
@@ -117,39 +297,157 @@ ptl_thread_manager_t
 
 /**
  * Submits the function pointer to the queue that is being watched by 
- * the pool of threads.
+ * the pool of threads. The function is called with NULL.
  *
  * @return 1 if successful, 0 otherwise
  */
-int submit(ptl_thread_manager_t manager, void (*function_to_execute)(void *));
+int submit(ptl_thread_manager_t manager, void *(*function_to_execute)(void *));
+
+/**
+ * Submits 'function_to_execute(arg)' and returns the future of its result.
+ * If the task is rejected the future is already finished, without a result.
+ * The future must be released with ptl_future_destroy().
+ *
+ * @return the task's future, NULL if 'manager' or the function is NULL
+ */
+ptl_future_t submit_with_arg(ptl_thread_manager_t manager, 
+							 void *(*function_to_execute)(void *), void *arg);
+
+/**
+ * Same as submit_with_arg, with the task's 'priority' set. It only changes
+ * the order when 'work_q' is a priority queue (ptl_pq_task_funcs); tasks
+ * pushed on a worker's own deque in work-stealing mode stay LIFO.
+ *
+ * @param priority higher runs first, equal priorities run in submit order
+ * @return the task's future, NULL if 'manager' or the function is NULL
+ */
+ptl_future_t submit_with_priority(ptl_thread_manager_t manager, 
+								  void *(*function_to_execute)(void *), void *arg,
+								  int priority);
 
 /**
  * Submits the task (ptl_task_t) to the queue that is being watched by the
  * pool of threads. This is a different flavor of submit(manager, void*).
+ * In work-stealing mode a task submitted from one of the manager's own
+ * workers goes on that worker's deque instead.
+ * A task still waiting on predecessors (see ptl_task_then) is held and
+ * counts as submitted. The worker that finishes its last predecessor
+ * submits it, or runs it next itself.
  *
  * @return 1 if successful, 0 otherwise
  */
 int submit_task(ptl_thread_manager_t manager, ptl_task_t task);
 
+/**
+ * Same as submit_task, but when 'work_q' is full and the pool can't grow it
+ * waits up to 'timeout' ms for room before giving the task to the rejection
+ * policy. This pushes back on producers that outrun the workers.
+ *
+ * @param timeout ms to wait for room in 'work_q'
+ * @return 1 if successful, otherwise what the rejection policy returned
+ */
+int submit_task_wait(ptl_thread_manager_t manager, ptl_task_t task, long timeout);
+
+/**
+ * Submits 'count' tasks, putting them in 'work_q' with one ptl_q_add_batch
+ * call per PTL_Q_DRAIN_BATCH_SIZE of them, so the queue's lock is taken
+ * once per batch instead of once per task. Tasks that don't fit go through
+ * submit_task one by one (the pool may grow, or the rejection policy decides).
+ * Held tasks are handled as by submit_task. Unlike submit_task, tasks
+ * submitted from a worker always go to 'work_q', not to its deque.
+ *
+ * @param tasks tasks to submit, the array itself stays the caller's
+ * @param count how many there are
+ * @return the number of tasks taken
+ */
+int submit_batch(ptl_thread_manager_t manager, ptl_task_t *tasks, int count);
+
+/**
+ * Submits 'task' once 'delay_ms' milliseconds have passed. Until then it
+ * waits in the manager's timer wheel, whose thread is started by the first
+ * call; it moves the tasks that are due to 'work_q' in batches. The task may
+ * still be cancelled through its future while it waits.
+ *
+ * @param delay_ms ms from now, 0 or less submits it straight away
+ * @return 1 if scheduled, 0 if rejected
+ */
+int schedule(ptl_thread_manager_t manager, ptl_task_t task, long delay_ms);
+
+/**
+ * Runs 'function_to_execute(arg)' after 'initial_delay' ms, then every
+ * 'period' ms measured from when the first run was due. A run that is late
+ * doesn't overlap the next one, the next one starts late instead. The series
+ * ends when the future is cancelled or the manager stops running; the
+ * future then finishes as cancelled.
+ *
+ * @param initial_delay ms before the first run
+ * @param period ms between the starts of two runs, more than 0
+ * @return the series' future, NULL if an argument is invalid
+ */
+ptl_future_t schedule_at_fixed_rate(ptl_thread_manager_t manager,
+									void *(*function_to_execute)(void *), void *arg,
+									long initial_delay, long period);
+
+/**
+ * Same as schedule_at_fixed_rate, but 'delay' ms are counted from the end of
+ * one run to the start of the next.
+ *
+ * @param initial_delay ms before the first run
+ * @param delay ms between the end of a run and the next, more than 0
+ * @return the series' future, NULL if an argument is invalid
+ */
+ptl_future_t schedule_with_fixed_delay(ptl_thread_manager_t manager,
+									   void *(*function_to_execute)(void *), void *arg,
+									   long initial_delay, long delay);
+
 /**
  * Initiates an orderly shutdown in which previously submitted
  * tasks are executed, but no new tasks will be
  * accepted. Invocation has no additional effect if already shut
- * down. Shutsdown the entire thread pool, manager, and signal handler.
+ * down. Tasks still waiting in the timer wheel are cancelled, and periodic
+ * tasks are not scheduled again. Returns once every worker has ended (it
+ * sleeps on 'termination_mutex'), except when called from one of the
+ * manager's own workers, which can't wait for itself.
+ * Named so as not to clash with shutdown(2) from <sys/socket.h>.
  * 
  */
-void shutdown(ptl_thread_manager_t manager);
+void ptl_tm_shutdown(ptl_thread_manager_t manager);
 
 /**
  * Attempts to stop all actively executing tasks, halts the
  * processing of waiting tasks, and returns a list of the tasks
  * that were awaiting execution. These tasks are drained (removed)
- * from the task queue upon return from this method.
+ * from 'work_q' and the worker deques in batches, upon return from this
+ * method. Tasks still waiting in the timer wheel are cancelled as by
+ * ptl_tm_shutdown, their futures end CANCELLED. Running tasks are not interrupted, they finish
+ * their current run (is_terminating() tells them to hurry). Use
+ * ptl_tm_await_termination to wait for them.
  *
- * @return a list of tasks that never commenced execution
+ * @return a linked queue of the tasks that never commenced execution, still
+ *         CREATED. The caller owns them (destroy_task) and the queue
+ *         (ptl_q_destroy_queue)
  */
 ptl_q_t shutdown_now(ptl_thread_manager_t manager);
 
+/**
+ * Waits until every worker has ended after ptl_tm_shutdown or shutdown_now.
+ *
+ * @param timeout ms to wait, 0 to only look, PTL_FUTURE_WAIT_FOREVER to wait
+ * @return 1 if terminated, 0 if it timed out
+ */
+int ptl_tm_await_termination(ptl_thread_manager_t manager, long timeout);
+
+/**
+ * Shuts the manager down (see ptl_tm_shutdown), waits for it to terminate, then
+ * frees it and the thread pool it made. Tasks that were submitted too late
+ * to run are rejected. 'work_q' belongs to the caller and is left as is.
+ * Can't be called from one of the manager's own workers.
+ *
+ * @param manager to destroy
+ * @return 1 if successful, 0 otherwise
+ */
+int destroy_thread_manager(ptl_thread_manager_t manager);
+
 /**
  * Returns 1 if the thread manager is terminated.
  *
@@ -166,38 +464,175 @@ int is_terminating(ptl_thread_manager_t manager);
 
 /**
  * Tries to remove from the work queue all tasks that have been cancelled.
+ * Cancelling (ptl_future_cancel) only flips the task's state, and a worker
+ * that dequeues a cancelled task drops it, so this is never needed for
+ * correctness. It gives back the room cancelled tasks take in 'work_q', in
+ * one batched pass over it. Tasks submitted while it runs may go ahead of
+ * the ones that were queued.
+ *
+ * @return the number of cancelled tasks removed
  */
-void purge_cancelled(ptl_thread_manager_t manager);
+long purge_cancelled(ptl_thread_manager_t manager);
+
+/**
+ * Scratch memory for the task that calls it, from the arena of the worker
+ * running it (of its fiber, in fiber mode, since a fiber may move to another
+ * worker). The worker resets it after each task, right after after_execute,
+ * so what is allocated from it must not outlive the task: not in its result,
+ * not in memory it hands to other tasks. ptl_al_create_array_list_arena
+ * builds a list in it.
+ *
+ * @return this worker's arena, or NULL if not called from a pool worker
+ */
+ptl_arena_t ptl_worker_arena();
+
+/**
+ * Returns the number of threads currently in the pool.
+ *
+ * @return number of live worker threads
+ */
+int ptl_tm_get_pool_size(ptl_thread_manager_t manager);
+
+/**
+ * Returns the number of tasks run to completion. Workers count their own
+ * tasks, the counts are only added up here.
+ *
+ * @return number of completed tasks
+ */
+long ptl_tm_get_completed_task_count(ptl_thread_manager_t manager);
+
+/**
+ * Changes the core size while the manager runs. Raising it starts the new
+ * core threads now; lowering it lets the threads above it retire once they
+ * have been idle for 'keep_alive_time'.
+ *
+ * @param core_pool_size from 0 up to the max size
+ * @return 1 if changed, 0 if out of range
+ */
+int ptl_tm_set_core_pool_size(ptl_thread_manager_t manager, int core_pool_size);
+
+/**
+ * Changes the max size while the manager runs. Threads above a lowered max
+ * end when they next look for a task. The pool can't grow past the slots it
+ * was made with ('max_pool_limit' option).
+ *
+ * @param max_pool_size from the core size (and at least 1) up to the slots
+ * @return 1 if changed, 0 if out of range
+ */
+int ptl_tm_set_max_pool_size(ptl_thread_manager_t manager, int max_pool_size);
+
+/**
+ * Threads the sizing controller currently keeps, see struct ptl_tm_sizing.
+ *
+ * @return the target, the core size when there is no controller
+ */
+int ptl_tm_get_target_pool_size(ptl_thread_manager_t manager);
+
+/**
+ * Replaces the rejection policy. Tasks already being rejected may still see
+ * the old one.
+ *
+ * @param policy one of the policies below or the caller's own, NULL restores
+ * 		  ptl_abort_policy
+ */
+void ptl_tm_set_rejection_policy(ptl_thread_manager_t manager,
+								 int (*policy)(ptl_thread_manager_t, ptl_task_t));
+
+/**
+ * Copies the rejection counters.
+ *
+ * @param counts filled in with the counts so far
+ */
+void ptl_tm_get_rejection_counts(ptl_thread_manager_t manager,
+								 struct ptl_tm_rejection_counts *counts);
+
+/**
+ * Adds up the per-thread counters and histograms, and those of 'work_q'.
+ * While tasks keep running the numbers are each current but may not add up
+ * to each other. The struct is large (two histograms), don't put it on a
+ * small stack.
+ *
+ * @param stats filled in, zeroed if the manager doesn't collect stats
+ * @return 1 if it collects stats ('collect_stats' option), 0 otherwise
+ */
+int ptl_tm_get_stats(ptl_thread_manager_t manager, struct ptl_tm_stats *stats);
 
 
 
  /* Policies */
+/*
+ * A policy is called with a task the manager can't take, either because it
+ * isn't running or because 'work_q' is full and the pool is at max. The
+ * policy owns the task and must run, queue or finish it. It returns what
+ * submit_task returns; 1 if the task was taken after all, 0 otherwise.
+ * A policy of your own can end with ptl_abort_policy to reject.
+ */
+
 /** 
- * This policy will return NULL when the task is rejected.
- * This is the default policy.
+ * Finishes the task as rejected and calls the manager's 'rejected_handler'
+ * with it. This is the default policy.
  *
- * @return returns NULL if the task is rejected.
+ * @return 0
  */
-void *ptl_abort_policy();
+int ptl_abort_policy(ptl_thread_manager_t manager, ptl_task_t task);
 
 /** 
  * The thread that submitted the task, will run the task.
  * This provides a simple feedback control mechanism that will slow down 
- * the rate that new tasks are submitted.
+ * the rate that new tasks are submitted. Scheduled tasks that come due when
+ * the queue is full run on the timer thread. If the manager isn't running
+ * the task is discarded.
+ *
+ * @return 1 if it ran, 0 if discarded
  */
-void *ptl_q_caller_runs_policy();
+int ptl_q_caller_runs_policy(ptl_thread_manager_t manager, ptl_task_t task);
 
 /** 
- * A task that cannot be executed is simply dropped.
+ * A task that cannot be executed is simply dropped; it finishes as
+ * rejected without calling the 'rejected_handler'.
+ *
+ * @return 0
  */
-void *ptl_q_discard_policy();
+int ptl_q_discard_policy(ptl_thread_manager_t manager, ptl_task_t task);
 
 /** 
  * If the executor is not shut down, the task at the head of the work queue 
  * is dropped, and then execution is retried (which can fail again, causing 
- * this to be repeated.) 
+ * this to be repeated.) Queues with ptl_q_add_evict support (array and
+ * priority) drop the head and add the task under one lock, so exactly one
+ * task is dropped.
+ *
+ * @return 1 if the task was queued, 0 if it was discarded
+ */
+int ptl_q_discard_oldest_policy(ptl_thread_manager_t manager, ptl_task_t task);
+
+
+ /* Sizing Controllers */
+/*
+ * A controller gets the manager's 'sizing' settings and the latest sample,
+ * and returns the number of threads to keep. It runs on the timer thread,
+ * so it must be quick and must not block. It may keep its own state in
+ * 'sizing->context' or 'sizing->streak'.
+ */
+
+/**
+ * Grows when tasks wait on busy threads, shrinks when threads sit idle, with
+ * hysteresis so a short spike or lull doesn't move the pool:
+ *
+ *   behind: tasks are queued, no thread is idle, and either the mean wait is
+ *           over 'grow_wait' or they arrive faster than they complete. After
+ *           'grow_samples' in a row the target grows to what Little's law
+ *           says the arrival rate needs (arrival_rate * mean_run), at least
+ *           by one thread and at most doubling.
+ *   idle:   nothing is queued and threads are idle. After 'shrink_samples'
+ *           in a row the target drops by half the idle threads, at least one.
+ *
+ * Any other sample breaks the streak. Settings of 0 take the
+ * PTL_TM_SIZING_* defaults.
+ *
+ * @return the new target
  */
-void *ptl_q_discard_oldest_policy();
+int ptl_tm_queue_sizing(struct ptl_tm_sizing *sizing, const struct ptl_tm_sizing_sample *sample);
 
 
 #endif
@@ -14,34 +14,309 @@
  * Foundation, Inc., 51 Franklin Street, Fifth Floor Boston, MA 02110-1301,  USA
  */
  
+#define _GNU_SOURCE // cpu sets, sched_getcpu
 #include <pthread.h>
+#include <sched.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <time.h>
 #include <sys/time.h>
 #include <assert.h>
 
 #include "ptl_thread_pool.h"
+#include "ptl_ws_deque.h"
+#include "ptl_arena.h"
+#include "ptl_util.h"
+
+
+/* Constants */
+#define PTL_TP_MAX_NODES 64
+#define PTL_TP_NODE_PATH "/sys/devices/system/node/node%d/cpulist"
+
+
+/* Private Functions */
+void _ptl_tp_read_topology();
+int _ptl_tp_parse_cpulist(const char *list, int node);
+int _ptl_tp_assign_cpus(ptl_thread_pool_t thread_pool, const struct ptl_tp_affinity *affinity);
+
+
+/* Global Variables */
+static int ptl_tp_cpu_node[CPU_SETSIZE];	// node of each cpu, -1 if not usable
+static int ptl_tp_nodes = 1;				// highest node with cpus + 1
+static pthread_once_t ptl_tp_topology_once = PTHREAD_ONCE_INIT;
 
 
 /* creates the thread pool */
 ptl_thread_pool_t ptl_create_thread_pool(int core_pool_size,
 										 int max_pool_size,
 										 long keep_alive_time){
+	return ptl_create_thread_pool_with_affinity(core_pool_size, max_pool_size,
+												keep_alive_time, NULL);
+}
+
+
+/* creates the thread pool, pinning slots as 'affinity' says */
+ptl_thread_pool_t ptl_create_thread_pool_with_affinity(int core_pool_size,
+													   int max_pool_size,
+													   long keep_alive_time,
+													   const struct ptl_tp_affinity *affinity){
+	return ptl_create_thread_pool_with_slots(core_pool_size, max_pool_size, keep_alive_time,
+											 max_pool_size, affinity);
+}
 
-	ptl_thread_pool_t thread_pool = (ptl_thread_pool_t)malloc(sizeof(struct ptl_thread_pool));
+
+/* creates the thread pool with 'slot_count' slots, max can grow up to them */
+ptl_thread_pool_t ptl_create_thread_pool_with_slots(int core_pool_size,
+													int max_pool_size,
+													long keep_alive_time,
+													int slot_count,
+													const struct ptl_tp_affinity *affinity){
+	if(core_pool_size < 0 || max_pool_size <= 0 || max_pool_size < core_pool_size ||
+	   keep_alive_time < 0 || slot_count < max_pool_size){
+		return NULL;
+	}
+
+	ptl_thread_pool_t thread_pool = (ptl_thread_pool_t)calloc(1, sizeof(struct ptl_thread_pool));
 	assert(thread_pool);
 											 
 	thread_pool->core_pool_size = core_pool_size;
 	thread_pool->max_pool_size = max_pool_size;
+	thread_pool->slot_count = slot_count;
 	thread_pool->keep_alive_time = keep_alive_time;
 											 
 	thread_pool->current_pool_size = 0;
-	thread_pool->threads = NULL;
+	thread_pool->largest_pool_size = 0;
+	thread_pool->idle_threads = 0;
 	thread_pool->completed_tasks = 0;
 											 
-	/* create memory enough for max_pool_threads */
-	thread_pool->threads = (pthread_t *)malloc(sizeof(pthread_t) * max_pool_size);
+	/* create memory enough for slot_count threads */
+	thread_pool->workers = (struct ptl_worker *)calloc(slot_count, sizeof(struct ptl_worker));
+	assert(thread_pool->workers);
+	
+	int i = 0;
+	for(i = 0; i < slot_count; i++){
+		thread_pool->workers[i].index = i;
+	}
+	
+	thread_pool->worker_cpus = NULL;
+	if(affinity != NULL && affinity->policy != PTL_TP_PIN_NONE && 
+	   !_ptl_tp_assign_cpus(thread_pool, affinity)){
+		ptl_destroy_thread_pool(thread_pool);
+		return NULL;
+	}
+	
+	return thread_pool;
+}
+
+
+/* frees the slots and the pool, the threads must be gone */
+void ptl_destroy_thread_pool(ptl_thread_pool_t thread_pool){
+	if(thread_pool == NULL){ return; }
+	
+	int i = 0;
+	for(i = 0; i < thread_pool->slot_count; i++){
+		ptl_wsd_destroy((ptl_wsd_t)thread_pool->workers[i].deque);
+		ptl_arena_destroy((ptl_arena_t)thread_pool->workers[i].arena);
+	}
+	
+	FREE(thread_pool->workers);
+	FREE(thread_pool->worker_cpus);
+	FREE(thread_pool);
+}
+
+
+/* first slot without a thread */
+struct ptl_worker *ptl_tp_free_worker(ptl_thread_pool_t thread_pool){
+	int i = 0;
+	for(i = 0; i < thread_pool->slot_count; i++){
+		if(!thread_pool->workers[i].alive){
+			return &thread_pool->workers[i];
+		}
+	}
+	
+	return NULL;
+}
+
+
+/* pin through the attributes so the thread never runs elsewhere */
+int ptl_tp_set_worker_affinity(ptl_thread_pool_t thread_pool, struct ptl_worker *worker,
+							   pthread_attr_t *attr){
+	if(thread_pool->worker_cpus == NULL || thread_pool->worker_cpus[worker->index] < 0){
+		return 0;
+	}
+	
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	CPU_SET(thread_pool->worker_cpus[worker->index], &set);
+	
+	return pthread_attr_setaffinity_np(attr, sizeof(cpu_set_t), &set) == 0;
+}
+
+
+/* nodes found in sysfs */
+int ptl_tp_num_nodes(){
+	pthread_once(&ptl_tp_topology_once, _ptl_tp_read_topology);
+	
+	return ptl_tp_nodes;
+}
+
+
+/* node of the current cpu */
+int ptl_tp_current_node(){
+	pthread_once(&ptl_tp_topology_once, _ptl_tp_read_topology);
+	
+	int cpu = sched_getcpu();
+	if(cpu < 0 || cpu >= CPU_SETSIZE || ptl_tp_cpu_node[cpu] < 0){
+		return 0;
+	}
+	
+	return ptl_tp_cpu_node[cpu];
+}
+
+
+/* Private Functions */
+
+/* map each cpu this process may use to its node, everything on node 0 without sysfs */
+void _ptl_tp_read_topology(){
+	cpu_set_t allowed;
+	CPU_ZERO(&allowed);
+	if(sched_getaffinity(0, sizeof(cpu_set_t), &allowed) != 0){
+		CPU_SET(0, &allowed);
+	}
+	
+	int cpu = 0;
+	for(cpu = 0; cpu < CPU_SETSIZE; cpu++){
+		ptl_tp_cpu_node[cpu] = CPU_ISSET(cpu, &allowed) ? 0 : -1;
+	}
+	
+	int node = 0;
+	int nodes = 0;
+	for(node = 0; node < PTL_TP_MAX_NODES; node++){
+		char path[64];
+		char list[1024];
+		snprintf(path, sizeof(path), PTL_TP_NODE_PATH, node);
+		
+		FILE *file = fopen(path, "r");
+		if(file == NULL){ continue; } // node ids may have gaps
+		
+		if(fgets(list, sizeof(list), file) != NULL && _ptl_tp_parse_cpulist(list, node)){
+			nodes = node + 1;
+		}
+		fclose(file);
+	}
+	
+	// drop cpus sysfs listed that we may not use
+	for(cpu = 0; cpu < CPU_SETSIZE; cpu++){
+		if(!CPU_ISSET(cpu, &allowed)){
+			ptl_tp_cpu_node[cpu] = -1;
+		}
+	}
+	
+	ptl_tp_nodes = (nodes > 0) ? nodes : 1;
+}
+
+
+/* a sysfs cpulist like "0-3,8-11". returns 1 if it named any cpu */
+int _ptl_tp_parse_cpulist(const char *list, int node){
+	const char *p = list;
+	int found = 0;
+	
+	while(*p != '\0' && *p != '\n'){
+		char *end = NULL;
+		long first = strtol(p, &end, 10);
+		if(end == p){ break; }
+		long last = first;
+		p = end;
+		
+		if(*p == '-'){
+			last = strtol(p + 1, &end, 10);
+			p = end;
+		}
+		
+		long cpu = 0;
+		for(cpu = first; cpu <= last && cpu < CPU_SETSIZE; cpu++){
+			if(cpu >= 0 && ptl_tp_cpu_node[cpu] >= 0){
+				ptl_tp_cpu_node[cpu] = node;
+				found = 1;
+			}
+		}
+		
+		if(*p == ','){ p++; }
+	}
+	
+	return found;
+}
+
+
+/* give every slot a cpu. returns 0 if 'affinity' leaves no cpu to use */
+int _ptl_tp_assign_cpus(ptl_thread_pool_t thread_pool, const struct ptl_tp_affinity *affinity){
+	pthread_once(&ptl_tp_topology_once, _ptl_tp_read_topology);
+	
+	int n = thread_pool->slot_count;
+	thread_pool->worker_cpus = (int *)malloc(sizeof(int) * n);
+	assert(thread_pool->worker_cpus);
+	
+	int i = 0;
+	if(affinity->policy == PTL_TP_PIN_LIST){
+		if(affinity->cpus == NULL || affinity->num_cpus <= 0){ return 0; }
+		
+		for(i = 0; i < affinity->num_cpus; i++){ // each one must be usable
+			int cpu = affinity->cpus[i];
+			if(cpu < 0 || cpu >= CPU_SETSIZE || ptl_tp_cpu_node[cpu] < 0){ return 0; }
+		}
+		
+		for(i = 0; i < n; i++){
+			thread_pool->worker_cpus[i] = affinity->cpus[i % affinity->num_cpus];
+		}
+		return 1;
+	}
+	
+	// usable cpus, grouped by node and in order within each node
+	int *cpus = (int *)malloc(sizeof(int) * CPU_SETSIZE);
+	int *node_start = (int *)calloc(ptl_tp_nodes + 1, sizeof(int));
+	assert(cpus && node_start);
+	int count = 0;
+	int node = 0;
+	for(node = 0; node < ptl_tp_nodes; node++){
+		node_start[node] = count;
+		if(affinity->numa_node != PTL_TP_ANY_NODE && affinity->numa_node != node){
+			continue;
+		}
+		
+		int cpu = 0;
+		for(cpu = 0; cpu < CPU_SETSIZE; cpu++){
+			if(ptl_tp_cpu_node[cpu] == node){
+				cpus[count++] = cpu;
+			}
+		}
+	}
+	node_start[ptl_tp_nodes] = count;
+	
+	// nodes that have any of those cpus
+	int *used_nodes = (int *)malloc(sizeof(int) * (ptl_tp_nodes + 1));
+	assert(used_nodes);
+	int num_used = 0;
+	for(node = 0; node < ptl_tp_nodes; node++){
+		if(node_start[node + 1] > node_start[node]){
+			used_nodes[num_used++] = node;
+		}
+	}
+	
+	for(i = 0; i < n && count > 0; i++){
+		if(affinity->policy == PTL_TP_PIN_SCATTER){
+			// round-robin over the nodes, then over the cpus of each node
+			node = used_nodes[i % num_used];
+			int size = node_start[node + 1] - node_start[node];
+			thread_pool->worker_cpus[i] = cpus[node_start[node] + (i / num_used) % size];
+		} else { // PTL_TP_PIN_COMPACT
+			thread_pool->worker_cpus[i] = cpus[i % count];
+		}
+	}
+	
+	FREE(used_nodes);
+	FREE(cpus);
+	FREE(node_start);
+	
+	return count > 0;
 }
-											 
-										
@@ -17,14 +17,69 @@
 #ifndef __PTL_THREAD_POOL_H__
 #define __PTL_THREAD_POOL_H__
 
+#include <pthread.h>
+#include "ptl_wait.h"
+
+/* Constants */
+/**
+ * Pinning policies, see struct ptl_tp_affinity:
+ *
+ *   NONE:    threads run wherever the scheduler puts them
+ *   COMPACT: slot i gets the i-th allowed cpu, filling one node first
+ *   SCATTER: slots go round-robin over the nodes, then over their cpus
+ *   LIST:    slot i gets cpus[i % num_cpus]
+ */
+#define PTL_TP_PIN_NONE    0
+#define PTL_TP_PIN_COMPACT 1
+#define PTL_TP_PIN_SCATTER 2
+#define PTL_TP_PIN_LIST    3
+
+#define PTL_TP_ANY_NODE -1	/**< no NUMA node restriction */
+
+
 /* Structures */
+
+/**
+ * Where the pool's threads run. Only the cpus the process may use count,
+ * so a taskset or cgroup limit is respected.
+ */
+struct ptl_tp_affinity {
+	int policy;					/**< PTL_TP_PIN_* */
+	const int *cpus;			/**< cpu ids used by PTL_TP_PIN_LIST */
+	int num_cpus;				/**< length of 'cpus' */
+	int numa_node;				/**< only use cpus of this node, or PTL_TP_ANY_NODE */
+};
+
+/**
+ * One slot of the pool. A slot is reused once its thread has retired.
+ * Only the worker thread writes 'completed_tasks', others may read it.
+ */
+struct ptl_worker {
+	pthread_t thread;			/**< thread running in this slot */
+	int index;					/**< position in the pool's 'workers' */
+	int alive;					/**< 1 while a thread owns this slot */
+	long completed_tasks;		/**< tasks this thread completed */
+	void *first_task;			/**< task to run before polling the queue */
+	void *manager;				/**< manager this worker takes tasks for */
+	void *deque;				/**< work-stealing deque of this slot, made by its
+									 first thread so it sits on that thread's node */
+	struct ptl_spin_state spin;	/**< how long this slot's threads spin when idle */
+	void *arena;				/**< scratch memory of the tasks run here, made by
+									 the first ptl_worker_arena, reset after each task */
+};
+
 struct ptl_thread_pool {
 	int core_pool_size;			/**< core size of the pool this manager is managing*/
 	int max_pool_size;			/**< max size of the pool this manager is managing*/ 
+	int slot_count;				/**< slots in 'workers'; max_pool_size may be raised
+									 up to it while the pool runs */
 	int current_pool_size;		/**< current pool size (between core and max) */
-	long keep_alive_time;		/**< keep alive time of each thread in the pool */
-	pthread_t *threads;			/**< actual threads */
-	long completed_tasks;		/**< number of tasks this thread completed */
+	int largest_pool_size;		/**< largest size the pool has reached */
+	int idle_threads;			/**< workers waiting on the queue (atomic) */
+	long keep_alive_time;		/**< ms an idle thread above core waits before retiring */
+	struct ptl_worker *workers;	/**< 'slot_count' worker slots */
+	long completed_tasks;		/**< tasks completed by threads that retired */
+	int *worker_cpus;			/**< cpu each slot is pinned to, -1 if not pinned */
 };
 
 
@@ -37,10 +92,85 @@ typedef struct ptl_thread_pool *ptl_thread_pool_t;
 /**
  * Creates the thread pool that a manager can manage.
  * When create_thread_manager is called, a thread pool is created.
+ * No threads are started here, the manager starts them in the slots.
+ *
+ * @param core_pool_size threads kept even when idle
+ * @param max_pool_size most threads the pool may grow to
+ * @param keep_alive_time milliseconds an idle thread above core is kept
+ * @return a new pool, or NULL if the sizes are invalid
  */
 ptl_thread_pool_t ptl_create_thread_pool(int core_pool_size,
 										 int max_pool_size,
 										 long keep_alive_time);
 
+/**
+ * Same as ptl_create_thread_pool(), with each slot given a cpu by
+ * 'affinity'. The threads are started on their cpu, so their stacks and
+ * what they allocate first land on the local NUMA node.
+ *
+ * @param affinity NULL to not pin
+ * @return a new pool, or NULL if the sizes are invalid or no cpu is usable
+ */
+ptl_thread_pool_t ptl_create_thread_pool_with_affinity(int core_pool_size,
+													   int max_pool_size,
+													   long keep_alive_time,
+													   const struct ptl_tp_affinity *affinity);
+
+/**
+ * Same as ptl_create_thread_pool_with_affinity(), with room for 'slot_count'
+ * threads. The slots can't move once threads run in them, so this is what
+ * max_pool_size can later be raised to (see ptl_tm_set_max_pool_size).
+ *
+ * @param slot_count at least 'max_pool_size'
+ * @return a new pool, or NULL if the sizes are invalid or no cpu is usable
+ */
+ptl_thread_pool_t ptl_create_thread_pool_with_slots(int core_pool_size,
+													int max_pool_size,
+													long keep_alive_time,
+													int slot_count,
+													const struct ptl_tp_affinity *affinity);
+
+/**
+ * Frees a pool created with ptl_create_thread_pool(). No thread may still
+ * be running in it.
+ *
+ * @param thread_pool pool to be freed
+ */
+void ptl_destroy_thread_pool(ptl_thread_pool_t thread_pool);
+
+/**
+ * Finds a slot no thread owns.
+ *
+ * @param thread_pool non-null pool, the manager's lock must be held
+ * @return a free slot, or NULL if every slot has a thread
+ */
+struct ptl_worker *ptl_tp_free_worker(ptl_thread_pool_t thread_pool);
+
+/**
+ * Sets the cpu of 'worker' on the attributes its thread is created with.
+ *
+ * @param thread_pool non-null pool
+ * @param worker slot about to get a thread
+ * @param attr attributes for pthread_create()
+ * @return 1 if pinned, 0 if the slot isn't pinned
+ */
+int ptl_tp_set_worker_affinity(ptl_thread_pool_t thread_pool, struct ptl_worker *worker,
+							   pthread_attr_t *attr);
+
+/**
+ * Number of NUMA nodes with usable cpus, 1 when there is no NUMA.
+ *
+ * @return number of nodes
+ */
+int ptl_tp_num_nodes();
+
+/**
+ * NUMA node of the cpu the calling thread is running on. With one manager
+ * per node (see 'numa_node'), index them with this to submit locally.
+ *
+ * @return node id, 0 when unknown
+ */
+int ptl_tp_current_node();
+
 
 #endif
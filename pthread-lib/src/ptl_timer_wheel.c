@@ -0,0 +1,517 @@
+/*
+ * This file is part of the pthread-lib Library.
+ * Copyright (C) 2008-2009 Nick Powers.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Library General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor Boston, MA 02110-1301,  USA
+ */
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <limits.h>
+#include "ptl_timer_wheel.h"
+#include "ptl_util.h"
+
+#define PTL_TW_ROOT_MASK (PTL_TW_ROOT_SIZE - 1)
+#define PTL_TW_LEVEL_MASK (PTL_TW_LEVEL_SIZE - 1)
+#define PTL_TW_DUE_LEVEL -1		/**< 'level' of a timer waiting to be handed out */
+
+/* Private Functions */
+void *_ptl_tw_run(void *wheel);
+unsigned long _ptl_tw_tick_at(ptl_tw_t wheel, unsigned long long nsec);
+struct ptl_timer **_ptl_tw_slot(ptl_tw_t wheel, int level, int slot);
+void _ptl_tw_set_bit(ptl_tw_t wheel, int level, int slot, int set);
+void _ptl_tw_insert(ptl_tw_t wheel, ptl_timer_t timer);
+void _ptl_tw_unlink(ptl_tw_t wheel, ptl_timer_t timer);
+void _ptl_tw_append_due(ptl_tw_t wheel, ptl_timer_t timer);
+int _ptl_tw_next_bit(const unsigned long long *bits, int nbits, int from);
+unsigned long _ptl_tw_next_tick(ptl_tw_t wheel);
+void _ptl_tw_process_tick(ptl_tw_t wheel, unsigned long tick);
+void _ptl_tw_deliver(ptl_tw_t wheel);
+int _ptl_tw_take_list(ptl_tw_t wheel, struct ptl_timer **head, ptl_timer_t *timers, int max);
+
+
+/* Public Functions */
+
+/* set up an empty wheel and start its thread */
+ptl_tw_t ptl_tw_create(long tick_msec,
+					   void (*expired)(struct ptl_timer **timers, int count, void *context),
+					   void *context){
+	if(expired == NULL){ return NULL; }
+	
+	ptl_tw_t wheel = (ptl_tw_t)calloc(1, sizeof(struct ptl_timer_wheel));
+	assert(wheel);
+	
+	wheel->tick_msec = (tick_msec > 0) ? tick_msec : PTL_TW_DEFAULT_TICK_MSEC;
+	wheel->start_nsec = ptl_get_time_nsec();
+	wheel->current = 0;
+	wheel->wake_tick = 0;
+	wheel->running = 1;
+	wheel->expired = expired;
+	wheel->context = context;
+	
+	pthread_mutex_init(&wheel->mutex, NULL);
+	ptl_cond_init(&wheel->changed);
+	
+	if(pthread_create(&wheel->thread, NULL, _ptl_tw_run, wheel) != 0){
+		pthread_mutex_destroy(&wheel->mutex);
+		pthread_cond_destroy(&wheel->changed);
+		FREE(wheel);
+		return NULL;
+	}
+	
+	return wheel;
+}
+
+
+/* stop the thread, pending timers are left as they are */
+void ptl_tw_destroy(ptl_tw_t wheel){
+	if(wheel == NULL){ return; }
+	
+	pthread_mutex_lock(&wheel->mutex);
+	wheel->running = 0;
+	pthread_cond_signal(&wheel->changed);
+	pthread_mutex_unlock(&wheel->mutex);
+	
+	pthread_join(wheel->thread, NULL);
+	
+	pthread_mutex_destroy(&wheel->mutex);
+	pthread_cond_destroy(&wheel->changed);
+	FREE(wheel);
+}
+
+
+/* an idle timer */
+void ptl_tw_init_timer(ptl_timer_t timer, void *data){
+	if(timer == NULL){ return; }
+	
+	timer->next = NULL;
+	timer->prev = NULL;
+	timer->expires = 0;
+	timer->level = 0;
+	timer->slot = 0;
+	timer->state = PTL_TW_STATE_IDLE;
+	timer->data = data;
+}
+
+
+/* put it in its slot, wake the thread if it now has to wake up earlier */
+int ptl_tw_add(ptl_tw_t wheel, ptl_timer_t timer, long delay_msec){
+	if(wheel == NULL || timer == NULL){ return 0; }
+	
+	if(delay_msec < 0){ delay_msec = 0; }
+	unsigned long long now_nsec = ptl_get_time_nsec();
+	
+	pthread_mutex_lock(&wheel->mutex);
+	
+	if(timer->state == PTL_TW_STATE_PENDING){
+		pthread_mutex_unlock(&wheel->mutex);
+		return 0;
+	}
+	
+	// an empty wheel may skip ahead, so the new timer lands on a low level
+	unsigned long now = _ptl_tw_tick_at(wheel, now_nsec);
+	if(wheel->pending == 0 && now > wheel->current + 1){
+		wheel->current = now - 1;
+	}
+	
+	// the first tick at or after the deadline, never this one
+	unsigned long expires = _ptl_tw_tick_at(wheel, now_nsec + (unsigned long long)delay_msec * 1000000ULL);
+	if(expires <= wheel->current){
+		expires = wheel->current + 1;
+	}
+	
+	timer->expires = expires;
+	timer->state = PTL_TW_STATE_PENDING;
+	_ptl_tw_insert(wheel, timer);
+	wheel->pending++;
+	
+	if(expires < wheel->wake_tick){
+		pthread_cond_signal(&wheel->changed);
+	}
+	
+	pthread_mutex_unlock(&wheel->mutex);
+	
+	return 1;
+}
+
+
+/* unlink it from its slot, or from the timers about to be handed out */
+int ptl_tw_cancel(ptl_tw_t wheel, ptl_timer_t timer){
+	if(wheel == NULL || timer == NULL){ return 0; }
+	
+	pthread_mutex_lock(&wheel->mutex);
+	
+	if(timer->state != PTL_TW_STATE_PENDING){
+		pthread_mutex_unlock(&wheel->mutex);
+		return 0;
+	}
+	
+	_ptl_tw_unlink(wheel, timer);
+	timer->state = PTL_TW_STATE_IDLE;
+	wheel->pending--;
+	
+	pthread_mutex_unlock(&wheel->mutex);
+	
+	return 1;
+}
+
+
+/* the due list first, then every slot of every level */
+int ptl_tw_drain(ptl_tw_t wheel, ptl_timer_t *timers, int max){
+	if(wheel == NULL || timers == NULL || max <= 0){ return 0; }
+	
+	int count = 0;
+	int level = 0;
+	int slot = 0;
+	
+	pthread_mutex_lock(&wheel->mutex);
+	
+	count += _ptl_tw_take_list(wheel, &wheel->due, timers, max);
+	for(slot = 0; slot < PTL_TW_ROOT_SIZE && wheel->pending > 0 && count < max; slot++){
+		count += _ptl_tw_take_list(wheel, &wheel->root[slot], timers + count, max - count);
+	}
+	for(level = 0; level < PTL_TW_LEVELS - 1 && wheel->pending > 0; level++){
+		for(slot = 0; slot < PTL_TW_LEVEL_SIZE && count < max; slot++){
+			count += _ptl_tw_take_list(wheel, &wheel->levels[level][slot], 
+									   timers + count, max - count);
+		}
+	}
+	
+	pthread_mutex_unlock(&wheel->mutex);
+	
+	return count;
+}
+
+
+/* timers in the slots and about to be handed out */
+long ptl_tw_pending(ptl_tw_t wheel){
+	if(wheel == NULL){ return 0; }
+	
+	pthread_mutex_lock(&wheel->mutex);
+	long pending = wheel->pending;
+	pthread_mutex_unlock(&wheel->mutex);
+	
+	return pending;
+}
+
+
+/* Private Functions */
+
+/**
+ * Thread body of the wheel. Processes every tick up to now that has work,
+ * hands out what expired, then sleeps until the next such tick. Ticks with
+ * nothing to do are skipped, so an idle wheel never wakes up.
+ *
+ * @param wheel the wheel to run
+ */
+void *_ptl_tw_run(void *wheel_ptr){
+	ptl_tw_t wheel = (ptl_tw_t)wheel_ptr;
+	struct timespec ts;
+	
+	pthread_mutex_lock(&wheel->mutex);
+	
+	while(wheel->running){
+		unsigned long now = _ptl_tw_tick_at(wheel, ptl_get_time_nsec() + 1) - 1; // floor
+		unsigned long next;
+		
+		while((next = _ptl_tw_next_tick(wheel)) <= now){
+			_ptl_tw_process_tick(wheel, next);
+		}
+		
+		// no tick in between has anything to do
+		if(now > wheel->current){
+			wheel->current = now;
+		}
+		
+		if(wheel->due != NULL){
+			_ptl_tw_deliver(wheel); // drops the lock while calling out
+			continue;
+		}
+		
+		next = _ptl_tw_next_tick(wheel);
+		wheel->wake_tick = next;
+		
+		if(next == ULONG_MAX){
+			pthread_cond_wait(&wheel->changed, &wheel->mutex);
+		} else {
+			unsigned long long deadline = wheel->start_nsec + 
+				(unsigned long long)next * wheel->tick_msec * 1000000ULL;
+			ts.tv_sec = deadline / 1000000000ULL;
+			ts.tv_nsec = deadline % 1000000000ULL;
+			pthread_cond_timedwait(&wheel->changed, &wheel->mutex, &ts);
+		}
+		
+		wheel->wake_tick = 0; // awake, adders don't need to signal
+	}
+	
+	pthread_mutex_unlock(&wheel->mutex);
+	
+	return NULL;
+}
+
+
+/* first tick that starts at or after 'nsec' */
+unsigned long _ptl_tw_tick_at(ptl_tw_t wheel, unsigned long long nsec){
+	unsigned long long tick_nsec = (unsigned long long)wheel->tick_msec * 1000000ULL;
+	
+	if(nsec <= wheel->start_nsec){ return 0; }
+	
+	return (unsigned long)((nsec - wheel->start_nsec + tick_nsec - 1) / tick_nsec);
+}
+
+
+/* head of the list in 'slot' of 'level', the root is level 0 */
+struct ptl_timer **_ptl_tw_slot(ptl_tw_t wheel, int level, int slot){
+	if(level == 0){
+		return &wheel->root[slot];
+	}
+	return &wheel->levels[level - 1][slot];
+}
+
+
+/* mark the slot empty or not in its level's bitmap */
+void _ptl_tw_set_bit(ptl_tw_t wheel, int level, int slot, int set){
+	unsigned long long *word = (level == 0) ? &wheel->root_bits[slot >> 6] : 
+											  &wheel->level_bits[level - 1];
+	unsigned long long bit = 1ULL << (slot & 63);
+	
+	if(set){
+		*word |= bit;
+	} else {
+		*word &= ~bit;
+	}
+}
+
+
+/* the lowest level that spans the timer's distance from 'current' */
+void _ptl_tw_insert(ptl_tw_t wheel, ptl_timer_t timer){
+	unsigned long expires = timer->expires;
+	unsigned long delta = (expires > wheel->current) ? expires - wheel->current : 0;
+	int level = 0;
+	int slot = 0;
+	
+	if(delta >= PTL_TW_MAX_TICKS){
+		// past the top level, it gets cascaded from there again
+		expires = wheel->current + PTL_TW_MAX_TICKS - 1;
+		delta = PTL_TW_MAX_TICKS - 1;
+	}
+	
+	if(delta < PTL_TW_ROOT_SIZE){
+		slot = expires & PTL_TW_ROOT_MASK;
+	} else {
+		for(level = 1; level < PTL_TW_LEVELS; level++){
+			int shift = PTL_TW_ROOT_BITS + (level - 1) * PTL_TW_LEVEL_BITS;
+			if(delta < (1UL << (shift + PTL_TW_LEVEL_BITS))){
+				slot = (expires >> shift) & PTL_TW_LEVEL_MASK;
+				break;
+			}
+		}
+	}
+	
+	struct ptl_timer **head = _ptl_tw_slot(wheel, level, slot);
+	timer->level = level;
+	timer->slot = slot;
+	timer->prev = NULL;
+	timer->next = *head;
+	if(*head != NULL){
+		(*head)->prev = timer;
+	}
+	*head = timer;
+	_ptl_tw_set_bit(wheel, level, slot, 1);
+}
+
+
+/* take it out of its slot or of the due list */
+void _ptl_tw_unlink(ptl_tw_t wheel, ptl_timer_t timer){
+	if(timer->level == PTL_TW_DUE_LEVEL){
+		if(timer->prev != NULL){
+			timer->prev->next = timer->next;
+		} else {
+			wheel->due = timer->next;
+		}
+		if(timer->next != NULL){
+			timer->next->prev = timer->prev;
+		} else {
+			wheel->due_tail = timer->prev;
+		}
+	} else {
+		struct ptl_timer **head = _ptl_tw_slot(wheel, timer->level, timer->slot);
+		if(timer->prev != NULL){
+			timer->prev->next = timer->next;
+		} else {
+			*head = timer->next;
+		}
+		if(timer->next != NULL){
+			timer->next->prev = timer->prev;
+		}
+		if(*head == NULL){
+			_ptl_tw_set_bit(wheel, timer->level, timer->slot, 0);
+		}
+	}
+	
+	timer->next = NULL;
+	timer->prev = NULL;
+}
+
+
+/* unlink up to 'max' timers from the list at 'head', they become IDLE */
+int _ptl_tw_take_list(ptl_tw_t wheel, struct ptl_timer **head, ptl_timer_t *timers, int max){
+	int count = 0;
+	
+	while(*head != NULL && count < max){
+		ptl_timer_t timer = *head;
+		
+		_ptl_tw_unlink(wheel, timer);
+		timer->state = PTL_TW_STATE_IDLE;
+		wheel->pending--;
+		timers[count++] = timer;
+	}
+	
+	return count;
+}
+
+
+/* expired, still pending until it's handed out */
+void _ptl_tw_append_due(ptl_tw_t wheel, ptl_timer_t timer){
+	timer->level = PTL_TW_DUE_LEVEL;
+	timer->next = NULL;
+	timer->prev = wheel->due_tail;
+	if(wheel->due_tail != NULL){
+		wheel->due_tail->next = timer;
+	} else {
+		wheel->due = timer;
+	}
+	wheel->due_tail = timer;
+}
+
+
+/**
+ * Distance from 'from' to the first set bit, wrapping around.
+ *
+ * @param bits bitmap of 'nbits' bits, a multiple of 64
+ * @return 0 to nbits - 1, or -1 if no bit is set
+ */
+int _ptl_tw_next_bit(const unsigned long long *bits, int nbits, int from){
+	int words = nbits / 64;
+	int k = 0;
+	
+	for(k = 0; k <= words; k++){
+		int w = ((from >> 6) + k) % words;
+		unsigned long long word = bits[w];
+		
+		if(k == 0){
+			word &= ~0ULL << (from & 63);				// at or after 'from'
+		} else if(k == words){
+			word &= (1ULL << (from & 63)) - 1;			// wrapped, before 'from'
+		}
+		
+		if(word != 0){
+			int index = w * 64 + __builtin_ctzll(word);
+			return (index - from + nbits) % nbits;
+		}
+	}
+	
+	return -1;
+}
+
+
+/* the next tick after 'current' that expires or cascades a timer */
+unsigned long _ptl_tw_next_tick(ptl_tw_t wheel){
+	unsigned long next = ULONG_MAX;
+	
+	if(wheel->pending == 0){ return next; }
+	
+	unsigned long from = wheel->current + 1;
+	int d = _ptl_tw_next_bit(wheel->root_bits, PTL_TW_ROOT_SIZE, from & PTL_TW_ROOT_MASK);
+	if(d >= 0){
+		next = from + d;
+	}
+	
+	// a slot above is cascaded when the level below wraps onto it
+	int level = 0;
+	for(level = 1; level < PTL_TW_LEVELS; level++){
+		int shift = PTL_TW_ROOT_BITS + (level - 1) * PTL_TW_LEVEL_BITS;
+		unsigned long index = (wheel->current >> shift) + 1;
+		
+		d = _ptl_tw_next_bit(&wheel->level_bits[level - 1], PTL_TW_LEVEL_SIZE, 
+							 index & PTL_TW_LEVEL_MASK);
+		if(d >= 0 && ((index + d) << shift) < next){
+			next = (index + d) << shift;
+		}
+	}
+	
+	return next;
+}
+
+
+/* cascade the levels that wrap on 'tick', then move its root slot to due */
+void _ptl_tw_process_tick(ptl_tw_t wheel, unsigned long tick){
+	wheel->current = tick;
+	
+	if((tick & PTL_TW_ROOT_MASK) == 0){
+		int level = 0;
+		for(level = 1; level < PTL_TW_LEVELS; level++){
+			int shift = PTL_TW_ROOT_BITS + (level - 1) * PTL_TW_LEVEL_BITS;
+			int slot = (tick >> shift) & PTL_TW_LEVEL_MASK;
+			struct ptl_timer **head = _ptl_tw_slot(wheel, level, slot);
+			struct ptl_timer *timer = *head;
+			
+			*head = NULL;
+			_ptl_tw_set_bit(wheel, level, slot, 0);
+			
+			while(timer != NULL){
+				struct ptl_timer *next = timer->next;
+				_ptl_tw_insert(wheel, timer);
+				timer = next;
+			}
+			
+			if(slot != 0){
+				break; // the level above didn't wrap
+			}
+		}
+	}
+	
+	int slot = tick & PTL_TW_ROOT_MASK;
+	struct ptl_timer *timer = wheel->root[slot];
+	
+	wheel->root[slot] = NULL;
+	_ptl_tw_set_bit(wheel, 0, slot, 0);
+	
+	while(timer != NULL){
+		struct ptl_timer *next = timer->next;
+		_ptl_tw_append_due(wheel, timer);
+		timer = next;
+	}
+}
+
+
+/* hand one batch from the due list to 'expired'; called and returns locked */
+void _ptl_tw_deliver(ptl_tw_t wheel){
+	struct ptl_timer *batch[PTL_TW_BATCH_SIZE];
+	int count = 0;
+	
+	while(wheel->due != NULL && count < PTL_TW_BATCH_SIZE){
+		struct ptl_timer *timer = wheel->due;
+		_ptl_tw_unlink(wheel, timer);
+		timer->state = PTL_TW_STATE_EXPIRED;
+		wheel->pending--;
+		batch[count++] = timer;
+	}
+	
+	pthread_mutex_unlock(&wheel->mutex);
+	wheel->expired(batch, count, wheel->context);
+	pthread_mutex_lock(&wheel->mutex);
+}
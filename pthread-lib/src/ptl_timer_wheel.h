@@ -0,0 +1,168 @@
+/*
+ * This file is part of the pthread-lib Library.
+ * Copyright (C) 2008-2009 Nick Powers.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Library General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor Boston, MA 02110-1301,  USA
+ */
+
+/**
+ * This "class" is a hierarchical timing wheel. A timer is put in a slot by
+ * its expiry tick: the root level has one slot per tick for the next 256
+ * ticks, each level above has 64 slots each covering 64 times the span of a
+ * slot below. When the root wraps, the next slot of the level above is
+ * cascaded down. Adding and cancelling a timer are O(1), a timer is moved
+ * down at most PTL_TW_LEVELS - 1 times before it expires.
+ *
+ * One thread runs the wheel. It sleeps until the next tick that has work
+ * (an expiry or a cascade), found from a bitmap of non-empty slots per level,
+ * and hands the expired timers to the 'expired' callback in batches of up to
+ * PTL_TW_BATCH_SIZE. The callback runs without the wheel's lock held, it may
+ * add timers again.
+ *
+ * Timers are embedded in the caller's own structures, the wheel never
+ * allocates them.
+ */
+
+#ifndef __PTL_TIMER_WHEEL_H__
+#define __PTL_TIMER_WHEEL_H__
+
+#include <pthread.h>
+
+/* Constants */
+#define PTL_TW_DEFAULT_TICK_MSEC 1		/**< ms per tick, the timer resolution */
+#define PTL_TW_LEVELS 4					/**< root plus three cascading levels */
+#define PTL_TW_ROOT_BITS 8
+#define PTL_TW_ROOT_SIZE (1 << PTL_TW_ROOT_BITS)
+#define PTL_TW_LEVEL_BITS 6
+#define PTL_TW_LEVEL_SIZE (1 << PTL_TW_LEVEL_BITS)
+#define PTL_TW_MAX_TICKS (1UL << (PTL_TW_ROOT_BITS + (PTL_TW_LEVELS - 1) * PTL_TW_LEVEL_BITS))
+#define PTL_TW_BATCH_SIZE 64			/**< max timers per call to 'expired' */
+
+#define PTL_TW_STATE_IDLE 0				/**< not in the wheel */
+#define PTL_TW_STATE_PENDING 1			/**< waiting in a slot */
+#define PTL_TW_STATE_EXPIRED 2			/**< handed to 'expired' */
+
+
+/* Structures */
+
+struct ptl_timer {
+	struct ptl_timer *next;			/**< links in the slot's list */
+	struct ptl_timer *prev;
+	unsigned long expires;			/**< tick to expire on */
+	int level;						/**< slot it's in, so cancel can unlink it */
+	int slot;
+	int state;						/**< PTL_TW_STATE_*, changed under the wheel's lock */
+	void *data;						/**< the caller's, for the 'expired' callback */
+};
+
+struct ptl_timer_wheel {
+	pthread_mutex_t mutex;			/**< guards everything below */
+	pthread_cond_t changed;			/**< an earlier timer was added, or stopping */
+	pthread_t thread;
+	int running;
+	long tick_msec;
+	unsigned long long start_nsec;	/**< monotonic time of tick 0 */
+	unsigned long current;			/**< last tick the thread processed */
+	unsigned long wake_tick;		/**< tick the thread sleeps until, ULONG_MAX if none */
+	long pending;					/**< timers in the slots and in 'due' */
+	struct ptl_timer *root[PTL_TW_ROOT_SIZE];
+	struct ptl_timer *levels[PTL_TW_LEVELS - 1][PTL_TW_LEVEL_SIZE];
+	unsigned long long root_bits[PTL_TW_ROOT_SIZE / 64];		/**< non-empty root slots */
+	unsigned long long level_bits[PTL_TW_LEVELS - 1];		/**< non-empty slots per level */
+	struct ptl_timer *due;			/**< expired, waiting to be handed out */
+	struct ptl_timer *due_tail;
+	void (*expired)(struct ptl_timer **timers, int count, void *context);
+	void *context;					/**< passed to 'expired' */
+};
+
+
+/* Type Definitions */
+typedef struct ptl_timer_wheel *ptl_tw_t;
+typedef struct ptl_timer *ptl_timer_t;
+
+
+/* Public Functions */
+
+/**
+ * Creates a wheel and starts its thread.
+ *
+ * @param tick_msec ms per tick, PTL_TW_DEFAULT_TICK_MSEC if 0 or less
+ * @param expired called from the wheel's thread with the timers that expired.
+ * 		  They are EXPIRED and belong to the caller again
+ * @param context passed to 'expired'
+ * @return a running wheel, or NULL if 'expired' is NULL or the thread can't start
+ */
+ptl_tw_t ptl_tw_create(long tick_msec,
+					   void (*expired)(struct ptl_timer **timers, int count, void *context),
+					   void *context);
+
+/**
+ * Stops the wheel's thread and frees the wheel. Timers still pending are
+ * dropped without calling 'expired'; they stay in the PENDING state.
+ * Must not be called from the 'expired' callback.
+ *
+ * @param wheel wheel to destroy
+ */
+void ptl_tw_destroy(ptl_tw_t wheel);
+
+/**
+ * Prepares a timer before its first use.
+ *
+ * @param timer timer to initialize
+ * @param data stored in the timer for the callback
+ */
+void ptl_tw_init_timer(ptl_timer_t timer, void *data);
+
+/**
+ * Adds 'timer' to expire 'delay_msec' from now, rounded up to the next tick.
+ * Delays longer than the wheel spans are cascaded again from the top level.
+ *
+ * @param wheel non-null wheel
+ * @param timer an IDLE or EXPIRED timer
+ * @param delay_msec ms from now, at least one tick
+ * @return 1 if added, 0 if it was already pending
+ */
+int ptl_tw_add(ptl_tw_t wheel, ptl_timer_t timer, long delay_msec);
+
+/**
+ * Takes 'timer' out of the wheel before it expires.
+ *
+ * @param wheel non-null wheel
+ * @param timer timer that was added to 'wheel'
+ * @return 1 if removed, 0 if it wasn't pending (it may be expiring right now)
+ */
+int ptl_tw_cancel(ptl_tw_t wheel, ptl_timer_t timer);
+
+/**
+ * Takes up to 'max' pending timers out of the wheel, expired or not, without
+ * calling 'expired'. They are IDLE again. Call it until it returns 0 to empty
+ * the wheel, e.g. to hand back what was scheduled when shutting down.
+ *
+ * @param wheel non-null wheel
+ * @param timers filled with the timers taken out
+ * @param max room in 'timers'
+ * @return timers taken out, 0 once the wheel is empty
+ */
+int ptl_tw_drain(ptl_tw_t wheel, ptl_timer_t *timers, int max);
+
+/**
+ * Number of timers waiting in the wheel.
+ *
+ * @param wheel non-null wheel
+ * @return pending timers
+ */
+long ptl_tw_pending(ptl_tw_t wheel);
+
+#endif
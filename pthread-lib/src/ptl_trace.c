@@ -0,0 +1,442 @@
+/*
+ * This file is part of the pthread-lib Library.
+ * Copyright (C) 2008-2009 Nick Powers.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Library General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor Boston, MA 02110-1301,  USA
+ */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include "ptl_trace.h"
+#include "ptl_util.h"
+
+/* Constants */
+#define _PTL_TRACE_COUNT_BITS (sizeof(unsigned long) * 8 - 16)	/* of a task id, the ring's id is above */
+
+
+/* Structures */
+
+/* state of one ptl_trace_dump */
+struct ptl_trace_writer {
+	FILE *file;
+	int events;						/* written so far, for the commas */
+	unsigned long long origin;		/* earliest record, ts 0 */
+	double nsec_per_tick;
+};
+
+
+/* Private Functions */
+struct ptl_trace_ring *_ptl_trace_ring();
+struct ptl_trace_ring *_ptl_trace_attach();
+void _ptl_trace_release(void *ring);
+void _ptl_trace_init();
+unsigned long long _ptl_trace_clock();
+double _ptl_trace_nsec_per_tick();
+struct ptl_trace_record *_ptl_trace_collect(int *count, unsigned long long *origin);
+int _ptl_trace_copy_ring(struct ptl_trace_ring *ring, struct ptl_trace_record *out);
+int _ptl_trace_compare(const void *a, const void *b);
+void _ptl_trace_write_records(struct ptl_trace_writer *writer, struct ptl_trace_record *records, int count);
+void _ptl_trace_write_names(struct ptl_trace_writer *writer, struct ptl_trace_record *records, int count);
+void _ptl_trace_write_span(struct ptl_trace_writer *writer, const char *name, const char *cat,
+						   struct ptl_trace_record *begin, struct ptl_trace_record *end, int async);
+void _ptl_trace_write_instant(struct ptl_trace_writer *writer, const char *name, 
+							  struct ptl_trace_record *record);
+void _ptl_trace_write_head(struct ptl_trace_writer *writer, const char *name, const char *cat,
+						   const char *phase, struct ptl_trace_record *record);
+
+
+/* Global Variables */
+static __thread struct ptl_trace_ring *ptl_trace_self = NULL;
+static struct ptl_trace_ring *ptl_trace_rings = NULL;	// pushed atomically, never freed
+static int ptl_trace_ring_count = 0;
+static pthread_key_t ptl_trace_key;
+static pthread_once_t ptl_trace_once = PTHREAD_ONCE_INIT;
+static unsigned long long ptl_trace_base_tick = 0;		// clocks when the first ring was made
+static unsigned long long ptl_trace_base_nsec = 0;
+
+
+/* Public Functions */
+
+/* See header file for documentation */
+
+/* claim the next slot, fill it in, then count it written. A dump copying
+   the slot meanwhile sees 'begun' moved past it and drops it */
+void ptl_trace_record(int event, unsigned long task){
+	struct ptl_trace_ring *ring = _ptl_trace_ring();
+	unsigned long long n = ring->begun; // only this thread writes it
+	struct ptl_trace_record *record = &ring->records[n & (PTL_TRACE_RING_SIZE - 1)];
+	
+	__atomic_store_n(&ring->begun, n + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	
+	__atomic_store_n(&record->time, _ptl_trace_clock(), __ATOMIC_RELAXED);
+	__atomic_store_n(&record->task, task, __ATOMIC_RELAXED);
+	__atomic_store_n(&record->worker, ring->worker, __ATOMIC_RELAXED);
+	__atomic_store_n(&record->event, event, __ATOMIC_RELAXED);
+	
+	__atomic_store_n(&ring->done, n + 1, __ATOMIC_RELEASE);
+}
+
+
+/* the ring's id in the top bits, no other thread counts in this ring */
+unsigned long ptl_trace_next_id(){
+	struct ptl_trace_ring *ring = _ptl_trace_ring();
+	
+	ring->next_id = (ring->next_id + 1) & ((1UL << _PTL_TRACE_COUNT_BITS) - 1);
+	
+	return ((unsigned long)ring->id << _PTL_TRACE_COUNT_BITS) | ring->next_id;
+}
+
+
+/* stamped on every record this thread makes from now on */
+void ptl_trace_set_worker(int worker){
+	_ptl_trace_ring()->worker = worker;
+}
+
+
+/* copy every ring, sort the records per task and per worker, and pair them
+   up into spans */
+int ptl_trace_dump(const char *path){
+	FILE *file = fopen(path, "w");
+	if(file == NULL){ return 0; }
+	
+	pthread_once(&ptl_trace_once, _ptl_trace_init); // for the clocks, if nothing was recorded
+	
+	struct ptl_trace_writer writer;
+	writer.file = file;
+	writer.events = 0;
+	writer.nsec_per_tick = _ptl_trace_nsec_per_tick();
+	
+	int count = 0;
+	struct ptl_trace_record *records = _ptl_trace_collect(&count, &writer.origin);
+	qsort(records, count, sizeof(struct ptl_trace_record), _ptl_trace_compare);
+	
+	fprintf(file, "{\"traceEvents\":[");
+	_ptl_trace_write_names(&writer, records, count);
+	_ptl_trace_write_records(&writer, records, count);
+	fprintf(file, "\n],\"displayTimeUnit\":\"ns\"}\n");
+	
+	FREE(records);
+	
+	int ok = !ferror(file);
+	if(fclose(file) != 0){ ok = 0; }
+	
+	return ok;
+}
+
+
+
+/* Private Functions */
+
+/* this thread's ring, taken on its first record */
+struct ptl_trace_ring *_ptl_trace_ring(){
+	struct ptl_trace_ring *ring = ptl_trace_self;
+	
+	if(__builtin_expect(ring != NULL, 1)){
+		return ring;
+	}
+	
+	return _ptl_trace_attach();
+}
+
+
+/* take over the ring of a thread that ended, or make one */
+struct ptl_trace_ring *_ptl_trace_attach(){
+	pthread_once(&ptl_trace_once, _ptl_trace_init);
+	
+	struct ptl_trace_ring *ring = __atomic_load_n(&ptl_trace_rings, __ATOMIC_ACQUIRE);
+	for(; ring != NULL; ring = ring->next){
+		int expected = 0;
+		if(__atomic_load_n(&ring->owned, __ATOMIC_RELAXED) == 0 &&
+		   __atomic_compare_exchange_n(&ring->owned, &expected, 1, 0,
+									   __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)){
+			break;
+		}
+	}
+	
+	if(ring == NULL){
+		ring = (struct ptl_trace_ring *)ptl_cache_aligned_alloc(sizeof(struct ptl_trace_ring));
+		ring->owned = 1;
+		ring->id = PTL_ATOMIC_INC(ptl_trace_ring_count);
+		
+		ring->next = __atomic_load_n(&ptl_trace_rings, __ATOMIC_RELAXED);
+		while(!__atomic_compare_exchange_n(&ptl_trace_rings, &ring->next, ring, 1,
+										   __ATOMIC_RELEASE, __ATOMIC_RELAXED)){
+			// 'next' was reloaded, try again
+		}
+	}
+	
+	ring->worker = PTL_TRACE_NO_WORKER;
+	ptl_trace_self = ring;
+	pthread_setspecific(ptl_trace_key, ring);
+	
+	return ring;
+}
+
+
+/* thread exit: the ring stays in the list, with its records, for the next thread */
+void _ptl_trace_release(void *ring){
+	struct ptl_trace_ring *r = (struct ptl_trace_ring *)ring;
+	
+	r->worker = PTL_TRACE_NO_WORKER;
+	__atomic_store_n(&r->owned, 0, __ATOMIC_RELEASE);
+}
+
+
+/* the key that gives a ring back, and the clocks the dump scales against */
+void _ptl_trace_init(){
+	pthread_key_create(&ptl_trace_key, _ptl_trace_release);
+	
+	ptl_trace_base_tick = _ptl_trace_clock();
+	ptl_trace_base_nsec = ptl_get_time_nsec();
+}
+
+
+/* the TSC on x86, a few ns to read; else the monotonic clock */
+unsigned long long _ptl_trace_clock(){
+#if defined(__x86_64__) || defined(__i386__)
+	return __builtin_ia32_rdtsc();
+#else
+	return ptl_get_time_nsec();
+#endif
+}
+
+
+/* ticks to ns, measured against the monotonic clock since the first ring */
+double _ptl_trace_nsec_per_tick(){
+	unsigned long long ticks = _ptl_trace_clock() - ptl_trace_base_tick;
+	unsigned long long nsec = ptl_get_time_nsec() - ptl_trace_base_nsec;
+	
+	if(ticks == 0){
+		return 1.0; // nothing was recorded yet
+	}
+	
+	return (double)nsec / (double)ticks;
+}
+
+
+/* the records of every ring, and the time of the earliest one */
+struct ptl_trace_record *_ptl_trace_collect(int *count, unsigned long long *origin){
+	// the list first: every ring on it was counted before it was pushed
+	struct ptl_trace_ring *ring = __atomic_load_n(&ptl_trace_rings, __ATOMIC_ACQUIRE);
+	int rings = PTL_ATOMIC_LOAD(ptl_trace_ring_count);
+	
+	struct ptl_trace_record *records = (struct ptl_trace_record *)
+		malloc(((size_t)rings * PTL_TRACE_RING_SIZE + 1) * sizeof(struct ptl_trace_record));
+	assert(records);
+	
+	*count = 0;
+	for(; ring != NULL; ring = ring->next){
+		*count += _ptl_trace_copy_ring(ring, records + *count);
+	}
+	
+	*origin = 0;
+	int i = 0;
+	for(i = 0; i < *count; i++){
+		if(i == 0 || records[i].time < *origin){
+			*origin = records[i].time;
+		}
+	}
+	
+	return records;
+}
+
+
+/* copy what 'ring' holds, then drop the oldest records if they were
+   overwritten during the copy */
+int _ptl_trace_copy_ring(struct ptl_trace_ring *ring, struct ptl_trace_record *out){
+	unsigned long long done = __atomic_load_n(&ring->done, __ATOMIC_ACQUIRE);
+	unsigned long long from = (done > PTL_TRACE_RING_SIZE) ? done - PTL_TRACE_RING_SIZE : 0;
+	unsigned long long i = 0;
+	
+	for(i = from; i < done; i++){
+		struct ptl_trace_record *record = &ring->records[i & (PTL_TRACE_RING_SIZE - 1)];
+		struct ptl_trace_record *copy = out + (i - from);
+		
+		copy->time = __atomic_load_n(&record->time, __ATOMIC_RELAXED);
+		copy->task = __atomic_load_n(&record->task, __ATOMIC_RELAXED);
+		copy->worker = __atomic_load_n(&record->worker, __ATOMIC_RELAXED);
+		copy->event = __atomic_load_n(&record->event, __ATOMIC_RELAXED);
+	}
+	
+	// pairs with the fence in ptl_trace_record: a slot it wrote over is
+	// below 'begun' - PTL_TRACE_RING_SIZE
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	unsigned long long begun = __atomic_load_n(&ring->begun, __ATOMIC_RELAXED);
+	unsigned long long valid = (begun > PTL_TRACE_RING_SIZE) ? begun - PTL_TRACE_RING_SIZE : 0;
+	
+	if(valid <= from){
+		return (int)(done - from);
+	}
+	if(valid >= done){
+		return 0;
+	}
+	
+	memmove(out, out + (valid - from), (done - valid) * sizeof(struct ptl_trace_record));
+	
+	return (int)(done - valid);
+}
+
+
+/* by task, the worker events (task 0) by worker, then by time */
+int _ptl_trace_compare(const void *a, const void *b){
+	const struct ptl_trace_record *x = (const struct ptl_trace_record *)a;
+	const struct ptl_trace_record *y = (const struct ptl_trace_record *)b;
+	
+	if(x->task != y->task){
+		return (x->task < y->task) ? -1 : 1;
+	}
+	if(x->task == 0 && x->worker != y->worker){
+		return (x->worker < y->worker) ? -1 : 1;
+	}
+	if(x->time != y->time){
+		return (x->time < y->time) ? -1 : 1;
+	}
+	
+	return x->event - y->event; // in lifecycle order
+}
+
+
+/* walk each task's (or idle worker's) records in time order: SUBMIT to
+   START is time queued, START to END a run, PARK to UNPARK time parked */
+void _ptl_trace_write_records(struct ptl_trace_writer *writer, struct ptl_trace_record *records, int count){
+	struct ptl_trace_record *queued = NULL;
+	struct ptl_trace_record *begun = NULL;
+	int i = 0;
+	
+	for(i = 0; i < count; i++){
+		struct ptl_trace_record *record = &records[i];
+		
+		if(i > 0 && (record->task != records[i - 1].task ||
+					 (record->task == 0 && record->worker != records[i - 1].worker))){
+			queued = NULL; // the next task, or worker
+			begun = NULL;
+		}
+		
+		switch(record->event){
+		case PTL_TRACE_SUBMIT:
+			queued = record;
+			break;
+		case PTL_TRACE_DEQUEUE:
+			_ptl_trace_write_instant(writer, "dequeue", record);
+			break;
+		case PTL_TRACE_START:
+			if(queued != NULL){
+				_ptl_trace_write_span(writer, "queued", "queue", queued, record, 1);
+				queued = NULL;
+			}
+			begun = record;
+			break;
+		case PTL_TRACE_END:
+			if(begun != NULL){
+				// a fiber may end on another worker than it started on
+				_ptl_trace_write_span(writer, "run", "task", begun, record,
+									  begun->worker != record->worker);
+				begun = NULL;
+			}
+			break;
+		case PTL_TRACE_CANCEL:
+			_ptl_trace_write_instant(writer, "cancel", record);
+			queued = NULL;
+			break;
+		case PTL_TRACE_REJECT:
+			_ptl_trace_write_instant(writer, "reject", record);
+			queued = NULL;
+			break;
+		case PTL_TRACE_PARK:
+			begun = record;
+			break;
+		case PTL_TRACE_UNPARK:
+			if(begun != NULL){
+				_ptl_trace_write_span(writer, "parked", "worker", begun, record, 0);
+				begun = NULL;
+			}
+			break;
+		}
+	}
+}
+
+
+/* name the rows: tid 0 is every thread outside the pools, tid n+1 worker n */
+void _ptl_trace_write_names(struct ptl_trace_writer *writer, struct ptl_trace_record *records, int count){
+	int max_worker = PTL_TRACE_NO_WORKER;
+	int i = 0;
+	
+	for(i = 0; i < count; i++){
+		if(records[i].worker > max_worker){
+			max_worker = records[i].worker;
+		}
+	}
+	
+	char *seen = (char *)calloc(max_worker + 2, 1);
+	assert(seen);
+	for(i = 0; i < count; i++){
+		seen[records[i].worker + 1] = 1;
+	}
+	
+	for(i = 0; i <= max_worker + 1; i++){
+		if(!seen[i]){ continue; }
+		
+		fprintf(writer->file, "%s\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,"
+				"\"args\":{\"name\":\"", (writer->events++ > 0) ? "," : "", i);
+		if(i == 0){
+			fprintf(writer->file, "other threads\"}}");
+		} else {
+			fprintf(writer->file, "worker %d\"}}", i - 1);
+		}
+	}
+	
+	FREE(seen);
+}
+
+
+/* a complete event on the row it began on, or with 'async' a pair of async
+   events, which may overlap anything else on their rows */
+void _ptl_trace_write_span(struct ptl_trace_writer *writer, const char *name, const char *cat,
+						   struct ptl_trace_record *begin, struct ptl_trace_record *end, int async){
+	double dur = (double)(end->time - begin->time) * writer->nsec_per_tick / 1000.0;
+	
+	if(!async){
+		_ptl_trace_write_head(writer, name, cat, "X", begin);
+		fprintf(writer->file, ",\"dur\":%.3f,\"args\":{\"task\":\"0x%lx\"}}", dur, begin->task);
+		return;
+	}
+	
+	_ptl_trace_write_head(writer, name, cat, "b", begin);
+	fprintf(writer->file, ",\"id\":\"0x%lx\"}", begin->task);
+	_ptl_trace_write_head(writer, name, cat, "e", end);
+	fprintf(writer->file, ",\"id\":\"0x%lx\"}", end->task);
+}
+
+
+/* a point in time on the record's row */
+void _ptl_trace_write_instant(struct ptl_trace_writer *writer, const char *name, 
+							  struct ptl_trace_record *record){
+	_ptl_trace_write_head(writer, name, "task", "i", record);
+	fprintf(writer->file, ",\"s\":\"t\",\"args\":{\"task\":\"0x%lx\"}}", record->task);
+}
+
+
+/* an event up to its timestamp, the caller adds the rest and the brace */
+void _ptl_trace_write_head(struct ptl_trace_writer *writer, const char *name, const char *cat,
+						   const char *phase, struct ptl_trace_record *record){
+	double ts = (double)(record->time - writer->origin) * writer->nsec_per_tick / 1000.0;
+	
+	fprintf(writer->file, "%s\n{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"%s\",\"pid\":1,\"tid\":%d,\"ts\":%.3f",
+			(writer->events++ > 0) ? "," : "", name, cat, phase, record->worker + 1, ts);
+}
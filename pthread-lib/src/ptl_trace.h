@@ -0,0 +1,136 @@
+/*
+ * This file is part of the pthread-lib Library.
+ * Copyright (C) 2008-2009 Nick Powers.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Library General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor Boston, MA 02110-1301,  USA
+ */
+
+/**
+ * Task lifecycle tracing. Each thread writes fixed size records into a ring
+ * buffer of its own, without locks: a timestamp (the TSC on x86, else the
+ * monotonic clock), the task's id, the worker's slot and the event. Once a
+ * ring is full the oldest records are overwritten. ptl_trace_dump writes
+ * what the rings hold as Chrome trace_event JSON (chrome://tracing,
+ * Perfetto): per worker the time each task ran and the time it was parked,
+ * per task the time it waited in the queue, and the rest as instant events.
+ *
+ * Recording is compiled in with -DPTL_TRACE (configure --enable-trace),
+ * otherwise the PTL_TRACE_* macros are empty and only ptl_trace_dump is
+ * left, writing an empty trace. A record costs a clock read and a few
+ * stores to memory only this thread writes.
+ *
+ * The events follow the PTL_TASK_STATE_* transitions:
+ *   SUBMIT   handed to a manager (again for each run of a periodic task)
+ *   DEQUEUE  taken off the queue by a worker
+ *   START    CREATED -> RUNNING, the function is called
+ *   END      the function returned: RUNNING -> DONE, or back to CREATED
+ *            for a periodic task
+ *   CANCEL   -> CANCELLED
+ *   REJECT   -> REJECTED
+ * and PARK / UNPARK around an idle worker's sleep on the work event.
+ *
+ * Workers are told apart by their slot index, so the workers of two managers
+ * traced at once share the same rows.
+ */
+
+#ifndef __PTL_TRACE_H__
+#define __PTL_TRACE_H__
+
+/* Constants */
+#define PTL_TRACE_RING_SIZE 4096		/**< records per thread, a power of 2 */
+#define PTL_TRACE_NO_WORKER -1			/**< 'worker' of threads outside the pools */
+
+#define PTL_TRACE_SUBMIT 1
+#define PTL_TRACE_DEQUEUE 2
+#define PTL_TRACE_START 3
+#define PTL_TRACE_END 4
+#define PTL_TRACE_CANCEL 5
+#define PTL_TRACE_REJECT 6
+#define PTL_TRACE_PARK 7
+#define PTL_TRACE_UNPARK 8
+
+/* the hooks the library calls, nothing unless compiled with PTL_TRACE */
+#ifdef PTL_TRACE
+#define PTL_TRACE_TASK(event, task) ptl_trace_record((event), (task)->trace_id)
+#define PTL_TRACE_WORKER(event) ptl_trace_record((event), 0)
+#define PTL_TRACE_SET_WORKER(worker) ptl_trace_set_worker(worker)
+#define PTL_TRACE_NEW_ID() ptl_trace_next_id()
+#else
+#define PTL_TRACE_TASK(event, task) ((void)0)
+#define PTL_TRACE_WORKER(event) ((void)0)
+#define PTL_TRACE_SET_WORKER(worker) ((void)0)
+#define PTL_TRACE_NEW_ID() 0
+#endif
+
+
+/* Structures */
+
+struct ptl_trace_record {
+	unsigned long long time;		/**< clock ticks, see ptl_trace.c */
+	unsigned long task;				/**< task id, 0 for worker events */
+	int worker;						/**< slot index, or PTL_TRACE_NO_WORKER */
+	int event;						/**< PTL_TRACE_* */
+};
+
+/* one thread's records. Only that thread writes them; a ring outlives it
+   and is taken over by a later thread */
+struct ptl_trace_ring {
+	unsigned long long begun;		/**< records started, ahead of 'done' while one is written */
+	unsigned long long done;		/**< records written */
+	int id;							/**< 1, 2, ... in the order the rings were made */
+	int worker;						/**< of the thread writing it now */
+	int owned;						/**< a live thread writes it (atomic) */
+	unsigned long next_id;			/**< last task id handed out here */
+	struct ptl_trace_ring *next;	/**< link in the list of all rings */
+	struct ptl_trace_record records[PTL_TRACE_RING_SIZE];
+};
+
+
+/* Public Functions */
+
+/**
+ * Records 'event' in this thread's ring.
+ *
+ * @param event PTL_TRACE_*
+ * @param task id of the task it's about, 0 for none
+ */
+void ptl_trace_record(int event, unsigned long task);
+
+/**
+ * A new task id, unique in the process: this ring's id above a count of
+ * its own.
+ *
+ * @return a non-zero id
+ */
+unsigned long ptl_trace_next_id();
+
+/**
+ * Sets the worker slot the following records of this thread are made in.
+ *
+ * @param worker slot index, or PTL_TRACE_NO_WORKER
+ */
+void ptl_trace_set_worker(int worker);
+
+/**
+ * Writes the records every ring holds now to 'path' as Chrome trace_event
+ * JSON. Threads may go on recording meanwhile; records overwritten while
+ * they were read are left out.
+ *
+ * @param path file to create or truncate
+ * @return 1 if written, 0 if the file couldn't be written
+ */
+int ptl_trace_dump(const char *path);
+
+#endif
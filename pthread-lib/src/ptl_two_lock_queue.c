@@ -0,0 +1,310 @@
+/*
+ * This file is part of the pthread-lib Library.
+ * Copyright (C) 2008-2009 Nick Powers.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Library General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor Boston, MA 02110-1301,  USA
+ */
+
+/* See header file for documentation. */
+
+#include <pthread.h>
+#include <stdlib.h> 
+#include <stdio.h>
+#include <assert.h>
+#include <time.h>
+#include <sys/time.h>
+#include <string.h>
+#include <errno.h>
+#include "ptl_queue.h"
+#include "ptl_two_lock_queue.h"
+#include "ptl_util.h"
+#include "ptl_node_pool.h"
+
+/* Private Functions */
+void* _ptl_tlq_take(ptl_q_t q, ptl_q_element_t *old_head);
+
+/* Global Variables */
+
+/* functions to use with ptl_q_create_queue() */
+struct ptl_q_funcs ptl_tlq_funcs = {
+	ptl_tlq_init_queue,
+	ptl_tlq_destroy_queue,
+	ptl_tlq_add,
+	ptl_tlq_add_wait,
+	ptl_tlq_clear,
+	ptl_tlq_peek,
+	ptl_tlq_get,
+	ptl_tlq_get_wait,
+	NULL,			// 'size' is kept up to date
+	ptl_tlq_add_batch,
+	ptl_tlq_get_batch
+};
+
+/* initialize memory needed for this type of queue. */
+void ptl_tlq_init_queue(ptl_q_t q){
+	assert(q);
+
+	pthread_mutex_init(&q->mutex, NULL); // head lock (consumers)
+	pthread_mutex_init(&q->tail_mutex, NULL); // tail lock (producers)
+	ptl_cond_init(&q->not_empty); // waited on under the head lock
+	ptl_cond_init(&q->not_full); // never used, this queue is unbounded
+
+	q->type = PTL_Q_TYPE_TWO_LOCK;
+	q->size = 0;
+	q->ptr = NULL; // not used
+	
+	// elements are recycled through a pool, 'capacity' nodes are allocated now
+	q->data = ptl_np_create_pool((q->capacity > 0) ? q->capacity : 0,
+								 PTL_NP_DEFAULT_MAX_RETAINED);
+	q->tail = q->head = ptl_np_get_element(q->data, NULL); // dummy node
+}
+
+
+/* free the memory created using this type of list. */
+void ptl_tlq_destroy_queue(ptl_q_t q){
+	ptl_tlq_clear(q); // clears all
+
+	FREE(q->head); // remove the dummy node
+	q->tail = NULL;
+	ptl_np_destroy_pool(q->data);
+	q->data = NULL;
+	
+	pthread_mutex_destroy(&q->mutex);
+	pthread_mutex_destroy(&q->tail_mutex);
+	pthread_cond_destroy(&q->not_empty);
+	pthread_cond_destroy(&q->not_full);
+	// leave destroying of ptl_q_t to the 'interface'
+}
+
+
+/* add 'value' to the tail of the queue, only the tail lock is held. */
+int ptl_tlq_add(ptl_q_t q, void *value){
+	if((q == NULL) || (value == NULL)){ return 0; }
+
+	// get the element/node before taking the lock
+	ptl_q_element_t element = ptl_np_get_element(q->data, value);
+	
+	PTL_Q_LOCK(q, &q->tail_mutex); // lock
+	
+	// consumers read 'next' under the other lock, publish with release
+	__atomic_store_n(&q->tail->next, element, __ATOMIC_RELEASE);
+	q->tail = element;
+	
+	// count it only once it is linked, so consumers that see size > 0
+	// always find a node
+	long size = PTL_ATOMIC_INC(q->size);
+	
+	pthread_mutex_unlock(&q->tail_mutex); // unlock
+	
+	// the queue was empty, so a consumer may be waiting. Consumers pass
+	// the signal on to each other while elements remain (see _ptl_tlq_take)
+	if(size == 1){
+		PTL_Q_LOCK(q, &q->mutex);
+		pthread_cond_signal(&q->not_empty);
+		pthread_mutex_unlock(&q->mutex);
+	}
+	
+	return 1;
+}
+
+
+/* link a chain of new elements onto the tail, only the tail lock is held */
+int ptl_tlq_add_batch(ptl_q_t q, void **values, int count){
+	if(q == NULL || values == NULL || count <= 0){ return 0; }
+	
+	// build the chain before taking the lock
+	ptl_q_element_t first = NULL;
+	ptl_q_element_t last = NULL;
+	int added = 0;
+	while(added < count && values[added] != NULL){
+		ptl_q_element_t element = ptl_np_get_element(q->data, values[added]);
+		if(last == NULL){
+			first = element;
+		} else {
+			last->next = element;
+		}
+		last = element;
+		added++;
+	}
+	
+	if(added == 0){ return 0; }
+	
+	PTL_Q_LOCK(q, &q->tail_mutex); // lock
+	
+	__atomic_store_n(&q->tail->next, first, __ATOMIC_RELEASE);
+	q->tail = last;
+	long size = __atomic_add_fetch(&q->size, added, __ATOMIC_ACQ_REL);
+	
+	pthread_mutex_unlock(&q->tail_mutex); // unlock
+	
+	// the queue was empty, wake a consumer (they pass it on, see ptl_tlq_add)
+	if(size == added){
+		PTL_Q_LOCK(q, &q->mutex);
+		pthread_cond_signal(&q->not_empty);
+		pthread_mutex_unlock(&q->mutex);
+	}
+	
+	return added;
+}
+
+
+/* There is no waiting for this type of queue because it is unbounded. */
+int ptl_tlq_add_wait(ptl_q_t q, void *value, long timeout){
+	return ptl_tlq_add(q, value);
+}
+
+
+/* Removes all of the elements from this queue. */
+void ptl_tlq_clear(ptl_q_t q){
+	ptl_tlq_clear_freefunc(q, free);
+}
+
+
+/* Removes all of the elements from this queue using the 
+   free_func to free memory. */
+void ptl_tlq_clear_freefunc(ptl_q_t q, void (*free_func)(void *)){
+	if(q == NULL){ return; }
+	
+	void *e = NULL;
+	while((e = ptl_tlq_get(q)) != NULL){
+		free_func(e);
+	}
+}
+
+
+/* Retrieves, but does not remove, the head of this queue. */
+void* ptl_tlq_peek(ptl_q_t q){
+	if(q == NULL || PTL_ATOMIC_LOAD(q->size) <= 0){ return NULL; }
+
+	PTL_Q_LOCK(q, &q->mutex); // lock head
+	
+	ptl_q_element_t first = __atomic_load_n(&q->head->next, __ATOMIC_ACQUIRE);
+	void *value = (first != NULL) ? first->value : NULL;
+
+	pthread_mutex_unlock(&q->mutex); // unlock head
+
+	return value;
+}
+
+
+/* Retrieves and removes the head of this queue, only the head lock is held. */
+void* ptl_tlq_get(ptl_q_t q){
+	if(q == NULL || PTL_ATOMIC_LOAD(q->size) <= 0){ return NULL; }
+
+	ptl_q_element_t old_head = NULL;
+
+	PTL_Q_LOCK(q, &q->mutex); // lock head
+	
+	void* value = _ptl_tlq_take(q, &old_head);
+	
+	pthread_mutex_unlock(&q->mutex); // unlock head
+	
+	ptl_np_put_element(q->data, old_head); // recycle outside of the lock
+	
+	return value;
+}
+
+
+/* take up to 'max' elements, only the head lock is held */
+int ptl_tlq_get_batch(ptl_q_t q, void **values, int max){
+	if(q == NULL || values == NULL || max <= 0){ return 0; }
+	if(PTL_ATOMIC_LOAD(q->size) <= 0){ return 0; }
+	
+	ptl_q_element_t old_heads = NULL; // recycled once we unlock
+	ptl_q_element_t old_head = NULL;
+	int taken = 0;
+	
+	PTL_Q_LOCK(q, &q->mutex); // lock head
+	
+	// every counted node is linked (see ptl_tlq_add)
+	long size = PTL_ATOMIC_LOAD(q->size);
+	while(taken < max && taken < size){
+		old_head = q->head;
+		ptl_q_element_t first = __atomic_load_n(&old_head->next, __ATOMIC_ACQUIRE);
+		
+		values[taken++] = first->value;
+		first->value = NULL;
+		q->head = first; // 'first' becomes the new dummy node
+		
+		old_head->next = old_heads;
+		old_heads = old_head;
+	}
+	
+	if(taken > 0 && __atomic_sub_fetch(&q->size, taken, __ATOMIC_ACQ_REL) > 0){
+		pthread_cond_signal(&q->not_empty); // more left for the next waiter
+	}
+	
+	pthread_mutex_unlock(&q->mutex); // unlock head
+	
+	while(old_heads != NULL){
+		old_head = old_heads;
+		old_heads = old_heads->next;
+		ptl_np_put_element(q->data, old_head);
+	}
+	
+	return taken;
+}
+
+
+/* Retrieves and removes the head of this queue, waiting up to the specified
+   wait time if necessary for an element to become available. */
+void* ptl_tlq_get_wait(ptl_q_t q, long timeout){
+	if(q == NULL || timeout < 0){ return NULL; }
+	
+	struct timespec deadline;
+	ptl_get_future_time(&deadline, timeout * 1000); // ms to usec
+	ptl_q_element_t old_head = NULL;
+	void *element = NULL;
+	
+	PTL_Q_LOCK(q, &q->mutex); // lock head
+	
+	// sleep on 'not_empty' (giving up the head lock) until an add or the deadline
+	while((element = _ptl_tlq_take(q, &old_head)) == NULL){
+		if(pthread_cond_timedwait(&q->not_empty, &q->mutex, &deadline) == ETIMEDOUT){
+			element = _ptl_tlq_take(q, &old_head); // one last try
+			break;
+		}
+	}
+	
+	pthread_mutex_unlock(&q->mutex); // unlock head
+	
+	ptl_np_put_element(q->data, old_head);
+	
+	return element;
+}
+
+
+/* takes the first element, the head lock must be held. The previous dummy
+   node is handed back in 'old_head' to be recycled after unlocking. */
+void* _ptl_tlq_take(ptl_q_t q, ptl_q_element_t *old_head){
+	// only consumers decrement 'size' and they hold the head lock, so a
+	// positive size means a linked node is waiting for us
+	if(PTL_ATOMIC_LOAD(q->size) <= 0){ return NULL; }
+	
+	ptl_q_element_t first = __atomic_load_n(&q->head->next, __ATOMIC_ACQUIRE);
+	
+	// 'first' becomes the new dummy node
+	void *value = first->value;
+	first->value = NULL;
+	*old_head = q->head;
+	q->head = first;
+	
+	// more elements are left, wake the next waiting consumer
+	if(PTL_ATOMIC_DEC(q->size) > 0){
+		pthread_cond_signal(&q->not_empty);
+	}
+	
+	return value;
+}
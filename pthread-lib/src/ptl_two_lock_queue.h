@@ -0,0 +1,152 @@
+/*
+ * This file is part of the pthread-lib Library.
+ * Copyright (C) 2008-2009 Nick Powers.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Library General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor Boston, MA 02110-1301,  USA
+ */
+
+
+/**
+ * This linked queue implementation is a FIFO queue that uses two locks, one
+ * for each end of the queue (Michael & Scott, "Simple, Fast, and Practical
+ * Non-Blocking and Blocking Concurrent Queue Algorithms"). Producers only take
+ * the tail lock and consumers only take the head lock, so an add and a get
+ * never wait on each other. The dummy node at the head keeps the two ends
+ * apart, even when the queue is empty. Capacity is not a concern.
+ */
+
+
+#ifndef __PTL_TWO_LOCK_QUEUE_H__
+#define __PTL_TWO_LOCK_QUEUE_H__
+
+/**
+ * Function table for this queue, e.g. ptl_q_create_queue(&ptl_tlq_funcs, 0)
+ */
+extern struct ptl_q_funcs ptl_tlq_funcs;
+
+/**
+ * Destroys the queue and frees the memory. This should be used when the queue
+ * is no longer going to be used.
+ * 
+ * @param q the queue to destroy
+ */
+void ptl_tlq_destroy_queue(ptl_q_t q);
+
+/**
+ * Initializes the queue, creating all memory needed to support this data
+ * structure, including the head and tail locks. Nodes are recycled through a
+ * node pool (see ptl_node_pool.h), and 'capacity' nodes are preallocated.
+ * 
+ * @param q queue to be initized.
+ */
+void ptl_tlq_init_queue(ptl_q_t q);
+
+/**
+ * Inserts the specified element at the tail of this queue. Only the tail
+ * lock is taken. This queue is unbounded, so capacity is not considered.
+ *
+ * @param q non-null queue
+ * @param value the value to be stored in the queue
+ * @return 1 if successful, 0 otherwise
+ */
+int ptl_tlq_add(ptl_q_t q, void *value);
+
+/**
+ * Inserts up to 'count' elements. The nodes are chained together first and
+ * then linked on under the tail lock once. Stops at the first NULL value.
+ *
+ * @param q non-null queue
+ * @param values elements to add, in order
+ * @param count number of elements in 'values'
+ * @return number of elements added
+ */
+int ptl_tlq_add_batch(ptl_q_t q, void **values, int count);
+
+/**
+ * There is no waiting for this type of queue because it is unbounded. 
+ * It simply calls ptl_tlq_add().
+ * 
+ * @param q non-null queue to add the value
+ * @param value data that will be added to the queue
+ * @param timeout this parameter is ignored
+ * @return 1 if successful, 0 otherwise
+ * @see ptl_tlq_add()
+ **/
+int ptl_tlq_add_wait(ptl_q_t q, void *value, long timeout);
+
+/**
+ * Removes all of the elements from this queue freeing memory as it iterates
+ * through. Please note, it frees the 'values' put in the list under add. To
+ * provide your own function, please use ptl_tlq_clear_freefunc();
+ *
+ * @param q non-null queue to be cleared
+ * @see ptl_tlq_clear_freefunc()
+ */
+void ptl_tlq_clear(ptl_q_t q);
+
+/**
+ * Removes all of the elements from this queue freeing memory as it iterates
+ * through. It frees the 'values' put in the list under add using the function
+ * provided in the free_func parameter.
+ *
+ * @param q non-null queue to be cleared
+ * @param free_func function that will be used to free the 'value' elements
+ * @see ptl_tlq_clear()
+ */
+void ptl_tlq_clear_freefunc(ptl_q_t q, void (*free_func)(void *));
+
+/**
+ * Retrieves, but does not remove, the head of this queue. Only the head lock
+ * is taken.
+ *
+ * @param q non-null queue to peek on
+ * @return pointer to the head element or NULL if no element was found
+ */
+void* ptl_tlq_peek(ptl_q_t q);
+
+/**
+ * Retrieves and removes the head of this queue. It will return null if the 
+ * queue is empty. Only the head lock is taken.
+ *
+ * @param q non-null queue to get an element from
+ * @return the head element or NULL if no element was found
+ */
+void* ptl_tlq_get(ptl_q_t q);
+
+/**
+ * Retrieves and removes up to 'max' elements under the head lock once.
+ *
+ * @param q non-null queue to get elements from
+ * @param values where the elements are stored, in queue order
+ * @param max room in 'values'
+ * @return number of elements stored in 'values'
+ */
+int ptl_tlq_get_batch(ptl_q_t q, void **values, int max);
+
+/**
+ * Retrieves and removes the head of this queue, waiting up to the specified
+ * wait time if necessary for an element to become available. The thread sleeps
+ * on the 'not_empty' condition under the head lock. A producer signals it when
+ * the queue goes from empty to non-empty, and each consumer passes the signal
+ * on while elements remain.
+ *
+ * @param q non-null queue to get an element from
+ * @param timeout time in milliseconds
+ * @return the head element or NULL if no element was found
+ */
+void* ptl_tlq_get_wait(ptl_q_t q, long timeout);
+
+
+#endif
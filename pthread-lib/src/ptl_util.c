@@ -19,7 +19,9 @@
 
 #include <pthread.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <assert.h>
 #include <time.h>
 #include <sys/time.h>
 #include "ptl_util.h"
@@ -37,7 +39,8 @@ int ptl_timed_wait(long wait_usec){
   struct timespec   ts;
 
   pthread_mutex_t timed_wait_mutex = PTHREAD_MUTEX_INITIALIZER;
-  pthread_cond_t  timed_wait_cond = PTHREAD_COND_INITIALIZER;
+  pthread_cond_t  timed_wait_cond;
+  ptl_cond_init(&timed_wait_cond);
 
   ptl_get_future_time(&ts, wait_usec);
 
@@ -54,13 +57,49 @@ int ptl_timed_wait(long wait_usec){
   return timed_wait_result;
 }
 
-/* Gets the time 'usec' microseconds later. */
+/* Gets the time 'usec' microseconds later (CLOCK_MONOTONIC). */
 void ptl_get_future_time(struct timespec *ts, long usec){
-  struct timeval    tp;
-  memset(&tp,0,sizeof(tp));
-	
-  gettimeofday(&tp, NULL);
-	
-  tp.tv_usec += usec; // add time
-  TIMEVAL_TO_TIMESPEC(&tp, ts); // defined locally
+  clock_gettime(CLOCK_MONOTONIC, ts);
+
+  ts->tv_sec += usec / 1000000;
+  ts->tv_nsec += (usec % 1000000) * 1000;
+  if(ts->tv_nsec >= 1000000000){ // carry into seconds
+    ts->tv_sec++;
+    ts->tv_nsec -= 1000000000;
+  }
+}
+
+/* Initializes a condition that waits on CLOCK_MONOTONIC. */
+int ptl_cond_init(pthread_cond_t *cond){
+  pthread_condattr_t attr;
+
+  pthread_condattr_init(&attr);
+  pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+  int rc = pthread_cond_init(cond, &attr);
+  pthread_condattr_destroy(&attr);
+
+  return rc;
+}
+
+/* calloc, but on a cache line boundary. */
+void *ptl_cache_aligned_alloc(size_t size){
+  void *mem = NULL;
+
+  size = (size + PTL_CACHE_LINE_SIZE - 1) & ~((size_t)PTL_CACHE_LINE_SIZE - 1);
+
+  int rc = posix_memalign(&mem, PTL_CACHE_LINE_SIZE, size);
+  assert(rc == 0 && mem);
+
+  memset(mem, 0, size);
+
+  return mem;
+}
+
+/* CLOCK_MONOTONIC in nanoseconds. */
+unsigned long long ptl_get_time_nsec(void){
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
 }
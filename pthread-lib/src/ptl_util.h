@@ -20,6 +20,7 @@
 #ifndef __PTL_UTIL_H__
 #define __PTL_UTIL_H__
 
+#include <pthread.h>
 #include <time.h>
 #include <sys/time.h>
 
@@ -36,6 +37,23 @@
 
 #define INT_TO_CHAR(num,c){ sprintf(c,"%i", num);  }
 
+/* size of a cache line, used to keep data written by different threads apart */
+#define PTL_CACHE_LINE_SIZE 64
+
+/* tell the cpu we're spinning (x86 pause, arm yield), see ptl_wait.h */
+#if defined(__x86_64__) || defined(__i386__)
+#define PTL_CPU_RELAX() __builtin_ia32_pause()
+#elif defined(__aarch64__) || defined(__arm__)
+#define PTL_CPU_RELAX() __asm__ __volatile__("yield" ::: "memory")
+#else
+#define PTL_CPU_RELAX() __asm__ __volatile__("" ::: "memory")
+#endif
+
+/* atomic counters shared by threads that don't hold the same lock (GCC builtins) */
+#define PTL_ATOMIC_LOAD(x) __atomic_load_n(&(x), __ATOMIC_ACQUIRE)
+#define PTL_ATOMIC_INC(x) __atomic_add_fetch(&(x), 1, __ATOMIC_ACQ_REL)
+#define PTL_ATOMIC_DEC(x) __atomic_sub_fetch(&(x), 1, __ATOMIC_ACQ_REL)
+
 # define TIMEVAL_TO_TIMESPEC(tv, ts) {                                   \
         (ts)->tv_sec = (tv)->tv_sec;                                    \
         (ts)->tv_nsec = (tv)->tv_usec * 1000;                           \
@@ -50,7 +68,8 @@
 
 /**
  * Wait wait_usec microseconds. A local mutex and cond is created to call the
- * pthread_cond_timedwait function.
+ * pthread_cond_timedwait function. For waiting on a queue, use the queue's own
+ * conditions instead.
  *
  * @param wait_usec number of microseconds to sleep
  * @return the result of calling pthread_cond_timedwait()
@@ -59,11 +78,40 @@ int ptl_timed_wait(long wait_usec);
 
 
 /**
- * Gets the time 'usec' microseconds later.
+ * Gets the time 'usec' microseconds later on the CLOCK_MONOTONIC clock. The
+ * result is an absolute deadline for pthread_cond_timedwait() on a condition
+ * created with ptl_cond_init(). It is not affected by changes to the wall
+ * clock.
  * 
  * @param ts the result will be stored in this struct
  * @param usec number of microseconds later to get the time
  */
 void ptl_get_future_time(struct timespec *ts, long usec);
 
+/**
+ * Initializes a condition whose timed waits are measured against
+ * CLOCK_MONOTONIC, matching the deadlines from ptl_get_future_time().
+ *
+ * @param cond condition to initialize
+ * @return the result of calling pthread_cond_init()
+ */
+int ptl_cond_init(pthread_cond_t *cond);
+
+/**
+ * Zeroed memory that starts on a cache line boundary, for structs whose
+ * fields are laid out by cache line. Release it with free() or FREE.
+ *
+ * @param size bytes wanted, rounded up to whole cache lines
+ * @return the memory
+ */
+void *ptl_cache_aligned_alloc(size_t size);
+
+/**
+ * Reads CLOCK_MONOTONIC in nanoseconds, for measuring intervals and building
+ * deadlines on the same clock as ptl_get_future_time().
+ *
+ * @return nanoseconds since an arbitrary fixed point
+ */
+unsigned long long ptl_get_time_nsec(void);
+
 #endif
@@ -0,0 +1,197 @@
+/*
+ * This file is part of the pthread-lib Library.
+ * Copyright (C) 2008-2009 Nick Powers.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Library General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor Boston, MA 02110-1301,  USA
+ */
+
+/* See header file for documentation. */
+
+#include <sched.h>
+#include <errno.h>
+#include <limits.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include "ptl_wait.h"
+#include "ptl_util.h"
+
+
+/* Private Functions */
+int _ptl_wait_clamp(const struct ptl_wait_strategy *strategy, int budget);
+
+
+/* Public Functions */
+
+/* the presets, see the header */
+void ptl_wait_strategy_init(struct ptl_wait_strategy *strategy, int preset){
+	if(strategy == NULL){ return; }
+	
+	memset(strategy, 0, sizeof(struct ptl_wait_strategy));
+	
+	switch(preset){
+	case PTL_WAIT_LOW_LATENCY:
+		strategy->spin_min = 256;
+		strategy->spin_max = 16384;
+		strategy->yields = 8;
+		strategy->adaptive = 1;
+		break;
+	case PTL_WAIT_BALANCED:
+		strategy->spin_min = 16;
+		strategy->spin_max = 1024;
+		strategy->yields = 1;
+		strategy->adaptive = 1;
+		break;
+	default: // PTL_WAIT_LOW_CPU, nothing before parking
+		break;
+	}
+	
+	// with one cpu the thread we spin for can't run until we stop
+	if(sysconf(_SC_NPROCESSORS_ONLN) <= 1){
+		strategy->spin_min = 0;
+		strategy->spin_max = 0;
+	}
+}
+
+
+/* pause, then yield, until 'ready' or out of budget */
+int ptl_wait_spin(const struct ptl_wait_strategy *strategy, struct ptl_spin_state *state,
+				  int (*ready)(void *), void *context){
+	if(strategy == NULL || state == NULL || ready == NULL){ return 0; }
+	
+	int budget = strategy->adaptive ? _ptl_wait_clamp(strategy, state->budget) : 
+									  strategy->spin_max;
+	int i = 0;
+	
+	for(i = 0; i < budget; i++){
+		PTL_CPU_RELAX();
+		if(ready(context)){
+			state->budget = _ptl_wait_clamp(strategy, budget * 2);
+			return 1;
+		}
+	}
+	
+	for(i = 0; i < strategy->yields; i++){
+		sched_yield();
+		if(ready(context)){
+			state->budget = _ptl_wait_clamp(strategy, budget * 2);
+			return 1;
+		}
+	}
+	
+	state->budget = budget;
+	
+	return 0;
+}
+
+
+/* a short park would have been caught by spinning longer */
+void ptl_wait_note_park(const struct ptl_wait_strategy *strategy, struct ptl_spin_state *state,
+						unsigned long long parked_nsec){
+	if(strategy == NULL || state == NULL || !strategy->adaptive){ return; }
+	
+	int budget = _ptl_wait_clamp(strategy, state->budget);
+	
+	if(parked_nsec < PTL_WAIT_SHORT_PARK_NSEC){
+		state->budget = _ptl_wait_clamp(strategy, budget * 2);
+	} else {
+		state->budget = _ptl_wait_clamp(strategy, budget / 2);
+	}
+}
+
+
+/* nobody waiting yet */
+void ptl_ec_init(struct ptl_eventcount *ec){
+	if(ec == NULL){ return; }
+	
+	ec->epoch = 0;
+	ec->waiters = 0;
+}
+
+
+/* count ourselves in before the caller looks at its condition */
+unsigned int ptl_ec_prepare(struct ptl_eventcount *ec){
+	// pairs with the fence in ptl_ec_notify_*. Either the notifier sees us
+	// in 'waiters', or we see what it published
+	__atomic_add_fetch(&ec->waiters, 1, __ATOMIC_SEQ_CST);
+	
+	return __atomic_load_n(&ec->epoch, __ATOMIC_SEQ_CST);
+}
+
+
+/* the condition was met, don't wait */
+void ptl_ec_cancel(struct ptl_eventcount *ec){
+	__atomic_sub_fetch(&ec->waiters, 1, __ATOMIC_RELEASE);
+}
+
+
+/* sleep on 'epoch' while it still equals 'key' */
+int ptl_ec_wait(struct ptl_eventcount *ec, unsigned int key, long timeout){
+	struct timespec ts;
+	struct timespec *tsp = NULL;
+	int timed_out = 0;
+	
+	if(timeout >= 0){
+		ts.tv_sec = timeout / 1000;
+		ts.tv_nsec = (timeout % 1000) * 1000000;
+		tsp = &ts;
+	}
+	
+	if(__atomic_load_n(&ec->epoch, __ATOMIC_ACQUIRE) == key){
+		// relative timeout, measured on CLOCK_MONOTONIC
+		if(syscall(SYS_futex, &ec->epoch, FUTEX_WAIT_PRIVATE, key, tsp, NULL, 0) == -1 &&
+		   errno == ETIMEDOUT){
+			timed_out = 1;
+		}
+	}
+	
+	__atomic_sub_fetch(&ec->waiters, 1, __ATOMIC_RELEASE);
+	
+	return !timed_out;
+}
+
+
+/* move the epoch on and wake one, only if someone is registered */
+void ptl_ec_notify_one(struct ptl_eventcount *ec){
+	__atomic_thread_fence(__ATOMIC_SEQ_CST); // see ptl_ec_prepare
+	
+	if(__atomic_load_n(&ec->waiters, __ATOMIC_RELAXED) > 0){
+		__atomic_add_fetch(&ec->epoch, 1, __ATOMIC_RELEASE);
+		syscall(SYS_futex, &ec->epoch, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+	}
+}
+
+
+/* same, waking all of them */
+void ptl_ec_notify_all(struct ptl_eventcount *ec){
+	__atomic_thread_fence(__ATOMIC_SEQ_CST); // see ptl_ec_prepare
+	
+	if(__atomic_load_n(&ec->waiters, __ATOMIC_RELAXED) > 0){
+		__atomic_add_fetch(&ec->epoch, 1, __ATOMIC_RELEASE);
+		syscall(SYS_futex, &ec->epoch, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+	}
+}
+
+
+/* Private Functions */
+
+/* keep 'budget' between the strategy's limits */
+int _ptl_wait_clamp(const struct ptl_wait_strategy *strategy, int budget){
+	if(budget < strategy->spin_min){ return strategy->spin_min; }
+	if(budget > strategy->spin_max){ return strategy->spin_max; }
+	return budget;
+}
@@ -0,0 +1,163 @@
+/*
+ * This file is part of the pthread-lib Library.
+ * Copyright (C) 2008-2009 Nick Powers.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Library General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor Boston, MA 02110-1301,  USA
+ */
+
+/**
+ * Ways for a thread to wait for work without paying for a sleep when the
+ * work is only microseconds away. A wait goes through up to three steps:
+ *
+ *   spin:  check again after each pause instruction (PTL_CPU_RELAX)
+ *   yield: give the cpu to another thread a few times, checking in between
+ *   park:  sleep in the kernel until woken
+ *
+ * How long to spin adapts to what happened lately: the budget doubles when
+ * the work turned up while spinning or soon after parking, and halves when
+ * a park lasted longer than PTL_WAIT_SHORT_PARK_NSEC. Each waiting thread
+ * keeps that history in its own struct ptl_spin_state.
+ *
+ * The park step uses an event count on a futex. A waiter registers, looks
+ * for work once more and only then sleeps; a producer only makes the system
+ * call when a waiter is registered, so notifying nobody costs a fence and a
+ * load.
+ */
+
+#ifndef __PTL_WAIT_H__
+#define __PTL_WAIT_H__
+
+/* Constants */
+
+/**
+ * Presets for ptl_wait_strategy_init:
+ *
+ *   LOW_CPU:     park straight away, as a plain condition wait does
+ *   BALANCED:    spin a few microseconds at most, the default
+ *   LOW_LATENCY: spin up to tens of microseconds and yield before parking;
+ *                burns cpu on idle workers in exchange for faster pickup
+ */
+#define PTL_WAIT_LOW_CPU     0
+#define PTL_WAIT_BALANCED    1
+#define PTL_WAIT_LOW_LATENCY 2
+
+#define PTL_WAIT_SHORT_PARK_NSEC 50000	/**< a park shorter than this means spin more */
+
+
+/* Structures */
+
+struct ptl_wait_strategy {
+	int spin_min;				/**< pauses the budget doesn't shrink below */
+	int spin_max;				/**< pauses the budget doesn't grow above, 0 never spins */
+	int yields;					/**< sched_yield calls between spinning and parking */
+	int adaptive;				/**< 0 always spins 'spin_max' */
+};
+
+/* what one thread's recent waits learned; zero is a valid start */
+struct ptl_spin_state {
+	int budget;					/**< pauses to spin next time */
+};
+
+struct ptl_eventcount {
+	unsigned int epoch;			/**< futex word, moved on by each notify that had waiters */
+	int waiters;				/**< threads between prepare and the end of their wait */
+};
+
+
+/* Public Functions */
+
+/**
+ * Fills in one of the presets. On a single cpu machine the spinning is
+ * left out, only the yields remain.
+ *
+ * @param strategy strategy to fill in
+ * @param preset PTL_WAIT_*
+ */
+void ptl_wait_strategy_init(struct ptl_wait_strategy *strategy, int preset);
+
+/**
+ * Spins, then yields, until 'ready' returns non-zero or the budget is used
+ * up. Doesn't park, the caller does that when this returns 0.
+ *
+ * @param strategy non-null strategy
+ * @param state the calling thread's history, updated
+ * @param ready checked after each pause and yield
+ * @param context passed to 'ready'
+ * @return 1 if 'ready' said so, 0 if it's time to park
+ */
+int ptl_wait_spin(const struct ptl_wait_strategy *strategy, struct ptl_spin_state *state,
+				  int (*ready)(void *), void *context);
+
+/**
+ * Tells the adaptive budget how long the caller was parked after
+ * ptl_wait_spin returned 0.
+ *
+ * @param strategy non-null strategy
+ * @param state the calling thread's history, updated
+ * @param parked_nsec time spent parked
+ */
+void ptl_wait_note_park(const struct ptl_wait_strategy *strategy, struct ptl_spin_state *state,
+						unsigned long long parked_nsec);
+
+/**
+ * Sets up an event count with no waiters.
+ *
+ * @param ec event count to initialize
+ */
+void ptl_ec_init(struct ptl_eventcount *ec);
+
+/**
+ * Registers the caller as a waiter. Check the condition after this, then
+ * either ptl_ec_wait or, if it was met, ptl_ec_cancel.
+ *
+ * @param ec non-null event count
+ * @return key for ptl_ec_wait
+ */
+unsigned int ptl_ec_prepare(struct ptl_eventcount *ec);
+
+/**
+ * Unregisters a waiter that found its condition met after ptl_ec_prepare.
+ *
+ * @param ec non-null event count
+ */
+void ptl_ec_cancel(struct ptl_eventcount *ec);
+
+/**
+ * Sleeps unless there was a notify since ptl_ec_prepare returned 'key', then
+ * unregisters the caller. It may return early, so check the condition again.
+ *
+ * @param ec non-null event count
+ * @param key the value ptl_ec_prepare returned
+ * @param timeout ms to sleep at most, less than 0 for no limit
+ * @return 0 if it timed out, 1 otherwise
+ */
+int ptl_ec_wait(struct ptl_eventcount *ec, unsigned int key, long timeout);
+
+/**
+ * Wakes one waiter, if any is registered. Call it after publishing the
+ * work.
+ *
+ * @param ec non-null event count
+ */
+void ptl_ec_notify_one(struct ptl_eventcount *ec);
+
+/**
+ * Wakes every registered waiter.
+ *
+ * @param ec non-null event count
+ */
+void ptl_ec_notify_all(struct ptl_eventcount *ec);
+
+#endif
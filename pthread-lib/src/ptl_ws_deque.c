@@ -0,0 +1,178 @@
+/*
+ * This file is part of the pthread-lib Library.
+ * Copyright (C) 2008-2009 Nick Powers.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Library General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor Boston, MA 02110-1301,  USA
+ */
+
+ /*
+  * For a "class" description, see the header file. 
+  *
+  * Memory orders follow "Correct and Efficient Work-Stealing for Weak Memory
+  * Models" (Le, Pop, Cohen, Zappa Nardelli, 2013).
+  */
+
+#include <stdlib.h>
+#include <assert.h>
+#include "ptl_ws_deque.h"
+#include "ptl_util.h"
+
+
+/* Private Functions */
+struct ptl_wsd_array *_ptl_wsd_create_array(long size);
+struct ptl_wsd_array *_ptl_wsd_grow(ptl_wsd_t deque, struct ptl_wsd_array *a, long top, long bottom);
+
+
+/* Public Functions */
+
+/* create an empty deque with a ring of at least 'capacity' slots */
+ptl_wsd_t ptl_wsd_create(long capacity){
+	long size = 2;
+	while(size < capacity){
+		size <<= 1;
+	}
+	
+	ptl_wsd_t deque = NULL;
+	int rc = posix_memalign((void **)&deque, PTL_CACHE_LINE_SIZE, sizeof(struct ptl_ws_deque));
+	assert(rc == 0 && deque);
+	
+	deque->top = 0;
+	deque->bottom = 0;
+	deque->array = _ptl_wsd_create_array(size);
+	
+	return deque;
+}
+
+
+/* free the current ring, all retired rings and the deque */
+void ptl_wsd_destroy(ptl_wsd_t deque){
+	if(deque == NULL){ return; }
+	
+	struct ptl_wsd_array *a = deque->array;
+	while(a != NULL){
+		struct ptl_wsd_array *retired = a->retired;
+		FREE(a->buffer);
+		FREE(a);
+		a = retired;
+	}
+	
+	FREE(deque);
+}
+
+
+/* owner: store at the bottom, then publish the new bottom */
+void ptl_wsd_push(ptl_wsd_t deque, void *value){
+	long b = __atomic_load_n(&deque->bottom, __ATOMIC_RELAXED);
+	long t = __atomic_load_n(&deque->top, __ATOMIC_ACQUIRE);
+	struct ptl_wsd_array *a = __atomic_load_n(&deque->array, __ATOMIC_RELAXED);
+	
+	if(b - t > a->mask){ // full
+		a = _ptl_wsd_grow(deque, a, t, b);
+	}
+	
+	__atomic_store_n(&a->buffer[b & a->mask], value, __ATOMIC_RELAXED);
+	__atomic_store_n(&deque->bottom, b + 1, __ATOMIC_RELEASE); // the value before the bottom
+}
+
+
+/* owner: reserve the bottom slot first, only the last one is raced for */
+void *ptl_wsd_pop(ptl_wsd_t deque){
+	long b = __atomic_load_n(&deque->bottom, __ATOMIC_RELAXED) - 1;
+	struct ptl_wsd_array *a = __atomic_load_n(&deque->array, __ATOMIC_RELAXED);
+	__atomic_store_n(&deque->bottom, b, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_SEQ_CST); // see a thief's 'top', or it sees our 'bottom'
+	long t = __atomic_load_n(&deque->top, __ATOMIC_RELAXED);
+	
+	if(t > b){ // was empty
+		__atomic_store_n(&deque->bottom, b + 1, __ATOMIC_RELAXED);
+		return NULL;
+	}
+	
+	void *value = __atomic_load_n(&a->buffer[b & a->mask], __ATOMIC_RELAXED);
+	
+	if(t == b){ // last one, a thief may be taking it too
+		if(!__atomic_compare_exchange_n(&deque->top, &t, t + 1, 0,
+										__ATOMIC_SEQ_CST, __ATOMIC_RELAXED)){
+			value = NULL; // the thief won
+		}
+		__atomic_store_n(&deque->bottom, b + 1, __ATOMIC_RELAXED);
+	}
+	
+	return value;
+}
+
+
+/* thief: read the top slot, then claim it by moving 'top' */
+void *ptl_wsd_steal(ptl_wsd_t deque){
+	long t = __atomic_load_n(&deque->top, __ATOMIC_ACQUIRE);
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	long b = __atomic_load_n(&deque->bottom, __ATOMIC_ACQUIRE);
+	
+	if(t >= b){ // empty
+		return NULL;
+	}
+	
+	struct ptl_wsd_array *a = __atomic_load_n(&deque->array, __ATOMIC_ACQUIRE);
+	void *value = __atomic_load_n(&a->buffer[t & a->mask], __ATOMIC_RELAXED);
+	
+	if(!__atomic_compare_exchange_n(&deque->top, &t, t + 1, 0,
+									__ATOMIC_SEQ_CST, __ATOMIC_RELAXED)){
+		return NULL; // the owner or another thief took it
+	}
+	
+	return value;
+}
+
+
+/* bottom - top, never negative */
+long ptl_wsd_size(ptl_wsd_t deque){
+	long b = __atomic_load_n(&deque->bottom, __ATOMIC_ACQUIRE);
+	long t = __atomic_load_n(&deque->top, __ATOMIC_ACQUIRE);
+	
+	return (b > t) ? b - t : 0;
+}
+
+
+
+/* Private Functions */
+
+/* an empty ring of 'size' slots */
+struct ptl_wsd_array *_ptl_wsd_create_array(long size){
+	struct ptl_wsd_array *a = (struct ptl_wsd_array *)calloc(1, sizeof(struct ptl_wsd_array));
+	assert(a);
+	
+	a->mask = size - 1;
+	a->buffer = (void **)calloc(size, sizeof(void *));
+	assert(a->buffer);
+	a->retired = NULL;
+	
+	return a;
+}
+
+
+/* owner: copy the live slots into a ring twice the size and publish it */
+struct ptl_wsd_array *_ptl_wsd_grow(ptl_wsd_t deque, struct ptl_wsd_array *a, long top, long bottom){
+	struct ptl_wsd_array *bigger = _ptl_wsd_create_array((a->mask + 1) << 1);
+	
+	long i = 0;
+	for(i = top; i < bottom; i++){
+		bigger->buffer[i & bigger->mask] = __atomic_load_n(&a->buffer[i & a->mask], __ATOMIC_RELAXED);
+	}
+	bigger->retired = a; // thieves may still be reading 'a'
+	
+	__atomic_store_n(&deque->array, bigger, __ATOMIC_RELEASE);
+	
+	return bigger;
+}
@@ -0,0 +1,112 @@
+/*
+ * This file is part of the pthread-lib Library.
+ * Copyright (C) 2008-2009 Nick Powers.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Library General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor Boston, MA 02110-1301,  USA
+ */
+
+/**
+ * This "class" is a Chase-Lev work-stealing deque. One thread, the owner,
+ * pushes and pops at the bottom (LIFO, the task it just made is still warm
+ * in its cache). Any other thread may steal from the top (FIFO, the oldest
+ * and usually largest task). The owner only contends with thieves when one
+ * element is left; pushes and pops are otherwise a few plain loads and
+ * stores.
+ *
+ * The ring grows when full. Old rings may still be read by a thief that
+ * loaded them before the swap, so they are kept until the deque is destroyed.
+ * Values may not be NULL, NULL means empty (or a lost steal race).
+ */
+
+#ifndef __PTL_WS_DEQUE_H__
+#define __PTL_WS_DEQUE_H__
+
+#include "ptl_util.h"
+
+/* Constants */
+#define PTL_WSD_DEFAULT_CAPACITY 256	/**< starting ring size */
+
+
+/* Structures */
+
+/* one ring of the deque, replaced by one twice the size when full */
+struct ptl_wsd_array {
+	long mask;						/**< size - 1, size is a power of two */
+	void **buffer;					/**< the slots, read by thieves atomically */
+	struct ptl_wsd_array *retired;	/**< the ring this one replaced */
+};
+
+struct ptl_ws_deque {
+	long top __attribute__((aligned(PTL_CACHE_LINE_SIZE)));	/**< next to steal, thieves CAS it */
+	long bottom __attribute__((aligned(PTL_CACHE_LINE_SIZE)));	/**< next free, owner only */
+	struct ptl_wsd_array *array;	/**< current ring, owner replaces it */
+};
+
+
+/* Type Definitions */
+typedef struct ptl_ws_deque *ptl_wsd_t;
+
+
+/* Public Functions */
+
+/**
+ * Creates an empty deque.
+ *
+ * @param capacity starting number of slots, rounded up to a power of two
+ * @return a new deque
+ */
+ptl_wsd_t ptl_wsd_create(long capacity);
+
+/**
+ * Frees the deque and every ring it used. No thread may be using it. The
+ * values left in it are not freed.
+ *
+ * @param deque deque to destroy
+ */
+void ptl_wsd_destroy(ptl_wsd_t deque);
+
+/**
+ * Pushes 'value' at the bottom, growing the ring if it's full. Owner only.
+ *
+ * @param deque non-null deque
+ * @param value non-null value
+ */
+void ptl_wsd_push(ptl_wsd_t deque, void *value);
+
+/**
+ * Takes the most recently pushed value. Owner only.
+ *
+ * @param deque non-null deque
+ * @return the value, or NULL if empty
+ */
+void *ptl_wsd_pop(ptl_wsd_t deque);
+
+/**
+ * Takes the oldest value. Any thread may call it.
+ *
+ * @param deque non-null deque
+ * @return the value, or NULL if empty or another thread took it first
+ */
+void *ptl_wsd_steal(ptl_wsd_t deque);
+
+/**
+ * Number of values in the deque. Only a hint when other threads are using it.
+ *
+ * @param deque non-null deque
+ * @return number of values
+ */
+long ptl_wsd_size(ptl_wsd_t deque);
+
+#endif
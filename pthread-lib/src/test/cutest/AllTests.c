@@ -4,22 +4,40 @@
 
 CuSuite* CuGetSuite();
 CuSuite* CuStringGetSuite();
+CuSuite* RingQueueGetSuite();
+CuSuite* SpscQueueGetSuite();
+CuSuite* ThreadManagerGetSuite();
+CuSuite* WsDequeGetSuite();
+CuSuite* TaskGetSuite();
+CuSuite* PriorityQueueGetSuite();
+CuSuite* TimerWheelGetSuite();
+CuSuite* HashMapGetSuite();
 
-void RunAllTests(void)
+int RunAllTests(void)
 {
 	CuString *output = CuStringNew();
 	CuSuite* suite = CuSuiteNew();
 
 	CuSuiteAddSuite(suite, CuGetSuite());
 	CuSuiteAddSuite(suite, CuStringGetSuite());
+	CuSuiteAddSuite(suite, RingQueueGetSuite());
+	CuSuiteAddSuite(suite, SpscQueueGetSuite());
+	CuSuiteAddSuite(suite, ThreadManagerGetSuite());
+	CuSuiteAddSuite(suite, WsDequeGetSuite());
+	CuSuiteAddSuite(suite, TaskGetSuite());
+	CuSuiteAddSuite(suite, PriorityQueueGetSuite());
+	CuSuiteAddSuite(suite, TimerWheelGetSuite());
+	CuSuiteAddSuite(suite, HashMapGetSuite());
 
 	CuSuiteRun(suite);
 	CuSuiteSummary(suite, output);
 	CuSuiteDetails(suite, output);
 	printf("%s\n", output->buffer);
+
+	return suite->failCount;
 }
 
 int main(void)
 {
-	RunAllTests();
+	return RunAllTests() != 0;
 }
@@ -0,0 +1,138 @@
+/*
+ * This file is part of the pthread-lib Library.
+ * Copyright (C) 2008-2009 Nick Powers.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Library General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor Boston, MA 02110-1301,  USA
+ */
+
+/*
+ * Single threaded checks of ptl_hash_map, mostly of the open addressing:
+ * keys removed leave tombstones, which have to be rehashed away at the same
+ * size rather than filling the table or making it grow without bound.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include "cutest/CuTest.h"
+#include "../ptl_hash_map.h"
+
+/* Constants */
+#define HM_TEST_KEYS 1000
+#define HM_TEST_LIVE 16				/* keys held at once while churning */
+#define HM_TEST_CHURN 100000
+#define HM_TEST_MAX_TABLE 64		/* more per segment means tombstones made it grow */
+
+
+/* Private Functions */
+void *hm_test_key(long id);
+void *hm_test_value(long id);
+
+
+void TestHashMapPutGetRemove(CuTest *tc)
+{
+	ptl_hash_map_t map = ptl_hm_create_hash_map();
+	long i = 0;
+	
+	for(i = 0; i < HM_TEST_KEYS; i++){
+		CuAssertPtrEquals(tc, NULL, ptl_hm_put(map, hm_test_key(i), hm_test_value(i)));
+	}
+	CuAssertIntEquals(tc, HM_TEST_KEYS, (int)ptl_hm_size(map));
+	
+	// replacing hands back the old value, put_if_absent keeps it
+	CuAssertPtrEquals(tc, hm_test_value(7), ptl_hm_put(map, hm_test_key(7), hm_test_value(8)));
+	CuAssertPtrEquals(tc, hm_test_value(8), ptl_hm_put_if_absent(map, hm_test_key(7), hm_test_value(9)));
+	CuAssertIntEquals(tc, HM_TEST_KEYS, (int)ptl_hm_size(map));
+	
+	for(i = 0; i < HM_TEST_KEYS; i += 2){
+		CuAssertPtrNotNull(tc, ptl_hm_remove(map, hm_test_key(i)));
+	}
+	CuAssertPtrEquals(tc, NULL, ptl_hm_remove(map, hm_test_key(0)));
+	CuAssertIntEquals(tc, HM_TEST_KEYS / 2, (int)ptl_hm_size(map));
+	
+	for(i = 1; i < HM_TEST_KEYS; i += 2){
+		CuAssertPtrEquals(tc, hm_test_value(i == 7 ? 8 : i), ptl_hm_get(map, hm_test_key(i)));
+		CuAssertIntEquals(tc, 0, ptl_hm_contains(map, hm_test_key(i - 1)));
+	}
+	
+	ptl_hm_destroy_hash_map(map);
+}
+
+
+void TestHashMapChurn(CuTest *tc)
+{
+	ptl_hash_map_t map = ptl_hm_create_hash_map_funcs(HM_TEST_LIVE, NULL, NULL);
+	long id = 0;
+	int i = 0;
+	
+	for(id = 0; id < HM_TEST_LIVE; id++){
+		ptl_hm_put(map, hm_test_key(id), hm_test_value(id));
+	}
+	
+	// every key is new, so each remove leaves a tombstone behind
+	for(id = HM_TEST_LIVE; id < HM_TEST_CHURN; id++){
+		long old = id - HM_TEST_LIVE;
+		
+		CuAssertPtrEquals(tc, hm_test_value(old), ptl_hm_remove(map, hm_test_key(old)));
+		CuAssertPtrEquals(tc, NULL, ptl_hm_get(map, hm_test_key(old)));
+		CuAssertPtrEquals(tc, NULL, ptl_hm_put(map, hm_test_key(id), hm_test_value(id)));
+	}
+	
+	CuAssertIntEquals(tc, HM_TEST_LIVE, (int)ptl_hm_size(map));
+	for(id = HM_TEST_CHURN - HM_TEST_LIVE; id < HM_TEST_CHURN; id++){
+		CuAssertPtrEquals(tc, hm_test_value(id), ptl_hm_get(map, hm_test_key(id)));
+	}
+	
+	// still at about the size it started at, with empty slots to end probes
+	for(i = 0; i < PTL_HM_SEGMENTS; i++){
+		struct ptl_hm_segment *segment = &map->segments[i];
+		unsigned long size = segment->mask + 1;
+		
+		CuAssertTrue(tc, size <= HM_TEST_MAX_TABLE);
+		CuAssertTrue(tc, (unsigned long)segment->used * 4 <= size * 3);
+		CuAssertTrue(tc, segment->used >= segment->count);
+	}
+	
+	// a lookup that misses has to reach an empty slot, and does
+	CuAssertIntEquals(tc, 0, ptl_hm_contains(map, hm_test_key(HM_TEST_CHURN)));
+	
+	ptl_hm_clear(map);
+	CuAssertIntEquals(tc, 0, (int)ptl_hm_size(map));
+	
+	ptl_hm_destroy_hash_map(map);
+}
+
+
+CuSuite *HashMapGetSuite(void)
+{
+	CuSuite *suite = CuSuiteNew();
+	
+	SUITE_ADD_TEST(suite, TestHashMapPutGetRemove);
+	SUITE_ADD_TEST(suite, TestHashMapChurn);
+	
+	return suite;
+}
+
+
+/* small ids as keys, off 0 so none is NULL */
+void *hm_test_key(long id){
+	return (void *)(uintptr_t)(id + 1);
+}
+
+
+/* values may not be NULL either */
+void *hm_test_value(long id){
+	return (void *)(uintptr_t)(id * 2 + 1);
+}
@@ -29,8 +29,7 @@ int run()
 {
 	printf("Start ptl_linked_queue_test\n");
 	
-	ptl_q_t q = (ptl_q_t)malloc(sizeof(struct ptl_q));
-	ptl_lq_init_queue (q);
+	ptl_q_t q = ptl_q_create_queue(&ptl_lq_funcs, 0);
 	int i = 0;
 	int *i_ptr = NULL;
 	for(i=0; i<10; i++){
@@ -51,7 +50,7 @@ int run()
 	
 	printf("Number of elements %ld\n", q->size);
 	
-	FREE(q);
+	ptl_q_destroy_queue(q);
 	
 	
 	printf("Done ptl_linked_queue_test\n");
@@ -0,0 +1,203 @@
+/*
+ * This file is part of the pthread-lib Library.
+ * Copyright (C) 2008-2009 Nick Powers.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Library General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor Boston, MA 02110-1301,  USA
+ */
+
+/*
+ * Single threaded checks of ptl_priority_queue: the 4-ary heap hands out the
+ * highest priority first and equal priorities in the order they were added,
+ * and a bounded queue's waits give up after their timeout.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "cutest/CuTest.h"
+#include "../ptl_queue.h"
+#include "../ptl_priority_queue.h"
+#include "../ptl_task.h"
+
+/* Constants */
+#define PQ_TEST_VALUES 500				/* well past PTL_PQ_INITIAL_CAPACITY */
+#define PQ_TEST_PRIORITIES 7
+#define PQ_TEST_TIMEOUT_MSEC 20
+
+
+/* Structures */
+
+struct pq_test_value {
+	long priority;
+	int id;								/* the order it was added in */
+};
+
+
+/* Private Functions */
+long pq_test_priority(void *value);
+void *pq_test_run(void *arg);
+long pq_test_elapsed_msec(struct timespec *since);
+
+
+/* Global Variables */
+static struct pq_test_value pq_test_values[PQ_TEST_VALUES];
+
+
+void TestPriorityQueueOrder(CuTest *tc)
+{
+	ptl_q_t q = ptl_q_create_queue(&ptl_pq_funcs, 0);
+	struct pq_test_value *value = NULL;
+	struct pq_test_value *last = NULL;
+	int i = 0;
+	
+	ptl_pq_set_priority_func(q, pq_test_priority);
+	for(i = 0; i < PQ_TEST_VALUES; i++){
+		pq_test_values[i].priority = (i * 37) % PQ_TEST_PRIORITIES;
+		pq_test_values[i].id = i;
+		CuAssertIntEquals(tc, 1, ptl_q_add(q, &pq_test_values[i]));
+	}
+	CuAssertIntEquals(tc, PQ_TEST_VALUES, (int)ptl_q_size(q));
+	
+	// by priority, then first in first out among equals
+	for(i = 0; i < PQ_TEST_VALUES; i++){
+		value = (struct pq_test_value *)ptl_q_get(q);
+		CuAssertPtrNotNull(tc, value);
+		if(last != NULL){
+			CuAssertTrue(tc, value->priority <= last->priority);
+			CuAssertTrue(tc, value->priority < last->priority || value->id > last->id);
+		}
+		last = value;
+	}
+	CuAssertPtrEquals(tc, NULL, ptl_q_get(q));
+	
+	ptl_q_destroy_queue(q);
+}
+
+
+void TestPriorityQueueTasks(CuTest *tc)
+{
+	ptl_q_t q = ptl_q_create_queue(&ptl_pq_task_funcs, 0);
+	ptl_task_t tasks[4];
+	int priorities[4] = { 1, 5, 3, 5 };
+	int i = 0;
+	
+	for(i = 0; i < 4; i++){
+		tasks[i] = create_task(pq_test_run);
+		tasks[i]->priority = priorities[i];
+		CuAssertIntEquals(tc, 1, ptl_q_add(q, tasks[i]));
+	}
+	
+	CuAssertPtrEquals(tc, tasks[1], ptl_q_peek(q));
+	CuAssertPtrEquals(tc, tasks[1], ptl_q_get(q));
+	CuAssertPtrEquals(tc, tasks[3], ptl_q_get(q));
+	CuAssertPtrEquals(tc, tasks[2], ptl_q_get(q));
+	CuAssertPtrEquals(tc, tasks[0], ptl_q_get(q));
+	
+	for(i = 0; i < 4; i++){
+		destroy_task(tasks[i]);
+	}
+	ptl_q_destroy_queue(q);
+}
+
+
+void TestPriorityQueueBoundedWait(CuTest *tc)
+{
+	ptl_q_t q = ptl_q_create_queue(&ptl_pq_funcs, 2);
+	struct timespec start;
+	
+	CuAssertIntEquals(tc, 1, ptl_q_add(q, &pq_test_values[0]));
+	CuAssertIntEquals(tc, 1, ptl_q_add_wait(q, &pq_test_values[1], PQ_TEST_TIMEOUT_MSEC));
+	CuAssertIntEquals(tc, 0, ptl_q_add(q, &pq_test_values[2]));
+	
+	// nobody takes one, the wait for room runs out
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	CuAssertIntEquals(tc, 0, ptl_q_add_wait(q, &pq_test_values[2], PQ_TEST_TIMEOUT_MSEC));
+	CuAssertTrue(tc, pq_test_elapsed_msec(&start) >= PQ_TEST_TIMEOUT_MSEC - 1);
+	CuAssertIntEquals(tc, 2, (int)ptl_q_size(q));
+	
+	CuAssertPtrEquals(tc, &pq_test_values[0], ptl_q_get_wait(q, PQ_TEST_TIMEOUT_MSEC));
+	CuAssertPtrEquals(tc, &pq_test_values[1], ptl_q_get(q));
+	
+	// nobody adds one, the wait for an element runs out
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	CuAssertPtrEquals(tc, NULL, ptl_q_get_wait(q, PQ_TEST_TIMEOUT_MSEC));
+	CuAssertTrue(tc, pq_test_elapsed_msec(&start) >= PQ_TEST_TIMEOUT_MSEC - 1);
+	
+	ptl_q_destroy_queue(q);
+}
+
+
+void TestPriorityQueueAddEvict(CuTest *tc)
+{
+	ptl_q_t q = ptl_q_create_queue(&ptl_pq_funcs, 2);
+	void *evicted = &pq_test_values[0];
+	int i = 0;
+	
+	ptl_pq_set_priority_func(q, pq_test_priority);
+	for(i = 0; i < 3; i++){
+		pq_test_values[i].priority = i;
+		pq_test_values[i].id = i;
+	}
+	
+	// room left, nothing goes
+	CuAssertIntEquals(tc, 1, ptl_q_add_evict(q, &pq_test_values[0], &evicted));
+	CuAssertPtrEquals(tc, NULL, evicted);
+	CuAssertIntEquals(tc, 1, ptl_q_add_evict(q, &pq_test_values[2], &evicted));
+	CuAssertPtrEquals(tc, NULL, evicted);
+	
+	// full, so the head (the highest priority) makes way
+	CuAssertIntEquals(tc, 1, ptl_q_add_evict(q, &pq_test_values[1], &evicted));
+	CuAssertPtrEquals(tc, &pq_test_values[2], evicted);
+	CuAssertIntEquals(tc, 2, (int)ptl_q_size(q));
+	CuAssertPtrEquals(tc, &pq_test_values[1], ptl_q_get(q));
+	CuAssertPtrEquals(tc, &pq_test_values[0], ptl_q_get(q));
+	
+	ptl_q_destroy_queue(q);
+}
+
+
+CuSuite *PriorityQueueGetSuite(void)
+{
+	CuSuite *suite = CuSuiteNew();
+	
+	SUITE_ADD_TEST(suite, TestPriorityQueueOrder);
+	SUITE_ADD_TEST(suite, TestPriorityQueueTasks);
+	SUITE_ADD_TEST(suite, TestPriorityQueueBoundedWait);
+	SUITE_ADD_TEST(suite, TestPriorityQueueAddEvict);
+	
+	return suite;
+}
+
+
+/* the priority stored with the value */
+long pq_test_priority(void *value){
+	return ((struct pq_test_value *)value)->priority;
+}
+
+
+/* tasks only get queued, never run */
+void *pq_test_run(void *arg){
+	return arg;
+}
+
+
+/* ms since 'since' on the monotonic clock */
+long pq_test_elapsed_msec(struct timespec *since){
+	struct timespec now;
+	
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	
+	return (now.tv_sec - since->tv_sec) * 1000 + (now.tv_nsec - since->tv_nsec) / 1000000;
+}
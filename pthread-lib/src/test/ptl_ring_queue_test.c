@@ -0,0 +1,150 @@
+/*
+ * This file is part of the pthread-lib Library.
+ * Copyright (C) 2008-2009 Nick Powers.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Library General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor Boston, MA 02110-1301,  USA
+ */
+
+/*
+ * Single threaded checks of ptl_ring_queue: order, the full and empty ends,
+ * and the sequence numbers staying right as the ring wraps many times.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "cutest/CuTest.h"
+#include "../ptl_queue.h"
+#include "../ptl_ring_queue.h"
+
+/* Constants */
+#define RQ_TEST_CAPACITY 8
+#define RQ_TEST_ROUNDS 1000
+
+
+/* Global Variables */
+static long rq_test_values[RQ_TEST_CAPACITY * 4];
+
+
+void TestRingQueueCapacity(CuTest *tc)
+{
+	ptl_q_t q = ptl_q_create_queue(&ptl_rq_funcs, 5);
+	
+	CuAssertIntEquals(tc, 8, (int)q->capacity); // rounded up to a power of two
+	CuAssertIntEquals(tc, 0, (int)ptl_q_size(q));
+	CuAssertPtrEquals(tc, NULL, ptl_q_get(q));
+	CuAssertPtrEquals(tc, NULL, ptl_q_peek(q));
+	
+	ptl_q_destroy_queue(q);
+}
+
+
+void TestRingQueueFifo(CuTest *tc)
+{
+	ptl_q_t q = ptl_q_create_queue(&ptl_rq_funcs, RQ_TEST_CAPACITY);
+	int i = 0;
+	
+	for(i = 0; i < RQ_TEST_CAPACITY; i++){
+		CuAssertIntEquals(tc, 1, ptl_q_add(q, &rq_test_values[i]));
+	}
+	CuAssertIntEquals(tc, 0, ptl_q_add(q, &rq_test_values[i])); // full
+	CuAssertIntEquals(tc, RQ_TEST_CAPACITY, (int)ptl_q_size(q));
+	CuAssertPtrEquals(tc, &rq_test_values[0], ptl_q_peek(q));
+	
+	for(i = 0; i < RQ_TEST_CAPACITY; i++){
+		CuAssertPtrEquals(tc, &rq_test_values[i], ptl_q_get(q));
+	}
+	CuAssertPtrEquals(tc, NULL, ptl_q_get(q));
+	CuAssertIntEquals(tc, 0, (int)ptl_q_size(q));
+	
+	ptl_q_destroy_queue(q);
+}
+
+
+void TestRingQueueWrap(CuTest *tc)
+{
+	ptl_q_t q = ptl_q_create_queue(&ptl_rq_funcs, RQ_TEST_CAPACITY);
+	int next_in = 0;
+	int next_out = 0;
+	int round = 0;
+	int i = 0;
+	
+	// keep 3 in the ring so head and tail cross the end at different times
+	for(i = 0; i < 3; i++){
+		ptl_q_add(q, &rq_test_values[next_in++ % RQ_TEST_CAPACITY]);
+	}
+	
+	for(round = 0; round < RQ_TEST_ROUNDS; round++){
+		CuAssertIntEquals(tc, 1, ptl_q_add(q, &rq_test_values[next_in++ % RQ_TEST_CAPACITY]));
+		CuAssertPtrEquals(tc, &rq_test_values[next_out++ % RQ_TEST_CAPACITY], ptl_q_get(q));
+		CuAssertIntEquals(tc, 3, (int)ptl_q_size(q));
+	}
+	
+	// fill it after all that wrapping, then empty it again
+	while(ptl_q_add(q, &rq_test_values[next_in % RQ_TEST_CAPACITY])){
+		next_in++;
+	}
+	CuAssertIntEquals(tc, RQ_TEST_CAPACITY, next_in - next_out);
+	while(next_out < next_in){
+		CuAssertPtrEquals(tc, &rq_test_values[next_out++ % RQ_TEST_CAPACITY], ptl_q_get(q));
+	}
+	CuAssertPtrEquals(tc, NULL, ptl_q_get(q));
+	
+	ptl_q_destroy_queue(q);
+}
+
+
+void TestRingQueueBatch(CuTest *tc)
+{
+	ptl_q_t q = ptl_q_create_queue(&ptl_rq_funcs, RQ_TEST_CAPACITY);
+	void *values[RQ_TEST_CAPACITY * 2];
+	void *got[RQ_TEST_CAPACITY * 2];
+	int i = 0;
+	
+	for(i = 0; i < RQ_TEST_CAPACITY * 2; i++){
+		values[i] = &rq_test_values[i];
+	}
+	
+	// move the ends to the middle, so the batches below wrap
+	CuAssertIntEquals(tc, 5, ptl_q_add_batch(q, values, 5));
+	CuAssertIntEquals(tc, 5, ptl_q_get_batch(q, got, RQ_TEST_CAPACITY));
+	
+	// only what fits goes in
+	CuAssertIntEquals(tc, RQ_TEST_CAPACITY, ptl_q_add_batch(q, values, RQ_TEST_CAPACITY * 2));
+	CuAssertIntEquals(tc, 3, ptl_q_get_batch(q, got, 3));
+	CuAssertIntEquals(tc, RQ_TEST_CAPACITY - 3, ptl_q_get_batch(q, got + 3, RQ_TEST_CAPACITY));
+	for(i = 0; i < RQ_TEST_CAPACITY; i++){
+		CuAssertPtrEquals(tc, values[i], got[i]);
+	}
+	
+	// a NULL ends the batch
+	values[2] = NULL;
+	CuAssertIntEquals(tc, 2, ptl_q_add_batch(q, values, 4));
+	CuAssertIntEquals(tc, 2, (int)ptl_q_size(q));
+	
+	ptl_q_destroy_queue(q);
+}
+
+
+CuSuite *RingQueueGetSuite(void)
+{
+	CuSuite *suite = CuSuiteNew();
+	
+	SUITE_ADD_TEST(suite, TestRingQueueCapacity);
+	SUITE_ADD_TEST(suite, TestRingQueueFifo);
+	SUITE_ADD_TEST(suite, TestRingQueueWrap);
+	SUITE_ADD_TEST(suite, TestRingQueueBatch);
+	
+	return suite;
+}
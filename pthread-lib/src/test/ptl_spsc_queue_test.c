@@ -0,0 +1,245 @@
+/*
+ * This file is part of the pthread-lib Library.
+ * Copyright (C) 2008-2009 Nick Powers.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Library General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor Boston, MA 02110-1301,  USA
+ */
+
+/*
+ * Checks of ptl_spsc_queue: order and the full and empty ends on one thread,
+ * then a producer and a consumer thread passing values through the waiting
+ * calls, which have to wake each other up.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include "cutest/CuTest.h"
+#include "../ptl_queue.h"
+#include "../ptl_spsc_queue.h"
+
+/* Constants */
+#define SPSC_TEST_CAPACITY 8
+#define SPSC_TEST_ROUNDS 1000
+#define SPSC_TEST_HANDOFFS 100000
+#define SPSC_TEST_TIMEOUT_MSEC 20
+#define SPSC_TEST_WAKEUPS 20
+
+
+/* Structures */
+
+/* a consumer in ptl_q_get_wait, and how long after the add it returned */
+struct spsc_test_waiter {
+	ptl_q_t q;
+	pthread_t thread;
+	void *value;
+	struct timespec added;				/* set by the test before it unlocks */
+	long latency_usec;
+};
+
+
+/* Private Functions */
+struct ptl_spsc_state;
+int _ptl_spsc_try_add(struct ptl_spsc_state *sq, void *value);
+
+void *spsc_test_produce(void *q);
+void *spsc_test_wait(void *waiter);
+long spsc_test_elapsed_msec(struct timespec *since);
+
+
+/* Global Variables */
+static long spsc_test_values[SPSC_TEST_CAPACITY + 1];
+
+
+void TestSpscQueueFifo(CuTest *tc)
+{
+	ptl_q_t q = ptl_q_create_queue(&ptl_spsc_funcs, 5);
+	int i = 0;
+	
+	CuAssertIntEquals(tc, SPSC_TEST_CAPACITY, (int)q->capacity); // a power of two
+	CuAssertPtrEquals(tc, NULL, ptl_q_get(q));
+	
+	for(i = 0; i < SPSC_TEST_CAPACITY; i++){
+		CuAssertIntEquals(tc, 1, ptl_q_add(q, &spsc_test_values[i]));
+	}
+	CuAssertIntEquals(tc, 0, ptl_q_add(q, &spsc_test_values[i])); // full
+	CuAssertIntEquals(tc, SPSC_TEST_CAPACITY, (int)ptl_q_size(q));
+	CuAssertPtrEquals(tc, &spsc_test_values[0], ptl_q_peek(q));
+	
+	for(i = 0; i < SPSC_TEST_CAPACITY; i++){
+		CuAssertPtrEquals(tc, &spsc_test_values[i], ptl_q_get(q));
+	}
+	CuAssertPtrEquals(tc, NULL, ptl_q_get(q));
+	CuAssertIntEquals(tc, 0, (int)ptl_q_size(q));
+	
+	ptl_q_destroy_queue(q);
+}
+
+
+void TestSpscQueueWrap(CuTest *tc)
+{
+	ptl_q_t q = ptl_q_create_queue(&ptl_spsc_funcs, SPSC_TEST_CAPACITY);
+	int next_in = 0;
+	int next_out = 0;
+	int round = 0;
+	
+	// three in, two out, so the ends keep moving around the ring
+	for(round = 0; round < SPSC_TEST_ROUNDS; round++){
+		while(ptl_q_size(q) + 3 <= SPSC_TEST_CAPACITY && next_in < next_out + 3){
+			CuAssertIntEquals(tc, 1, ptl_q_add(q, &spsc_test_values[next_in++ % SPSC_TEST_CAPACITY]));
+		}
+		CuAssertPtrEquals(tc, &spsc_test_values[next_out++ % SPSC_TEST_CAPACITY], ptl_q_get(q));
+		CuAssertPtrEquals(tc, &spsc_test_values[next_out++ % SPSC_TEST_CAPACITY], ptl_q_get(q));
+		CuAssertIntEquals(tc, next_in - next_out, (int)ptl_q_size(q));
+	}
+	
+	ptl_q_destroy_queue(q);
+}
+
+
+void TestSpscQueueWaitTimeout(CuTest *tc)
+{
+	ptl_q_t q = ptl_q_create_queue(&ptl_spsc_funcs, 2);
+	struct timespec start;
+	
+	// nothing comes, the wait runs out
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	CuAssertPtrEquals(tc, NULL, ptl_q_get_wait(q, SPSC_TEST_TIMEOUT_MSEC));
+	CuAssertTrue(tc, spsc_test_elapsed_msec(&start) >= SPSC_TEST_TIMEOUT_MSEC - 1);
+	
+	// no room comes either
+	CuAssertIntEquals(tc, 1, ptl_q_add_wait(q, &spsc_test_values[0], SPSC_TEST_TIMEOUT_MSEC));
+	CuAssertIntEquals(tc, 1, ptl_q_add(q, &spsc_test_values[1]));
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	CuAssertIntEquals(tc, 0, ptl_q_add_wait(q, &spsc_test_values[2], SPSC_TEST_TIMEOUT_MSEC));
+	CuAssertTrue(tc, spsc_test_elapsed_msec(&start) >= SPSC_TEST_TIMEOUT_MSEC - 1);
+	CuAssertPtrEquals(tc, &spsc_test_values[0], ptl_q_get_wait(q, 0));
+	
+	ptl_q_destroy_queue(q);
+}
+
+
+void TestSpscQueueHandoff(CuTest *tc)
+{
+	ptl_q_t q = ptl_q_create_queue(&ptl_spsc_funcs, SPSC_TEST_CAPACITY);
+	pthread_t producer;
+	long expected = 1;
+	int in_order = 1;
+	
+	// both sides block in turn, on a full ring and on an empty one
+	pthread_create(&producer, NULL, spsc_test_produce, q);
+	while(expected <= SPSC_TEST_HANDOFFS){
+		void *value = ptl_q_get_wait(q, 1000);
+		if(value == NULL){
+			break;
+		}
+		in_order &= ((long)(intptr_t)value == expected++);
+	}
+	pthread_join(producer, NULL);
+	
+	CuAssertIntEquals(tc, 1, in_order);
+	CuAssertTrue(tc, expected == SPSC_TEST_HANDOFFS + 1);
+	CuAssertIntEquals(tc, 0, (int)ptl_q_size(q));
+	
+	ptl_q_destroy_queue(q);
+}
+
+
+void TestSpscQueueNoLostWakeup(CuTest *tc)
+{
+	ptl_q_t q = ptl_q_create_queue(&ptl_spsc_funcs, SPSC_TEST_CAPACITY);
+	struct spsc_test_waiter waiter;
+	long total = 0;
+	int round = 0;
+	
+	waiter.q = q;
+	
+	// the consumer has set its flag and waits for the lock when the value
+	// and the signal come; it must see the value, not sleep out a recheck
+	for(round = 0; round < SPSC_TEST_WAKEUPS; round++){
+		pthread_mutex_lock(&q->mutex);
+		pthread_create(&waiter.thread, NULL, spsc_test_wait, &waiter);
+		usleep(PTL_SPSC_RECHECK_USEC / 4);
+		
+		_ptl_spsc_try_add((struct ptl_spsc_state *)q->data, &spsc_test_values[0]);
+		pthread_cond_signal(&q->not_empty);
+		clock_gettime(CLOCK_MONOTONIC, &waiter.added);
+		pthread_mutex_unlock(&q->mutex);
+		
+		pthread_join(waiter.thread, NULL);
+		CuAssertPtrEquals(tc, &spsc_test_values[0], waiter.value);
+		total += waiter.latency_usec;
+	}
+	
+	// each missed signal costs PTL_SPSC_RECHECK_USEC
+	CuAssertTrue(tc, total < SPSC_TEST_WAKEUPS * PTL_SPSC_RECHECK_USEC / 4);
+	
+	ptl_q_destroy_queue(q);
+}
+
+
+CuSuite *SpscQueueGetSuite(void)
+{
+	CuSuite *suite = CuSuiteNew();
+	
+	SUITE_ADD_TEST(suite, TestSpscQueueFifo);
+	SUITE_ADD_TEST(suite, TestSpscQueueWrap);
+	SUITE_ADD_TEST(suite, TestSpscQueueWaitTimeout);
+	SUITE_ADD_TEST(suite, TestSpscQueueHandoff);
+	SUITE_ADD_TEST(suite, TestSpscQueueNoLostWakeup);
+	
+	return suite;
+}
+
+
+/* adds 1 to SPSC_TEST_HANDOFFS, as if they were pointers */
+void *spsc_test_produce(void *q){
+	long i = 0;
+	
+	for(i = 1; i <= SPSC_TEST_HANDOFFS; i++){
+		if(!ptl_q_add_wait((ptl_q_t)q, (void *)(intptr_t)i, 1000)){
+			break;
+		}
+	}
+	
+	return NULL;
+}
+
+
+/* one ptl_q_get_wait, timed from when the test added the value */
+void *spsc_test_wait(void *waiter){
+	struct spsc_test_waiter *w = (struct spsc_test_waiter *)waiter;
+	struct timespec now;
+	
+	w->value = ptl_q_get_wait(w->q, 1000);
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	w->latency_usec = (now.tv_sec - w->added.tv_sec) * 1000000 + 
+		(now.tv_nsec - w->added.tv_nsec) / 1000;
+	
+	return NULL;
+}
+
+
+/* ms since 'since' on the monotonic clock */
+long spsc_test_elapsed_msec(struct timespec *since){
+	struct timespec now;
+	
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	
+	return (now.tv_sec - since->tv_sec) * 1000 + (now.tv_nsec - since->tv_nsec) / 1000000;
+}
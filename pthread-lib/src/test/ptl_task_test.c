@@ -0,0 +1,233 @@
+/*
+ * This file is part of the pthread-lib Library.
+ * Copyright (C) 2008-2009 Nick Powers.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Library General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor Boston, MA 02110-1301,  USA
+ */
+
+/*
+ * Checks of tasks and their futures without a thread manager: the test
+ * moves each task through its states itself, with ptl_task_start and
+ * ptl_task_finish as a worker would.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <time.h>
+#include "cutest/CuTest.h"
+#include "../ptl_task.h"
+
+/* Constants */
+#define TASK_TEST_TIMEOUT_MSEC 20
+#define TASK_TEST_RESULT ((void *)7)
+
+
+/* Private Functions */
+void *task_test_function(void *arg);
+void *task_test_finish_later(void *task);
+long task_test_elapsed_msec(struct timespec *since);
+int task_test_submit(void *manager, ptl_task_t task);
+
+
+/* Global Variables */
+static ptl_task_t task_test_submitted;		/* last task task_test_submit was given */
+
+
+void TestTaskPooled(CuTest *tc)
+{
+	ptl_task_t task = create_task(task_test_function);
+	ptl_future_t future = ptl_task_get_future(task);
+	ptl_task_t other = NULL;
+	
+	// the future still owns it, so it isn't handed out again
+	destroy_task(task);
+	other = create_task(task_test_function);
+	CuAssertTrue(tc, other != task);
+	destroy_task(other);
+	
+	// other went back to the cache, then task on top of it
+	ptl_future_destroy(future);
+	CuAssertPtrEquals(tc, task, create_task(task_test_function));
+	CuAssertPtrEquals(tc, other, create_task(task_test_function));
+	CuAssertIntEquals(tc, PTL_TASK_STATE_CREATED, other->state);
+	
+	destroy_task(task);
+	destroy_task(other);
+}
+
+
+void TestFutureDone(CuTest *tc)
+{
+	ptl_task_t task = create_task_with_arg(task_test_function, TASK_TEST_RESULT);
+	ptl_future_t future = ptl_task_get_future(task);
+	
+	CuAssertPtrEquals(tc, TASK_TEST_RESULT, task->arg);
+	CuAssertIntEquals(tc, 0, ptl_future_is_done(future));
+	CuAssertPtrEquals(tc, NULL, ptl_future_get(future, 0));
+	
+	CuAssertIntEquals(tc, 1, ptl_task_start(task));
+	CuAssertIntEquals(tc, 0, ptl_future_is_done(future));
+	ptl_task_finish(task, task->function_to_execute(task->arg), PTL_TASK_STATE_DONE);
+	
+	CuAssertIntEquals(tc, 1, ptl_future_is_done(future));
+	CuAssertPtrEquals(tc, TASK_TEST_RESULT, ptl_future_get(future, 0));
+	CuAssertPtrEquals(tc, TASK_TEST_RESULT, ptl_future_get(future, PTL_FUTURE_WAIT_FOREVER));
+	CuAssertIntEquals(tc, 0, ptl_future_cancel(future)); // too late
+	
+	destroy_task(task);
+	ptl_future_destroy(future);
+}
+
+
+void TestFutureGetTimeout(CuTest *tc)
+{
+	ptl_task_t task = create_task_with_arg(task_test_function, TASK_TEST_RESULT);
+	ptl_future_t future = ptl_task_get_future(task);
+	struct timespec start;
+	pthread_t finisher;
+	
+	// nobody runs it, the wait runs out
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	CuAssertPtrEquals(tc, NULL, ptl_future_get(future, TASK_TEST_TIMEOUT_MSEC));
+	CuAssertTrue(tc, task_test_elapsed_msec(&start) >= TASK_TEST_TIMEOUT_MSEC - 1);
+	CuAssertIntEquals(tc, 0, ptl_future_is_done(future));
+	
+	// finished by another thread while this one sleeps on the future
+	CuAssertIntEquals(tc, 1, ptl_task_start(task));
+	pthread_create(&finisher, NULL, task_test_finish_later, task);
+	CuAssertPtrEquals(tc, TASK_TEST_RESULT, ptl_future_get(future, PTL_FUTURE_WAIT_FOREVER));
+	CuAssertIntEquals(tc, 1, ptl_future_is_done(future));
+	pthread_join(finisher, NULL);
+	
+	destroy_task(task);
+	ptl_future_destroy(future);
+}
+
+
+void TestFutureCancel(CuTest *tc)
+{
+	ptl_task_t task = create_task_with_arg(task_test_function, TASK_TEST_RESULT);
+	ptl_future_t future = ptl_task_get_future(task);
+	
+	CuAssertIntEquals(tc, 1, ptl_future_cancel(future));
+	CuAssertIntEquals(tc, 0, ptl_future_cancel(future));
+	CuAssertIntEquals(tc, PTL_TASK_STATE_CANCELLED, task->state);
+	
+	// a worker that dequeues it doesn't run it, waiters get no result
+	CuAssertIntEquals(tc, 0, ptl_task_start(task));
+	CuAssertIntEquals(tc, 1, ptl_future_is_done(future));
+	CuAssertPtrEquals(tc, NULL, ptl_future_get(future, PTL_FUTURE_WAIT_FOREVER));
+	
+	destroy_task(task);
+	ptl_future_destroy(future);
+}
+
+
+void TestTaskWhenAll(CuTest *tc)
+{
+	ptl_task_t tasks[2] = { create_task(task_test_function), create_task(task_test_function) };
+	ptl_task_t next = create_task(task_test_function);
+	
+	CuAssertIntEquals(tc, 1, ptl_task_when_all(tasks, 2, next));
+	CuAssertIntEquals(tc, 3, next->pending); // its submit and both tasks
+	
+	// held by its submit, the last predecessor to finish submits it
+	task_test_submitted = NULL;
+	CuAssertIntEquals(tc, 1, ptl_task_hold(next, task_test_submit, NULL));
+	ptl_task_finish(tasks[1], NULL, PTL_TASK_STATE_DONE);
+	CuAssertPtrEquals(tc, NULL, task_test_submitted);
+	ptl_task_finish(tasks[0], NULL, PTL_TASK_STATE_CANCELLED);
+	CuAssertPtrEquals(tc, next, task_test_submitted);
+	
+	destroy_task(tasks[0]);
+	destroy_task(tasks[1]);
+	destroy_task(next);
+}
+
+
+void TestTaskWhenAllRejectsBadEntry(CuTest *tc)
+{
+	ptl_task_t first = create_task(task_test_function);
+	ptl_task_t next = create_task(task_test_function);
+	ptl_task_t with_null[3] = { first, NULL, first };
+	ptl_task_t with_next[2] = { first, next };
+	
+	// nothing is linked, not even the entries before the bad one
+	CuAssertIntEquals(tc, 0, ptl_task_when_all(with_null, 3, next));
+	CuAssertIntEquals(tc, 0, ptl_task_when_all(with_next, 2, next));
+	CuAssertIntEquals(tc, 1, next->pending);
+	CuAssertPtrEquals(tc, NULL, first->successors);
+	
+	// so its submit isn't held, and finishing 'first' doesn't submit it
+	task_test_submitted = NULL;
+	CuAssertIntEquals(tc, 0, ptl_task_hold(next, task_test_submit, NULL));
+	ptl_task_finish(first, NULL, PTL_TASK_STATE_DONE);
+	CuAssertPtrEquals(tc, NULL, task_test_submitted);
+	
+	destroy_task(first);
+	destroy_task(next);
+}
+
+
+CuSuite *TaskGetSuite(void)
+{
+	CuSuite *suite = CuSuiteNew();
+	
+	SUITE_ADD_TEST(suite, TestTaskPooled);
+	SUITE_ADD_TEST(suite, TestFutureDone);
+	SUITE_ADD_TEST(suite, TestFutureGetTimeout);
+	SUITE_ADD_TEST(suite, TestFutureCancel);
+	SUITE_ADD_TEST(suite, TestTaskWhenAll);
+	SUITE_ADD_TEST(suite, TestTaskWhenAllRejectsBadEntry);
+	
+	return suite;
+}
+
+
+/* returns its argument */
+void *task_test_function(void *arg){
+	return arg;
+}
+
+
+/* runs a started task after TASK_TEST_TIMEOUT_MSEC */
+void *task_test_finish_later(void *task){
+	ptl_task_t started = (ptl_task_t)task;
+	
+	usleep(TASK_TEST_TIMEOUT_MSEC * 1000);
+	ptl_task_finish(started, started->function_to_execute(started->arg), 
+					PTL_TASK_STATE_DONE);
+	
+	return NULL;
+}
+
+
+/* stands in for a manager's submit, released tasks only get noted */
+int task_test_submit(void *manager, ptl_task_t task){
+	task_test_submitted = task;
+	return 1;
+}
+
+
+/* ms since 'since' on the monotonic clock */
+long task_test_elapsed_msec(struct timespec *since){
+	struct timespec now;
+	
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	
+	return (now.tv_sec - since->tv_sec) * 1000 + (now.tv_nsec - since->tv_nsec) / 1000000;
+}
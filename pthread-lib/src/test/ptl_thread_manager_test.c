@@ -0,0 +1,588 @@
+/*
+ * This file is part of the pthread-lib Library.
+ * Copyright (C) 2008-2009 Nick Powers.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Library General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor Boston, MA 02110-1301,  USA
+ */
+
+/*
+ * Checks of the thread manager's pool and of what happens to tasks it can't
+ * take. Tasks that block on 'tm_test_gate' hold workers busy, so the pool and
+ * 'work_q' can be filled to the point under test before the gate opens.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <unistd.h>
+#include "cutest/CuTest.h"
+#include "../ptl_queue.h"
+#include "../ptl_linked_queue.h"
+#include "../ptl_array_queue.h"
+#include "../ptl_ring_queue.h"
+#include "../ptl_thread_manager.h"
+
+/* Constants */
+#define TM_TEST_TASKS 100
+#define TM_TEST_IDS 16						/* ids a blocking task can mark */
+#define TM_TEST_KEEP_ALIVE_MSEC 50
+#define TM_TEST_WAIT_MSEC 5000				/* before a wait counts as failed */
+
+
+/* Private Functions */
+void *tm_test_count(void *arg);
+void *tm_test_block(void *arg);
+void *tm_test_spawn(void *manager);
+void *tm_test_caller(void *arg);
+void *tm_test_open_later(void *arg);
+void tm_test_rejected(void *task);
+int tm_test_wait_for(int *counter, int value);
+int tm_test_wait_pool_size(ptl_thread_manager_t manager, int size);
+void tm_test_reset();
+ptl_thread_manager_t tm_test_saturate(int (*policy)(ptl_thread_manager_t, ptl_task_t));
+void tm_test_release(int ran);
+
+
+/* Global Variables */
+static int tm_test_gate;					/* blocking tasks wait until it is 1 */
+static int tm_test_started;					/* blocking tasks that began */
+static int tm_test_ran;						/* tasks that finished */
+static int tm_test_rejections;				/* calls to tm_test_rejected */
+static int tm_test_ran_ids[TM_TEST_IDS];	/* which blocking tasks finished */
+static pthread_t tm_test_caller_thread;		/* where tm_test_caller ran */
+
+
+void TestManagerRunsTasks(CuTest *tc)
+{
+	ptl_q_t q = ptl_q_create_queue(&ptl_lq_funcs, 0);
+	ptl_thread_manager_t manager = create_thread_manager(2, 2, 1000, q, NULL);
+	int i = 0;
+	
+	tm_test_reset();
+	for(i = 0; i < TM_TEST_TASKS; i++){
+		CuAssertIntEquals(tc, 1, submit(manager, tm_test_count));
+	}
+	
+	CuAssertIntEquals(tc, 1, tm_test_wait_for(&tm_test_ran, TM_TEST_TASKS));
+	CuAssertIntEquals(tc, 2, ptl_tm_get_pool_size(manager));
+	
+	// a run is counted once its task has returned
+	for(i = 0; i < TM_TEST_WAIT_MSEC && 
+		ptl_tm_get_completed_task_count(manager) < TM_TEST_TASKS; i++){
+		usleep(1000);
+	}
+	CuAssertTrue(tc, ptl_tm_get_completed_task_count(manager) == TM_TEST_TASKS);
+	
+	CuAssertIntEquals(tc, 1, destroy_thread_manager(manager));
+	ptl_q_destroy_queue(q);
+}
+
+
+void TestManagerGrowsToMax(CuTest *tc)
+{
+	ptl_q_t q = ptl_q_create_queue(&ptl_rq_funcs, 2);
+	ptl_thread_manager_t manager = create_thread_manager(1, 4, 1000, q, tm_test_rejected);
+	int i = 0;
+	
+	tm_test_reset();
+	CuAssertIntEquals(tc, 1, ptl_tm_get_pool_size(manager));
+	
+	// busy threads and a task waiting, so another thread starts, up to max
+	for(i = 1; i <= 4; i++){
+		CuAssertIntEquals(tc, 1, submit(manager, tm_test_block));
+		CuAssertIntEquals(tc, 1, tm_test_wait_for(&tm_test_started, i));
+	}
+	CuAssertIntEquals(tc, 1, submit(manager, tm_test_block));
+	CuAssertIntEquals(tc, 1, submit(manager, tm_test_block));
+	CuAssertIntEquals(tc, 4, ptl_tm_get_pool_size(manager));
+	CuAssertIntEquals(tc, 2, (int)ptl_q_size(q));
+	
+	// at max with the queue full, the default policy rejects
+	CuAssertIntEquals(tc, 0, submit(manager, tm_test_block));
+	CuAssertIntEquals(tc, 1, tm_test_rejections);
+	
+	__atomic_store_n(&tm_test_gate, 1, __ATOMIC_RELEASE);
+	CuAssertIntEquals(tc, 1, tm_test_wait_for(&tm_test_ran, 6));
+	
+	CuAssertIntEquals(tc, 1, destroy_thread_manager(manager));
+	ptl_q_destroy_queue(q);
+}
+
+
+void TestManagerRetiresAboveCore(CuTest *tc)
+{
+	ptl_q_t q = ptl_q_create_queue(&ptl_rq_funcs, 2);
+	ptl_thread_manager_t manager = create_thread_manager(1, 3, 
+									TM_TEST_KEEP_ALIVE_MSEC, q, NULL);
+	int i = 0;
+	
+	tm_test_reset();
+	for(i = 1; i <= 3; i++){
+		CuAssertIntEquals(tc, 1, submit(manager, tm_test_block));
+		CuAssertIntEquals(tc, 1, tm_test_wait_for(&tm_test_started, i));
+	}
+	CuAssertIntEquals(tc, 3, ptl_tm_get_pool_size(manager));
+	
+	__atomic_store_n(&tm_test_gate, 1, __ATOMIC_RELEASE);
+	CuAssertIntEquals(tc, 1, tm_test_wait_for(&tm_test_ran, 3));
+	
+	// idle for 'keep_alive_time', the two threads above core end
+	CuAssertIntEquals(tc, 1, tm_test_wait_pool_size(manager, 1));
+	
+	// the core thread stays, however long it idles
+	usleep(TM_TEST_KEEP_ALIVE_MSEC * 4 * 1000);
+	CuAssertIntEquals(tc, 1, ptl_tm_get_pool_size(manager));
+	CuAssertIntEquals(tc, 1, submit(manager, tm_test_count));
+	CuAssertIntEquals(tc, 1, tm_test_wait_for(&tm_test_ran, 4));
+	
+	CuAssertIntEquals(tc, 1, destroy_thread_manager(manager));
+	ptl_q_destroy_queue(q);
+}
+
+
+void TestRejectAbort(CuTest *tc)
+{
+	ptl_thread_manager_t manager = tm_test_saturate(ptl_abort_policy);
+	ptl_q_t q = manager->work_q;
+	struct ptl_tm_rejection_counts counts;
+	
+	ptl_future_t future = submit_with_arg(manager, tm_test_block, (void *)3);
+	CuAssertPtrNotNull(tc, future);
+	CuAssertIntEquals(tc, 1, ptl_future_is_done(future));
+	CuAssertPtrEquals(tc, NULL, ptl_future_get(future, 0));
+	ptl_future_destroy(future);
+	
+	ptl_tm_get_rejection_counts(manager, &counts);
+	CuAssertTrue(tc, counts.rejected == 1);
+	CuAssertTrue(tc, counts.caller_ran == 0 && counts.discarded == 0);
+	
+	tm_test_release(2);
+	CuAssertIntEquals(tc, 0, tm_test_ran_ids[3]);
+	
+	CuAssertIntEquals(tc, 1, destroy_thread_manager(manager));
+	ptl_q_destroy_queue(q);
+}
+
+
+void TestRejectCallerRuns(CuTest *tc)
+{
+	ptl_thread_manager_t manager = tm_test_saturate(ptl_q_caller_runs_policy);
+	ptl_q_t q = manager->work_q;
+	struct ptl_tm_rejection_counts counts;
+	
+	ptl_future_t future = submit_with_arg(manager, tm_test_caller, (void *)3);
+	CuAssertPtrNotNull(tc, future);
+	
+	// run by this thread before submit returned
+	CuAssertIntEquals(tc, 1, ptl_future_is_done(future));
+	CuAssertPtrEquals(tc, (void *)3, ptl_future_get(future, 0));
+	CuAssertTrue(tc, pthread_equal(tm_test_caller_thread, pthread_self()));
+	ptl_future_destroy(future);
+	
+	ptl_tm_get_rejection_counts(manager, &counts);
+	CuAssertTrue(tc, counts.caller_ran == 1 && counts.rejected == 0);
+	
+	tm_test_release(3);
+	
+	CuAssertIntEquals(tc, 1, destroy_thread_manager(manager));
+	ptl_q_destroy_queue(q);
+}
+
+
+void TestRejectDiscard(CuTest *tc)
+{
+	ptl_thread_manager_t manager = tm_test_saturate(ptl_q_discard_policy);
+	ptl_q_t q = manager->work_q;
+	struct ptl_tm_rejection_counts counts;
+	
+	ptl_future_t future = submit_with_arg(manager, tm_test_block, (void *)3);
+	CuAssertPtrNotNull(tc, future);
+	CuAssertIntEquals(tc, 1, ptl_future_is_done(future));
+	ptl_future_destroy(future);
+	
+	ptl_tm_get_rejection_counts(manager, &counts);
+	CuAssertTrue(tc, counts.discarded == 1 && counts.rejected == 0);
+	
+	tm_test_release(2);
+	CuAssertIntEquals(tc, 0, tm_test_ran_ids[3]);
+	
+	CuAssertIntEquals(tc, 1, destroy_thread_manager(manager));
+	ptl_q_destroy_queue(q);
+}
+
+
+void TestRejectDiscardOldest(CuTest *tc)
+{
+	ptl_thread_manager_t manager = tm_test_saturate(ptl_q_discard_oldest_policy);
+	ptl_q_t q = manager->work_q;
+	struct ptl_tm_rejection_counts counts;
+	
+	// task 2 waits in the full queue, task 3 takes its place
+	ptl_future_t future = submit_with_arg(manager, tm_test_block, (void *)3);
+	CuAssertPtrNotNull(tc, future);
+	CuAssertIntEquals(tc, 1, (int)ptl_q_size(q));
+	
+	ptl_tm_get_rejection_counts(manager, &counts);
+	CuAssertTrue(tc, counts.discarded_oldest == 1 && counts.rejected == 0);
+	
+	tm_test_release(2);
+	CuAssertPtrEquals(tc, (void *)3, ptl_future_get(future, PTL_FUTURE_WAIT_FOREVER));
+	CuAssertIntEquals(tc, 0, tm_test_ran_ids[2]);
+	CuAssertIntEquals(tc, 1, tm_test_ran_ids[3]);
+	ptl_future_destroy(future);
+	
+	CuAssertIntEquals(tc, 1, destroy_thread_manager(manager));
+	ptl_q_destroy_queue(q);
+}
+
+
+void TestSubmitWaitTimesOut(CuTest *tc)
+{
+	ptl_thread_manager_t manager = tm_test_saturate(ptl_abort_policy);
+	ptl_q_t q = manager->work_q;
+	struct ptl_tm_rejection_counts counts;
+	
+	// no room comes, so the policy has the task after the wait
+	ptl_task_t task = create_task_with_arg(tm_test_block, (void *)3);
+	ptl_future_t future = ptl_task_get_future(task);
+	CuAssertIntEquals(tc, 0, submit_task_wait(manager, task, 20));
+	CuAssertIntEquals(tc, 1, ptl_future_is_done(future));
+	ptl_future_destroy(future);
+	
+	ptl_tm_get_rejection_counts(manager, &counts);
+	CuAssertTrue(tc, counts.blocked == 1 && counts.timed_out == 1);
+	CuAssertTrue(tc, counts.rejected == 1);
+	
+	tm_test_release(2);
+	CuAssertIntEquals(tc, 0, tm_test_ran_ids[3]);
+	
+	CuAssertIntEquals(tc, 1, destroy_thread_manager(manager));
+	ptl_q_destroy_queue(q);
+}
+
+
+void TestSubmitWaitGetsRoom(CuTest *tc)
+{
+	ptl_thread_manager_t manager = tm_test_saturate(ptl_abort_policy);
+	ptl_q_t q = manager->work_q;
+	struct ptl_tm_rejection_counts counts;
+	pthread_t opener;
+	
+	// the gate opens while submit_task_wait sleeps, which frees a slot
+	pthread_create(&opener, NULL, tm_test_open_later, NULL);
+	ptl_task_t task = create_task_with_arg(tm_test_block, (void *)3);
+	CuAssertIntEquals(tc, 1, submit_task_wait(manager, task, TM_TEST_WAIT_MSEC));
+	pthread_join(opener, NULL);
+	
+	ptl_tm_get_rejection_counts(manager, &counts);
+	CuAssertTrue(tc, counts.blocked == 1 && counts.timed_out == 0);
+	CuAssertTrue(tc, counts.rejected == 0);
+	
+	tm_test_release(3);
+	CuAssertIntEquals(tc, 1, tm_test_ran_ids[3]);
+	
+	CuAssertIntEquals(tc, 1, destroy_thread_manager(manager));
+	ptl_q_destroy_queue(q);
+}
+
+
+void TestShutdownWaitsForWorkers(CuTest *tc)
+{
+	ptl_q_t q = ptl_q_create_queue(&ptl_lq_funcs, 0);
+	ptl_thread_manager_t manager = create_thread_manager(2, 2, 1000, q, NULL);
+	pthread_t opener;
+	int i = 0;
+	
+	tm_test_reset();
+	for(i = 0; i < 4; i++){
+		CuAssertIntEquals(tc, 1, submit(manager, tm_test_block));
+	}
+	CuAssertIntEquals(tc, 1, tm_test_wait_for(&tm_test_started, 2));
+	
+	// returns only once the queued tasks ran too and the workers ended
+	pthread_create(&opener, NULL, tm_test_open_later, NULL);
+	ptl_tm_shutdown(manager);
+	CuAssertIntEquals(tc, 4, __atomic_load_n(&tm_test_ran, __ATOMIC_ACQUIRE));
+	CuAssertIntEquals(tc, 1, is_terminated(manager));
+	CuAssertIntEquals(tc, 1, ptl_tm_await_termination(manager, 0));
+	CuAssertIntEquals(tc, 0, submit(manager, tm_test_count));
+	pthread_join(opener, NULL);
+	
+	CuAssertIntEquals(tc, 1, destroy_thread_manager(manager));
+	ptl_q_destroy_queue(q);
+}
+
+
+void TestShutdownNowDrainsQueue(CuTest *tc)
+{
+	ptl_q_t q = ptl_q_create_queue(&ptl_lq_funcs, 0);
+	ptl_thread_manager_t manager = create_thread_manager(1, 1, 1000, q, NULL);
+	ptl_q_t drained = NULL;
+	ptl_task_t task = NULL;
+	int i = 0;
+	
+	tm_test_reset();
+	for(i = 0; i < 4; i++){
+		CuAssertIntEquals(tc, 1, submit(manager, tm_test_block));
+	}
+	CuAssertIntEquals(tc, 1, tm_test_wait_for(&tm_test_started, 1));
+	
+	// the running task is left to finish, the three waiting ones come back
+	drained = shutdown_now(manager);
+	CuAssertPtrNotNull(tc, drained);
+	CuAssertIntEquals(tc, 3, (int)ptl_q_size(drained));
+	CuAssertIntEquals(tc, 0, (int)ptl_q_size(q));
+	CuAssertIntEquals(tc, 0, ptl_tm_await_termination(manager, 10));
+	
+	while((task = ptl_q_get(drained)) != NULL){
+		CuAssertIntEquals(tc, PTL_TASK_STATE_CREATED, task->state);
+		destroy_task(task);
+	}
+	ptl_q_destroy_queue(drained);
+	
+	__atomic_store_n(&tm_test_gate, 1, __ATOMIC_RELEASE);
+	CuAssertIntEquals(tc, 1, ptl_tm_await_termination(manager, PTL_FUTURE_WAIT_FOREVER));
+	CuAssertIntEquals(tc, 1, __atomic_load_n(&tm_test_ran, __ATOMIC_ACQUIRE));
+	
+	CuAssertIntEquals(tc, 1, destroy_thread_manager(manager));
+	ptl_q_destroy_queue(q);
+}
+
+
+void TestShutdownNowDrainsDeques(CuTest *tc)
+{
+	ptl_q_t q = ptl_q_create_queue(&ptl_lq_funcs, 0);
+	struct ptl_tm_options options;
+	ptl_q_t drained = NULL;
+	ptl_task_t task = NULL;
+	int count = 0;
+	
+	ptl_tm_options_init(&options);
+	options.scheduling = PTL_TM_SCHED_WORK_STEALING;
+	ptl_thread_manager_t manager = create_thread_manager_with_options(1, 1, 1000, 
+										q, NULL, NULL, NULL, &options);
+	
+	// a worker's own submits go on its deque, where shutdown_now finds them
+	tm_test_reset();
+	CuAssertPtrNotNull(tc, manager);
+	task = create_task_with_arg(tm_test_spawn, manager);
+	CuAssertIntEquals(tc, 1, submit_task(manager, task));
+	CuAssertIntEquals(tc, 1, tm_test_wait_for(&tm_test_started, 1));
+	CuAssertIntEquals(tc, 0, (int)ptl_q_size(q));
+	
+	drained = shutdown_now(manager);
+	CuAssertPtrNotNull(tc, drained);
+	while((task = ptl_q_get(drained)) != NULL){
+		CuAssertIntEquals(tc, PTL_TASK_STATE_CREATED, task->state);
+		destroy_task(task);
+		count++;
+	}
+	CuAssertIntEquals(tc, TM_TEST_IDS, count);
+	ptl_q_destroy_queue(drained);
+	
+	__atomic_store_n(&tm_test_gate, 1, __ATOMIC_RELEASE);
+	CuAssertIntEquals(tc, 1, ptl_tm_await_termination(manager, PTL_FUTURE_WAIT_FOREVER));
+	CuAssertIntEquals(tc, 1, __atomic_load_n(&tm_test_ran, __ATOMIC_ACQUIRE));
+	
+	CuAssertIntEquals(tc, 1, destroy_thread_manager(manager));
+	ptl_q_destroy_queue(q);
+}
+
+
+void TestPurgeCancelled(CuTest *tc)
+{
+	ptl_q_t q = ptl_q_create_queue(&ptl_lq_funcs, 0);
+	ptl_thread_manager_t manager = create_thread_manager(1, 1, 1000, q, NULL);
+	ptl_future_t futures[5];
+	int i = 0;
+	
+	tm_test_reset();
+	CuAssertIntEquals(tc, 1, submit(manager, tm_test_block));
+	CuAssertIntEquals(tc, 1, tm_test_wait_for(&tm_test_started, 1));
+	for(i = 0; i < 5; i++){
+		futures[i] = submit_with_arg(manager, tm_test_count, NULL);
+		CuAssertPtrNotNull(tc, futures[i]);
+	}
+	
+	// cancelling only flips the state, purging takes them out of 'work_q'
+	CuAssertIntEquals(tc, 1, ptl_future_cancel(futures[0]));
+	CuAssertIntEquals(tc, 1, ptl_future_cancel(futures[2]));
+	CuAssertIntEquals(tc, 1, ptl_future_cancel(futures[4]));
+	CuAssertIntEquals(tc, 5, (int)ptl_q_size(q));
+	CuAssertTrue(tc, purge_cancelled(manager) == 3);
+	CuAssertIntEquals(tc, 2, (int)ptl_q_size(q));
+	CuAssertTrue(tc, purge_cancelled(manager) == 0);
+	
+	__atomic_store_n(&tm_test_gate, 1, __ATOMIC_RELEASE);
+	CuAssertPtrEquals(tc, NULL, ptl_future_get(futures[3], PTL_FUTURE_WAIT_FOREVER));
+	CuAssertIntEquals(tc, 1, ptl_future_is_done(futures[1]));
+	CuAssertIntEquals(tc, 1, tm_test_wait_for(&tm_test_ran, 3));
+	for(i = 0; i < 5; i++){
+		CuAssertIntEquals(tc, 1, ptl_future_is_done(futures[i]));
+		ptl_future_destroy(futures[i]);
+	}
+	
+	CuAssertIntEquals(tc, 1, destroy_thread_manager(manager));
+	ptl_q_destroy_queue(q);
+}
+
+
+CuSuite *ThreadManagerGetSuite(void)
+{
+	CuSuite *suite = CuSuiteNew();
+	
+	SUITE_ADD_TEST(suite, TestManagerRunsTasks);
+	SUITE_ADD_TEST(suite, TestManagerGrowsToMax);
+	SUITE_ADD_TEST(suite, TestManagerRetiresAboveCore);
+	SUITE_ADD_TEST(suite, TestRejectAbort);
+	SUITE_ADD_TEST(suite, TestRejectCallerRuns);
+	SUITE_ADD_TEST(suite, TestRejectDiscard);
+	SUITE_ADD_TEST(suite, TestRejectDiscardOldest);
+	SUITE_ADD_TEST(suite, TestSubmitWaitTimesOut);
+	SUITE_ADD_TEST(suite, TestSubmitWaitGetsRoom);
+	SUITE_ADD_TEST(suite, TestShutdownWaitsForWorkers);
+	SUITE_ADD_TEST(suite, TestShutdownNowDrainsQueue);
+	SUITE_ADD_TEST(suite, TestShutdownNowDrainsDeques);
+	SUITE_ADD_TEST(suite, TestPurgeCancelled);
+	
+	return suite;
+}
+
+
+/* finishes straight away */
+void *tm_test_count(void *arg){
+	__atomic_add_fetch(&tm_test_ran, 1, __ATOMIC_ACQ_REL);
+	return arg;
+}
+
+
+/* holds its worker until the gate opens, then marks its id */
+void *tm_test_block(void *arg){
+	__atomic_add_fetch(&tm_test_started, 1, __ATOMIC_ACQ_REL);
+	while(!__atomic_load_n(&tm_test_gate, __ATOMIC_ACQUIRE)){
+		usleep(500);
+	}
+	
+	__atomic_store_n(&tm_test_ran_ids[(long)arg], 1, __ATOMIC_RELEASE);
+	__atomic_add_fetch(&tm_test_ran, 1, __ATOMIC_ACQ_REL);
+	return arg;
+}
+
+
+/* submits TM_TEST_IDS tasks from its worker, then blocks like tm_test_block */
+void *tm_test_spawn(void *manager){
+	int i = 0;
+	
+	for(i = 0; i < TM_TEST_IDS; i++){
+		submit_task((ptl_thread_manager_t)manager, create_task(tm_test_count));
+	}
+	
+	return tm_test_block(NULL);
+}
+
+
+/* notes the thread it ran on */
+void *tm_test_caller(void *arg){
+	tm_test_caller_thread = pthread_self();
+	return arg;
+}
+
+
+/* opens the gate a little after it was started */
+void *tm_test_open_later(void *arg){
+	usleep(20000);
+	__atomic_store_n(&tm_test_gate, 1, __ATOMIC_RELEASE);
+	return NULL;
+}
+
+
+/* the rejected handler, counts its calls */
+void tm_test_rejected(void *task){
+	__atomic_add_fetch(&tm_test_rejections, 1, __ATOMIC_ACQ_REL);
+}
+
+
+/* 1 once 'counter' reached 'value', 0 if it didn't within TM_TEST_WAIT_MSEC */
+int tm_test_wait_for(int *counter, int value){
+	int waited = 0;
+	
+	while(__atomic_load_n(counter, __ATOMIC_ACQUIRE) < value){
+		if(waited++ >= TM_TEST_WAIT_MSEC){
+			return 0;
+		}
+		usleep(1000);
+	}
+	
+	return 1;
+}
+
+
+/* 1 once the pool shrank to 'size', 0 if it didn't within TM_TEST_WAIT_MSEC */
+int tm_test_wait_pool_size(ptl_thread_manager_t manager, int size){
+	int waited = 0;
+	
+	while(ptl_tm_get_pool_size(manager) != size){
+		if(waited++ >= TM_TEST_WAIT_MSEC){
+			return 0;
+		}
+		usleep(1000);
+	}
+	
+	return 1;
+}
+
+
+/* closes the gate and zeroes the counters */
+void tm_test_reset(){
+	int i = 0;
+	
+	tm_test_gate = 0;
+	tm_test_started = 0;
+	tm_test_ran = 0;
+	tm_test_rejections = 0;
+	for(i = 0; i < TM_TEST_IDS; i++){
+		tm_test_ran_ids[i] = 0;
+	}
+}
+
+
+/* 
+ * a manager of one thread running blocking task 1, with blocking task 2
+ * filling its one slot array queue, so the next task goes to 'policy'
+ */
+ptl_thread_manager_t tm_test_saturate(int (*policy)(ptl_thread_manager_t, ptl_task_t)){
+	ptl_q_t q = ptl_q_create_queue(&ptl_aq_funcs, 1);
+	ptl_thread_manager_t manager = create_thread_manager(1, 1, 1000, q, NULL);
+	ptl_future_t future = NULL;
+	
+	tm_test_reset();
+	ptl_tm_set_rejection_policy(manager, policy);
+	
+	future = submit_with_arg(manager, tm_test_block, (void *)1);
+	ptl_future_destroy(future);
+	tm_test_wait_for(&tm_test_started, 1);
+	
+	future = submit_with_arg(manager, tm_test_block, (void *)2);
+	ptl_future_destroy(future);
+	
+	return manager;
+}
+
+
+/* opens the gate and waits for 'ran' tasks to have finished */
+void tm_test_release(int ran){
+	__atomic_store_n(&tm_test_gate, 1, __ATOMIC_RELEASE);
+	tm_test_wait_for(&tm_test_ran, ran);
+}
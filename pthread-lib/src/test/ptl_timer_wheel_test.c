@@ -0,0 +1,298 @@
+/*
+ * This file is part of the pthread-lib Library.
+ * Copyright (C) 2008-2009 Nick Powers.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Library General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor Boston, MA 02110-1301,  USA
+ */
+
+/*
+ * Checks of ptl_timer_wheel. Most drive a wheel that has no thread through
+ * the wheel's own private functions, tick by tick, so where a timer sits and
+ * when it cascades can be checked exactly: timers on every level expire on
+ * their tick, in order, and _ptl_tw_next_tick skips the empty ticks between.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <unistd.h>
+#include "cutest/CuTest.h"
+#include "../ptl_timer_wheel.h"
+
+/* Constants */
+#define TW_TEST_MAX_FIRED 32
+
+
+/* Structures */
+
+/* the timers a wheel handed out, and the tick each expired on */
+struct tw_test_fired {
+	ptl_timer_t timers[TW_TEST_MAX_FIRED];
+	unsigned long ticks[TW_TEST_MAX_FIRED];
+	int count;
+	int steps;							/* ticks processed to get there */
+};
+
+
+/* Private Functions */
+void _ptl_tw_insert(ptl_tw_t wheel, ptl_timer_t timer);
+void _ptl_tw_unlink(ptl_tw_t wheel, ptl_timer_t timer);
+unsigned long _ptl_tw_next_tick(ptl_tw_t wheel);
+void _ptl_tw_process_tick(ptl_tw_t wheel, unsigned long tick);
+
+ptl_tw_t tw_test_create(unsigned long current);
+void tw_test_destroy(ptl_tw_t wheel);
+void tw_test_add(ptl_tw_t wheel, ptl_timer_t timer, unsigned long expires);
+void tw_test_run(ptl_tw_t wheel, struct tw_test_fired *fired);
+void tw_test_expired(struct ptl_timer **timers, int count, void *fired);
+
+
+void TestTimerWheelLevels(CuTest *tc)
+{
+	ptl_tw_t wheel = tw_test_create(0);
+	struct ptl_timer timers[5];
+	
+	// each level spans PTL_TW_LEVEL_BITS more bits than the one below
+	tw_test_add(wheel, &timers[0], 1);
+	tw_test_add(wheel, &timers[1], PTL_TW_ROOT_SIZE - 1);
+	tw_test_add(wheel, &timers[2], PTL_TW_ROOT_SIZE);
+	tw_test_add(wheel, &timers[3], 1UL << (PTL_TW_ROOT_BITS + PTL_TW_LEVEL_BITS));
+	tw_test_add(wheel, &timers[4], PTL_TW_MAX_TICKS - 1);
+	
+	CuAssertIntEquals(tc, 0, timers[0].level);
+	CuAssertIntEquals(tc, 0, timers[1].level);
+	CuAssertIntEquals(tc, 1, timers[2].level);
+	CuAssertIntEquals(tc, 2, timers[3].level);
+	CuAssertIntEquals(tc, PTL_TW_LEVELS - 1, timers[4].level);
+	CuAssertIntEquals(tc, 5, (int)ptl_tw_pending(wheel));
+	
+	tw_test_destroy(wheel);
+}
+
+
+void TestTimerWheelCascade(CuTest *tc)
+{
+	ptl_tw_t wheel = tw_test_create(0);
+	struct tw_test_fired fired;
+	unsigned long expires[] = {
+		1, 255, 256, 257, 300, 16383, 16384, 16385, 70000, 
+		1UL << 20, (1UL << 20) + 1, PTL_TW_MAX_TICKS - 1 };
+	int count = sizeof(expires) / sizeof(expires[0]);
+	struct ptl_timer timers[sizeof(expires) / sizeof(expires[0])];
+	int i = 0;
+	
+	// added out of order, they still have to come out in order
+	for(i = count - 1; i >= 0; i--){
+		tw_test_add(wheel, &timers[i], expires[i]);
+	}
+	
+	tw_test_run(wheel, &fired);
+	
+	CuAssertIntEquals(tc, count, fired.count);
+	for(i = 0; i < count && i < fired.count; i++){
+		CuAssertPtrEquals(tc, &timers[i], fired.timers[i]);
+		CuAssertTrue(tc, expires[i] == fired.ticks[i]);
+	}
+	CuAssertIntEquals(tc, 0, (int)ptl_tw_pending(wheel));
+	
+	// only ticks that expire or cascade something are visited, not 2^26
+	CuAssertTrue(tc, fired.steps < 100);
+	
+	tw_test_destroy(wheel);
+}
+
+
+void TestTimerWheelNextTick(CuTest *tc)
+{
+	// off any boundary, so the level indexes don't start at 0
+	unsigned long current = 5000;
+	ptl_tw_t wheel = tw_test_create(current);
+	struct ptl_timer timer;
+	struct tw_test_fired fired;
+	
+	CuAssertTrue(tc, _ptl_tw_next_tick(wheel) == ULONG_MAX); // empty
+	
+	// on level 2, so the next tick is where level 2 cascades, not the deadline
+	unsigned long due = current + 70000;
+	unsigned long shift = PTL_TW_ROOT_BITS + PTL_TW_LEVEL_BITS;
+	tw_test_add(wheel, &timer, due);
+	CuAssertIntEquals(tc, 2, timer.level);
+	CuAssertTrue(tc, _ptl_tw_next_tick(wheel) == ((due >> shift) << shift));
+	
+	// processing that tick moves it down a level, closer to its slot
+	_ptl_tw_process_tick(wheel, _ptl_tw_next_tick(wheel));
+	CuAssertTrue(tc, timer.level < 2);
+	CuAssertTrue(tc, _ptl_tw_next_tick(wheel) <= due);
+	
+	tw_test_run(wheel, &fired);
+	CuAssertIntEquals(tc, 1, fired.count);
+	CuAssertTrue(tc, due == fired.ticks[0]);
+	
+	tw_test_destroy(wheel);
+}
+
+
+void TestTimerWheelCancel(CuTest *tc)
+{
+	ptl_tw_t wheel = tw_test_create(0);
+	struct ptl_timer timers[4];
+	struct tw_test_fired fired;
+	
+	tw_test_add(wheel, &timers[0], 10);
+	tw_test_add(wheel, &timers[1], 10);
+	tw_test_add(wheel, &timers[2], 10);
+	tw_test_add(wheel, &timers[3], 20000);
+	
+	// the middle of a slot's list, then a slot of its own on level 2
+	CuAssertIntEquals(tc, 1, ptl_tw_cancel(wheel, &timers[1]));
+	CuAssertIntEquals(tc, 0, ptl_tw_cancel(wheel, &timers[1]));
+	CuAssertIntEquals(tc, 1, ptl_tw_cancel(wheel, &timers[3]));
+	CuAssertIntEquals(tc, 2, (int)ptl_tw_pending(wheel));
+	
+	tw_test_run(wheel, &fired);
+	CuAssertIntEquals(tc, 2, fired.count);
+	CuAssertTrue(tc, fired.timers[0] != &timers[1] && fired.timers[1] != &timers[1]);
+	
+	tw_test_destroy(wheel);
+}
+
+
+void TestTimerWheelDrain(CuTest *tc)
+{
+	ptl_tw_t wheel = tw_test_create(5000);
+	struct ptl_timer timers[3];
+	ptl_timer_t drained[4];
+	
+	// drain takes every level, the timers are IDLE again
+	tw_test_add(wheel, &timers[0], wheel->current + 3);
+	tw_test_add(wheel, &timers[1], wheel->current + 300);
+	tw_test_add(wheel, &timers[2], wheel->current + 30000);
+	CuAssertIntEquals(tc, 3, ptl_tw_drain(wheel, drained, 4));
+	CuAssertIntEquals(tc, 0, ptl_tw_drain(wheel, drained, 4));
+	CuAssertIntEquals(tc, PTL_TW_STATE_IDLE, timers[2].state);
+	CuAssertIntEquals(tc, 0, (int)ptl_tw_pending(wheel));
+	CuAssertTrue(tc, _ptl_tw_next_tick(wheel) == ULONG_MAX);
+	
+	tw_test_destroy(wheel);
+}
+
+
+void TestTimerWheelThread(CuTest *tc)
+{
+	struct tw_test_fired fired;
+	struct ptl_timer timers[2];
+	int waited = 0;
+	
+	fired.count = 0;
+	ptl_tw_t wheel = ptl_tw_create(1, tw_test_expired, &fired);
+	CuAssertPtrNotNull(tc, wheel);
+	
+	ptl_tw_init_timer(&timers[0], NULL);
+	ptl_tw_init_timer(&timers[1], NULL);
+	CuAssertIntEquals(tc, 1, ptl_tw_add(wheel, &timers[0], 20));
+	CuAssertIntEquals(tc, 1, ptl_tw_add(wheel, &timers[1], 1));
+	CuAssertIntEquals(tc, 0, ptl_tw_add(wheel, &timers[1], 1)); // pending already
+	
+	while(ptl_tw_pending(wheel) > 0 && waited++ < 1000){
+		usleep(1000);
+	}
+	ptl_tw_destroy(wheel); // joins the thread, 'fired' is complete
+	
+	CuAssertIntEquals(tc, 2, fired.count);
+	CuAssertPtrEquals(tc, &timers[1], fired.timers[0]);
+	CuAssertPtrEquals(tc, &timers[0], fired.timers[1]);
+	CuAssertIntEquals(tc, PTL_TW_STATE_EXPIRED, timers[0].state);
+}
+
+
+CuSuite *TimerWheelGetSuite(void)
+{
+	CuSuite *suite = CuSuiteNew();
+	
+	SUITE_ADD_TEST(suite, TestTimerWheelLevels);
+	SUITE_ADD_TEST(suite, TestTimerWheelCascade);
+	SUITE_ADD_TEST(suite, TestTimerWheelNextTick);
+	SUITE_ADD_TEST(suite, TestTimerWheelCancel);
+	SUITE_ADD_TEST(suite, TestTimerWheelDrain);
+	SUITE_ADD_TEST(suite, TestTimerWheelThread);
+	
+	return suite;
+}
+
+
+/* a wheel without its thread, at tick 'current' */
+ptl_tw_t tw_test_create(unsigned long current){
+	ptl_tw_t wheel = (ptl_tw_t)calloc(1, sizeof(struct ptl_timer_wheel));
+	
+	pthread_mutex_init(&wheel->mutex, NULL);
+	wheel->tick_msec = 1;
+	wheel->current = current;
+	
+	return wheel;
+}
+
+
+void tw_test_destroy(ptl_tw_t wheel){
+	pthread_mutex_destroy(&wheel->mutex);
+	free(wheel);
+}
+
+
+/* what ptl_tw_add does, with the tick given instead of worked out from now */
+void tw_test_add(ptl_tw_t wheel, ptl_timer_t timer, unsigned long expires){
+	ptl_tw_init_timer(timer, NULL);
+	timer->expires = expires;
+	timer->state = PTL_TW_STATE_PENDING;
+	_ptl_tw_insert(wheel, timer);
+	wheel->pending++;
+}
+
+
+/* what the wheel's thread does, as if every tick had passed already */
+void tw_test_run(ptl_tw_t wheel, struct tw_test_fired *fired){
+	unsigned long tick = 0;
+	
+	fired->count = 0;
+	fired->steps = 0;
+	
+	while((tick = _ptl_tw_next_tick(wheel)) != ULONG_MAX){
+		_ptl_tw_process_tick(wheel, tick);
+		fired->steps++;
+		
+		while(wheel->due != NULL){
+			ptl_timer_t timer = wheel->due;
+			_ptl_tw_unlink(wheel, timer);
+			timer->state = PTL_TW_STATE_EXPIRED;
+			wheel->pending--;
+			
+			if(fired->count < TW_TEST_MAX_FIRED){
+				fired->timers[fired->count] = timer;
+				fired->ticks[fired->count] = tick;
+				fired->count++;
+			}
+		}
+	}
+}
+
+
+/* 'expired' of a real wheel, on its thread */
+void tw_test_expired(struct ptl_timer **timers, int count, void *context){
+	struct tw_test_fired *fired = (struct tw_test_fired *)context;
+	int i = 0;
+	
+	for(i = 0; i < count && fired->count < TW_TEST_MAX_FIRED; i++){
+		fired->timers[fired->count++] = timers[i];
+	}
+}
@@ -0,0 +1,135 @@
+/*
+ * This file is part of the pthread-lib Library.
+ * Copyright (C) 2008-2009 Nick Powers.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Library General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor Boston, MA 02110-1301,  USA
+ */
+
+/*
+ * Single threaded checks of ptl_ws_deque: the owner's LIFO end, the thieves'
+ * FIFO end, both ends walking around the ring, and growth keeping the order.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "cutest/CuTest.h"
+#include "../ptl_ws_deque.h"
+
+/* Constants */
+#define WSD_TEST_CAPACITY 4
+#define WSD_TEST_VALUES 100
+#define WSD_TEST_ROUNDS 1000
+
+
+/* Global Variables */
+static long wsd_test_values[WSD_TEST_VALUES];
+
+
+void TestWsDequeLifoFifo(CuTest *tc)
+{
+	ptl_wsd_t deque = ptl_wsd_create(WSD_TEST_CAPACITY);
+	int i = 0;
+	
+	CuAssertPtrEquals(tc, NULL, ptl_wsd_pop(deque));
+	CuAssertPtrEquals(tc, NULL, ptl_wsd_steal(deque));
+	
+	for(i = 0; i < WSD_TEST_CAPACITY; i++){
+		ptl_wsd_push(deque, &wsd_test_values[i]);
+	}
+	CuAssertIntEquals(tc, WSD_TEST_CAPACITY, (int)ptl_wsd_size(deque));
+	
+	// the oldest from the top, the newest from the bottom
+	CuAssertPtrEquals(tc, &wsd_test_values[0], ptl_wsd_steal(deque));
+	CuAssertPtrEquals(tc, &wsd_test_values[WSD_TEST_CAPACITY - 1], ptl_wsd_pop(deque));
+	CuAssertPtrEquals(tc, &wsd_test_values[1], ptl_wsd_steal(deque));
+	CuAssertPtrEquals(tc, &wsd_test_values[2], ptl_wsd_pop(deque));
+	
+	CuAssertIntEquals(tc, 0, (int)ptl_wsd_size(deque));
+	CuAssertPtrEquals(tc, NULL, ptl_wsd_pop(deque));
+	CuAssertPtrEquals(tc, NULL, ptl_wsd_steal(deque));
+	
+	ptl_wsd_destroy(deque);
+}
+
+
+void TestWsDequeWrap(CuTest *tc)
+{
+	ptl_wsd_t deque = ptl_wsd_create(WSD_TEST_CAPACITY);
+	struct ptl_wsd_array *array = deque->array;
+	int next_in = 0;
+	int next_out = 0;
+	int round = 0;
+	
+	// a queue through the deque: push at the bottom, steal from the top
+	ptl_wsd_push(deque, &wsd_test_values[next_in++ % WSD_TEST_VALUES]);
+	ptl_wsd_push(deque, &wsd_test_values[next_in++ % WSD_TEST_VALUES]);
+	for(round = 0; round < WSD_TEST_ROUNDS; round++){
+		ptl_wsd_push(deque, &wsd_test_values[next_in++ % WSD_TEST_VALUES]);
+		CuAssertPtrEquals(tc, &wsd_test_values[next_out++ % WSD_TEST_VALUES], ptl_wsd_steal(deque));
+	}
+	
+	// never more than fits, so the ring went round without growing
+	CuAssertPtrEquals(tc, array, deque->array);
+	CuAssertIntEquals(tc, 2, (int)ptl_wsd_size(deque));
+	
+	CuAssertPtrEquals(tc, &wsd_test_values[(next_in - 1) % WSD_TEST_VALUES], ptl_wsd_pop(deque));
+	CuAssertPtrEquals(tc, &wsd_test_values[next_out % WSD_TEST_VALUES], ptl_wsd_pop(deque));
+	CuAssertPtrEquals(tc, NULL, ptl_wsd_pop(deque));
+	
+	ptl_wsd_destroy(deque);
+}
+
+
+void TestWsDequeGrow(CuTest *tc)
+{
+	ptl_wsd_t deque = ptl_wsd_create(WSD_TEST_CAPACITY);
+	int i = 0;
+	
+	// move top and bottom off 0 first, so the copy has to unwrap the ring
+	for(i = 0; i < 3; i++){
+		ptl_wsd_push(deque, &wsd_test_values[0]);
+		ptl_wsd_steal(deque);
+	}
+	
+	for(i = 0; i < WSD_TEST_VALUES; i++){
+		ptl_wsd_push(deque, &wsd_test_values[i]);
+	}
+	CuAssertIntEquals(tc, WSD_TEST_VALUES, (int)ptl_wsd_size(deque));
+	CuAssertTrue(tc, deque->array->mask + 1 >= WSD_TEST_VALUES);
+	CuAssertPtrNotNull(tc, deque->array->retired);
+	
+	// half from the top in push order, the rest from the bottom in reverse
+	for(i = 0; i < WSD_TEST_VALUES / 2; i++){
+		CuAssertPtrEquals(tc, &wsd_test_values[i], ptl_wsd_steal(deque));
+	}
+	for(i = WSD_TEST_VALUES - 1; i >= WSD_TEST_VALUES / 2; i--){
+		CuAssertPtrEquals(tc, &wsd_test_values[i], ptl_wsd_pop(deque));
+	}
+	CuAssertPtrEquals(tc, NULL, ptl_wsd_pop(deque));
+	
+	ptl_wsd_destroy(deque);
+}
+
+
+CuSuite *WsDequeGetSuite(void)
+{
+	CuSuite *suite = CuSuiteNew();
+	
+	SUITE_ADD_TEST(suite, TestWsDequeLifoFifo);
+	SUITE_ADD_TEST(suite, TestWsDequeWrap);
+	SUITE_ADD_TEST(suite, TestWsDequeGrow);
+	
+	return suite;
+}